@@ -0,0 +1,544 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_afpacket.c
+ *
+ * Description:
+ *
+ * Linux AF_PACKET I/O backend.  Each router interface is bound to a real or
+ * veth interface of the same name through a packet socket with a
+ * memory-mapped TPACKET_V3 RX ring and a TX ring in the same mapping, so
+ * frames move without a copy into the kernel or a syscall per packet.
+ *
+ * Interface names come from the -i argument, a comma separated list:
+ *
+ *     -b afpacket -i eth1,eth2=10.0.2.1,eth3
+ *
+ * MACs are read from the OS.  IPs are read from the OS too unless given
+ * after '='; giving them on the command line lets the kernel's own stack
+ * stay unconfigured on those interfaces so it doesn't answer ARP or ICMP
+ * behind our back.  See README.md for a veth/netns setup.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifdef _LINUX_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_io.h"
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+
+#define SR_AFP_MAX_IFS     16
+#define SR_AFP_BLOCK_SZ    (1 << 18)  /* 256KB, a multiple of the frame size */
+#define SR_AFP_BLOCK_NR    16
+#define SR_AFP_FRAME_SZ    2048
+#define SR_AFP_JUMBO_SZ    16384      /* TX slots for MTUs that don't fit above */
+#define SR_AFP_BLOCK_TMO   10         /* ms before a partly filled block retires */
+#define SR_AFP_TX_BLOCK_NR 4
+#define SR_AFP_TX_BATCH    32         /* frames queued before we kick the kernel */
+#define SR_AFP_POLL_MS     100
+
+/* where frame data starts in a TX slot */
+#define SR_AFP_TX_DATA (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+
+struct sr_afp_if
+{
+    char name[sr_IFACE_NAMELEN];
+    int fd;
+    int ifindex;
+
+    uint8_t* map;
+    size_t map_len;
+
+    uint8_t* rx;                /* SR_AFP_BLOCK_NR blocks */
+    unsigned int rx_block;      /* next block we expect the kernel to hand us */
+
+    pthread_mutex_t tx_lock;
+    uint8_t* tx;                /* tx_frames fixed size slots */
+    unsigned int tx_frame_sz;
+    unsigned int tx_frames;
+    unsigned int tx_next;
+    unsigned int tx_pending;    /* slots handed over but not kicked yet */
+    unsigned long tx_full;      /* sends refused, ring full */
+};
+
+struct sr_afp
+{
+    int nifs;
+    struct sr_afp_if ifs[SR_AFP_MAX_IFS];
+    struct pollfd pfds[SR_AFP_MAX_IFS];
+};
+
+/* set while the receive loop runs, so sends it causes get batched */
+static __thread int sr_afp_in_rx = 0;
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_afp_if_open(..)
+ * Scope: Local
+ *
+ * Set up the socket and rings for one interface and add it to the router's
+ * interface list.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_afp_if_open(struct sr_instance* sr, struct sr_afp_if* afi,
+                          const char* name, const char* ip)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    struct ifreq ifr;
+    struct in_addr addr;
+    size_t rx_len, tx_len;
+    int ver = TPACKET_V3, one = 1;
+    unsigned int mtu = SR_DEFAULT_MTU;
+
+    memset(afi, 0, sizeof(*afi));
+    afi->fd = -1;
+    strncpy(afi->name, name, sr_IFACE_NAMELEN - 1);
+    pthread_mutex_init(&afi->tx_lock, NULL);
+
+    if ( strlen(name) >= IFNAMSIZ )
+    {
+        fprintf(stderr, "Interface name %s too long\n", name);
+        return -1;
+    }
+
+    if ((afi->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0)
+    {
+        perror("socket(..):sr_afpacket.c::sr_afp_if_open(..)");
+        return -1;
+    }
+
+    if (setsockopt(afi->fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0)
+    {
+        perror("setsockopt(PACKET_VERSION):sr_afpacket.c::sr_afp_if_open(..)");
+        return -1;
+    }
+
+    /* -- TX slots sized for the interface MTU, RX blocks take any frame -- */
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(afi->fd, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu > 0)
+    { mtu = ifr.ifr_mtu < SR_MAX_MTU ? ifr.ifr_mtu : SR_MAX_MTU; }
+    afi->tx_frame_sz = SR_AFP_FRAME_SZ;
+    if (SR_AFP_TX_DATA + mtu + sizeof(sr_ethernet_hdr_t) > SR_AFP_FRAME_SZ)
+    { afi->tx_frame_sz = SR_AFP_JUMBO_SZ; }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_AFP_BLOCK_SZ;
+    req.tp_block_nr   = SR_AFP_BLOCK_NR;
+    req.tp_frame_size = SR_AFP_FRAME_SZ;
+    req.tp_frame_nr   = (SR_AFP_BLOCK_SZ / SR_AFP_FRAME_SZ) * SR_AFP_BLOCK_NR;
+    req.tp_retire_blk_tov = SR_AFP_BLOCK_TMO;
+    if (setsockopt(afi->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("setsockopt(PACKET_RX_RING):sr_afpacket.c::sr_afp_if_open(..)");
+        return -1;
+    }
+    rx_len = (size_t)SR_AFP_BLOCK_SZ * SR_AFP_BLOCK_NR;
+
+    /* -- the TX ring wants the V3 specific fields left at zero -- */
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_AFP_BLOCK_SZ;
+    req.tp_block_nr   = SR_AFP_TX_BLOCK_NR;
+    req.tp_frame_size = afi->tx_frame_sz;
+    req.tp_frame_nr   = (SR_AFP_BLOCK_SZ / afi->tx_frame_sz) * SR_AFP_TX_BLOCK_NR;
+    if (setsockopt(afi->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("setsockopt(PACKET_TX_RING):sr_afpacket.c::sr_afp_if_open(..)");
+        return -1;
+    }
+    tx_len = (size_t)SR_AFP_BLOCK_SZ * SR_AFP_TX_BLOCK_NR;
+    afi->tx_frames = req.tp_frame_nr;
+
+    afi->map_len = rx_len + tx_len;
+    afi->map = mmap(0, afi->map_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, afi->fd, 0);
+    if (afi->map == MAP_FAILED)
+    {
+        afi->map = 0;
+        perror("mmap(..):sr_afpacket.c::sr_afp_if_open(..)");
+        return -1;
+    }
+    afi->rx = afi->map;
+    afi->tx = afi->map + rx_len;
+
+    /* -- we never want to see our own (or the host stack's) tx -- */
+    setsockopt(afi->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(afi->fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        fprintf(stderr, "No such interface %s\n", name);
+        return -1;
+    }
+    afi->ifindex = ifr.ifr_ifindex;
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family   = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex  = afi->ifindex;
+    if (bind(afi->fd, (struct sockaddr*)&sll, sizeof(sll)) < 0)
+    {
+        perror("bind(..):sr_afpacket.c::sr_afp_if_open(..)");
+        return -1;
+    }
+
+    if (ioctl(afi->fd, SIOCGIFFLAGS, &ifr) == 0 && !(ifr.ifr_flags & IFF_UP))
+    { fprintf(stderr, "Warning: interface %s is down\n", name); }
+
+    /* -- hardware address from the OS -- */
+    if (ioctl(afi->fd, SIOCGIFHWADDR, &ifr) < 0)
+    {
+        perror("ioctl(SIOCGIFHWADDR):sr_afpacket.c::sr_afp_if_open(..)");
+        return -1;
+    }
+
+    sr_add_interface(sr, name);
+    sr_set_ether_addr(sr, (unsigned char*)ifr.ifr_hwaddr.sa_data);
+
+    /* -- IP from the command line, else from the OS -- */
+    if (ip)
+    {
+        if (inet_aton(ip, &addr) == 0)
+        {
+            fprintf(stderr, "Bad IP address %s for %s\n", ip, name);
+            return -1;
+        }
+    }
+    else
+    {
+        if (ioctl(afi->fd, SIOCGIFADDR, &ifr) < 0)
+        {
+            fprintf(stderr, "Interface %s has no IPv4 address, "
+                    "give one as %s=a.b.c.d\n", name, name);
+            return -1;
+        }
+        addr = ((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr;
+    }
+    sr_set_ether_ip(sr, addr.s_addr);
+    sr_get_interface(sr, name)->mtu = mtu;
+
+    return 0;
+} /* -- sr_afp_if_open -- */
+
+static void sr_afp_close(struct sr_instance* sr)
+{
+    struct sr_afp* afp = (struct sr_afp*)sr->io_priv;
+    int i;
+
+    if (!afp)
+    { return; }
+
+    for (i = 0; i < afp->nifs; i++)
+    {
+        struct sr_afp_if* afi = &afp->ifs[i];
+        if (afi->map)
+        { munmap(afi->map, afi->map_len); }
+        if (afi->fd >= 0)
+        { close(afi->fd); }
+        if (afi->tx_full)
+        {
+            fprintf(stderr, "%s: tx ring full %lu times\n",
+                    afi->name, afi->tx_full);
+        }
+        pthread_mutex_destroy(&afi->tx_lock);
+    }
+
+    free(afp);
+    sr->io_priv = 0;
+} /* -- sr_afp_close -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_afp_open(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_afp_open(struct sr_instance* sr, const char* arg)
+{
+    struct sr_afp* afp;
+    char *list, *tok, *save = 0, *ip;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if (!arg || !*arg)
+    {
+        fprintf(stderr, "afpacket backend needs -i iface[=ip][,iface[=ip]...]\n");
+        return -1;
+    }
+
+    afp = (struct sr_afp*)calloc(1, sizeof(struct sr_afp));
+    assert(afp);
+    sr->io_priv = afp;
+
+    list = strdup(arg);
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(0, ",", &save))
+    {
+        if (afp->nifs == SR_AFP_MAX_IFS)
+        {
+            fprintf(stderr, "Too many interfaces, at most %d\n", SR_AFP_MAX_IFS);
+            break;
+        }
+        if ((ip = strchr(tok, '=')) != 0)
+        { *ip++ = '\0'; }
+
+        if (sr_afp_if_open(sr, &afp->ifs[afp->nifs], tok, ip) != 0)
+        {
+            afp->nifs++;
+            free(list);
+            sr_afp_close(sr);
+            return -1;
+        }
+        afp->pfds[afp->nifs].fd = afp->ifs[afp->nifs].fd;
+        afp->pfds[afp->nifs].events = POLLIN | POLLERR;
+        afp->nifs++;
+    }
+    free(list);
+
+    if (afp->nifs == 0)
+    {
+        sr_afp_close(sr);
+        return -1;
+    }
+    return 0;
+} /* -- sr_afp_open -- */
+
+static struct sr_afp_if* sr_afp_find(struct sr_afp* afp, const char* name)
+{
+    int i;
+
+    for (i = 0; i < afp->nifs; i++)
+    {
+        if (strncmp(afp->ifs[i].name, name, sr_IFACE_NAMELEN) == 0)
+        { return &afp->ifs[i]; }
+    }
+    return 0;
+} /* -- sr_afp_find -- */
+
+/* tell the kernel to transmit everything marked SEND_REQUEST; tx_lock held */
+static void sr_afp_kick(struct sr_afp_if* afi)
+{
+    if (send(afi->fd, 0, 0, MSG_DONTWAIT) < 0 &&
+        errno != EAGAIN && errno != ENOBUFS && errno != EINTR)
+    { perror("send(..):sr_afpacket.c::sr_afp_kick(..)"); }
+    afi->tx_pending = 0;
+} /* -- sr_afp_kick -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_afp_send(..)
+ * Scope: Local
+ *
+ * Copy the frame into the next TX slot.  Sends made from inside the receive
+ * loop are kicked in batches at the end of the round; anything else (ARP
+ * sweeper, workers) kicks right away so it doesn't sit in the ring.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_afp_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                       const char* iface)
+{
+    struct sr_afp* afp = (struct sr_afp*)sr->io_priv;
+    struct sr_afp_if* afi;
+    struct tpacket3_hdr* hdr;
+
+    if (!(afi = sr_afp_find(afp, iface)))
+    {
+        fprintf(stderr, "** Error, interface %s, does not exist\n", iface);
+        return -1;
+    }
+    if (len > afi->tx_frame_sz - SR_AFP_TX_DATA)
+    {
+        fprintf(stderr, "** Error: frame of %u bytes too big for %s\n", len, iface);
+        return -1;
+    }
+
+    pthread_mutex_lock(&afi->tx_lock);
+
+    hdr = (struct tpacket3_hdr*)(afi->tx + (size_t)afi->tx_next * afi->tx_frame_sz);
+    if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) &
+        (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+    {
+        /* ring full, push what we have and look again */
+        sr_afp_kick(afi);
+        if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) &
+            (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+        {
+            afi->tx_full++;
+            pthread_mutex_unlock(&afi->tx_lock);
+            return SR_IO_BUSY;
+        }
+    }
+
+    memcpy((uint8_t*)hdr + SR_AFP_TX_DATA, buf, len);
+    hdr->tp_len = len;
+    hdr->tp_snaplen = len;
+    hdr->tp_next_offset = 0;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    afi->tx_next = (afi->tx_next + 1) % afi->tx_frames;
+    if (++afi->tx_pending >= SR_AFP_TX_BATCH || !sr_afp_in_rx)
+    { sr_afp_kick(afi); }
+
+    pthread_mutex_unlock(&afi->tx_lock);
+    return 0;
+} /* -- sr_afp_send -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_afp_poll(..)
+ * Scope: Local
+ *
+ * Wait for any RX ring to have a retired block, deliver every frame in
+ * every ready block and give the blocks back.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_afp_poll(struct sr_instance* sr)
+{
+    struct sr_afp* afp = (struct sr_afp*)sr->io_priv;
+    int i;
+
+    if (poll(afp->pfds, afp->nifs, SR_AFP_POLL_MS) < 0 && errno != EINTR)
+    {
+        perror("poll(..):sr_afpacket.c::sr_afp_poll(..)");
+        return -1;
+    }
+
+    sr_afp_in_rx = 1;
+
+    for (i = 0; i < afp->nifs; i++)
+    {
+        struct sr_afp_if* afi = &afp->ifs[i];
+
+        for (;;)
+        {
+            struct tpacket_block_desc* bd = (struct tpacket_block_desc*)
+                (afi->rx + (size_t)afi->rx_block * SR_AFP_BLOCK_SZ);
+            struct tpacket3_hdr* ppd;
+            unsigned int n, num;
+
+            if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+                  TP_STATUS_USER))
+            { break; }
+
+            num = bd->hdr.bh1.num_pkts;
+            ppd = (struct tpacket3_hdr*)((uint8_t*)bd +
+                                         bd->hdr.bh1.offset_to_first_pkt);
+            for (n = 0; n < num; n++)
+            {
+                sr_io_deliver(sr, (uint8_t*)ppd + ppd->tp_mac,
+                              ppd->tp_snaplen, afi->name);
+                ppd = (struct tpacket3_hdr*)((uint8_t*)ppd + ppd->tp_next_offset);
+            }
+
+            __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                             __ATOMIC_RELEASE);
+            afi->rx_block = (afi->rx_block + 1) % SR_AFP_BLOCK_NR;
+        }
+    }
+
+    sr_afp_in_rx = 0;
+
+    /* -- flush whatever forwarding queued up this round -- */
+    for (i = 0; i < afp->nifs; i++)
+    {
+        struct sr_afp_if* afi = &afp->ifs[i];
+        pthread_mutex_lock(&afi->tx_lock);
+        if (afi->tx_pending)
+        { sr_afp_kick(afi); }
+        pthread_mutex_unlock(&afi->tx_lock);
+    }
+
+    return 1;
+} /* -- sr_afp_poll -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_afp_tx_flush(..)
+ * Scope: Local
+ *
+ * Wait for a slot to free up on any interface whose TX ring is full.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_afp_tx_flush(struct sr_instance* sr, int timeout_ms)
+{
+    struct sr_afp* afp = (struct sr_afp*)sr->io_priv;
+    struct pollfd pfds[SR_AFP_MAX_IFS];
+    int i, n = 0;
+
+    for (i = 0; i < afp->nifs; i++)
+    {
+        struct sr_afp_if* afi = &afp->ifs[i];
+        struct tpacket3_hdr* hdr;
+
+        pthread_mutex_lock(&afi->tx_lock);
+        hdr = (struct tpacket3_hdr*)(afi->tx + (size_t)afi->tx_next * afi->tx_frame_sz);
+        if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) &
+            (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+        {
+            sr_afp_kick(afi);
+            pfds[n].fd = afi->fd;
+            pfds[n].events = POLLOUT;
+            pfds[n].revents = 0;
+            n++;
+        }
+        pthread_mutex_unlock(&afi->tx_lock);
+    }
+
+    if (n == 0)
+    { return 1; }
+    return poll(pfds, n, timeout_ms) > 0;
+} /* -- sr_afp_tx_flush -- */
+
+const struct sr_io_ops sr_io_afpacket =
+{
+    "afpacket",
+    sr_afp_open,
+    sr_afp_send,
+    sr_afp_poll,
+    sr_afp_close,
+    sr_afp_tx_flush
+};
+
+#else /* _LINUX_ */
+
+#include <stdio.h>
+#include "sr_io.h"
+
+static int sr_afp_open(struct sr_instance* sr, const char* arg)
+{
+    fprintf(stderr, "afpacket backend is only available on Linux\n");
+    return -1;
+}
+
+const struct sr_io_ops sr_io_afpacket =
+{
+    "afpacket",
+    sr_afp_open,
+    0,
+    0,
+    0
+};
+
+#endif /* _LINUX_ */
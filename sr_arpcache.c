@@ -12,6 +12,11 @@
 #include "sr_if.h"
 #include "sr_rt.h"
 #include "sr_protocol.h"
+#include "sr_dispatch.h"
+#include "sr_bufpool.h"
+#include "sr_log.h"
+#include "sr_stats.h"
+#include "sr_probe.h"
 
 /* 
   This function gets called every second. For each request sent out, we keep
@@ -22,9 +27,13 @@
 void sr_arp_reply(struct sr_instance* sr,struct sr_if* interface,
 				  const unsigned char* tha,uint32_t tip){
 	unsigned int len = sizeof(sr_ethernet_hdr_t)+sizeof(sr_arp_hdr_t);
-	uint8_t *packet = (uint8_t*)malloc(len);
-	assert(packet);
-	printf("sending a arp_reply\n");
+	uint8_t *packet = (uint8_t*)sr_buf_alloc(len);
+	if(!packet){
+		SR_ERR("out of memory building arp reply, dropped\n");
+		SR_STATS_DROP(SR_DROP_NO_BUF);
+		return;
+	}
+	SR_DEBUG("sending a arp_reply\n");
 	sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t*)(packet);
 	memcpy(eth_hdr->ether_dhost,tha,6);
 	memcpy(eth_hdr->ether_shost,interface->addr,6);
@@ -42,14 +51,18 @@ void sr_arp_reply(struct sr_instance* sr,struct sr_if* interface,
 	arp_hdr->ar_tip = tip;
 	
 	sr_send_packet(sr,packet,len,interface->name);
-	free(packet);
+	sr_buf_free(packet);
 }
 
 void sr_arp_request(struct sr_instance* sr,uint32_t tip){
 	unsigned int len = sizeof(sr_ethernet_hdr_t)+sizeof(sr_arp_hdr_t);
-	uint8_t *packet = (uint8_t*)malloc(len);
-	assert(packet);
-	printf("ARP--sending a arp_request\n");
+	uint8_t *packet = (uint8_t*)sr_buf_alloc(len);
+	if(!packet){
+		SR_ERR("out of memory building arp request, dropped\n");
+		SR_STATS_DROP(SR_DROP_NO_BUF);
+		return;
+	}
+	SR_DEBUG("ARP--sending a arp_request\n");
 	sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t*)(packet);
 	
 	memset(eth_hdr->ether_dhost,0xff,6);
@@ -69,36 +82,57 @@ void sr_arp_request(struct sr_instance* sr,uint32_t tip){
 	/*if I found none it's safe to quit and print error 
 	for otherwise I'll be sending myself icmp net unreachable*/
 	if(!tb){
-		fprintf(stderr,"Destination net unreachable from the router\n");
-		free(packet);
+		SR_WARN("Destination net unreachable from the router\n");
+		sr_buf_free(packet);
 		return;
 	}
+	SR_STATS_ROUTE(tb,SR_ROUTE_ARP,len);
 	struct sr_if* interface = sr_get_interface(sr,tb->interface);
 	memcpy(eth_hdr->ether_shost,interface->addr,6);
 	memcpy(arp_hdr->ar_sha,interface->addr,6);
 	arp_hdr->ar_sip = interface->ip;
 	sr_send_packet(sr,packet,len,interface->name);
-	free(packet);
+	sr_buf_free(packet);
 }
 
 
 
+/*when a packet was parked, for the ARP queue delay histogram*/
+static uint64_t sr_arpcache_now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
 void sr_arpcache_sweepreqs(struct sr_instance *sr) { 
     /* Fill this in */
     
     struct sr_arpcache *cache = &sr->cache;
-    struct sr_arpreq *req,*prev = NULL, *next = NULL;
-    for (req = cache->requests; req != NULL; req = req->next){
+    struct sr_arpreq *req, *next = NULL;
+    /*handle_arpreq unlinks a failed req itself, and it may already be
+      freed by the time it returns, so grab next first*/
+    for (req = cache->requests; req != NULL; req = next){
     	next = req->next;
-		if(handle_arpreq(sr,cache,req)){
-			if(prev)prev->next = next;
-			else cache->requests = next;
-		}else{
-			prev = req;
-		}
+		handle_arpreq(sr,cache,req);
     }
 }
 
+/*send host unreachable for every packet parked on a failed req, then
+  free it. req has already been taken off the request queue*/
+static void sr_arpreq_fail_job(struct sr_instance *sr,void *arg){
+	struct sr_arpreq *req = (struct sr_arpreq*)arg;
+	struct sr_packet * pkt = req->packets;
+	while(pkt){
+		sr_ip_hdr_t* iphdr = (sr_ip_hdr_t*)(pkt->buf+sizeof(sr_ethernet_hdr_t));
+		SR_SKETCH_SOURCE(iphdr->ip_src);
+		SR_STATS_DROP(SR_DROP_ARP_UNRESOLVED);
+		sr_icmp_dest_unr(sr,iphdr,1);
+		pkt = pkt->next;	
+	}
+	SR_SKETCH_SOURCE(0);
+	sr_arpreq_destroy(&sr->cache,req);
+}
+
 int handle_arpreq(struct sr_instance *sr,struct sr_arpcache *cache,struct sr_arpreq *req){
 	time_t curtime = time(NULL);
 	
@@ -106,14 +140,19 @@ int handle_arpreq(struct sr_instance *sr,struct sr_arpcache *cache,struct sr_arp
 		if(req->times_sent >= 5){
 			/*send icmp host unreachable to source addr of all pkts waits*/
 			/*I'll write ip packeting in sr_router*/
-			printf("ARP--padding out host unreachable\n");
-			struct sr_packet * pkt = req->packets;
-			while(pkt){
-				sr_ip_hdr_t* iphdr = (sr_ip_hdr_t*)(pkt->buf+sizeof(sr_ethernet_hdr_t));
-				sr_icmp_dest_unr(sr,iphdr,1);
-				pkt = pkt->next;	
+			SR_DEBUG("ARP--padding out host unreachable\n");
+			/*unlink now, the unreachables can go out whenever a worker
+			  is free (right away when there are no workers)*/
+			struct sr_arpreq *walker, *prev = NULL;
+			for(walker = cache->requests; walker; walker = walker->next){
+				if(walker==req){
+					if(prev)prev->next = req->next;
+					else cache->requests = req->next;
+					break;
+				}
+				prev = walker;
 			}
-			sr_arpreq_destroy(cache,req);
+			sr_defer(sr,sr_arpreq_fail_job,req);
 			return 1;
 		}else{
 			/*send arp request*/
@@ -169,6 +208,7 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     assert(cache);
     assert(packet);
     assert(iface);
+    struct sr_stats_arpq *q = sr_stats_arp_queue();
     struct sr_arpreq *req;
     for (req = cache->requests; req != NULL; req = req->next) {
         if (req->ip == ip) {
@@ -182,17 +222,29 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
         req->ip = ip;
         req->next = cache->requests;
         cache->requests = req;
+        q->pending++;
     }
     
     /* Add the packet to the list of packets for this request */
     if (packet && packet_len && iface) {
         struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
         
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
+        new_pkt->buf = (uint8_t *)sr_buf_alloc(packet_len);
+        if (!new_pkt->buf) {
+            SR_ERR("out of memory queueing on arp, dropped\n");
+            SR_STATS_DROP(SR_DROP_NO_BUF);
+            free(new_pkt);
+            pthread_mutex_unlock(&(cache->lock));
+            return req;
+        }
         memcpy(new_pkt->buf, packet, packet_len);
         new_pkt->len = packet_len;
 		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
         strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
+        new_pkt->queued = sr_arpcache_now_ns();
+        SR_PROBE3(arp_queue, ip, iface, packet_len);
+        q->queued_packets++;
+        q->queued_bytes += packet_len;
         new_pkt->next = req->packets;
         req->packets = new_pkt;
     }
@@ -228,6 +280,8 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
         }
         prev = req;
     }
+    if (req)
+        req->resolved = 1;
     
     int i;
     for (i = 0; i < SR_ARPCACHE_SZ; i++) {
@@ -270,17 +324,31 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
             prev = req;
         }
         
+        struct sr_stats_arpq *q = sr_stats_arp_queue();
         struct sr_packet *pkt, *nxt;
+        uint64_t now = sr_arpcache_now_ns();
         
+        /* by now the packets have been sent, or answered with host
+           unreachable if the next hop never replied */
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
+            q->delay.count[sr_lat_bucket(now - pkt->queued)]++;
+            SR_PROBE4(arp_dequeue, entry->ip, pkt->len, now - pkt->queued,
+                      entry->resolved);
+            if (entry->resolved)
+                q->released++;
+            else
+                q->unreachable++;
+            q->queued_packets--;
+            q->queued_bytes -= pkt->len;
             if (pkt->buf)
-                free(pkt->buf);
+                sr_buf_free(pkt->buf);
             if (pkt->iface)
                 free(pkt->iface);
             free(pkt);
         }
         
+        q->pending--;
         free(entry);
     }
     
@@ -315,6 +383,11 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
     pthread_mutexattr_init(&(cache->attr));
     pthread_mutexattr_settype(&(cache->attr), PTHREAD_MUTEX_RECURSIVE);
     int success = pthread_mutex_init(&(cache->lock), &(cache->attr));
+
+    pthread_mutex_init(&(cache->stop_lock), NULL);
+    pthread_cond_init(&(cache->stop_cond), NULL);
+    cache->running = 1;
+    cache->sweeping = 0;
     
     return success;
 }
@@ -329,9 +402,17 @@ int sr_arpcache_destroy(struct sr_arpcache *cache) {
 void *sr_arpcache_timeout(void *sr_ptr) {
     struct sr_instance *sr = sr_ptr;
     struct sr_arpcache *cache = &(sr->cache);
+    struct timespec ts;
     
-    while (1) {
-        sleep(1.0);
+    pthread_mutex_lock(&(cache->stop_lock));
+    while (cache->running) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        pthread_cond_timedwait(&(cache->stop_cond), &(cache->stop_lock), &ts);
+        if (!cache->running) {
+            break;
+        }
+        pthread_mutex_unlock(&(cache->stop_lock));
         
         pthread_mutex_lock(&(cache->lock));
     
@@ -347,8 +428,23 @@ void *sr_arpcache_timeout(void *sr_ptr) {
         sr_arpcache_sweepreqs(sr);
 
         pthread_mutex_unlock(&(cache->lock));
+        pthread_mutex_lock(&(cache->stop_lock));
     }
+    pthread_mutex_unlock(&(cache->stop_lock));
     
     return NULL;
 }
 
+/* Stops the sweeper thread and waits for it to finish its round. */
+void sr_arpcache_stop(struct sr_arpcache *cache) {
+    if (!cache->sweeping) {
+        return;
+    }
+    pthread_mutex_lock(&(cache->stop_lock));
+    cache->running = 0;
+    pthread_cond_signal(&(cache->stop_cond));
+    pthread_mutex_unlock(&(cache->stop_lock));
+    pthread_join(cache->sweeper, NULL);
+    cache->sweeping = 0;
+}
+
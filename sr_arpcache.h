@@ -78,6 +78,7 @@ struct sr_packet {
     uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
     unsigned int len;           /* Length of raw Ethernet frame */
     char *iface;                /* The outgoing interface */
+    uint64_t queued;            /* CLOCK_MONOTONIC ns when it was parked */
     struct sr_packet *next;
 };
 
@@ -96,6 +97,7 @@ struct sr_arpreq {
     uint32_t times_sent;        /* Number of times this request was sent. You 
                                    should update this. */
     struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
+    int resolved;               /* answered, its packets are being sent */
     struct sr_arpreq *next;
 };
 
@@ -104,6 +106,13 @@ struct sr_arpcache {
     struct sr_arpreq *requests;
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
+
+    /* -- the sweeper thread, only for sleeping and stopping it -- */
+    pthread_t sweeper;
+    pthread_mutex_t stop_lock;
+    pthread_cond_t stop_cond;
+    int running;
+    int sweeping;                   /* sweeper was started */
 };
 
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order. 
@@ -132,7 +141,10 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      uint32_t ip);
 
 /* Frees all memory associated with this arp request entry. If this arp request
-   entry is on the arp request queue, it is removed from the queue. */
+   entry is on the arp request queue, it is removed from the queue. Each
+   packet's time on the queue goes into the sr_stats ARP delay histogram,
+   counted as released if sr_arpcache_insert found the request, host
+   unreachable otherwise. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
 
 /* Prints out the ARP table. */
@@ -146,6 +158,10 @@ void sr_arpcache_dump(struct sr_arpcache *cache);
 int   sr_arpcache_init(struct sr_arpcache *cache);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
 void *sr_arpcache_timeout(void *cache_ptr);
+
+/* Stop the sweeper and wait for it, so it sends nothing more; call before
+   the dispatch and egress it sends through are torn down. */
+void  sr_arpcache_stop(struct sr_arpcache *cache);
 void sr_arpcache_sweepreqs(struct sr_instance *sr);
 
 /*return 1 if arp destroyed*/
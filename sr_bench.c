@@ -0,0 +1,456 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_bench.c
+ *
+ * Description:
+ *
+ * Microbenchmarks of the building blocks of the packet path, each timed on
+ * its own against the real router code: cksum at several lengths,
+ * ethertype, the interface lookups, sr_LPM, the ARP cache and every ICMP
+ * builder.  The ICMP builders run all the way to sr_send_packet, which
+ * hands the frame to a null backend that only counts it.
+ *
+ * Each benchmark is run a few times to warm up, then runs times, a run
+ * being n operations timed together; the median and 99th percentile of
+ * the time per operation over the runs are reported, as a table or, with
+ * -j, as JSON on stdout.  Some benchmarks do fewer operations a run, the
+ * ITERS column says how many.
+ *
+ * The interfaces, routes (-R, the packet path's sr_LPM walks every one)
+ * and ARP cache are made up here; nothing is read from files and nothing
+ * goes on a wire.  The build is the router's, so numbers compare with
+ * what sr does, not with an optimized build.
+ *
+ *   sr_bench [-r runs] [-w warmup runs] [-n operations] [-R routes]
+ *            [-f name] [-j]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_utils.h"
+#include "sr_protocol.h"
+#include "sr_arpcache.h"
+#include "sr_io.h"
+#include "sr_log.h"
+
+#define BENCH_IFS       4
+#define BENCH_DSTS      256         /* sr_LPM destinations cycled through */
+#define BENCH_ICMP_DATA 56          /* ping payload */
+
+struct bench
+{
+    const char* name;
+    unsigned int arg;               /* cksum length, ICMP code */
+    unsigned int div;               /* runs do n / div operations */
+    void (*setup)(void);            /* 0 if none */
+    void (*run)(unsigned int n, unsigned int arg);
+};
+
+struct bench_result
+{
+    unsigned int iters;
+    double median_ns;               /* per operation */
+    double p99_ns;
+    double min_ns;
+};
+
+static int  nruns = 101;
+static int  nwarmup = 5;
+static int  nops = 10000;
+static int  nroutes = 32;
+
+static struct sr_instance sr;
+static char ifnames[BENCH_IFS][sr_IFACE_NAMELEN];
+static uint32_t ifips[BENCH_IFS];
+static uint32_t dsts[BENCH_DSTS];
+static uint32_t arpips[SR_ARPCACHE_SZ];
+static uint8_t data[1500];
+static uint8_t frame[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +
+                     sizeof(sr_icmp_hdr_t) + BENCH_ICMP_DATA];
+
+static volatile uint32_t sink;
+
+/* -- the null backend: every frame is taken, none goes anywhere -- */
+static int null_send(struct sr_instance* s, uint8_t* buf, unsigned int len,
+                     const char* iface)
+{
+    sink += len;
+    return 0;
+} /* -- null_send -- */
+
+static const struct sr_io_ops null_io = { "null", 0, null_send, 0, 0, 0 };
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- now_ns -- */
+
+static void bench_cksum(unsigned int n, unsigned int len)
+{
+    uint32_t x = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    { x += cksum(data, len); }
+    sink += x;
+} /* -- bench_cksum -- */
+
+static void bench_ethertype(unsigned int n, unsigned int arg)
+{
+    uint32_t x = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    { x += ethertype(frame); }
+    sink += x;
+} /* -- bench_ethertype -- */
+
+static void bench_get_interface(unsigned int n, unsigned int arg)
+{
+    uint32_t x = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    { x += sr_get_interface(&sr, ifnames[i % BENCH_IFS])->ip; }
+    sink += x;
+} /* -- bench_get_interface -- */
+
+static void bench_get_interface_by_ip(unsigned int n, unsigned int arg)
+{
+    uint32_t x = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    { x += sr_get_interface_by_ip(&sr, ifips[i % BENCH_IFS])->mtu; }
+    sink += x;
+} /* -- bench_get_interface_by_ip -- */
+
+static void bench_lpm(unsigned int n, unsigned int arg)
+{
+    uint32_t x = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    { x += sr_LPM(&sr, dsts[i % BENCH_DSTS])->gw.s_addr; }
+    sink += x;
+} /* -- bench_lpm -- */
+
+/* a full cache: the interfaces' next hops, then made up neighbours */
+static void fill_arpcache(void)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0 };
+    int i;
+
+    memset(sr.cache.entries, 0, sizeof(sr.cache.entries));
+    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+        if (i < BENCH_IFS)
+        { arpips[i] = htonl(0x0a000002 | (i + 1) << 8); }
+        else
+        { arpips[i] = htonl(0x0a010000 | i); }
+        mac[5] = (unsigned char)i;
+        sr_arpcache_insert(&sr.cache, mac, arpips[i]);
+    }
+} /* -- fill_arpcache -- */
+
+static void bench_arp_lookup(unsigned int n, unsigned int arg)
+{
+    struct sr_arpentry* e;
+    uint32_t x = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        e = sr_arpcache_lookup(&sr.cache, arpips[i % SR_ARPCACHE_SZ]);
+        x += e->mac[5];
+        free(e);
+    }
+    sink += x;
+} /* -- bench_arp_lookup -- */
+
+/* fills the cache from empty, emptying it again whenever it is full */
+static void bench_arp_insert(unsigned int n, unsigned int arg)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 1 };
+    unsigned int i, k;
+
+    for (i = 0; i < n; i++) {
+        k = i % SR_ARPCACHE_SZ;
+        if (k == 0)
+        { memset(sr.cache.entries, 0, sizeof(sr.cache.entries)); }
+        sr_arpcache_insert(&sr.cache, mac, arpips[k]);
+    }
+} /* -- bench_arp_insert -- */
+
+static sr_ip_hdr_t* frame_ip(void)
+{
+    return (sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+} /* -- frame_ip -- */
+
+static void bench_icmp_echo_reply(unsigned int n, unsigned int arg)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    { sr_icmp_echo_reply(&sr, frame_ip()); }
+} /* -- bench_icmp_echo_reply -- */
+
+static void bench_icmp_time_exceeded(unsigned int n, unsigned int arg)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    { sr_icmp_TLE(&sr, frame_ip()); }
+} /* -- bench_icmp_time_exceeded -- */
+
+static void bench_icmp_dest_unr(unsigned int n, unsigned int code)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    { sr_icmp_dest_unr(&sr, frame_ip(), (uint8_t)code); }
+} /* -- bench_icmp_dest_unr -- */
+
+static void bench_icmp_frag_needed(unsigned int n, unsigned int arg)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    { sr_icmp_frag_needed(&sr, frame_ip(), 1400); }
+} /* -- bench_icmp_frag_needed -- */
+
+static const struct bench benches[] =
+{
+    { "cksum",                20,   1, 0, bench_cksum },
+    { "cksum",                64,   1, 0, bench_cksum },
+    { "cksum",                576,  1, 0, bench_cksum },
+    { "cksum",                1500, 1, 0, bench_cksum },
+    { "ethertype",            0,    1, 0, bench_ethertype },
+    { "sr_get_interface",     0,    1, 0, bench_get_interface },
+    { "sr_get_interface_by_ip", 0,  1, 0, bench_get_interface_by_ip },
+    { "sr_LPM",               0,    1, 0, bench_lpm },
+    { "sr_arpcache_lookup",   0,    1, fill_arpcache, bench_arp_lookup },
+    { "sr_arpcache_insert",   0,    1, 0, bench_arp_insert },
+    { "icmp_echo_reply",      0,    10, fill_arpcache, bench_icmp_echo_reply },
+    { "icmp_time_exceeded",   0,    10, 0, bench_icmp_time_exceeded },
+    { "icmp_net_unreachable", 0,    10, 0, bench_icmp_dest_unr },
+    { "icmp_host_unreachable", 1,   10, 0, bench_icmp_dest_unr },
+    { "icmp_port_unreachable", 3,   10, 0, bench_icmp_dest_unr },
+    { "icmp_frag_needed",     0,    10, 0, bench_icmp_frag_needed },
+    { 0, 0, 0, 0, 0 }
+};
+
+/*---------------------------------------------------------------------
+ * Method: setup_router(..)
+ * Scope:  Local
+ *
+ * eth1..eth4 on 10.0.1.1..10.0.4.1, each with a next hop at .2, a /24 per
+ * interface, made up /24s under 172.16/12 spread over them to make up
+ * nroutes, and a default route last.  The cache is left full.
+ *
+ *---------------------------------------------------------------------*/
+
+static void setup_router(void)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0 };
+    struct in_addr dest, gw, mask;
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip = frame_ip();
+    sr_icmp_hdr_t* icmp = (sr_icmp_hdr_t*)(ip + 1);
+    int i, n172;
+
+    memset(&sr, 0, sizeof(sr));
+    sr.sockfd = -1;
+    sr.io = &null_io;
+    pthread_mutex_init(&sr.send_lock, 0);
+    sr_arpcache_init(&sr.cache);
+
+    for (i = 0; i < BENCH_IFS; i++) {
+        snprintf(ifnames[i], sr_IFACE_NAMELEN, "eth%d", i + 1);
+        ifips[i] = htonl(0x0a000001 | (i + 1) << 8);
+        mac[5] = (unsigned char)(i + 1);
+        sr_add_interface(&sr, ifnames[i]);
+        sr_set_ether_addr(&sr, mac);
+        sr_set_ether_ip(&sr, ifips[i]);
+    }
+
+    mask.s_addr = htonl(0xffffff00);
+    for (i = 0; i < BENCH_IFS; i++) {
+        dest.s_addr = htonl(0x0a000000 | (i + 1) << 8);
+        gw.s_addr = htonl(0x0a000002 | (i + 1) << 8);
+        sr_add_rt_entry(&sr, dest, gw, mask, ifnames[i]);
+    }
+    n172 = nroutes - BENCH_IFS - 1;
+    for (i = 0; i < n172; i++) {
+        dest.s_addr = htonl(0xac100000 | i << 8);
+        gw.s_addr = htonl(0x0a000002 | (i % BENCH_IFS + 1) << 8);
+        sr_add_rt_entry(&sr, dest, gw, mask, ifnames[i % BENCH_IFS]);
+    }
+    dest.s_addr = mask.s_addr = 0;
+    gw.s_addr = htonl(0x0a000202);
+    sr_add_rt_entry(&sr, dest, gw, mask, ifnames[1]);
+
+    /* -- one in 8 only matches the default route -- */
+    for (i = 0; i < BENCH_DSTS; i++) {
+        if (i % 8 == 0 || n172 < 1)
+        { dsts[i] = htonl(0x08080000 | i); }
+        else
+        { dsts[i] = htonl(0xac100007 | (i % n172) << 8); }
+    }
+
+    fill_arpcache();
+
+    for (i = 0; i < (int)sizeof(data); i++)
+    { data[i] = (uint8_t)(i * 131 + 7); }
+
+    /* -- a ping from behind eth1 to eth2's address -- */
+    memset(frame, 0, sizeof(frame));
+    eth->ether_type = htons(ethertype_ip);
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(sizeof(frame) - sizeof(sr_ethernet_hdr_t));
+    ip->ip_id = htons(1);
+    ip->ip_ttl = 64;
+    ip->ip_p = ip_protocol_icmp;
+    ip->ip_src = htonl(0x0a000105);
+    ip->ip_dst = ifips[1];
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+    icmp->icmp_type = 8;
+    icmp->icmp_sum = cksum(icmp, sizeof(sr_icmp_hdr_t) + BENCH_ICMP_DATA);
+} /* -- setup_router -- */
+
+static int cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+} /* -- cmp_double -- */
+
+static void measure(const struct bench* b, double* t, struct bench_result* res)
+{
+    unsigned int n = nops / b->div ? nops / b->div : 1;
+    uint64_t t0;
+    int i;
+
+    if (b->setup)
+    { b->setup(); }
+    for (i = 0; i < nwarmup; i++)
+    { b->run(n, b->arg); }
+    for (i = 0; i < nruns; i++) {
+        t0 = now_ns();
+        b->run(n, b->arg);
+        t[i] = (double)(now_ns() - t0) / n;
+    }
+    qsort(t, nruns, sizeof(t[0]), cmp_double);
+
+    res->iters = n;
+    res->min_ns = t[0];
+    res->median_ns = nruns % 2 ? t[nruns / 2] :
+                     (t[nruns / 2 - 1] + t[nruns / 2]) / 2;
+    /* -- nearest rank -- */
+    i = (nruns * 99 + 99) / 100 - 1;
+    res->p99_ns = t[i < nruns ? i : nruns - 1];
+} /* -- measure -- */
+
+static void usage(const char* argv0)
+{
+    printf("Format: %s [-r runs] [-w warmup runs] [-n operations] "
+           "[-R routes] [-f name] [-j]\n", argv0);
+    printf("   -r  timed runs per benchmark, default %d\n", nruns);
+    printf("   -w  untimed runs first, default %d\n", nwarmup);
+    printf("   -n  operations per run, default %d\n", nops);
+    printf("   -R  routes in the table, default %d\n", nroutes);
+    printf("   -f  only the benchmarks whose name contains name\n");
+    printf("   -j  JSON on stdout instead of a table\n");
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    const struct bench* b;
+    struct bench_result res;
+    const char* filter = 0;
+    double* t;
+    int json = 0, first = 1, c;
+
+    while ((c = getopt(argc, argv, "hr:w:n:R:f:j")) != EOF)
+    {
+        switch (c)
+        {
+            case 'r':
+                nruns = atoi(optarg);
+                break;
+            case 'w':
+                nwarmup = atoi(optarg);
+                break;
+            case 'n':
+                nops = atoi(optarg);
+                break;
+            case 'R':
+                nroutes = atoi(optarg);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 'j':
+                json = 1;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (nruns < 1 || nwarmup < 0 || nops < 1 || nroutes < BENCH_IFS + 1) {
+        fprintf(stderr, "need a run, an operation and at least %d routes\n",
+                BENCH_IFS + 1);
+        return 1;
+    }
+
+    sr_log_level = SR_LOG_ERR;
+    setup_router();
+    t = (double*)malloc(nruns * sizeof(double));
+    assert(t);
+
+    if (json) {
+        printf("{\"runs\": %d, \"warmup\": %d, \"routes\": %d, "
+               "\"benchmarks\": [", nruns, nwarmup, nroutes);
+    }
+    else {
+        printf("runs=%d warmup=%d routes=%d, ns per operation\n", nruns,
+               nwarmup, nroutes);
+        printf("%-24s %6s %8s %10s %10s %10s\n", "BENCHMARK", "ARG", "ITERS",
+               "MEDIAN", "P99", "MIN");
+    }
+    for (b = benches; b->name; b++) {
+        if (filter && !strstr(b->name, filter))
+        { continue; }
+        measure(b, t, &res);
+        if (json) {
+            printf("%s\n  {\"name\": \"%s\", \"arg\": %u, \"iters\": %u, "
+                   "\"median_ns\": %.2f, \"p99_ns\": %.2f, \"min_ns\": %.2f}",
+                   first ? "" : ",", b->name, b->arg, res.iters,
+                   res.median_ns, res.p99_ns, res.min_ns);
+        }
+        else {
+            printf("%-24s %6u %8u %10.1f %10.1f %10.1f\n", b->name, b->arg,
+                   res.iters, res.median_ns, res.p99_ns, res.min_ns);
+        }
+        fflush(stdout);
+        first = 0;
+    }
+    if (json)
+    { printf("\n]}\n"); }
+
+    free(t);
+    return 0;
+} /* -- main -- */
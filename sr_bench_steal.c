@@ -0,0 +1,310 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_bench_steal.c
+ *
+ * Description:
+ *
+ * Benchmark comparing static flow-hash dispatch with work stealing under a
+ * skewed (Zipf) flow distribution.
+ *
+ * Every synthetic packet costs a fixed amount of in-order forwarding work on
+ * the worker its flow hashes to.  A fraction of packets also produce
+ * order-insensitive work (think ICMP generation or ARP failure handling).
+ * With static dispatch that work runs inline on the owner; with stealing it
+ * is batched onto the owner's sr_deque where idle workers can take it.
+ *
+ * The default is the case stealing is for: a few elephant flows pile most
+ * packets onto one worker, and most of them make deferred work (an ICMP
+ * storm, say), faster than its owner gets round to it between ring
+ * batches.  With a light unordered share the owner keeps up with its own
+ * deque and there is next to nothing to steal.
+ *
+ * Busy time is each worker's CPU time, and the busiest worker's is the
+ * critical path: the makespan given a CPU per worker.  On fewer CPUs than
+ * workers the wall clock is just the total work and can't improve, so the
+ * speedup to look at is the critical path's.
+ *
+ *   sr_bench_steal [-w workers] [-n packets] [-f flows] [-s zipf exponent]
+ *                  [-u unordered %] [-c fwd cost] [-k unordered cost]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#include "sr_deque.h"
+
+#define MAX_WORKERS 64
+#define JOB_BATCH   16     /* same granularity as SR_JOB_BATCH */
+#define RING_BATCH  32     /* packets drained between job runs */
+
+struct bench_pkt
+{
+    uint32_t flow;
+    uint8_t unordered;
+};
+
+struct bench_job
+{
+    int n;                 /* unordered items in this batch */
+};
+
+struct bench_worker
+{
+    int id;
+    struct bench_pkt* pkts;
+    int npkts;
+    double busy_ms;
+    long stolen;
+    struct sr_deque jobs;
+} __attribute__ ((aligned (64)));
+
+static int  nworkers = 4;
+static int  npackets = 200000;
+static int  nflows = 256;
+static double zipf_s = 1.5;
+static int  unordered_pct = 60;
+static long fwd_cost = 200;
+static long job_cost = 2000;
+
+static struct bench_worker workers[MAX_WORKERS];
+static long remaining;              /* unordered items not yet run */
+static int  stealing;
+static pthread_barrier_t start_line;
+
+static volatile uint32_t sink;
+
+static void spin(long n)
+{
+    uint32_t x = sink;
+    long i;
+    for (i = 0; i < n; i++)
+    { x = x * 1664525u + 1013904223u; }
+    sink = x;
+} /* -- spin -- */
+
+static double now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+} /* -- now_ms -- */
+
+/* the calling thread's CPU time, which time slicing doesn't inflate */
+static double cpu_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+} /* -- cpu_ms -- */
+
+static void run_job(struct bench_job* job)
+{
+    spin(job_cost * job->n);
+    __atomic_fetch_sub(&remaining, job->n, __ATOMIC_RELEASE);
+    free(job);
+} /* -- run_job -- */
+
+static void push_job(struct bench_worker* w, int n)
+{
+    struct bench_job* job = (struct bench_job*)malloc(sizeof(struct bench_job));
+    job->n = n;
+    if (sr_deque_push(&w->jobs, job) != 0)
+    { run_job(job); }
+} /* -- push_job -- */
+
+static void* worker_main(void* arg)
+{
+    struct bench_worker* w = (struct bench_worker*)arg;
+    double t0, busy = 0;
+    int i = 0, pending = 0;
+    void* job;
+
+    pthread_barrier_wait(&start_line);
+    t0 = cpu_ms();
+
+    if (!stealing) {
+        for (i = 0; i < w->npkts; i++) {
+            spin(fwd_cost);
+            if (w->pkts[i].unordered)
+            { spin(job_cost); }
+        }
+        w->busy_ms = cpu_ms() - t0;
+        return NULL;
+    }
+
+    while (i < w->npkts) {
+        int end = i + RING_BATCH < w->npkts ? i + RING_BATCH : w->npkts;
+        for (; i < end; i++) {
+            spin(fwd_cost);
+            if (w->pkts[i].unordered && ++pending == JOB_BATCH) {
+                push_job(w, pending);
+                pending = 0;
+            }
+        }
+        if (pending) {
+            push_job(w, pending);
+            pending = 0;
+        }
+        if ((job = sr_deque_take(&w->jobs)) != SR_DEQUE_EMPTY)
+        { run_job((struct bench_job*)job); }
+    }
+    while ((job = sr_deque_take(&w->jobs)) != SR_DEQUE_EMPTY)
+    { run_job((struct bench_job*)job); }
+    busy = cpu_ms() - t0;
+
+    /* our ring is dry; help out until every unordered item has run */
+    while (__atomic_load_n(&remaining, __ATOMIC_ACQUIRE) > 0) {
+        int v;
+        for (v = 1; v < nworkers; v++) {
+            job = sr_deque_steal(&workers[(w->id + v) % nworkers].jobs);
+            if (job != SR_DEQUE_EMPTY && job != SR_DEQUE_ABORT) {
+                double s = cpu_ms();
+                run_job((struct bench_job*)job);
+                busy += cpu_ms() - s;
+                w->stolen++;
+                break;
+            }
+        }
+        if (v == nworkers)
+        { sched_yield(); }
+    }
+
+    w->busy_ms = busy;
+    return NULL;
+} /* -- worker_main -- */
+
+/* flow ids drawn from a Zipf(s) distribution over nflows flows */
+static void generate(struct bench_pkt* all)
+{
+    double* cdf = (double*)malloc(nflows * sizeof(double));
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < nflows; i++)
+    { sum += 1.0 / pow(i + 1, zipf_s); cdf[i] = sum; }
+
+    srand(42);
+    for (i = 0; i < npackets; i++) {
+        double r = sum * rand() / ((double)RAND_MAX + 1);
+        int lo = 0, hi = nflows - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] < r) lo = mid + 1; else hi = mid;
+        }
+        all[i].flow = lo;
+        all[i].unordered = (rand() % 100) < unordered_pct;
+    }
+    free(cdf);
+} /* -- generate -- */
+
+static void run(const char* name, struct bench_pkt* all, int steal,
+                double* wall_ms, double* critical_ms)
+{
+    pthread_t tid[MAX_WORKERS];
+    double t0, elapsed, max_busy = 0, sum_busy = 0;
+    long stolen = 0;
+    int i;
+
+    stealing = steal;
+    remaining = 0;
+    for (i = 0; i < nworkers; i++) {
+        workers[i].id = i;
+        workers[i].npkts = 0;
+        workers[i].stolen = 0;
+        sr_deque_init(&workers[i].jobs);
+    }
+
+    /* static flow-hash dispatch, as the receive thread would do it */
+    for (i = 0; i < npackets; i++) {
+        struct bench_worker* w = &workers[(all[i].flow * 2654435761u >> 16) % nworkers];
+        w->pkts[w->npkts++] = all[i];
+        remaining += all[i].unordered;
+    }
+
+    pthread_barrier_init(&start_line, NULL, nworkers + 1);
+    for (i = 0; i < nworkers; i++)
+    { pthread_create(&tid[i], NULL, worker_main, &workers[i]); }
+    pthread_barrier_wait(&start_line);
+    t0 = now_ms();
+    for (i = 0; i < nworkers; i++)
+    { pthread_join(tid[i], NULL); }
+    elapsed = now_ms() - t0;
+    pthread_barrier_destroy(&start_line);
+
+    for (i = 0; i < nworkers; i++) {
+        sum_busy += workers[i].busy_ms;
+        if (workers[i].busy_ms > max_busy) max_busy = workers[i].busy_ms;
+        stolen += workers[i].stolen;
+    }
+
+    printf("%-8s %10.2f %12.2f %10.2f %8ld   ", name, elapsed, max_busy,
+           sum_busy ? max_busy * nworkers / sum_busy : 0.0, stolen);
+    for (i = 0; i < nworkers; i++)
+    { printf(" %d", workers[i].npkts); }
+    printf("\n");
+    *wall_ms = elapsed;
+    *critical_ms = max_busy;
+} /* -- run -- */
+
+int main(int argc, char** argv)
+{
+    struct bench_pkt* all;
+    double t_static, t_steal, c_static, c_steal;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int c, i;
+
+    while ((c = getopt(argc, argv, "w:n:f:s:u:c:k:h")) != EOF) {
+        switch (c) {
+            case 'w': nworkers = atoi(optarg); break;
+            case 'n': npackets = atoi(optarg); break;
+            case 'f': nflows = atoi(optarg); break;
+            case 's': zipf_s = atof(optarg); break;
+            case 'u': unordered_pct = atoi(optarg); break;
+            case 'c': fwd_cost = atol(optarg); break;
+            case 'k': job_cost = atol(optarg); break;
+            default:
+                printf("Format: %s [-w workers] [-n packets] [-f flows] "
+                       "[-s zipf exponent]\n"
+                       "           [-u unordered %%] [-c fwd cost] "
+                       "[-k unordered cost]\n", argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (nworkers < 2 || nworkers > MAX_WORKERS || npackets < 1 || nflows < 1) {
+        fprintf(stderr, "need 2..%d workers, at least one packet and flow\n",
+                MAX_WORKERS);
+        return 1;
+    }
+
+    all = (struct bench_pkt*)malloc(npackets * sizeof(struct bench_pkt));
+    for (i = 0; i < nworkers; i++)
+    { workers[i].pkts = (struct bench_pkt*)malloc(npackets * sizeof(struct bench_pkt)); }
+    generate(all);
+
+    printf("workers=%d packets=%d flows=%d zipf=%.2f unordered=%d%% "
+           "cost fwd=%ld unordered=%ld\n",
+           nworkers, npackets, nflows, zipf_s, unordered_pct, fwd_cost, job_cost);
+    printf("%-8s %10s %12s %10s %8s   %s\n", "MODE", "WALL_MS", "CRITICAL_MS",
+           "IMBALANCE", "STOLEN", "PACKETS PER WORKER");
+    run("static", all, 0, &t_static, &c_static);
+    run("steal", all, 1, &t_steal, &c_steal);
+    printf("speedup: %.2fx critical path, %.2fx wall clock\n",
+           c_steal > 0 ? c_static / c_steal : 0.0,
+           t_steal > 0 ? t_static / t_steal : 0.0);
+    if (ncpus > 0 && ncpus < nworkers) {
+        printf("only %ld CPUs for %d workers: the wall clock can't improve, "
+               "the critical path\nis what it would be with a CPU each\n",
+               ncpus, nworkers);
+    }
+
+    for (i = 0; i < nworkers; i++)
+    { free(workers[i].pkts); }
+    free(all);
+    return 0;
+} /* -- main -- */
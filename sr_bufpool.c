@@ -0,0 +1,168 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bufpool.c
+ *
+ * Description:
+ *
+ * Size-classed packet buffer pools, see sr_bufpool.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_bufpool.h"
+
+#define SR_BUF_NCLASSES 4
+#define SR_BUF_HEAP     SR_BUF_NCLASSES /* class of oversized buffers */
+#define SR_BUF_MAGIC    0x53524246      /* "SRBF" */
+#define SR_BUF_CHUNK    (1 << 18)       /* bytes carved per refill */
+#define SR_BUF_MIN_REFILL 8
+
+/* in front of every buffer; a multiple of 16 so buffers stay aligned */
+union sr_buf_hdr
+{
+    struct
+    {
+        uint32_t cls;
+        uint32_t magic;
+        union sr_buf_hdr* next;         /* free list link */
+    } h;
+    char pad[16];
+};
+
+struct sr_buf_class
+{
+    unsigned int size;
+    pthread_mutex_t lock;
+    union sr_buf_hdr* free;
+    unsigned long carved;
+    unsigned long in_use;
+    unsigned long peak;
+};
+
+static struct sr_buf_class sr_buf_classes[SR_BUF_NCLASSES] =
+{
+    { SR_BUF_SMALL, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0 },
+    { SR_BUF_STD,   PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0 },
+    { SR_BUF_JUMBO, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0 },
+    { SR_BUF_MAX,   PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0 }
+};
+
+/* carve another chunk into buffers for c; lock held */
+static int sr_buf_refill(struct sr_buf_class* c, uint32_t cls)
+{
+    size_t stride = sizeof(union sr_buf_hdr) + c->size;
+    size_t n = SR_BUF_CHUNK / stride;
+    uint8_t* chunk;
+    size_t i;
+
+    if (n < SR_BUF_MIN_REFILL)
+    { n = SR_BUF_MIN_REFILL; }
+    if ((chunk = (uint8_t*)malloc(n * stride)) == 0)
+    { return -1; }
+
+    for (i = 0; i < n; i++)
+    {
+        union sr_buf_hdr* b = (union sr_buf_hdr*)(chunk + i * stride);
+        b->h.cls = cls;
+        b->h.magic = SR_BUF_MAGIC;
+        b->h.next = c->free;
+        c->free = b;
+    }
+    c->carved += n;
+    return 0;
+} /* -- sr_buf_refill -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_buf_alloc(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+void* sr_buf_alloc(unsigned int len)
+{
+    struct sr_buf_class* c;
+    union sr_buf_hdr* b;
+    uint32_t cls;
+
+    for (cls = 0; cls < SR_BUF_NCLASSES; cls++)
+    {
+        if (len <= sr_buf_classes[cls].size)
+        { break; }
+    }
+
+    if (cls == SR_BUF_HEAP)
+    {
+        if ((b = (union sr_buf_hdr*)malloc(sizeof(union sr_buf_hdr) + len)) == 0)
+        { return 0; }
+        b->h.cls = SR_BUF_HEAP;
+        b->h.magic = SR_BUF_MAGIC;
+        return b + 1;
+    }
+
+    c = &sr_buf_classes[cls];
+    pthread_mutex_lock(&c->lock);
+    if (!c->free && sr_buf_refill(c, cls) != 0)
+    {
+        pthread_mutex_unlock(&c->lock);
+        return 0;
+    }
+    b = c->free;
+    c->free = b->h.next;
+    if (++c->in_use > c->peak)
+    { c->peak = c->in_use; }
+    pthread_mutex_unlock(&c->lock);
+
+    return b + 1;
+} /* -- sr_buf_alloc -- */
+
+void sr_buf_free(void* buf)
+{
+    union sr_buf_hdr* b;
+    struct sr_buf_class* c;
+
+    if (!buf)
+    { return; }
+
+    b = (union sr_buf_hdr*)buf - 1;
+    assert(b->h.magic == SR_BUF_MAGIC);
+
+    if (b->h.cls == SR_BUF_HEAP)
+    {
+        free(b);
+        return;
+    }
+
+    c = &sr_buf_classes[b->h.cls];
+    pthread_mutex_lock(&c->lock);
+    b->h.next = c->free;
+    c->free = b;
+    c->in_use--;
+    pthread_mutex_unlock(&c->lock);
+} /* -- sr_buf_free -- */
+
+void sr_bufpool_print(FILE* fp)
+{
+    int i;
+
+    fprintf(fp, "buffer pool    size   carved   in use     peak\n");
+    for (i = 0; i < SR_BUF_NCLASSES; i++)
+    {
+        struct sr_buf_class* c = &sr_buf_classes[i];
+
+        pthread_mutex_lock(&c->lock);
+        fprintf(fp, "            %6u %8lu %8lu %8lu\n",
+                c->size, c->carved, c->in_use, c->peak);
+        pthread_mutex_unlock(&c->lock);
+    }
+} /* -- sr_bufpool_print -- */
@@ -0,0 +1,35 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bufpool.h
+ *
+ * Description:
+ *
+ * Size-classed packet buffer pools.  Every packet copy the router makes
+ * (worker rings, ARP queues, ICMP replies, fragments, VNS messages) comes
+ * from here instead of malloc, so a mix of 64 byte and 9000 byte frames
+ * doesn't leave the heap in pieces.  Buffers are carved out of large chunks
+ * per class and go back on that class's free list; chunks are never given
+ * back.  Anything larger than the biggest class falls through to malloc.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_BUFPOOL_H
+#define SR_BUFPOOL_H
+
+#include <stdio.h>
+
+/* size classes; the largest holds a whole VNS message */
+#define SR_BUF_SMALL   256        /* ARP, ICMP errors */
+#define SR_BUF_STD     2048       /* up to a 1500 byte MTU frame */
+#define SR_BUF_JUMBO   9728       /* up to a 9216 byte MTU frame */
+#define SR_BUF_MAX     16384
+
+/* A buffer of at least len bytes, 0 if out of memory. */
+void* sr_buf_alloc(unsigned int len);
+
+/* Give a buffer from sr_buf_alloc back.  0 is ignored. */
+void  sr_buf_free(void* buf);
+
+/* Per class buffers carved, in use and peak in use. */
+void  sr_bufpool_print(FILE* fp);
+
+#endif /* -- SR_BUFPOOL_H -- */
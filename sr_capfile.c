@@ -0,0 +1,397 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capfile.c
+ *
+ * Description:
+ *
+ * pcap and pcapng capture files written through mmap'd segments, see
+ * sr_capfile.h.  Only sr_capture's writer thread calls in here.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sr_capfile.h"
+#include "sr_capfilter.h"
+#include "sr_dumper.h"
+
+#define SR_NSEC 1000000000ULL
+
+/* pcapng block types and options */
+#define PCAPNG_SHB          0x0A0D0D0A
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BOM          0x1A2B3C4D
+#define PCAPNG_SHB_USERAPPL 4
+#define PCAPNG_IF_NAME      2
+#define PCAPNG_IF_TSRESOL   9
+#define PCAPNG_EPB_FLAGS    2
+#define PCAPNG_FLAG_IN      0x1
+#define PCAPNG_FLAG_OUT     0x2
+
+#define PAD4(n) (((n) + 3) & ~3U)
+
+static const uint8_t sr_capfile_zero[4] = { 0, 0, 0, 0 };
+
+/* map the segment at seg_off, growing the file to hold it */
+static int sr_capfile_map(struct sr_capfile* cf)
+{
+    int err;
+
+    if ((err = posix_fallocate(cf->fd, cf->seg_off, SR_CAPFILE_SEG)) != 0 &&
+        ftruncate(cf->fd, cf->seg_off + SR_CAPFILE_SEG) < 0) {
+        errno = err;
+        perror("posix_fallocate(..):sr_capfile.c::sr_capfile_map(..)");
+        return -1;
+    }
+    cf->seg = (uint8_t*)mmap(0, SR_CAPFILE_SEG, PROT_WRITE, MAP_SHARED, cf->fd,
+                             cf->seg_off);
+    if (cf->seg == MAP_FAILED) {
+        perror("mmap(..):sr_capfile.c::sr_capfile_map(..)");
+        cf->seg = 0;
+        return -1;
+    }
+    cf->pos = 0;
+    return 0;
+} /* -- sr_capfile_map -- */
+
+/* hand a pipe's segment to the kernel */
+static int sr_capfile_drain(struct sr_capfile* cf)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < cf->pos) {
+        if ((n = write(cf->fd, cf->seg + off, cf->pos - off)) < 0) {
+            if (errno == EINTR)
+            { continue; }
+            perror("write(..):sr_capfile.c::sr_capfile_drain(..)");
+            cf->pos = 0;
+            return -1;
+        }
+        off += n;
+    }
+    cf->pos = 0;
+    return 0;
+} /* -- sr_capfile_drain -- */
+
+/* append n bytes, moving on to the next segment as this one fills */
+static int sr_capfile_put(struct sr_capfile* cf, const void* data, size_t n)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    size_t chunk;
+
+    while (n > 0) {
+        if (!cf->seg)
+        { return -1; }
+        if (cf->pos == SR_CAPFILE_SEG) {
+            if (cf->mapped) {
+                munmap(cf->seg, SR_CAPFILE_SEG);
+                cf->seg = 0;
+                cf->seg_off += SR_CAPFILE_SEG;
+                if (sr_capfile_map(cf) < 0)
+                { return -1; }
+            }
+            else if (sr_capfile_drain(cf) < 0)
+            { return -1; }
+        }
+        chunk = SR_CAPFILE_SEG - cf->pos;
+        if (chunk > n)
+        { chunk = n; }
+        memcpy(cf->seg + cf->pos, p, chunk);
+        cf->pos += chunk;
+        cf->size += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+    return 0;
+} /* -- sr_capfile_put -- */
+
+/* a pcapng option; value is padded to 4 bytes */
+static int sr_capfile_opt(struct sr_capfile* cf, uint16_t code,
+                          const void* val, uint16_t len)
+{
+    uint16_t h[2];
+
+    h[0] = code;
+    h[1] = len;
+    if (sr_capfile_put(cf, h, sizeof(h)) < 0 || sr_capfile_put(cf, val, len) < 0)
+    { return -1; }
+    return sr_capfile_put(cf, sr_capfile_zero, PAD4(len) - len);
+} /* -- sr_capfile_opt -- */
+
+static int sr_capfile_header(struct sr_capfile* cf)
+{
+    if (cf->format == SR_CAPFILE_PCAPNG) {
+        static const char appl[] = "sr";
+        uint32_t shb[6], len;
+        uint16_t version[2];
+        int64_t section = -1;           /* length not known */
+
+        len = sizeof(shb) + 4 + PAD4(sizeof(appl) - 1) + 4 + 4;
+        version[0] = 1;
+        version[1] = 0;
+        shb[0] = PCAPNG_SHB;
+        shb[1] = len;
+        shb[2] = PCAPNG_BOM;
+        memcpy(&shb[3], version, sizeof(version));
+        memcpy(&shb[4], &section, sizeof(section));
+        return sr_capfile_put(cf, shb, sizeof(shb)) ||
+               sr_capfile_opt(cf, PCAPNG_SHB_USERAPPL, appl, sizeof(appl) - 1) ||
+               sr_capfile_put(cf, sr_capfile_zero, 4) ||
+               sr_capfile_put(cf, &len, 4) ? -1 : 0;
+    }
+    else {
+        struct pcap_file_header hdr;
+
+        hdr.magic = TCPDUMP_MAGIC;
+        hdr.version_major = PCAP_VERSION_MAJOR;
+        hdr.version_minor = PCAP_VERSION_MINOR;
+        hdr.thiszone = 0;
+        hdr.sigfigs = 0;
+        hdr.snaplen = cf->snaplen;
+        hdr.linktype = LINKTYPE_ETHERNET;
+        return sr_capfile_put(cf, &hdr, sizeof(hdr));
+    }
+} /* -- sr_capfile_header -- */
+
+/* name of file number seq: path with _NNNN before the extension */
+static void sr_capfile_name(struct sr_capfile* cf)
+{
+    const char* dot = strrchr(cf->path, '.');
+    const char* slash = strrchr(cf->path, '/');
+    unsigned int n = cf->rotate.files ? cf->seq % cf->rotate.files : cf->seq;
+
+    if (!cf->rotate.bytes && !cf->rotate.secs) {
+        strcpy(cf->cur, cf->path);
+        return;
+    }
+    if (!dot || (slash && dot < slash))
+    { dot = cf->path + strlen(cf->path); }
+    snprintf(cf->cur, sizeof(cf->cur), "%.*s_%04u%s",
+             (int)(dot - cf->path), cf->path, n, dot);
+} /* -- sr_capfile_name -- */
+
+static int sr_capfile_start(struct sr_capfile* cf)
+{
+    struct stat st;
+
+    sr_capfile_name(cf);
+    cf->size = 0;
+    cf->opened = 0;
+    cf->nifs = 0;
+    cf->seg_off = 0;
+    cf->pos = 0;
+    cf->seg = 0;
+
+    if (strcmp(cf->cur, "-") == 0)
+    { cf->fd = STDOUT_FILENO; }
+    else if ((cf->fd = open(cf->cur, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                            0644)) < 0) {
+        fprintf(stderr, "capture: can't open %s: %s\n", cf->cur,
+                strerror(errno));
+        return -1;
+    }
+
+    cf->mapped = fstat(cf->fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (cf->mapped) {
+        if (sr_capfile_map(cf) < 0)
+        { return -1; }
+    }
+    else {
+        cf->seg = (uint8_t*)malloc(SR_CAPFILE_SEG);
+        assert(cf->seg);
+    }
+
+    return sr_capfile_header(cf);
+} /* -- sr_capfile_start -- */
+
+static void sr_capfile_end(struct sr_capfile* cf)
+{
+    if (cf->mapped) {
+        if (cf->seg)
+        { munmap(cf->seg, SR_CAPFILE_SEG); }
+        if (ftruncate(cf->fd, cf->size) < 0)
+        { perror("ftruncate(..):sr_capfile.c::sr_capfile_end(..)"); }
+    }
+    else if (cf->seg) {
+        sr_capfile_drain(cf);
+        free(cf->seg);
+    }
+    cf->seg = 0;
+    if (cf->fd != STDOUT_FILENO)
+    { close(cf->fd); }
+    cf->fd = -1;
+} /* -- sr_capfile_end -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capfile_open(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_capfile_open(struct sr_capfile* cf, const char* path,
+                    unsigned int snaplen,
+                    const struct sr_capfile_rotate* rotate)
+{
+    size_t n;
+
+    assert(cf);
+    assert(path);
+
+    memset(cf, 0, sizeof(*cf));
+    cf->fd = -1;
+    if ((n = strlen(path)) >= SR_CAPFILE_PATHLEN - 8) {
+        fprintf(stderr, "capture: file name too long\n");
+        return -1;
+    }
+    strcpy(cf->path, path);
+    cf->format = n > 7 && strcmp(path + n - 7, ".pcapng") == 0 ?
+                 SR_CAPFILE_PCAPNG : SR_CAPFILE_PCAP;
+    cf->snaplen = snaplen;
+    if (rotate && strcmp(path, "-") != 0)
+    { cf->rotate = *rotate; }
+
+    if (sr_capfile_start(cf) < 0) {
+        if (cf->fd >= 0)
+        { sr_capfile_end(cf); }
+        return -1;
+    }
+    return 0;
+} /* -- sr_capfile_open -- */
+
+/* ID of iface in this section, writing its IDB the first time */
+static int sr_capfile_ifid(struct sr_capfile* cf, const char* iface)
+{
+    uint32_t idb[4], tail[2];
+    uint16_t link[2];
+    uint8_t tsresol = 9;            /* 10^-9 s */
+    size_t nlen;
+    int i;
+
+    for (i = 0; i < cf->nifs; i++) {
+        if (strncmp(cf->ifs[i], iface, sr_IFACE_NAMELEN) == 0)
+        { return i; }
+    }
+    if (cf->nifs == SR_CAPFILE_MAX_IFS)
+    { return SR_CAPFILE_MAX_IFS - 1; }  /* out of IDs, lump the rest in */
+
+    strncpy(cf->ifs[cf->nifs], iface, sr_IFACE_NAMELEN - 1);
+    nlen = strlen(cf->ifs[cf->nifs]);
+
+    idb[0] = PCAPNG_IDB;
+    idb[1] = sizeof(idb) + 4 + PAD4(nlen) + 4 + 4 + 4 + sizeof(tail[1]);
+    link[0] = LINKTYPE_ETHERNET;
+    link[1] = 0;                    /* reserved */
+    memcpy(&idb[2], link, sizeof(link));
+    idb[3] = cf->snaplen;
+    tail[0] = 0;                    /* opt_endofopt */
+    tail[1] = idb[1];
+    if (sr_capfile_put(cf, idb, sizeof(idb)) < 0 ||
+        sr_capfile_opt(cf, PCAPNG_IF_NAME, cf->ifs[cf->nifs], nlen) < 0 ||
+        sr_capfile_opt(cf, PCAPNG_IF_TSRESOL, &tsresol, 1) < 0 ||
+        sr_capfile_put(cf, tail, sizeof(tail)) < 0)
+    { return -1; }
+    return cf->nifs++;
+} /* -- sr_capfile_ifid -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capfile_write(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capfile_write(struct sr_capfile* cf, uint64_t ts, const uint8_t* buf,
+                      unsigned int caplen, unsigned int len,
+                      const char* iface, int dir)
+{
+    unsigned int need;
+    int rc;
+
+    need = cf->format == SR_CAPFILE_PCAPNG ? 44 + PAD4(caplen) :
+           sizeof(struct pcap_sf_pkthdr) + caplen;
+
+    /* -- time for a new file? never for one without frames yet -- */
+    if (cf->opened &&
+        ((cf->rotate.bytes && cf->size + need > cf->rotate.bytes) ||
+         (cf->rotate.secs && ts - cf->opened >= cf->rotate.secs * SR_NSEC))) {
+        sr_capfile_end(cf);
+        cf->seq++;
+        if (sr_capfile_start(cf) < 0 && cf->fd >= 0)
+        { sr_capfile_end(cf); }
+    }
+    if (cf->fd < 0) {
+        cf->errors++;
+        return;
+    }
+    if (!cf->opened)
+    { cf->opened = ts; }
+
+    if (cf->format == SR_CAPFILE_PCAPNG) {
+        uint32_t epb[7], tail[2], flags;
+        int id = sr_capfile_ifid(cf, iface);
+
+        epb[0] = PCAPNG_EPB;
+        epb[1] = need;
+        epb[2] = id < 0 ? 0 : id;
+        epb[3] = (uint32_t)(ts >> 32);
+        epb[4] = (uint32_t)ts;
+        epb[5] = caplen;
+        epb[6] = len;
+        flags = dir == SR_CAP_OUT ? PCAPNG_FLAG_OUT : PCAPNG_FLAG_IN;
+        tail[0] = 0;
+        tail[1] = need;
+        rc = id < 0 ||
+             sr_capfile_put(cf, epb, sizeof(epb)) < 0 ||
+             sr_capfile_put(cf, buf, caplen) < 0 ||
+             sr_capfile_put(cf, sr_capfile_zero, PAD4(caplen) - caplen) < 0 ||
+             sr_capfile_opt(cf, PCAPNG_EPB_FLAGS, &flags, 4) < 0 ||
+             sr_capfile_put(cf, tail, sizeof(tail)) < 0;
+    }
+    else {
+        struct pcap_sf_pkthdr h;
+
+        h.ts.tv_sec = ts / SR_NSEC;
+        h.ts.tv_usec = (ts % SR_NSEC) / 1000;
+        h.caplen = caplen;
+        h.len = len;
+        rc = sr_capfile_put(cf, &h, sizeof(h)) < 0 ||
+             sr_capfile_put(cf, buf, caplen) < 0;
+    }
+
+    if (rc)
+    { cf->errors++; }
+    else
+    { cf->frames++; }
+} /* -- sr_capfile_write -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capfile_flush(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capfile_flush(struct sr_capfile* cf)
+{
+    if (cf->fd >= 0 && !cf->mapped && cf->seg)
+    { sr_capfile_drain(cf); }
+} /* -- sr_capfile_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capfile_close(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capfile_close(struct sr_capfile* cf)
+{
+    if (cf->fd >= 0)
+    { sr_capfile_end(cf); }
+} /* -- sr_capfile_close -- */
@@ -0,0 +1,100 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capfile.h
+ *
+ * Description:
+ *
+ * Capture file writer behind sr_capture's writer thread.  A file whose
+ * name ends in .pcapng is written as pcapng: a Section Header Block, an
+ * Interface Description Block for each router interface the first time a
+ * frame of it is written, and Enhanced Packet Blocks with nanosecond
+ * timestamps, the interface's ID and the direction in epb_flags.  Any
+ * other name gets classic microsecond pcap as before.
+ *
+ * Regular files are written through mmap'd segments: the file is extended
+ * a segment at a time (fallocate), the segment is mapped and records are
+ * copied into it, so writing a frame is a memcpy and the kernel writes the
+ * pages back on its own.  The file is cut to its real length when it is
+ * closed.  Pipes and stdout get the same segments as plain memory, written
+ * out whole.
+ *
+ * Files can rotate by size (-C) and/or age (-G).  Rotated files are named
+ * with a sequence number before the extension, cap_0000.pcapng,
+ * cap_0001.pcapng, ...; with a file limit the numbers wrap and the oldest
+ * file is overwritten, bounding the disk used.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPFILE_H
+#define SR_CAPFILE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+#include "sr_protocol.h"
+
+#define SR_CAPFILE_PCAP      0
+#define SR_CAPFILE_PCAPNG    1
+
+#define SR_CAPFILE_SEG       (4 << 20)   /* bytes mapped at a time */
+#define SR_CAPFILE_MAX_IFS   32          /* interface IDs per section */
+#define SR_CAPFILE_PATHLEN   256
+
+/* when to start a new file, 0 = never */
+struct sr_capfile_rotate
+{
+    uint64_t bytes;                 /* -C, file size */
+    unsigned int secs;              /* -G, file age */
+    unsigned int files;             /* keep at most this many, 0 = all */
+};
+
+struct sr_capfile
+{
+    char path[SR_CAPFILE_PATHLEN];  /* as given */
+    char cur[SR_CAPFILE_PATHLEN];   /* file being written */
+    int format;                     /* SR_CAPFILE_* */
+    unsigned int snaplen;
+    struct sr_capfile_rotate rotate;
+    unsigned int seq;               /* files opened so far */
+
+    int fd;
+    int mapped;                     /* regular file, seg is mmap'd */
+    uint8_t* seg;                   /* current segment */
+    uint64_t seg_off;               /* its offset in the file */
+    size_t pos;                     /* bytes used in it */
+    uint64_t size;                  /* bytes written to this file */
+    uint64_t opened;                /* timestamp of its first frame, ns */
+
+    char ifs[SR_CAPFILE_MAX_IFS][sr_IFACE_NAMELEN]; /* IDBs written */
+    int nifs;
+
+    uint64_t frames;
+    uint64_t errors;                /* frames lost to write errors */
+};
+
+/* Open path ("-" for stdout) keeping up to snaplen bytes per frame, rotating
+   as rotate says (0 for never).  0 on success. */
+int  sr_capfile_open(struct sr_capfile* cf, const char* path,
+                     unsigned int snaplen,
+                     const struct sr_capfile_rotate* rotate);
+
+/* Append a frame taken at ts (CLOCK_REALTIME ns) on iface, dir SR_CAP_IN
+   or SR_CAP_OUT; buf holds caplen of its len bytes. */
+void sr_capfile_write(struct sr_capfile* cf, uint64_t ts, const uint8_t* buf,
+                      unsigned int caplen, unsigned int len,
+                      const char* iface, int dir);
+
+/* Make what was written visible to readers of a pipe; a no-op for mapped
+   files, whose pages are already in the page cache. */
+void sr_capfile_flush(struct sr_capfile* cf);
+
+/* Trim and close the current file. */
+void sr_capfile_close(struct sr_capfile* cf);
+
+#endif /* -- SR_CAPFILE_H -- */
@@ -0,0 +1,459 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capfilter.c
+ *
+ * Description:
+ *
+ * Capture filter compiler and matcher, see sr_capfilter.h.
+ *
+ * The expression is parsed by recursive descent into a small tree, which
+ * is then compiled back to front: and(a, b) compiles b first and sends a's
+ * true branch to it, or(a, b) sends a's false branch there, and not swaps
+ * the targets.  No test is ever compiled twice.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+
+#include "sr_capfilter.h"
+
+/* tests */
+#define SR_CF_OP_DIR    1
+#define SR_CF_OP_IFACE  2
+#define SR_CF_OP_ETHER  3
+#define SR_CF_OP_PROTO  4
+#define SR_CF_OP_SRC    5           /* (ip_src & mask) == k */
+#define SR_CF_OP_DST    6
+#define SR_CF_OP_SPORT  7
+#define SR_CF_OP_DPORT  8
+
+#define SR_CF_LEAF      0
+#define SR_CF_AND       1
+#define SR_CF_OR        2
+#define SR_CF_NOT       3
+
+#define SR_CF_MAX_NODES (2 * SR_CF_MAX_INSNS)
+#define SR_CF_TOKLEN    64
+
+struct sr_cf_node
+{
+    int type;
+    struct sr_cf_insn test;         /* SR_CF_LEAF */
+    struct sr_cf_node* l;
+    struct sr_cf_node* r;
+};
+
+struct sr_cf_parse
+{
+    const char* expr;
+    const char* p;                  /* after the current token */
+    char tok[SR_CF_TOKLEN];         /* current token, "" at the end */
+    struct sr_cf_node nodes[SR_CF_MAX_NODES];
+    int nnodes;
+    int error;
+    struct sr_capfilter* f;
+};
+
+static struct sr_cf_node* sr_cf_expr(struct sr_cf_parse* ps);
+
+static void sr_cf_error(struct sr_cf_parse* ps, const char* what)
+{
+    if (!ps->error) {
+        fprintf(stderr, "capture filter \"%s\": %s%s%s\n", ps->expr, what,
+                ps->tok[0] ? " at " : "", ps->tok);
+    }
+    ps->error = 1;
+} /* -- sr_cf_error -- */
+
+/* advance to the next token: a parenthesis, ! or a run of other
+   non-blank characters */
+static void sr_cf_next(struct sr_cf_parse* ps)
+{
+    const char* s = ps->p;
+    int n = 0;
+
+    while (isspace((unsigned char)*s))
+    { s++; }
+    if (*s == '(' || *s == ')' || *s == '!') {
+        ps->tok[n++] = *s++;
+    }
+    else {
+        while (*s && !isspace((unsigned char)*s) && *s != '(' && *s != ')') {
+            if (n < SR_CF_TOKLEN - 1)
+            { ps->tok[n++] = *s; }
+            s++;
+        }
+    }
+    ps->tok[n] = '\0';
+    ps->p = s;
+} /* -- sr_cf_next -- */
+
+static int sr_cf_is(struct sr_cf_parse* ps, const char* a, const char* b)
+{
+    return strcmp(ps->tok, a) == 0 || (b && strcmp(ps->tok, b) == 0);
+} /* -- sr_cf_is -- */
+
+static struct sr_cf_node* sr_cf_node(struct sr_cf_parse* ps, int type,
+                                     struct sr_cf_node* l, struct sr_cf_node* r)
+{
+    struct sr_cf_node* n;
+
+    if (ps->nnodes == SR_CF_MAX_NODES) {
+        sr_cf_error(ps, "expression too long");
+        return 0;
+    }
+    n = &ps->nodes[ps->nnodes++];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->l = l;
+    n->r = r;
+    return n;
+} /* -- sr_cf_node -- */
+
+static struct sr_cf_node* sr_cf_leaf(struct sr_cf_parse* ps, int op,
+                                     uint32_t k, uint32_t mask)
+{
+    struct sr_cf_node* n = sr_cf_node(ps, SR_CF_LEAF, 0, 0);
+
+    if (n) {
+        n->test.op = op;
+        n->test.k = k;
+        n->test.mask = mask;
+    }
+    return n;
+} /* -- sr_cf_leaf -- */
+
+/* number in the current token, decimal or 0x hex */
+static int sr_cf_number(struct sr_cf_parse* ps, unsigned long max,
+                        uint32_t* out)
+{
+    char* end;
+    unsigned long v;
+
+    if (!ps->tok[0]) {
+        sr_cf_error(ps, "number expected");
+        return -1;
+    }
+    v = strtoul(ps->tok, &end, 0);
+    if (*end || v > max) {
+        sr_cf_error(ps, "bad number");
+        return -1;
+    }
+    *out = (uint32_t)v;
+    sr_cf_next(ps);
+    return 0;
+} /* -- sr_cf_number -- */
+
+/* A.B.C.D, or A.B.C.D/LEN if prefix is set; network order */
+static int sr_cf_address(struct sr_cf_parse* ps, int prefix, uint32_t* addr,
+                         uint32_t* mask)
+{
+    char buf[SR_CF_TOKLEN];
+    char* slash;
+    struct in_addr in;
+    unsigned long bits = 32;
+
+    strcpy(buf, ps->tok);
+    if ((slash = strchr(buf, '/')) != 0) {
+        char* end;
+        *slash++ = '\0';
+        bits = strtoul(slash, &end, 10);
+        if (!prefix || *end || !*slash || bits > 32) {
+            sr_cf_error(ps, "bad prefix length");
+            return -1;
+        }
+    }
+    else if (prefix) {
+        sr_cf_error(ps, "A.B.C.D/LEN expected");
+        return -1;
+    }
+    if (inet_aton(buf, &in) == 0) {
+        sr_cf_error(ps, "bad address");
+        return -1;
+    }
+    *mask = bits ? htonl(0xffffffffUL << (32 - bits)) : 0;
+    *addr = in.s_addr & *mask;
+    sr_cf_next(ps);
+    return 0;
+} /* -- sr_cf_address -- */
+
+/* host, net or port with an optional src/dst in front */
+static struct sr_cf_node* sr_cf_endpoint(struct sr_cf_parse* ps, int src,
+                                         int dst)
+{
+    uint32_t k = 0, mask = 0;
+    int sop, dop;
+
+    if (sr_cf_is(ps, "host", 0) || sr_cf_is(ps, "net", 0)) {
+        int prefix = sr_cf_is(ps, "net", 0);
+        sr_cf_next(ps);
+        if (sr_cf_address(ps, prefix, &k, &mask) < 0)
+        { return 0; }
+        sop = SR_CF_OP_SRC;
+        dop = SR_CF_OP_DST;
+    }
+    else if (sr_cf_is(ps, "port", 0)) {
+        sr_cf_next(ps);
+        if (sr_cf_number(ps, 0xffff, &k) < 0)
+        { return 0; }
+        sop = SR_CF_OP_SPORT;
+        dop = SR_CF_OP_DPORT;
+    }
+    else {
+        sr_cf_error(ps, "host, net or port expected");
+        return 0;
+    }
+
+    if (src)
+    { return sr_cf_leaf(ps, sop, k, mask); }
+    if (dst)
+    { return sr_cf_leaf(ps, dop, k, mask); }
+    return sr_cf_node(ps, SR_CF_OR, sr_cf_leaf(ps, sop, k, mask),
+                      sr_cf_leaf(ps, dop, k, mask));
+} /* -- sr_cf_endpoint -- */
+
+static struct sr_cf_node* sr_cf_primitive(struct sr_cf_parse* ps)
+{
+    struct sr_cf_node* n;
+    uint32_t k;
+
+    if (sr_cf_is(ps, "not", "!")) {
+        sr_cf_next(ps);
+        if (!(n = sr_cf_primitive(ps)))
+        { return 0; }
+        return sr_cf_node(ps, SR_CF_NOT, n, 0);
+    }
+    if (sr_cf_is(ps, "(", 0)) {
+        sr_cf_next(ps);
+        if (!(n = sr_cf_expr(ps)))
+        { return 0; }
+        if (!sr_cf_is(ps, ")", 0)) {
+            sr_cf_error(ps, "missing )");
+            return 0;
+        }
+        sr_cf_next(ps);
+        return n;
+    }
+
+    if (sr_cf_is(ps, "in", "out")) {
+        k = sr_cf_is(ps, "out", 0) ? SR_CAP_OUT : SR_CAP_IN;
+        sr_cf_next(ps);
+        return sr_cf_leaf(ps, SR_CF_OP_DIR, k, 0);
+    }
+    if (sr_cf_is(ps, "iface", 0)) {
+        sr_cf_next(ps);
+        if (!ps->tok[0] || strlen(ps->tok) >= sr_IFACE_NAMELEN) {
+            sr_cf_error(ps, "interface name expected");
+            return 0;
+        }
+        if ((n = sr_cf_leaf(ps, SR_CF_OP_IFACE, 0, 0)) != 0)
+        { strcpy(n->test.name, ps->tok); }
+        sr_cf_next(ps);
+        return n;
+    }
+    if (sr_cf_is(ps, "arp", "ip")) {
+        k = sr_cf_is(ps, "arp", 0) ? ethertype_arp : ethertype_ip;
+        sr_cf_next(ps);
+        return sr_cf_leaf(ps, SR_CF_OP_ETHER, k, 0);
+    }
+    if (sr_cf_is(ps, "ether", 0)) {
+        sr_cf_next(ps);
+        if (sr_cf_number(ps, 0xffff, &k) < 0)
+        { return 0; }
+        return sr_cf_leaf(ps, SR_CF_OP_ETHER, k, 0);
+    }
+    if (sr_cf_is(ps, "proto", 0)) {
+        sr_cf_next(ps);
+        if (!sr_cf_is(ps, "icmp", "tcp") && !sr_cf_is(ps, "udp", 0)) {
+            if (sr_cf_number(ps, 0xff, &k) < 0)
+            { return 0; }
+            return sr_cf_leaf(ps, SR_CF_OP_PROTO, k, 0);
+        }
+    }
+    if (sr_cf_is(ps, "icmp", "tcp") || sr_cf_is(ps, "udp", 0)) {
+        k = sr_cf_is(ps, "icmp", 0) ? ip_protocol_icmp :
+            sr_cf_is(ps, "tcp", 0) ? 6 : 17;
+        sr_cf_next(ps);
+        return sr_cf_leaf(ps, SR_CF_OP_PROTO, k, 0);
+    }
+    if (sr_cf_is(ps, "src", "dst")) {
+        int src = sr_cf_is(ps, "src", 0);
+        sr_cf_next(ps);
+        return sr_cf_endpoint(ps, src, !src);
+    }
+    if (sr_cf_is(ps, "host", "net") || sr_cf_is(ps, "port", 0))
+    { return sr_cf_endpoint(ps, 0, 0); }
+
+    sr_cf_error(ps, ps->tok[0] ? "unknown primitive" : "unexpected end");
+    return 0;
+} /* -- sr_cf_primitive -- */
+
+static struct sr_cf_node* sr_cf_term(struct sr_cf_parse* ps)
+{
+    struct sr_cf_node* n = sr_cf_primitive(ps);
+
+    while (n && sr_cf_is(ps, "and", "&&")) {
+        sr_cf_next(ps);
+        n = sr_cf_node(ps, SR_CF_AND, n, sr_cf_primitive(ps));
+        if (n && !n->r)
+        { return 0; }
+    }
+    return n;
+} /* -- sr_cf_term -- */
+
+static struct sr_cf_node* sr_cf_expr(struct sr_cf_parse* ps)
+{
+    struct sr_cf_node* n = sr_cf_term(ps);
+
+    while (n && sr_cf_is(ps, "or", "||")) {
+        sr_cf_next(ps);
+        n = sr_cf_node(ps, SR_CF_OR, n, sr_cf_term(ps));
+        if (n && !n->r)
+        { return 0; }
+    }
+    return n;
+} /* -- sr_cf_expr -- */
+
+/* compile n so that it continues at t when true and f when false,
+   returns its first insn */
+static int sr_cf_gen(struct sr_cf_parse* ps, struct sr_cf_node* n, int t, int f)
+{
+    struct sr_cf_insn* i;
+
+    if (ps->error)
+    { return SR_CF_REJECT; }
+
+    switch (n->type) {
+        case SR_CF_AND:
+            return sr_cf_gen(ps, n->l, sr_cf_gen(ps, n->r, t, f), f);
+        case SR_CF_OR:
+            return sr_cf_gen(ps, n->l, t, sr_cf_gen(ps, n->r, t, f));
+        case SR_CF_NOT:
+            return sr_cf_gen(ps, n->l, f, t);
+    }
+
+    if (ps->f->ninsns == SR_CF_MAX_INSNS) {
+        sr_cf_error(ps, "expression too long");
+        return SR_CF_REJECT;
+    }
+    i = &ps->f->insn[ps->f->ninsns];
+    *i = n->test;
+    i->jt = t;
+    i->jf = f;
+    return ps->f->ninsns++;
+} /* -- sr_cf_gen -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capfilter_compile(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_capfilter_compile(struct sr_capfilter* f, const char* expr)
+{
+    struct sr_cf_parse* ps;
+    struct sr_cf_node* root;
+    int rc = 0;
+
+    assert(f);
+    assert(expr);
+
+    memset(f, 0, sizeof(*f));
+    f->entry = SR_CF_ACCEPT;
+
+    ps = (struct sr_cf_parse*)calloc(1, sizeof(struct sr_cf_parse));
+    assert(ps);
+    ps->expr = ps->p = expr;
+    ps->f = f;
+
+    sr_cf_next(ps);
+    if (ps->tok[0]) {
+        root = sr_cf_expr(ps);
+        if (root && ps->tok[0])
+        { sr_cf_error(ps, "unexpected"); }
+        if (!ps->error)
+        { f->entry = sr_cf_gen(ps, root, SR_CF_ACCEPT, SR_CF_REJECT); }
+        if (ps->error) {
+            f->entry = SR_CF_REJECT;
+            rc = -1;
+        }
+    }
+
+    free(ps);
+    return rc;
+} /* -- sr_capfilter_compile -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capfilter_match(..)
+ * Scope:  Global
+ *
+ * Pull the fields any test may look at out of the headers once, then
+ * walk the program.  Tests on IP fields fail for frames without them.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_capfilter_match(const struct sr_capfilter* f, const uint8_t* buf,
+                       unsigned int len, const char* iface, int dir)
+{
+    const struct sr_cf_insn* i;
+    const sr_ip_hdr_t* ip = 0;
+    const uint8_t* l4;
+    uint32_t ether = 0, sport = 0, dport = 0;
+    int has_ports = 0, pc, r;
+
+    if ((pc = f->entry) == SR_CF_ACCEPT)
+    { return 1; }
+
+    if (len >= sizeof(sr_ethernet_hdr_t)) {
+        ether = ntohs(((const sr_ethernet_hdr_t*)buf)->ether_type);
+        if (ether == ethertype_ip &&
+            len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)) {
+            ip = (const sr_ip_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+            l4 = (const uint8_t*)ip + ip->ip_hl * 4;
+            if ((ip->ip_p == 6 || ip->ip_p == 17) && ip->ip_hl >= 5 &&
+                (ntohs(ip->ip_off) & IP_OFFMASK) == 0 && l4 + 4 <= buf + len) {
+                sport = (l4[0] << 8) | l4[1];
+                dport = (l4[2] << 8) | l4[3];
+                has_ports = 1;
+            }
+        }
+    }
+
+    while (pc >= 0) {
+        i = &f->insn[pc];
+        switch (i->op) {
+            case SR_CF_OP_DIR:
+                r = (uint32_t)dir == i->k;
+                break;
+            case SR_CF_OP_IFACE:
+                r = iface && strncmp(iface, i->name, sr_IFACE_NAMELEN) == 0;
+                break;
+            case SR_CF_OP_ETHER:
+                r = ether == i->k;
+                break;
+            case SR_CF_OP_PROTO:
+                r = ip && ip->ip_p == i->k;
+                break;
+            case SR_CF_OP_SRC:
+                r = ip && (ip->ip_src & i->mask) == i->k;
+                break;
+            case SR_CF_OP_DST:
+                r = ip && (ip->ip_dst & i->mask) == i->k;
+                break;
+            case SR_CF_OP_SPORT:
+                r = has_ports && sport == i->k;
+                break;
+            case SR_CF_OP_DPORT:
+                r = has_ports && dport == i->k;
+                break;
+            default:
+                r = 0;
+        }
+        pc = r ? i->jt : i->jf;
+    }
+    return pc == SR_CF_ACCEPT;
+} /* -- sr_capfilter_match -- */
@@ -0,0 +1,79 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capfilter.h
+ *
+ * Description:
+ *
+ * Capture filters (-F).  An expression such as
+ *
+ *     in and iface eth1 and udp and (src net 10.0.1.0/24 or dst port 53)
+ *
+ * is parsed once at startup and compiled into a short program of tests,
+ * each with a jump for true and one for false, in the manner of BPF.
+ * Tests only jump to ones compiled before them, so there are no loops and a
+ * match runs at most one test per primitive; frames that fail early cost a
+ * compare or two.
+ *
+ * Primitives:
+ *
+ *     in | out                     direction of the frame
+ *     iface NAME                   interface it arrived on or leaves by
+ *     arp | ip | ether TYPE        ethertype
+ *     icmp | tcp | udp | proto N   IP protocol
+ *     [src|dst] host A.B.C.D       IP address, either end if neither given
+ *     [src|dst] net A.B.C.D/LEN    IP prefix
+ *     [src|dst] port N             TCP or UDP port, first fragment only
+ *
+ * combined with not (!), and (&&), or (||) and parentheses; and binds
+ * tighter than or.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPFILTER_H
+#define SR_CAPFILTER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+
+#define SR_CF_MAX_INSNS  64
+
+/* directions */
+#define SR_CAP_IN        0
+#define SR_CAP_OUT       1
+
+/* jump targets past the end of the program */
+#define SR_CF_ACCEPT     (-1)
+#define SR_CF_REJECT     (-2)
+
+/* one compiled test */
+struct sr_cf_insn
+{
+    uint8_t op;                     /* SR_CF_OP_* in sr_capfilter.c */
+    int16_t jt, jf;                 /* next insn, or SR_CF_ACCEPT/REJECT */
+    uint32_t k;                     /* value compared against */
+    uint32_t mask;                  /* for prefixes, network order */
+    char name[sr_IFACE_NAMELEN];    /* for iface */
+};
+
+struct sr_capfilter
+{
+    int entry;                      /* first insn, SR_CF_ACCEPT if empty */
+    int ninsns;
+    struct sr_cf_insn insn[SR_CF_MAX_INSNS];
+};
+
+/* Compile expr into f.  0 on success, otherwise -1 with the reason on
+   stderr. */
+int sr_capfilter_compile(struct sr_capfilter* f, const char* expr);
+
+/* Does the frame match?  dir is SR_CAP_IN or SR_CAP_OUT. */
+int sr_capfilter_match(const struct sr_capfilter* f, const uint8_t* buf,
+                       unsigned int len, const char* iface, int dir);
+
+#endif /* -- SR_CAPFILTER_H -- */
@@ -0,0 +1,267 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.c
+ *
+ * Description:
+ *
+ * Asynchronous pcap capture, see sr_capture.h.
+ *
+ * The ring is the bounded multi-producer queue of D. Vyukov: every slot
+ * carries the ring position it is next ready for, so a producer claims a
+ * position with one compare-and-swap on tail and publishes the record by
+ * advancing its slot's sequence.  The single writer reads slots in order
+ * and hands each back one lap ahead.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sr_capture.h"
+#include "sr_bufpool.h"
+
+#define SR_NSEC 1000000000ULL
+
+/* matches seen by this thread, for sampling */
+static __thread unsigned long sr_capture_seen = 0;
+
+static void* sr_capture_thread(void* arg);
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_open(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_capture* sr_capture_open(const char* fname, unsigned int snaplen,
+                                   const char* filter, unsigned int sample,
+                                   const struct sr_capfile_rotate* rotate)
+{
+    struct sr_capture* cap;
+    uint32_t i;
+
+    assert(fname);
+
+    cap = (struct sr_capture*)calloc(1, sizeof(struct sr_capture));
+    assert(cap);
+
+    if (sr_capfilter_compile(&cap->filter, filter ? filter : "") != 0) {
+        free(cap);
+        return 0;
+    }
+    cap->sample = sample ? sample : 1;
+
+    if (sr_capfile_open(&cap->file, fname, snaplen, rotate) != 0) {
+        free(cap);
+        return 0;
+    }
+    cap->snaplen = snaplen;
+
+    for (i = 0; i < SR_CAPTURE_RING_SZ; i++)
+    { cap->ring[i].seq = i; }
+
+    pthread_mutex_init(&cap->lock, NULL);
+    pthread_cond_init(&cap->cond, NULL);
+    cap->running = 1;
+
+    if (pthread_create(&cap->thread, NULL, sr_capture_thread, cap) != 0) {
+        perror("pthread_create(..):sr_capture.c::sr_capture_open(..)");
+        pthread_cond_destroy(&cap->cond);
+        pthread_mutex_destroy(&cap->lock);
+        sr_capfile_close(&cap->file);
+        free(cap);
+        return 0;
+    }
+
+    return cap;
+} /* -- sr_capture_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_packet(..)
+ * Scope:  Global
+ *
+ * Runs on every thread that receives or sends.  Frames the filter or the
+ * sampling leave out cost only the test.  Otherwise claims a slot, fills it
+ * and publishes it; wakes the writer only when the ring is half full and
+ * it is asleep.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf /* lent */,
+                       unsigned int len, const char* iface, int dir)
+{
+    struct sr_capture_rec* rec;
+    struct timespec ts;
+    unsigned int caplen = len < cap->snaplen ? len : cap->snaplen;
+    uint8_t* copy;
+    uint32_t pos, seq;
+
+    if (!sr_capfilter_match(&cap->filter, buf, len, iface, dir))
+    { return; }
+    if (cap->sample > 1 && sr_capture_seen++ % cap->sample != 0)
+    { return; }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    if ((copy = (uint8_t*)sr_buf_alloc(caplen ? caplen : 1)) == 0) {
+        __atomic_fetch_add(&cap->no_buf, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    memcpy(copy, buf, caplen);
+
+    pos = __atomic_load_n(&cap->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        rec = &cap->ring[pos & SR_CAPTURE_RING_MASK];
+        seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&cap->tail, &pos, pos + 1, 0,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            { break; }
+        }
+        else if ((int32_t)(seq - pos) < 0) {
+            /* -- a lap behind: the writer hasn't freed this slot yet -- */
+            __atomic_fetch_add(&cap->ring_full, 1, __ATOMIC_RELAXED);
+            sr_buf_free(copy);
+            return;
+        }
+        else
+        { pos = __atomic_load_n(&cap->tail, __ATOMIC_RELAXED); }
+    }
+
+    rec->len = len;
+    rec->caplen = caplen;
+    rec->ts = (uint64_t)ts.tv_sec * SR_NSEC + ts.tv_nsec;
+    rec->buf = copy;
+    rec->dir = dir;
+    strncpy(rec->iface, iface ? iface : "", sr_IFACE_NAMELEN - 1);
+    rec->iface[sr_IFACE_NAMELEN - 1] = '\0';
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (pos + 1 - __atomic_load_n(&cap->head, __ATOMIC_RELAXED) >=
+        SR_CAPTURE_RING_SZ / 2 &&
+        __atomic_load_n(&cap->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&cap->lock);
+        if (cap->sleeping) {
+            cap->sleeping = 0;
+            cap->wakeups++;
+            pthread_cond_signal(&cap->cond);
+        }
+        pthread_mutex_unlock(&cap->lock);
+    }
+} /* -- sr_capture_packet -- */
+
+/* write out every published record, returns how many */
+static unsigned int sr_capture_drain(struct sr_capture* cap)
+{
+    struct sr_capture_rec* rec;
+    uint32_t head = cap->head;
+    unsigned int n = 0;
+
+    for (;;) {
+        rec = &cap->ring[head & SR_CAPTURE_RING_MASK];
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != head + 1)
+        { break; }
+
+        sr_capfile_write(&cap->file, rec->ts, rec->buf, rec->caplen, rec->len,
+                         rec->iface, rec->dir);
+        sr_buf_free(rec->buf);
+        cap->bytes += rec->caplen;
+
+        __atomic_store_n(&rec->seq, head + SR_CAPTURE_RING_SZ, __ATOMIC_RELEASE);
+        head++;
+        __atomic_store_n(&cap->head, head, __ATOMIC_RELEASE);
+        n++;
+    }
+    return n;
+} /* -- sr_capture_drain -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_thread(..)
+ * Scope:  Local
+ *
+ * Drain, flush, sleep up to SR_CAPTURE_FLUSH_MS.  Only a pipe needs the
+ * flush; it is done once a drain round is over, so under load a pipe is
+ * written a whole segment at a time.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_capture_thread(void* arg)
+{
+    struct sr_capture* cap = (struct sr_capture*)arg;
+    struct timespec ts;
+    int dirty = 0;
+
+    for (;;) {
+        if (sr_capture_drain(cap))
+        { dirty = 1; }
+
+        pthread_mutex_lock(&cap->lock);
+        if (!cap->running) {
+            pthread_mutex_unlock(&cap->lock);
+            break;
+        }
+        pthread_mutex_unlock(&cap->lock);
+
+        if (dirty) {
+            sr_capfile_flush(&cap->file);
+            dirty = 0;
+        }
+
+        pthread_mutex_lock(&cap->lock);
+        __atomic_store_n(&cap->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (cap->running &&
+            __atomic_load_n(&cap->tail, __ATOMIC_SEQ_CST) - cap->head <
+            SR_CAPTURE_RING_SZ / 2) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += SR_CAPTURE_FLUSH_MS * 1000000L;
+            if (ts.tv_nsec >= (long)SR_NSEC) {
+                ts.tv_sec++;
+                ts.tv_nsec -= SR_NSEC;
+            }
+            pthread_cond_timedwait(&cap->cond, &cap->lock, &ts);
+        }
+        cap->sleeping = 0;
+        pthread_mutex_unlock(&cap->lock);
+    }
+
+    /* -- producers are gone; whatever they published is written -- */
+    sr_capture_drain(cap);
+    sr_capfile_flush(&cap->file);
+    return 0;
+} /* -- sr_capture_thread -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_close(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_close(struct sr_capture* cap)
+{
+    if (!cap)
+    { return; }
+
+    pthread_mutex_lock(&cap->lock);
+    cap->running = 0;
+    pthread_cond_signal(&cap->cond);
+    pthread_mutex_unlock(&cap->lock);
+    pthread_join(cap->thread, NULL);
+
+    sr_capfile_close(&cap->file);
+
+    fprintf(stderr, "capture: %llu frames (%llu bytes) written to %u file(s), "
+            "%llu dropped ring full, %llu dropped no buffer, %llu lost to "
+            "write errors, writer woken %llu times\n",
+            (unsigned long long)cap->file.frames,
+            (unsigned long long)cap->bytes, cap->file.seq + 1,
+            (unsigned long long)cap->ring_full,
+            (unsigned long long)cap->no_buf,
+            (unsigned long long)cap->file.errors,
+            (unsigned long long)cap->wakeups);
+
+    pthread_cond_destroy(&cap->cond);
+    pthread_mutex_destroy(&cap->lock);
+    free(cap);
+} /* -- sr_capture_close -- */
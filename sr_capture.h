@@ -0,0 +1,95 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.h
+ *
+ * Description:
+ *
+ * Packet capture (-l) off the forwarding path.  Whichever thread sees a
+ * frame first runs it through the capture filter (-F, sr_capfilter.h) and
+ * 1-in-N sampling (-n).  A frame that is kept is stamped, up to snaplen
+ * (-L) bytes of it are copied into a pool buffer and a (timestamp, length,
+ * buffer) record goes on a bounded lock-free ring; that is all the thread
+ * pays.  A writer thread drains the ring into the capture file
+ * (sr_capfile.h), so the file sees a few big writes instead of two small
+ * writes and a flush per frame.  The writer wakes on a timer, or early once
+ * the ring is half full, so producers never make a system call under light
+ * load.
+ *
+ * If the writer falls behind the ring fills and further frames are left
+ * out of the capture and counted, rather than forwarding slowing down to
+ * the speed of the disk.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPTURE_H
+#define SR_CAPTURE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#include "sr_capfilter.h"
+#include "sr_capfile.h"
+
+#define SR_CAPTURE_RING_SZ   8192          /* records, power of two */
+#define SR_CAPTURE_RING_MASK (SR_CAPTURE_RING_SZ - 1)
+#define SR_CAPTURE_FLUSH_MS  10            /* longest a record waits */
+
+/* one captured frame, a slot of the ring */
+struct sr_capture_rec
+{
+    uint32_t seq;                   /* ring position this slot is ready for */
+    uint32_t len;                   /* length on the wire */
+    uint32_t caplen;                /* bytes in buf */
+    uint64_t ts;                    /* CLOCK_REALTIME ns */
+    uint8_t* buf;                   /* from sr_buf_alloc, owned by the ring */
+    int dir;                        /* SR_CAP_IN or SR_CAP_OUT */
+    char iface[sr_IFACE_NAMELEN];
+};
+
+struct sr_capture
+{
+    struct sr_capfile file;         /* the writer's alone */
+    unsigned int snaplen;           /* bytes kept of each frame */
+    unsigned int sample;            /* keep 1 in this many matches */
+    struct sr_capfilter filter;
+
+    /* -- ring, any number of producers, the writer consumes -- */
+    struct sr_capture_rec ring[SR_CAPTURE_RING_SZ];
+    uint32_t tail;                  /* next position to claim */
+    uint32_t head;                  /* next position the writer reads */
+
+    pthread_mutex_t lock;           /* only for sleeping and waking */
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+    int sleeping;                   /* the writer is waiting on cond */
+
+    uint64_t bytes;                 /* captured bytes written */
+    uint64_t ring_full;             /* dropped, writer behind */
+    uint64_t no_buf;                /* dropped, buffer pool empty */
+    uint64_t wakeups;               /* producers had to wake the writer */
+};
+
+/* Open fname ("-" for stdout) as a capture file, rotated as rotate says (0
+   for never), capturing up to snaplen bytes of one in every sample frames
+   that match filter (0 for all) and start its writer.  0 on failure,
+   including a filter that doesn't compile. */
+struct sr_capture* sr_capture_open(const char* fname, unsigned int snaplen,
+                                   const char* filter, unsigned int sample,
+                                   const struct sr_capfile_rotate* rotate);
+
+/* Queue a frame seen on iface in direction dir (SR_CAP_IN, SR_CAP_OUT) for
+   the file if it is to be kept; never blocks.  buf is copied. */
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf /* lent */,
+                       unsigned int len, const char* iface, int dir);
+
+/* Write out what is queued, print the counters and close the file. */
+void sr_capture_close(struct sr_capture* cap);
+
+#endif /* -- SR_CAPTURE_H -- */
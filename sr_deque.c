@@ -0,0 +1,88 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_deque.c
+ *
+ * Description:
+ *
+ * Chase-Lev work-stealing deque, see sr_deque.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <assert.h>
+
+#include "sr_deque.h"
+
+#define SR_DEQUE_MASK (SR_DEQUE_SZ - 1)
+
+void sr_deque_init(struct sr_deque* q)
+{
+    assert(q);
+    memset(q, 0, sizeof(struct sr_deque));
+} /* -- sr_deque_init -- */
+
+int sr_deque_push(struct sr_deque* q, void* item)
+{
+    int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+
+    if (b - t >= SR_DEQUE_SZ)
+    { return -1; }
+
+    __atomic_store_n(&q->slots[b & SR_DEQUE_MASK], item, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+} /* -- sr_deque_push -- */
+
+void* sr_deque_take(struct sr_deque* q)
+{
+    int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+    int64_t t;
+    void* item;
+
+    __atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        /* empty, restore */
+        __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+        return SR_DEQUE_EMPTY;
+    }
+
+    item = __atomic_load_n(&q->slots[b & SR_DEQUE_MASK], __ATOMIC_RELAXED);
+    if (t == b) {
+        /* last item, race the thieves for it */
+        if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        { item = SR_DEQUE_EMPTY; }
+        __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return item;
+} /* -- sr_deque_take -- */
+
+void* sr_deque_steal(struct sr_deque* q)
+{
+    int64_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+    int64_t b;
+    void* item;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+
+    if (t >= b)
+    { return SR_DEQUE_EMPTY; }
+
+    item = __atomic_load_n(&q->slots[t & SR_DEQUE_MASK], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    { return SR_DEQUE_ABORT; }
+    return item;
+} /* -- sr_deque_steal -- */
+
+int sr_deque_size(struct sr_deque* q)
+{
+    int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+    return b > t ? (int)(b - t) : 0;
+} /* -- sr_deque_size -- */
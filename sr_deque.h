@@ -0,0 +1,53 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_deque.h
+ *
+ * Description:
+ *
+ * Fixed-capacity Chase-Lev work-stealing deque.  The owning worker pushes
+ * and takes at the bottom (LIFO, cache warm); any other worker may steal
+ * from the top (FIFO).  Only work that does not care about ordering goes
+ * through here; in-order forwarding stays on the per-worker rx ring.
+ *
+ * Memory ordering follows Le, Pop, Cohen and Zappa Nardelli, "Correct and
+ * Efficient Work-Stealing for Weak Memory Models" (PPoPP '13).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_DEQUE_H
+#define SR_DEQUE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_DEQUE_SZ 256            /* slots, power of 2 */
+
+#define SR_DEQUE_EMPTY ((void*)0)
+#define SR_DEQUE_ABORT ((void*)1)  /* lost a race, caller may retry */
+
+struct sr_deque
+{
+    int64_t top __attribute__ ((aligned (64)));    /* thieves */
+    int64_t bottom __attribute__ ((aligned (64))); /* owner */
+    void* slots[SR_DEQUE_SZ];
+};
+
+void  sr_deque_init(struct sr_deque* q);
+
+/* Owner only.  Returns 0, or -1 if the deque is full. */
+int   sr_deque_push(struct sr_deque* q, void* item);
+
+/* Owner only.  Returns the newest item or SR_DEQUE_EMPTY. */
+void* sr_deque_take(struct sr_deque* q);
+
+/* Any thread.  Returns the oldest item, SR_DEQUE_EMPTY or SR_DEQUE_ABORT. */
+void* sr_deque_steal(struct sr_deque* q);
+
+/* Approximate number of queued items. */
+int   sr_deque_size(struct sr_deque* q);
+
+#endif /* -- SR_DEQUE_H -- */
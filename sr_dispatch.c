@@ -0,0 +1,738 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_dispatch.c
+ *
+ * Description:
+ *
+ * Flow-affine dispatch of received frames to forwarding workers.  See
+ * sr_dispatch.h for the big picture.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "sr_dispatch.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_bufpool.h"
+#include "sr_stats.h"
+
+#define SR_RING_MASK   (SR_WORKER_RING_SZ - 1)
+#define SR_RETA_MASK   (SR_RETA_SIZE - 1)
+#define SR_NO_BUCKET   SR_RETA_SIZE     /* desc->bucket of non-IP frames */
+#define SR_WORKER_SPIN 64      /* empty polls before a worker goes to sleep */
+
+/* Microsoft's default RSS key, so hashes match what a NIC would compute */
+static const uint8_t rss_key[40] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+/* 12 input bytes (src ip, dst ip, sport, dport) x 256 values */
+#define SR_RSS_INPUT 12
+static uint32_t rss_table[SR_RSS_INPUT][256];
+static pthread_once_t rss_once = PTHREAD_ONCE_INIT;
+
+static void sr_rss_table_init(void)
+{
+    int byte, val, bit;
+
+    for (byte = 0; byte < SR_RSS_INPUT; byte++) {
+        for (val = 0; val < 256; val++) {
+            uint32_t h = 0;
+            for (bit = 0; bit < 8; bit++) {
+                if (val & (0x80 >> bit)) {
+                    /* the 32 key bits starting at input bit position */
+                    int pos = byte * 8 + bit;
+                    int k = pos / 8, s = pos % 8;
+                    uint64_t win = ((uint64_t)rss_key[k]     << 32) |
+                                   ((uint64_t)rss_key[k + 1] << 24) |
+                                   ((uint64_t)rss_key[k + 2] << 16) |
+                                   ((uint64_t)rss_key[k + 3] << 8)  |
+                                    (uint64_t)rss_key[k + 4];
+                    h ^= (uint32_t)(win >> (8 - s));
+                }
+            }
+            rss_table[byte][val] = h;
+        }
+    }
+} /* -- sr_rss_table_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_hash(..)
+ * Scope:  Global
+ *
+ * Toeplitz hash over the IPv4 addresses and, for unfragmented TCP/UDP,
+ * the port pair.  Fragments hash on addresses only so that all pieces of
+ * a datagram stay together.
+ *
+ *---------------------------------------------------------------------*/
+
+uint32_t sr_flow_hash(const uint8_t* packet, unsigned int len, int* is_ip)
+{
+    const sr_ip_hdr_t* iphdr;
+    uint8_t in[SR_RSS_INPUT];
+    unsigned int ihl, n, i;
+    uint32_t h = 0;
+
+    *is_ip = 0;
+    if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+    { return 0; }
+    if (((const sr_ethernet_hdr_t*)packet)->ether_type != htons(ethertype_ip))
+    { return 0; }
+
+    iphdr = (const sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+    *is_ip = 1;
+
+    memcpy(in, &iphdr->ip_src, 4);
+    memcpy(in + 4, &iphdr->ip_dst, 4);
+    n = 8;
+
+    ihl = iphdr->ip_hl * 4;
+    if ((iphdr->ip_p == 6 || iphdr->ip_p == 17) &&
+        !(ntohs(iphdr->ip_off) & (IP_MF | IP_OFFMASK)) &&
+        len >= sizeof(sr_ethernet_hdr_t) + ihl + 4)
+    {
+        memcpy(in + 8, packet + sizeof(sr_ethernet_hdr_t) + ihl, 4);
+        n = 12;
+    }
+
+    for (i = 0; i < n; i++)
+    { h ^= rss_table[i][in[i]]; }
+
+    return h;
+} /* -- sr_flow_hash -- */
+
+static __thread struct sr_worker* sr_self = 0;
+
+struct sr_worker* sr_dispatch_self(void)
+{
+    return sr_self;
+} /* -- sr_dispatch_self -- */
+
+static void sr_job_run(struct sr_instance* sr, struct sr_job* job)
+{
+    int i;
+
+    for (i = 0; i < job->n; i++)
+    { job->fn[i](sr, job->arg[i]); }
+    free(job);
+} /* -- sr_job_run -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_wake_idle(..)
+ * Scope:  Local
+ *
+ * Kick one sleeping worker so it comes looking for something to steal.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_wake_idle(struct sr_dispatch* d, struct sr_worker* self)
+{
+    int i;
+
+    for (i = 0; i < d->nworkers; i++) {
+        struct sr_worker* w = &d->workers[i];
+        if (w == self || !__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST))
+        { continue; }
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        return;
+    }
+} /* -- sr_wake_idle -- */
+
+/* push the batch sr_defer has been filling, or run it if the deque is full */
+static void sr_worker_flush(struct sr_worker* w)
+{
+    struct sr_job* job = w->pending;
+
+    if (!job)
+    { return; }
+    w->pending = 0;
+
+    if (sr_deque_push(&w->jobs, job) != 0) {
+        sr_job_run(w->sr, job);
+        w->jobs_run++;
+        return;
+    }
+    if (sr_deque_size(&w->jobs) > 1)
+    { sr_wake_idle(w->sr->dispatch, w); }
+} /* -- sr_worker_flush -- */
+
+/* move jobs posted by non-worker threads onto our stealable deque */
+static void sr_worker_take_inbox(struct sr_worker* w)
+{
+    struct sr_job *job, *next;
+
+    pthread_mutex_lock(&w->lock);
+    job = w->inbox;
+    w->inbox = 0;
+    pthread_mutex_unlock(&w->lock);
+
+    for (; job; job = next) {
+        next = job->next;
+        if (sr_deque_push(&w->jobs, job) != 0) {
+            sr_job_run(w->sr, job);
+            w->jobs_run++;
+        }
+    }
+} /* -- sr_worker_take_inbox -- */
+
+static struct sr_job* sr_worker_steal(struct sr_worker* w, struct sr_dispatch* d)
+{
+    /* rotate the first victim so thieves don't all pile onto worker 0 */
+    int i, start = (int)((w->id + w->steal_attempts) % d->nworkers);
+
+    for (i = 0; i < d->nworkers; i++) {
+        struct sr_worker* victim = &d->workers[(start + i) % d->nworkers];
+        void* job;
+
+        if (victim == w)
+        { continue; }
+        w->steal_attempts++;
+        job = sr_deque_steal(&victim->jobs);
+        if (job == SR_DEQUE_ABORT)
+        { job = sr_deque_steal(&victim->jobs); }
+        if (job != SR_DEQUE_EMPTY && job != SR_DEQUE_ABORT)
+        { return (struct sr_job*)job; }
+    }
+    return 0;
+} /* -- sr_worker_steal -- */
+
+static int sr_worker_has_work(struct sr_worker* w, struct sr_dispatch* d)
+{
+    int i;
+
+    if (__atomic_load_n(&w->tail, __ATOMIC_SEQ_CST) != w->head ||
+        __atomic_load_n(&w->inbox, __ATOMIC_RELAXED) ||
+        sr_deque_size(&w->jobs))
+    { return 1; }
+    for (i = 0; i < d->nworkers; i++) {
+        if (sr_deque_size(&d->workers[i].jobs))
+        { return 1; }
+    }
+    return 0;
+} /* -- sr_worker_has_work -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_wait(..)
+ * Scope:  Local
+ *
+ * Spin briefly, then sleep until the receive thread signals new frames
+ * or a sibling signals stealable work.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_worker_wait(struct sr_worker* w, struct sr_dispatch* d)
+{
+    struct timespec ts;
+    struct timeval now;
+    int i;
+
+    for (i = 0; i < SR_WORKER_SPIN; i++) {
+        if (sr_worker_has_work(w, d))
+        { return; }
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&w->lock);
+    __atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (!sr_worker_has_work(w, d) &&
+        __atomic_load_n(&d->running, __ATOMIC_ACQUIRE))
+    {
+        /* timed, so a lost wakeup costs at most 100ms */
+        gettimeofday(&now, 0);
+        ts.tv_sec  = now.tv_sec;
+        ts.tv_nsec = now.tv_usec * 1000 + 100000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+    }
+    __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&w->lock);
+} /* -- sr_worker_wait -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_main(..)
+ * Scope:  Local
+ *
+ * In-order frames from our ring always come first.  Between ring batches
+ * we run one deferred job of our own; when the ring is dry we work through
+ * our deque and then try to steal from the others.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_worker_main(void* arg)
+{
+    struct sr_worker* w = (struct sr_worker*)arg;
+    struct sr_dispatch* d = w->sr->dispatch;
+    struct sr_job* job;
+
+    sr_self = w;
+
+    for (;;) {
+        uint32_t tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+
+        if (tail != w->head) {
+            /* drain the whole batch that is visible right now */
+            while (w->head != tail) {
+                struct sr_rx_desc* desc = &w->ring[w->head & SR_RING_MASK];
+                uint8_t* buf = desc->buf;
+                uint16_t bucket = desc->bucket;
+
+                sr_handlepacket(w->sr, buf, desc->len, desc->iface);
+                sr_buf_free(buf);
+                w->processed++;
+
+                if (bucket != SR_NO_BUCKET)
+                { __atomic_fetch_sub(&d->bucket_inflight[bucket], 1,
+                                     __ATOMIC_RELEASE); }
+                __atomic_store_n(&w->head, w->head + 1, __ATOMIC_RELEASE);
+            }
+            sr_worker_flush(w);
+        }
+
+        if (__atomic_load_n(&w->inbox, __ATOMIC_RELAXED))
+        { sr_worker_take_inbox(w); }
+
+        if ((job = (struct sr_job*)sr_deque_take(&w->jobs)) != SR_DEQUE_EMPTY) {
+            sr_job_run(w->sr, job);
+            w->jobs_run++;
+            continue;
+        }
+        /* -- frames that came in meanwhile go before anyone else's work -- */
+        if (__atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) != w->head)
+        { continue; }
+
+        if ((job = sr_worker_steal(w, d)) != 0) {
+            sr_job_run(w->sr, job);
+            sr_worker_flush(w);
+            w->jobs_stolen++;
+            continue;
+        }
+
+        /* only leave once everything handed to us has been forwarded */
+        if (!__atomic_load_n(&d->running, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == w->head)
+        { break; }
+        sr_worker_wait(w, d);
+    }
+
+    sr_worker_flush(w);
+    return NULL;
+} /* -- sr_worker_main -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_defer(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_defer(struct sr_instance* sr, sr_job_fn fn, void* arg)
+{
+    struct sr_dispatch* d = sr->dispatch;
+    struct sr_worker* w = sr_self;
+    struct sr_job* job;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(fn);
+
+    if (!d) {
+        fn(sr, arg);
+        return;
+    }
+
+    if (w) {
+        if (!w->pending &&
+            !(w->pending = (struct sr_job*)calloc(1, sizeof(struct sr_job))))
+        {
+            fn(sr, arg);
+            return;
+        }
+        w->pending->fn[w->pending->n]  = fn;
+        w->pending->arg[w->pending->n] = arg;
+        if (++w->pending->n == SR_JOB_BATCH)
+        { sr_worker_flush(w); }
+        return;
+    }
+
+    /* not a worker (e.g. the ARP sweeper): post to the control worker */
+    if (!(job = (struct sr_job*)calloc(1, sizeof(struct sr_job)))) {
+        fn(sr, arg);
+        return;
+    }
+    job->n = 1;
+    job->fn[0] = fn;
+    job->arg[0] = arg;
+
+    w = &d->workers[SR_CONTROL_WORKER];
+    pthread_mutex_lock(&w->lock);
+    job->next = w->inbox;
+    w->inbox = job;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+} /* -- sr_defer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dispatch_init(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_dispatch_init(struct sr_instance* sr, int nworkers)
+{
+    struct sr_dispatch* d;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if (nworkers < 1 || nworkers > SR_MAX_WORKERS) {
+        fprintf(stderr, "Worker count must be between 1 and %d\n",
+                SR_MAX_WORKERS);
+        return -1;
+    }
+
+    pthread_once(&rss_once, sr_rss_table_init);
+
+    d = (struct sr_dispatch*)calloc(1, sizeof(struct sr_dispatch));
+    assert(d);
+    d->nworkers = nworkers;
+    d->running  = 1;
+
+    /* round robin to start with; rebalancing takes it from there */
+    for (i = 0; i < SR_RETA_SIZE; i++)
+    { d->reta[i] = i % nworkers; }
+
+    if (posix_memalign((void**)&d->workers, SR_CACHELINE,
+                       nworkers * sizeof(struct sr_worker)) != 0)
+    {
+        fprintf(stderr, "Error: out of memory (sr_dispatch_init)\n");
+        free(d);
+        return -1;
+    }
+    memset(d->workers, 0, nworkers * sizeof(struct sr_worker));
+
+    sr->dispatch = d;
+
+    for (i = 0; i < nworkers; i++) {
+        struct sr_worker* w = &d->workers[i];
+        w->id = i;
+        w->sr = sr;
+        sr_deque_init(&w->jobs);
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        if (pthread_create(&w->thread, &(sr->attr), sr_worker_main, w) != 0) {
+            perror("pthread_create(..):sr_dispatch.c::sr_dispatch_init(..)");
+            d->nworkers = i;
+            sr_dispatch_destroy(sr);
+            return -1;
+        }
+    }
+
+    printf("Dispatching to %d forwarding workers\n", nworkers);
+    return 0;
+} /* -- sr_dispatch_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dispatch_destroy(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_dispatch_destroy(struct sr_instance* sr)
+{
+    struct sr_dispatch* d = sr->dispatch;
+    int i;
+
+    if (!d)
+    { return; }
+
+    __atomic_store_n(&d->running, 0, __ATOMIC_RELEASE);
+
+    for (i = 0; i < d->nworkers; i++) {
+        struct sr_worker* w = &d->workers[i];
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+    }
+
+    /* -- job args are owned by their functions, so whatever is left still
+          runs, and with the pool gone anything it defers runs inline -- */
+    sr->dispatch = 0;
+    for (i = 0; i < d->nworkers; i++) {
+        struct sr_worker* w = &d->workers[i];
+        struct sr_job* job;
+
+        while (w->head != w->tail) {
+            sr_buf_free(w->ring[w->head & SR_RING_MASK].buf);
+            w->head++;
+        }
+        sr_worker_take_inbox(w);
+        while ((job = (struct sr_job*)sr_deque_take(&w->jobs)) != SR_DEQUE_EMPTY)
+        { sr_job_run(sr, job); }
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+    }
+
+    sr_dispatch_print_stats(d);
+
+    free(d->workers);
+    free(d);
+} /* -- sr_dispatch_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dispatch_check_imbalance(..)
+ * Scope:  Local
+ *
+ * Every SR_REBALANCE_PKTS packets compare the busiest worker with the
+ * mean and rebalance if the spread has grown too large.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_dispatch_check_imbalance(struct sr_dispatch* d)
+{
+    uint64_t max = 0, total = 0;
+    int i;
+
+    for (i = 0; i < d->nworkers; i++) {
+        total += d->workers[i].window;
+        if (d->workers[i].window > max)
+        { max = d->workers[i].window; }
+    }
+
+    if (total && (double)max * d->nworkers > SR_REBALANCE_RATIO * total) {
+        d->imbalance_events++;
+        sr_dispatch_rebalance(d);
+    }
+
+    /* age the history so old elephants don't pin the table forever */
+    for (i = 0; i < d->nworkers; i++)
+    { d->workers[i].window = 0; }
+    for (i = 0; i < SR_RETA_SIZE; i++)
+    { d->bucket_load[i] >>= 1; }
+    d->since_check = 0;
+} /* -- sr_dispatch_check_imbalance -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dispatch_set_lossless(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_dispatch_set_lossless(struct sr_dispatch* d)
+{
+    assert(d);
+    d->lossless = 1;
+} /* -- sr_dispatch_set_lossless -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dispatch_packet(..)
+ * Scope:  Global
+ *
+ * Called from the receive thread only.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_dispatch_packet(struct sr_instance* sr,
+                        uint8_t* packet /* lent */,
+                        unsigned int len,
+                        const char* iface /* lent */)
+{
+    struct sr_dispatch* d = sr->dispatch;
+    struct sr_worker* w;
+    struct sr_rx_desc* desc;
+    uint32_t hash, tail;
+    int is_ip;
+    uint16_t bucket;
+
+    /* REQUIRES */
+    assert(d);
+    assert(packet);
+    assert(iface);
+
+    hash = sr_flow_hash(packet, len, &is_ip);
+    bucket = hash & SR_RETA_MASK;
+    if (is_ip)
+    { w = &d->workers[d->reta[bucket]]; }
+    else
+    { w = &d->workers[SR_CONTROL_WORKER]; }
+
+    tail = w->tail;
+    while (d->lossless &&
+           tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE) >=
+           SR_WORKER_RING_SZ &&
+           __atomic_load_n(&d->running, __ATOMIC_ACQUIRE))
+    { sched_yield(); }
+    if (tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE) >= SR_WORKER_RING_SZ) {
+        w->dropped++;
+        SR_STATS_DROP(SR_DROP_WORKER_FULL);
+        return;
+    }
+    if (tail - w->head + 1 > w->max_depth)
+    { w->max_depth = tail - w->head + 1; }
+
+    desc = &w->ring[tail & SR_RING_MASK];
+    desc->buf = (uint8_t*)sr_buf_alloc(len);
+    if (!desc->buf) {
+        w->dropped++;
+        SR_STATS_DROP(SR_DROP_NO_BUF);
+        return;
+    }
+    memcpy(desc->buf, packet, len);
+    desc->len = len;
+    strncpy(desc->iface, iface, sr_IFACE_NAMELEN);
+
+    /* -- non-IP frames go to the control worker whatever the table says,
+          so they don't hold a bucket in place -- */
+    if (is_ip) {
+        desc->bucket = bucket;
+        d->bucket_load[bucket]++;
+        __atomic_fetch_add(&d->bucket_inflight[bucket], 1, __ATOMIC_RELAXED);
+    }
+    else
+    { desc->bucket = SR_NO_BUCKET; }
+    w->enqueued++;
+    w->window++;
+
+    __atomic_store_n(&w->tail, tail + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    if (++d->since_check >= SR_REBALANCE_PKTS)
+    { sr_dispatch_check_imbalance(d); }
+} /* -- sr_dispatch_packet -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dispatch_set_reta(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_dispatch_set_reta(struct sr_dispatch* d, int idx, int worker)
+{
+    assert(d);
+
+    if (idx < 0 || idx >= SR_RETA_SIZE || worker < 0 || worker >= d->nworkers)
+    { return -1; }
+
+    /* moving a bucket with frames still queued would reorder its flows */
+    if (__atomic_load_n(&d->bucket_inflight[idx], __ATOMIC_ACQUIRE) != 0)
+    { return -1; }
+
+    d->reta[idx] = (uint8_t)worker;
+    return 0;
+} /* -- sr_dispatch_set_reta -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dispatch_rebalance(..)
+ * Scope:  Global
+ *
+ * Greedy: repeatedly move the largest idle bucket that fits in half the
+ * gap between the busiest and the idlest worker.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_dispatch_rebalance(struct sr_dispatch* d)
+{
+    uint64_t load[SR_MAX_WORKERS];
+    int moved = 0, i;
+
+    assert(d);
+
+    if (d->nworkers < 2)
+    { return 0; }
+
+    memset(load, 0, sizeof(load));
+    for (i = 0; i < SR_RETA_SIZE; i++)
+    { load[d->reta[i]] += d->bucket_load[i]; }
+
+    while (moved < SR_RETA_SIZE) {
+        int hi = 0, lo = 0, best = -1;
+        uint64_t gap;
+
+        for (i = 1; i < d->nworkers; i++) {
+            if (load[i] > load[hi]) hi = i;
+            if (load[i] < load[lo]) lo = i;
+        }
+        gap = (load[hi] - load[lo]) / 2;
+        if (gap == 0)
+        { break; }
+
+        for (i = 0; i < SR_RETA_SIZE; i++) {
+            if (d->reta[i] != hi || d->bucket_load[i] == 0 ||
+                d->bucket_load[i] > gap)
+            { continue; }
+            if (best < 0 || d->bucket_load[i] > d->bucket_load[best])
+            { best = i; }
+        }
+        if (best < 0 || sr_dispatch_set_reta(d, best, lo) != 0)
+        { break; }
+
+        load[hi] -= d->bucket_load[best];
+        load[lo] += d->bucket_load[best];
+        moved++;
+    }
+
+    if (moved)
+    { d->rebalances++; }
+    return moved;
+} /* -- sr_dispatch_rebalance -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dispatch_print_stats(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_dispatch_print_stats(struct sr_dispatch* d)
+{
+    uint64_t total = 0, max = 0;
+    int i;
+
+    assert(d);
+
+    for (i = 0; i < d->nworkers; i++) {
+        total += d->workers[i].enqueued;
+        if (d->workers[i].enqueued > max)
+        { max = d->workers[i].enqueued; }
+    }
+
+    fprintf(stderr, "\nWORKER  ENQUEUED    PROCESSED   DROPPED     MAXDEPTH  SHARE"
+            "   JOBS        STOLEN\n");
+    fprintf(stderr, "-------------------------------------------------------------"
+            "-----------------------\n");
+    for (i = 0; i < d->nworkers; i++) {
+        struct sr_worker* w = &d->workers[i];
+        fprintf(stderr, "%-6d  %-10llu  %-10llu  %-10llu  %-8u  %5.1f%%"
+                "  %-10llu  %-10llu\n",
+                i, (unsigned long long)w->enqueued,
+                (unsigned long long)w->processed,
+                (unsigned long long)w->dropped, w->max_depth,
+                total ? 100.0 * w->enqueued / total : 0.0,
+                (unsigned long long)w->jobs_run,
+                (unsigned long long)w->jobs_stolen);
+    }
+    fprintf(stderr, "imbalance (max/mean): %.2f  imbalance events: %llu  "
+            "rebalances: %llu\n\n",
+            total ? (double)max * d->nworkers / total : 0.0,
+            (unsigned long long)d->imbalance_events,
+            (unsigned long long)d->rebalances);
+} /* -- sr_dispatch_print_stats -- */
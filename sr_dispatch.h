@@ -0,0 +1,167 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_dispatch.h
+ *
+ * Description:
+ *
+ * RSS-style dispatch of received frames to a pool of forwarding workers.
+ *
+ * The receive loop hashes the IPv4 5-tuple of every frame (Toeplitz, as a
+ * NIC would) and looks the hash up in an indirection table to pick a worker.
+ * All frames of a flow therefore land on the same worker and stay in order.
+ * ARP and anything that is not IPv4 is pinned to the control worker (0), so
+ * the ARP cache request queue only ever gets serviced from one thread.
+ *
+ * Each worker owns a single-producer/single-consumer ring; the receive
+ * thread is the only producer.  The indirection table can be rebalanced at
+ * runtime.  A bucket is only moved while none of its frames are queued, so
+ * rebalancing never reorders a flow.
+ *
+ * Work that does not need flow ordering (ICMP generation, ARP failure
+ * processing, logging) is deferred as batched jobs onto a per-worker
+ * work-stealing deque, so an idle worker can pick it up while the owner
+ * is stuck behind an elephant flow or an ARP burst.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_DISPATCH_H
+#define SR_DISPATCH_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#include "sr_protocol.h"
+#include "sr_deque.h"
+
+#define SR_MAX_WORKERS      16
+#define SR_CONTROL_WORKER   0
+#define SR_RETA_SIZE        128    /* indirection table entries, power of 2 */
+#define SR_WORKER_RING_SZ   1024   /* per-worker rx ring slots, power of 2 */
+#define SR_REBALANCE_PKTS   65536  /* packets between imbalance checks */
+#define SR_REBALANCE_RATIO  1.25   /* rebalance when max/mean exceeds this */
+
+#define SR_JOB_BATCH        16     /* deferred items per stealable job */
+
+#define SR_CACHELINE 64
+
+struct sr_instance;
+
+/* a unit of order-insensitive work; arg is owned by fn */
+typedef void (*sr_job_fn)(struct sr_instance* , void* );
+
+/* a batch of deferred work, the granularity at which jobs are stolen */
+struct sr_job
+{
+    int n;
+    sr_job_fn fn[SR_JOB_BATCH];
+    void* arg[SR_JOB_BATCH];
+    struct sr_job* next;            /* inbox linkage */
+};
+
+/* one received frame handed from the receive thread to a worker */
+struct sr_rx_desc
+{
+    uint8_t* buf;                   /* owned by the ring until consumed */
+    unsigned int len;
+    uint16_t bucket;                /* reta slot, SR_RETA_SIZE for non-IP */
+    char iface[sr_IFACE_NAMELEN];
+};
+
+struct sr_worker
+{
+    int id;
+    pthread_t thread;
+    struct sr_instance* sr;
+
+    /* -- consumer side, written by the worker only -- */
+    volatile uint32_t head __attribute__ ((aligned (SR_CACHELINE)));
+    volatile int sleeping;
+    uint64_t processed;
+    struct sr_job* pending;         /* batch being filled by sr_defer */
+    uint64_t jobs_run;              /* batches taken from our own deque */
+    uint64_t jobs_stolen;           /* batches stolen from other workers */
+    uint64_t steal_attempts;
+
+    /* -- producer side, written by the receive thread only -- */
+    volatile uint32_t tail __attribute__ ((aligned (SR_CACHELINE)));
+    uint64_t enqueued;
+    uint64_t dropped;               /* ring full, frame discarded */
+    uint64_t window;                /* enqueued since last imbalance check */
+    uint32_t max_depth;             /* high-water mark of ring occupancy */
+
+    pthread_mutex_t lock __attribute__ ((aligned (SR_CACHELINE)));
+    pthread_cond_t  cond;
+    struct sr_job* inbox;           /* jobs from non-worker threads, locked */
+
+    struct sr_deque jobs;           /* stealable, order-insensitive work */
+
+    struct sr_rx_desc ring[SR_WORKER_RING_SZ];
+};
+
+struct sr_dispatch
+{
+    int nworkers;
+    volatile int running;
+    int lossless;                   /* wait for ring space instead of dropping */
+
+    /* indirection table: hash bucket -> worker */
+    volatile uint8_t reta[SR_RETA_SIZE];
+
+    /* per-bucket load, maintained by the receive thread */
+    uint64_t bucket_load[SR_RETA_SIZE];
+    /* frames of each bucket still sitting in a ring (atomic) */
+    uint32_t bucket_inflight[SR_RETA_SIZE];
+
+    uint64_t since_check;           /* packets since last imbalance check */
+    uint64_t rebalances;
+    uint64_t imbalance_events;      /* checks that found max/mean too high */
+
+    struct sr_worker* workers;
+};
+
+/* Start nworkers forwarding threads.  Returns 0 on success. */
+int  sr_dispatch_init(struct sr_instance* sr, int nworkers);
+
+/* Stop and join all workers, freeing anything still queued. */
+void sr_dispatch_destroy(struct sr_instance* sr);
+
+/* Make sr_dispatch_packet wait for a full ring to drain instead of
+   dropping, for sources that can be held up (pcap replay). */
+void sr_dispatch_set_lossless(struct sr_dispatch* d);
+
+/* Copy a received frame onto the ring of the worker that owns its flow. */
+void sr_dispatch_packet(struct sr_instance* sr,
+                        uint8_t* packet /* lent */,
+                        unsigned int len,
+                        const char* iface /* lent */);
+
+/* Toeplitz hash of the IPv4 5-tuple (2-tuple for fragments).  Returns 0 and
+   sets *is_ip to 0 for frames that are not IPv4. */
+uint32_t sr_flow_hash(const uint8_t* packet, unsigned int len, int* is_ip);
+
+/* Point indirection table entry idx at worker.  Safe at runtime; refuses
+   (returns -1) while frames of that bucket are still queued. */
+int  sr_dispatch_set_reta(struct sr_dispatch* d, int idx, int worker);
+
+/* Reassign idle buckets so that per-worker load evens out.  Called by the
+   receive thread; returns the number of buckets moved. */
+int  sr_dispatch_rebalance(struct sr_dispatch* d);
+
+/* Run fn(sr, arg) off the in-order path.  On a worker it is batched onto
+   that worker's stealable deque; from other threads it goes to the control
+   worker's inbox; without workers it runs immediately. */
+void sr_defer(struct sr_instance* sr, sr_job_fn fn, void* arg);
+
+/* The worker the calling thread is, or 0 if it is not a worker. */
+struct sr_worker* sr_dispatch_self(void);
+
+/* Print per-worker load and imbalance counters to stderr. */
+void sr_dispatch_print_stats(struct sr_dispatch* d);
+
+#endif /* -- SR_DISPATCH_H -- */
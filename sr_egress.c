@@ -0,0 +1,755 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_egress.c
+ *
+ * Description:
+ *
+ * Per-interface transmit queues in front of the I/O backend, see
+ * sr_egress.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_egress.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_io.h"
+#include "sr_bufpool.h"
+#include "sr_stats.h"
+
+#define SR_NSEC 1000000000ULL
+
+#define SR_CLASS_EMPTY(c) ((c)->head == (c)->tail)
+
+/* ring slot of free running index n; depth is a power of two so the slot
+   stays in step when n wraps */
+#define SR_SLOT(e, n) ((n) & ((e)->depth - 1))
+
+static const char* sr_qos_names[SR_QOS_NCLASSES] =
+{ "control", "expedited", "default", "bulk" };
+
+/* DRR weights, in quanta per round; control is strict priority */
+static const uint32_t sr_qos_weight[SR_QOS_NCLASSES] = { 0, 4, 2, 1 };
+
+static void* sr_egress_thread(void* arg);
+
+static uint64_t sr_egress_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * SR_NSEC + ts.tv_nsec;
+} /* -- sr_egress_now -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_egress_init(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_egress_init(struct sr_instance* sr, unsigned int depth,
+                   unsigned int target_us, unsigned int interval_us,
+                   int shape)
+{
+    struct sr_egress* e;
+    pthread_condattr_t ca;
+
+    assert(sr);
+    assert(depth > 0 && (depth & (depth - 1)) == 0);
+
+    if ((e = (struct sr_egress*)calloc(1, sizeof(struct sr_egress))) == 0)
+    { return -1; }
+
+    /* -- shaper deadlines are CLOCK_MONOTONIC -- */
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->cond, &ca);
+    pthread_cond_init(&e->done, NULL);
+    pthread_condattr_destroy(&ca);
+
+    e->depth = depth;
+    e->target = (uint64_t)target_us * 1000;
+    e->interval = (uint64_t)interval_us * 1000;
+    e->shape = shape;
+    e->running = 1;
+    sr->egress = e;
+
+    if (pthread_create(&e->thread, &(sr->attr), sr_egress_thread, sr) != 0) {
+        perror("pthread_create(..):sr_egress.c::sr_egress_init(..)");
+        sr->egress = 0;
+        pthread_cond_destroy(&e->done);
+        pthread_cond_destroy(&e->cond);
+        pthread_mutex_destroy(&e->lock);
+        free(e);
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_egress_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_qos_classify(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_qos_classify(const uint8_t* buf, unsigned int len)
+{
+    const sr_ip_hdr_t* ip;
+
+    if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+        ((const sr_ethernet_hdr_t*)buf)->ether_type != htons(ethertype_ip))
+    { return SR_QOS_CONTROL; }
+
+    ip = (const sr_ip_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+    if (ip->ip_p == ip_protocol_icmp)
+    { return SR_QOS_CONTROL; }
+
+    switch (ip->ip_tos >> 2) {
+        case 48: case 56:                       /* CS6, CS7 */
+            return SR_QOS_CONTROL;
+        case 46:                                /* EF */
+        case 32: case 40:                       /* CS4, CS5 */
+        case 34: case 36: case 38:              /* AF41-43 */
+            return SR_QOS_EXPEDITED;
+        case 8: case 1:                         /* CS1, LE */
+            return SR_QOS_BULK;
+        default:
+            return SR_QOS_DEFAULT;
+    }
+} /* -- sr_qos_classify -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shaper_wait(..)
+ * Scope:  Local
+ *
+ * Refill the bucket up to now and say how long (ns) until len bytes fit,
+ * 0 if they do already.  Tokens are kept in byte-nanoseconds so frequent
+ * refills don't lose the fractions.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint64_t sr_shaper_wait(struct sr_shaper* s, unsigned int len,
+                               uint64_t now)
+{
+    uint64_t dt, need;
+
+    if (!s->rate)
+    { return 0; }
+
+    dt = now - s->last;
+    if (dt > SR_NSEC)
+    { dt = SR_NSEC; }
+    s->last = now;
+    s->tokens += dt * s->rate;
+    if (s->tokens > s->burst * SR_NSEC)
+    { s->tokens = s->burst * SR_NSEC; }
+
+    need = (uint64_t)len * SR_NSEC;
+    if (s->tokens >= need)
+    { return 0; }
+    return (need - s->tokens) / s->rate + 1;
+} /* -- sr_shaper_wait -- */
+
+/* the queue of iface, created on first use; lock held */
+static struct sr_egress_q* sr_egress_find(struct sr_instance* sr,
+                                          struct sr_egress* e,
+                                          const char* iface)
+{
+    struct sr_egress_q* q;
+    struct sr_if* ifc;
+    int i, k;
+
+    for (i = 0; i < e->nq; i++) {
+        if (strncmp(e->q[i].name, iface, sr_IFACE_NAMELEN) == 0)
+        { return &e->q[i]; }
+    }
+
+    if (e->nq == SR_EGRESS_MAX_IFS)
+    { return 0; }
+
+    q = &e->q[e->nq];
+    for (k = 0; k < SR_QOS_NCLASSES; k++) {
+        q->cls[k].ring = (struct sr_egress_pkt*)
+            calloc(e->depth, sizeof(struct sr_egress_pkt));
+        if (!q->cls[k].ring) {
+            while (k-- > 0) {
+                free(q->cls[k].ring);
+                q->cls[k].ring = 0;
+            }
+            return 0;
+        }
+    }
+    strncpy(q->name, iface, sr_IFACE_NAMELEN - 1);
+    q->drr_cur = SR_QOS_CONTROL + 1;
+    q->drr_fresh = 1;
+
+    /* -- pace at the interface's speed, starting with a full bucket -- */
+    ifc = sr_get_interface(sr, iface);
+    q->stats = ifc ? ifc->stats : sr_stats_if_index(iface);
+    if (e->shape && ifc && ifc->speed) {
+        q->shaper.rate = (uint64_t)ifc->speed * 1000000 / 8;
+        q->shaper.burst = q->shaper.rate * SR_SHAPER_BURST_US / 1000000;
+        if (q->shaper.burst < 2 * SR_MAX_FRAME)
+        { q->shaper.burst = 2 * SR_MAX_FRAME; }
+        q->shaper.tokens = q->shaper.burst * SR_NSEC;
+        q->shaper.last = sr_egress_now();
+    }
+
+    e->nq++;
+    return q;
+} /* -- sr_egress_find -- */
+
+/* hand one frame to the backend and account for the result.  The lock is
+   held on entry and return but dropped around the send; q->sending keeps
+   q's other frames back meanwhile.  0 if it was sent, -1 if it was
+   refused, 1 if the transport is busy. */
+static int sr_egress_xmit(struct sr_instance* sr, struct sr_egress* e,
+                          struct sr_egress_q* q, struct sr_egress_class* c,
+                          uint8_t* buf, unsigned int len)
+{
+    int ret;
+
+    q->sending = 1;
+    pthread_mutex_unlock(&e->lock);
+    ret = sr->io->send(sr, buf, len, q->name);
+    pthread_mutex_lock(&e->lock);
+    q->sending = 0;
+    if (e->waiters)
+    { pthread_cond_broadcast(&e->done); }
+
+    switch (ret) {
+        case SR_IO_PARTIAL:
+            /* taken, but the backend still holds part of it */
+            e->wake = 1;
+            /* fall through */
+        case 0:
+            c->sent++;
+            c->bytes += len;
+            SR_STATS_TX(q->stats, len);
+            if (q->shaper.rate) {
+                uint64_t used = (uint64_t)len * SR_NSEC;
+                q->shaper.tokens = q->shaper.tokens > used ?
+                                   q->shaper.tokens - used : 0;
+            }
+            return 0;
+        case SR_IO_BUSY:
+            q->blocked = 1;
+            e->stalls++;
+            e->wake = 1;
+            return 1;
+        case SR_IO_DROPPED:
+            return -1;
+        default:
+            q->errors++;
+            SR_STATS_DROP(SR_DROP_TX_ERROR);
+            return -1;
+    }
+} /* -- sr_egress_xmit -- */
+
+/* q may send again at t; lock held */
+static void sr_egress_hold(struct sr_egress* e, struct sr_egress_q* q,
+                           uint64_t t)
+{
+    if (!q->ready_at)
+    { q->held++; }
+    q->ready_at = t;
+    if (!e->timer || t < e->timer) {
+        e->timer = t;
+        pthread_cond_signal(&e->cond);
+    }
+} /* -- sr_egress_hold -- */
+
+/* discard the head frame of c; lock held */
+static void sr_egress_pop(struct sr_egress* e, struct sr_egress_class* c)
+{
+    struct sr_egress_pkt* p = &c->ring[SR_SLOT(e, c->head)];
+
+    sr_buf_free(p->buf);
+    p->buf = 0;
+    c->head++;
+} /* -- sr_egress_pop -- */
+
+/* RFC 8289 dodequeue(): has the head's sojourn been above target for a
+   whole interval?  Lock held. */
+static int sr_codel_ok_to_drop(struct sr_egress* e, struct sr_egress_class* c,
+                               uint64_t now)
+{
+    struct sr_codel* cd = &c->codel;
+    uint64_t sojourn;
+
+    if (SR_CLASS_EMPTY(c)) {
+        cd->first_above = 0;
+        return 0;
+    }
+
+    sojourn = now - c->ring[SR_SLOT(e, c->head)].t_enq;
+
+    /* -- a single frame is no standing queue -- */
+    if (sojourn < e->target || c->tail - c->head <= 1) {
+        cd->first_above = 0;
+        return 0;
+    }
+    if (cd->first_above == 0) {
+        cd->first_above = now + e->interval;
+        return 0;
+    }
+    return now >= cd->first_above;
+} /* -- sr_codel_ok_to_drop -- */
+
+static uint64_t sr_codel_control_law(struct sr_egress* e, uint64_t t,
+                                     uint32_t count)
+{
+    return t + (uint64_t)(e->interval / sqrt((double)count));
+} /* -- sr_codel_control_law -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_egress_codel(..)
+ * Scope:  Local
+ *
+ * The drop half of RFC 8289 dequeue(), run on a class's head before it is
+ * handed to the transport.  Leaves the frame to send at the head, if any.
+ * Lock held.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_egress_codel(struct sr_egress* e, struct sr_egress_class* c,
+                            uint64_t now)
+{
+    struct sr_codel* cd = &c->codel;
+    int drop = sr_codel_ok_to_drop(e, c, now);
+    uint32_t delta;
+
+    if (cd->dropping) {
+        if (!drop)
+        { cd->dropping = 0; }
+        while (cd->dropping && now >= cd->drop_next) {
+            sr_egress_pop(e, c);
+            c->codel_drops++;
+            SR_STATS_DROP(SR_DROP_CODEL);
+            cd->count++;
+            if (!sr_codel_ok_to_drop(e, c, now))
+            { cd->dropping = 0; }
+            else
+            { cd->drop_next = sr_codel_control_law(e, cd->drop_next, cd->count); }
+        }
+    }
+    else if (drop) {
+        sr_egress_pop(e, c);
+        c->codel_drops++;
+        SR_STATS_DROP(SR_DROP_CODEL);
+        sr_codel_ok_to_drop(e, c, now);
+        cd->dropping = 1;
+
+        /* -- pick up near the old drop rate if we were dropping recently -- */
+        delta = cd->count - cd->lastcount;
+        cd->count = 1;
+        if (delta > 1 && now - cd->drop_next < 16 * e->interval)
+        { cd->count = delta; }
+        cd->drop_next = sr_codel_control_law(e, now, cd->count);
+        cd->lastcount = cd->count;
+    }
+} /* -- sr_egress_codel -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_egress_pick(..)
+ * Scope:  Local
+ *
+ * The class q sends from next: control if it has anything, otherwise
+ * deficit round robin over the rest.  -1 if q is empty.  Lock held.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_egress_pick(struct sr_egress* e, struct sr_egress_q* q)
+{
+    struct sr_egress_class* c;
+    int k;
+
+    if (!SR_CLASS_EMPTY(&q->cls[SR_QOS_CONTROL]))
+    { return SR_QOS_CONTROL; }
+
+    for (k = SR_QOS_CONTROL + 1; k < SR_QOS_NCLASSES; k++) {
+        if (!SR_CLASS_EMPTY(&q->cls[k]))
+        { break; }
+    }
+    if (k == SR_QOS_NCLASSES)
+    { return -1; }
+
+    for (;;) {
+        c = &q->cls[q->drr_cur];
+        if (SR_CLASS_EMPTY(c))
+        { c->deficit = 0; }
+        else {
+            if (q->drr_fresh) {
+                c->deficit += sr_qos_weight[q->drr_cur] * SR_DRR_QUANTUM;
+                q->drr_fresh = 0;
+            }
+            if (c->ring[SR_SLOT(e, c->head)].len <= c->deficit)
+            { return q->drr_cur; }
+        }
+        q->drr_cur = q->drr_cur % (SR_QOS_NCLASSES - 1) + 1;
+        q->drr_fresh = 1;
+    }
+} /* -- sr_egress_pick -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_egress_drain(..)
+ * Scope:  Local
+ *
+ * Send queued frames, one per interface per round so a long queue doesn't
+ * hold the short ones up, until every interface is empty, blocked or
+ * waiting for its shaper.  Lock held, except while a frame is with the
+ * backend; the frame stays at the head of its class until then.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_egress_drain(struct sr_instance* sr, struct sr_egress* e)
+{
+    uint64_t now, wait, sojourn;
+    int idle = 0, k;
+
+    e->timer = 0;
+    while (idle < e->nq) {
+        struct sr_egress_q* q = &e->q[e->rr];
+        struct sr_egress_class* c;
+        struct sr_egress_pkt* p;
+
+        e->rr = (e->rr + 1) % e->nq;
+        if (q->blocked || q->sending || (k = sr_egress_pick(e, q)) < 0) {
+            idle++;
+            continue;
+        }
+        c = &q->cls[k];
+        now = sr_egress_now();
+
+        if (e->target) {
+            sr_egress_codel(e, c, now);
+            if (SR_CLASS_EMPTY(c)) {
+                idle = 0;
+                continue;
+            }
+        }
+
+        p = &c->ring[SR_SLOT(e, c->head)];
+        if ((wait = sr_shaper_wait(&q->shaper, p->len, now)) != 0) {
+            sr_egress_hold(e, q, now + wait);
+            idle++;
+            continue;
+        }
+        q->ready_at = 0;
+        idle = 0;
+
+        if (sr_egress_xmit(sr, e, q, c, p->buf, p->len) > 0)
+        { continue; }
+        if ((sojourn = now - p->t_enq) > c->max_sojourn)
+        { c->max_sojourn = sojourn; }
+        c->deficit = c->deficit > p->len ? c->deficit - p->len : 0;
+        sr_egress_pop(e, c);
+        if (SR_CLASS_EMPTY(c))
+        { c->deficit = 0; }
+    }
+
+    if (e->wake)
+    { pthread_cond_signal(&e->cond); }
+} /* -- sr_egress_drain -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_egress_send(..)
+ * Scope:  Global
+ *
+ * Frames only go straight to the backend while nothing is waiting ahead
+ * of them on the same interface (control only looks at its own class),
+ * so per-class order is kept.  Such a frame holds the head slot of its
+ * class while the lock is dropped for the send; whatever is queued
+ * meanwhile lands behind it, and it takes the slot if the transport is
+ * busy.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_egress_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   const char* iface)
+{
+    struct sr_egress* e = sr->egress;
+    struct sr_egress_q* q;
+    struct sr_egress_class* c;
+    struct sr_egress_pkt* p;
+    uint64_t now = 0, wait = 0;
+    uint32_t depth;
+    int k, ret, held = 0;
+
+    assert(e);
+
+    k = sr_qos_classify(buf, len);
+
+    pthread_mutex_lock(&e->lock);
+
+    if ((q = sr_egress_find(sr, e, iface)) == 0) {
+        pthread_mutex_unlock(&e->lock);
+        fprintf(stderr, "** Error: no egress queue for %s\n", iface);
+        return -1;
+    }
+    c = &q->cls[k];
+
+    /* -- wait out another thread's send rather than queue behind it -- */
+    while (q->sending && !q->blocked) {
+        e->waiters++;
+        pthread_cond_wait(&e->done, &e->lock);
+        e->waiters--;
+    }
+
+    /* -- fast path, the transport takes it right away -- */
+    if (!q->blocked && !q->sending && SR_CLASS_EMPTY(c) &&
+        (k == SR_QOS_CONTROL || sr_egress_pick(e, q) < 0)) {
+        if (q->shaper.rate)
+        { wait = sr_shaper_wait(&q->shaper, len, now = sr_egress_now()); }
+        if (wait == 0) {
+            p = &c->ring[SR_SLOT(e, c->tail)];
+            p->buf = 0;
+            c->tail++;
+            held = 1;
+            if ((ret = sr_egress_xmit(sr, e, q, c, buf, len)) <= 0) {
+                c->head++;
+                /* -- a drain may have passed q over while it was sending -- */
+                if (q->ready_at)
+                { sr_egress_hold(e, q, q->ready_at); }
+                if (e->wake)
+                { pthread_cond_signal(&e->cond); }
+                pthread_mutex_unlock(&e->lock);
+                return ret;
+            }
+        }
+    }
+
+    /* -- drop tail -- */
+    if (!held && c->tail - c->head >= e->depth) {
+        c->dropped++;
+        SR_STATS_DROP(SR_DROP_QUEUE_FULL);
+        pthread_mutex_unlock(&e->lock);
+        return -1;
+    }
+
+    if (!held)
+    { p = &c->ring[SR_SLOT(e, c->tail)]; }
+    if ((p->buf = (uint8_t*)sr_buf_alloc(len)) == 0) {
+        if (held)
+        { c->head++; }
+        c->dropped++;
+        SR_STATS_DROP(SR_DROP_NO_BUF);
+        pthread_mutex_unlock(&e->lock);
+        return -1;
+    }
+    if (!now)
+    { now = sr_egress_now(); }
+    memcpy(p->buf, buf, len);
+    p->len = len;
+    p->t_enq = now;
+    if (!held)
+    { c->tail++; }
+    c->queued++;
+
+    depth = c->tail - c->head;
+    if (depth > c->max_depth)
+    { c->max_depth = depth; }
+
+    /* -- make sure the transmit thread comes back for it -- */
+    if (e->wake)
+    { pthread_cond_signal(&e->cond); }
+    else if (!q->blocked && !q->ready_at)
+    { sr_egress_hold(e, q, now + wait); }
+
+    pthread_mutex_unlock(&e->lock);
+    return 0;
+} /* -- sr_egress_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_egress_thread(..)
+ * Scope:  Local
+ *
+ * Sleeps until a queue is blocked, the backend is holding a partly
+ * written frame or a shaped queue's deadline comes up.  The backend is
+ * waited for outside the lock (senders keep queueing meanwhile).
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_egress_thread(void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_egress* e = sr->egress;
+    struct timespec ts;
+    int room, i;
+
+    pthread_mutex_lock(&e->lock);
+    while (e->running) {
+        if (e->wake) {
+            e->wake = 0;
+            pthread_mutex_unlock(&e->lock);
+
+            if (sr->io->tx_flush)
+            { room = sr->io->tx_flush(sr, SR_EGRESS_WAIT_MS); }
+            else {
+                usleep(SR_EGRESS_RETRY_US);
+                room = 1;
+            }
+
+            pthread_mutex_lock(&e->lock);
+            if (!room) {
+                e->wake = 1;
+                continue;
+            }
+            for (i = 0; i < e->nq; i++)
+            { e->q[i].blocked = 0; }
+            sr_egress_drain(sr, e);
+        }
+        else if (e->timer) {
+            if (sr_egress_now() < e->timer) {
+                ts.tv_sec = e->timer / SR_NSEC;
+                ts.tv_nsec = e->timer % SR_NSEC;
+                pthread_cond_timedwait(&e->cond, &e->lock, &ts);
+                continue;
+            }
+            sr_egress_drain(sr, e);
+        }
+        else
+        { pthread_cond_wait(&e->cond, &e->lock); }
+    }
+    pthread_mutex_unlock(&e->lock);
+
+    return 0;
+} /* -- sr_egress_thread -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_egress_destroy(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_egress_destroy(struct sr_instance* sr)
+{
+    struct sr_egress* e = sr->egress;
+    int i, k;
+
+    if (!e)
+    { return; }
+
+    pthread_mutex_lock(&e->lock);
+    e->running = 0;
+    pthread_cond_signal(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+    pthread_join(e->thread, NULL);
+
+    /* -- whatever the transport and shapers take now, the rest is lost -- */
+    if (sr->io->tx_flush)
+    { sr->io->tx_flush(sr, SR_EGRESS_WAIT_MS); }
+    pthread_mutex_lock(&e->lock);
+    for (i = 0; i < e->nq; i++)
+    { e->q[i].blocked = 0; }
+    sr_egress_drain(sr, e);
+    pthread_mutex_unlock(&e->lock);
+
+    sr_egress_print_stats(e);
+
+    sr->egress = 0;
+    for (i = 0; i < e->nq; i++) {
+        for (k = 0; k < SR_QOS_NCLASSES; k++) {
+            struct sr_egress_class* c = &e->q[i].cls[k];
+            while (!SR_CLASS_EMPTY(c))
+            { sr_egress_pop(e, c); }
+            free(c->ring);
+        }
+    }
+    pthread_cond_destroy(&e->done);
+    pthread_cond_destroy(&e->cond);
+    pthread_mutex_destroy(&e->lock);
+    free(e);
+} /* -- sr_egress_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_egress_depth(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_egress_depth(struct sr_egress* e, const char* iface)
+{
+    int i, k, depth = -1;
+
+    assert(e);
+
+    pthread_mutex_lock(&e->lock);
+    for (i = 0; i < e->nq; i++) {
+        if (strncmp(e->q[i].name, iface, sr_IFACE_NAMELEN) == 0) {
+            for (depth = 0, k = 0; k < SR_QOS_NCLASSES; k++)
+            { depth += e->q[i].cls[k].tail - e->q[i].cls[k].head; }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&e->lock);
+
+    return depth;
+} /* -- sr_egress_depth -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_egress_print_stats(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_egress_print_stats(struct sr_egress* e)
+{
+    int i, k;
+
+    assert(e);
+
+    pthread_mutex_lock(&e->lock);
+    fprintf(stderr, "\nEGRESS  CLASS      SENT        QUEUED      DROPPED     CODEL"
+            "       DEPTH  MAXDEPTH  MAXDELAY(us)\n");
+    fprintf(stderr, "-------------------------------------------------------"
+            "--------------------------------------------\n");
+    for (i = 0; i < e->nq; i++) {
+        struct sr_egress_q* q = &e->q[i];
+
+        for (k = 0; k < SR_QOS_NCLASSES; k++) {
+            struct sr_egress_class* c = &q->cls[k];
+
+            if (!c->sent && !c->queued && !c->dropped)
+            { continue; }
+            fprintf(stderr, "%-6s  %-9s  %-10llu  %-10llu  %-10llu  %-10llu  "
+                    "%-5u  %-8u  %llu\n",
+                    q->name, sr_qos_names[k], (unsigned long long)c->sent,
+                    (unsigned long long)c->queued,
+                    (unsigned long long)c->dropped,
+                    (unsigned long long)c->codel_drops,
+                    c->tail - c->head, c->max_depth,
+                    (unsigned long long)(c->max_sojourn / 1000));
+        }
+        if (q->shaper.rate) {
+            fprintf(stderr, "%-6s  shaped to %llu Mbit/s, held %llu times\n",
+                    q->name,
+                    (unsigned long long)(q->shaper.rate * 8 / 1000000),
+                    (unsigned long long)q->held);
+        }
+        if (q->errors) {
+            fprintf(stderr, "%-6s  %llu transport errors\n", q->name,
+                    (unsigned long long)q->errors);
+        }
+    }
+    if (e->target) {
+        fprintf(stderr, "queue depth: %u  codel target: %llu us  interval: "
+                "%llu us  transport stalls: %llu\n\n", e->depth,
+                (unsigned long long)(e->target / 1000),
+                (unsigned long long)(e->interval / 1000),
+                (unsigned long long)e->stalls);
+    }
+    else {
+        fprintf(stderr, "queue depth: %u  drop tail only  transport stalls: "
+                "%llu\n\n", e->depth, (unsigned long long)e->stalls);
+    }
+    pthread_mutex_unlock(&e->lock);
+} /* -- sr_egress_print_stats -- */
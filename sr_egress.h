@@ -0,0 +1,177 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_egress.h
+ *
+ * Description:
+ *
+ * Bounded transmit queues, one per outgoing interface, in front of the I/O
+ * backend.  sr_send_packet() hands frames to the backend directly as long
+ * as it takes them.  When the transport pushes back (SR_IO_BUSY) the frame
+ * is copied onto its interface's queue instead and the caller moves on; a
+ * transmit thread waits for the backend to have room again (tx_flush) and
+ * drains the queues round robin.  A full queue drops the new frame (drop
+ * tail), so one congested interface costs its own frames but never stalls
+ * forwarding or the other interfaces.
+ *
+ * Drop tail alone lets a queue stand full under sustained overload, adding
+ * depth frames of delay to everything.  Each queue therefore also runs
+ * CoDel (RFC 8289) at dequeue: once the time frames spent queued (sojourn)
+ * has stayed above target for a whole interval, the head is dropped, and
+ * drops come faster (interval / sqrt(count)) until the sojourn falls back
+ * under target.  Bursts shorter than an interval pass untouched.
+ *
+ * Within an interface frames are split into classes by DSCP.  Control
+ * traffic (ARP, ICMP, CS6/CS7) is served first; the others share what is
+ * left by deficit round robin, weighted towards expedited traffic.  Each
+ * class is its own drop-tail + CoDel queue.  An interface with a known
+ * speed (HWSPEED, Mbit/s) is paced by a token bucket at that rate, so the
+ * queueing happens here, where the classes are told apart, rather than in
+ * the transport.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_EGRESS_H
+#define SR_EGRESS_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#include "sr_protocol.h"
+
+#define SR_EGRESS_MAX_IFS       16
+#define SR_EGRESS_DEFAULT_DEPTH 256    /* frames per class, -q */
+#define SR_EGRESS_MAX_DEPTH     65536  /* -q, a power of two up to this */
+#define SR_EGRESS_WAIT_MS       100    /* longest single tx_flush wait */
+#define SR_EGRESS_RETRY_US      200    /* backends without tx_flush */
+
+#define SR_CODEL_TARGET_US      5000   /* acceptable standing delay, -c */
+#define SR_CODEL_INTERVAL_US    100000 /* how long it may stand above it */
+
+/* traffic classes, highest priority first */
+#define SR_QOS_CONTROL          0      /* ARP, ICMP, CS6, CS7: strict priority */
+#define SR_QOS_EXPEDITED        1      /* EF, CS4, CS5, AF4x */
+#define SR_QOS_DEFAULT          2      /* everything else */
+#define SR_QOS_BULK             3      /* CS1, LE */
+#define SR_QOS_NCLASSES         4
+
+#define SR_DRR_QUANTUM          1514   /* bytes per round per unit of weight */
+#define SR_SHAPER_BURST_US      2000   /* bucket depth, as time at line rate */
+
+struct sr_instance;
+
+/* a frame waiting for the transport */
+struct sr_egress_pkt
+{
+    uint8_t* buf;                   /* from sr_buf_alloc, owned by the queue */
+    unsigned int len;
+    uint64_t t_enq;                 /* CLOCK_MONOTONIC ns when queued */
+};
+
+/* RFC 8289 state of one queue, times in ns */
+struct sr_codel
+{
+    uint64_t first_above;           /* when sojourn may first count as bad */
+    uint64_t drop_next;             /* next drop while dropping */
+    uint32_t count;                 /* drops since dropping started */
+    uint32_t lastcount;
+    int dropping;
+};
+
+/* one traffic class of an interface */
+struct sr_egress_class
+{
+    struct sr_egress_pkt* ring;     /* depth slots */
+    uint32_t head, tail;            /* free running, depth = tail - head */
+    uint32_t deficit;               /* DRR bytes left this round */
+    struct sr_codel codel;
+
+    uint64_t sent;                  /* taken by the transport */
+    uint64_t bytes;
+    uint64_t queued;                /* had to wait on the queue first */
+    uint64_t dropped;               /* queue full, frame discarded */
+    uint64_t codel_drops;           /* dropped by CoDel at dequeue */
+    uint32_t max_depth;             /* high-water mark of queue occupancy */
+    uint64_t max_sojourn;           /* longest time a frame waited, ns */
+};
+
+/* token bucket, bytes and ns */
+struct sr_shaper
+{
+    uint64_t rate;                  /* bytes per second, 0 = unshaped */
+    uint64_t burst;                 /* bucket depth */
+    uint64_t tokens;
+    uint64_t last;                  /* last refill */
+};
+
+struct sr_egress_q
+{
+    char name[sr_IFACE_NAMELEN];
+    unsigned int stats;             /* the interface's sr_stats row */
+    struct sr_egress_class cls[SR_QOS_NCLASSES];
+    int drr_cur;                    /* DRR class being served */
+    int drr_fresh;                  /* its quantum is still to be added */
+    int blocked;                    /* transport busy, wait for tx_flush */
+    int sending;                    /* a frame is with the backend, unlocked */
+    uint64_t ready_at;              /* shaped until then, 0 = not shaped */
+    struct sr_shaper shaper;
+
+    uint64_t errors;                /* transport refused the frame */
+    uint64_t held;                  /* times the shaper held the queue */
+};
+
+struct sr_egress
+{
+    pthread_mutex_t lock;           /* guards everything below */
+    pthread_cond_t cond;
+    pthread_cond_t done;            /* a queue's sending went back to 0 */
+    int waiters;                    /* senders waiting on done */
+    pthread_t thread;
+    int running;
+    int wake;                       /* the transmit thread has work */
+    uint64_t timer;                 /* earliest ready_at of any queue */
+
+    unsigned int depth;
+    int shape;                      /* pace interfaces at their speed */
+    uint64_t target;                /* CoDel target, ns, 0 = drop tail only */
+    uint64_t interval;              /* CoDel interval, ns */
+    int nq;
+    int rr;                         /* queue the next drain starts at */
+    uint64_t stalls;                /* times the transport pushed back */
+
+    struct sr_egress_q q[SR_EGRESS_MAX_IFS];
+};
+
+/* Put queues of depth (a power of two) frames per class in front of
+   sr->io and start the transmit thread.  Queues are created as interfaces first send.  CoDel
+   runs with target_us and interval_us unless target_us is 0; interfaces
+   with a speed are shaped to it if shape is set.  0 on success. */
+int  sr_egress_init(struct sr_instance* sr, unsigned int depth,
+                    unsigned int target_us, unsigned int interval_us,
+                    int shape);
+
+/* Class of a frame, SR_QOS_*. */
+int  sr_qos_classify(const uint8_t* buf, unsigned int len);
+
+/* Stop the transmit thread, give queued frames one last chance and free
+   what is left. */
+void sr_egress_destroy(struct sr_instance* sr);
+
+/* Send a frame or queue it behind the ones already waiting on iface.  0 if
+   it was sent or queued, -1 if it was dropped. */
+int  sr_egress_send(struct sr_instance* sr, uint8_t* buf /* lent */,
+                    unsigned int len, const char* iface /* lent */);
+
+/* Frames currently queued on iface over all classes, -1 if it has no
+   queue. */
+int  sr_egress_depth(struct sr_egress* e, const char* iface);
+
+/* Print per-interface, per-class queue counters to stderr. */
+void sr_egress_print_stats(struct sr_egress* e);
+
+#endif /* -- SR_EGRESS_H -- */
@@ -0,0 +1,606 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow.c
+ *
+ * Description:
+ *
+ * Flow accounting and IPFIX export, see sr_flow.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_flow.h"
+
+#ifndef CLOCK_REALTIME_COARSE
+#define CLOCK_REALTIME_COARSE CLOCK_REALTIME
+#endif
+
+#define SR_NSEC 1000000000ULL
+
+#define SR_IPFIX_VERSION        10
+#define SR_IPFIX_TEMPLATE_SET   2
+#define SR_IPFIX_TEMPLATE_ID    256
+#define SR_IPFIX_HDR_LEN        16
+#define SR_IPFIX_UDP_MAX        1400    /* a message per datagram, no IP fragments */
+#define SR_IPFIX_FILE_MAX       65535
+#define SR_IPFIX_TEMPLATE_MS    60000   /* templates resent this often over UDP */
+
+/* the template: information element id and length */
+static const uint16_t sr_ipfix_fields[][2] =
+{
+    {   8, 4 },                     /* sourceIPv4Address */
+    {  12, 4 },                     /* destinationIPv4Address */
+    {   7, 2 },                     /* sourceTransportPort */
+    {  11, 2 },                     /* destinationTransportPort */
+    {   4, 1 },                     /* protocolIdentifier */
+    {   6, 2 },                     /* tcpControlBits */
+    {  10, 4 },                     /* ingressInterface */
+    {  14, 4 },                     /* egressInterface */
+    {   2, 8 },                     /* packetDeltaCount */
+    {   1, 8 },                     /* octetDeltaCount */
+    { 152, 8 },                     /* flowStartMilliseconds */
+    { 153, 8 },                     /* flowEndMilliseconds */
+    { 136, 1 }                      /* flowEndReason */
+};
+#define SR_IPFIX_NFIELDS (sizeof(sr_ipfix_fields) / sizeof(sr_ipfix_fields[0]))
+#define SR_IPFIX_REC_LEN 56
+
+static void* sr_flow_thread(void* arg);
+static void sr_flow_scan(struct sr_flow_table* ft, uint64_t now, int all);
+
+static uint64_t sr_flow_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} /* -- sr_flow_now -- */
+
+/* udp:host:port as a connected socket, -1 on failure */
+static int sr_flow_connect(const char* spec)
+{
+    char host[256];
+    const char* port;
+    struct addrinfo hints, *ai;
+    int fd, err;
+
+    if ((port = strrchr(spec, ':')) == 0 || port - spec >= (int)sizeof(host)) {
+        fprintf(stderr, "Bad collector %s, want udp:host:port\n", spec);
+        return -1;
+    }
+    memcpy(host, spec, port - spec);
+    host[port - spec] = '\0';
+    port++;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if ((err = getaddrinfo(host, port, &hints, &ai)) != 0) {
+        fprintf(stderr, "Collector %s: %s\n", spec, gai_strerror(err));
+        return -1;
+    }
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket(..):sr_flow.c::sr_flow_connect(..)");
+    }
+    else if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        perror("connect(..):sr_flow.c::sr_flow_connect(..)");
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(ai);
+    return fd;
+} /* -- sr_flow_connect -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_open(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_flow_table* sr_flow_open(const char* dest, unsigned int entries,
+                                   unsigned int idle, unsigned int active,
+                                   uint32_t domain)
+{
+    struct sr_flow_table* ft;
+    uint32_t nbuckets = 1;
+
+    assert(dest);
+
+    ft = (struct sr_flow_table*)calloc(1, sizeof(struct sr_flow_table));
+    assert(ft);
+
+    if (strncmp(dest, "udp:", 4) == 0) {
+        ft->fd = sr_flow_connect(dest + 4);
+        ft->udp = 1;
+        ft->msgmax = SR_IPFIX_UDP_MAX;
+    }
+    else {
+        if ((ft->fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        { perror("open(..):sr_flow.c::sr_flow_open(..)"); }
+        ft->msgmax = SR_IPFIX_FILE_MAX;
+    }
+    if (ft->fd < 0) {
+        free(ft);
+        return 0;
+    }
+
+    /* -- a power of two of buckets -- */
+    if (entries == 0)
+    { entries = SR_FLOW_DEFAULT_ENTRIES; }
+    while (nbuckets * SR_FLOW_WAYS < entries && nbuckets < (1u << 30))
+    { nbuckets <<= 1; }
+    if (posix_memalign((void**)&ft->bucket, 64,
+                       nbuckets * sizeof(struct sr_flow_bucket)) != 0) {
+        fprintf(stderr, "No memory for %u flows\n", nbuckets * SR_FLOW_WAYS);
+        close(ft->fd);
+        free(ft);
+        return 0;
+    }
+    memset(ft->bucket, 0, nbuckets * sizeof(struct sr_flow_bucket));
+    ft->mask = nbuckets - 1;
+    ft->idle_ms = (idle ? idle : SR_FLOW_DEFAULT_IDLE) * 1000;
+    ft->active_ms = (active ? active : SR_FLOW_DEFAULT_ACTIVE) * 1000;
+    ft->domain = domain;
+    ft->msg = (uint8_t*)malloc(ft->msgmax);
+    assert(ft->msg);
+
+    pthread_mutex_init(&ft->pending_lock, NULL);
+    pthread_mutex_init(&ft->lock, NULL);
+    pthread_cond_init(&ft->cond, NULL);
+    ft->running = 1;
+
+    if (pthread_create(&ft->thread, NULL, sr_flow_thread, ft) != 0) {
+        perror("pthread_create(..):sr_flow.c::sr_flow_open(..)");
+        pthread_cond_destroy(&ft->cond);
+        pthread_mutex_destroy(&ft->lock);
+        pthread_mutex_destroy(&ft->pending_lock);
+        close(ft->fd);
+        free(ft->msg);
+        free(ft->bucket);
+        free(ft);
+        return 0;
+    }
+
+    fprintf(stderr, "Exporting flows to %s, %u entries, idle %us active %us\n",
+            dest, nbuckets * SR_FLOW_WAYS, ft->idle_ms / 1000,
+            ft->active_ms / 1000);
+    return ft;
+} /* -- sr_flow_open -- */
+
+/* a bucket's lock is only ever held for a few stores */
+static __inline__ void sr_flow_lock(struct sr_flow_bucket* b)
+{
+    while (__atomic_exchange_n(&b->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&b->lock, __ATOMIC_RELAXED))
+        { }
+    }
+} /* -- sr_flow_lock -- */
+
+static __inline__ void sr_flow_unlock(struct sr_flow_bucket* b)
+{
+    __atomic_store_n(&b->lock, 0, __ATOMIC_RELEASE);
+} /* -- sr_flow_unlock -- */
+
+/* the key words mixed murmur3 style */
+static __inline__ uint32_t sr_flow_hash_key(uint32_t src, uint32_t dst,
+                                            uint32_t ports, uint32_t proto)
+{
+    uint32_t h = src * 0xcc9e2d51u ^ dst;
+
+    h = (h ^ (h >> 16)) * 0x85ebca6bu ^ ports;
+    h = (h ^ (h >> 13)) * 0xc2b2ae35u ^ proto;
+    return h ^ (h >> 16);
+} /* -- sr_flow_hash_key -- */
+
+/* hand a record to the exporter; 0 if it had to be dropped */
+static int sr_flow_push(struct sr_flow_table* ft, const struct sr_flow_rec* rec,
+                        int reason)
+{
+    int ok = 0, wake = 0;
+
+    pthread_mutex_lock(&ft->pending_lock);
+    if (ft->npending < SR_FLOW_PENDING) {
+        ft->pending[ft->npending].rec = *rec;
+        ft->pending[ft->npending++].reason = (uint8_t)reason;
+        ft->expired[reason]++;
+        wake = ft->npending == SR_FLOW_PENDING / 2;
+        ok = 1;
+    }
+    else
+    { ft->lost++; }
+    pthread_mutex_unlock(&ft->pending_lock);
+
+    /* -- a burst of evictions would fill the list before the next tick -- */
+    if (wake) {
+        pthread_mutex_lock(&ft->lock);
+        ft->drain = 1;
+        pthread_cond_signal(&ft->cond);
+        pthread_mutex_unlock(&ft->lock);
+    }
+    return ok;
+} /* -- sr_flow_push -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_packet(..)
+ * Scope:  Global
+ *
+ * A hit is a compare of at most SR_FLOW_WAYS keys in the bucket the hash
+ * picks and four stores.  New flows take the first free way; with none
+ * free the least recently seen is swapped out and exported once the lock
+ * is dropped.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_flow_packet(struct sr_flow_table* ft, const sr_ip_hdr_t* ip /* lent */,
+                    unsigned int len, unsigned int in_if, unsigned int out_if)
+{
+    const uint8_t* l4 = (const uint8_t*)ip + ip->ip_hl * 4;
+    unsigned int hl = ip->ip_hl * 4;
+    uint16_t sport = 0, dport = 0;
+    uint8_t flags = 0;
+    struct sr_flow_bucket* b;
+    struct sr_flow_rec* rec;
+    struct sr_flow_rec* victim = 0;
+    struct sr_flow_rec old;
+    uint64_t now = sr_flow_now();
+    uint32_t at;
+    int i, evict = 0;
+
+    /* -- ports only in the first fragment -- */
+    if ((ntohs(ip->ip_off) & IP_OFFMASK) == 0) {
+        if ((ip->ip_p == ip_protocol_tcp || ip->ip_p == ip_protocol_udp) &&
+            len >= hl + 4) {
+            memcpy(&sport, l4, 2);
+            memcpy(&dport, l4 + 2, 2);
+            if (ip->ip_p == ip_protocol_tcp && len >= hl + 14)
+            { flags = l4[13]; }
+        }
+        else if (ip->ip_p == ip_protocol_icmp && len >= hl + 2)
+        { dport = htons((uint16_t)(l4[0] << 8 | l4[1])); }
+    }
+
+    b = &ft->bucket[sr_flow_hash_key(ip->ip_src, ip->ip_dst,
+                                     (uint32_t)sport << 16 | dport,
+                                     ip->ip_p) & ft->mask];
+    sr_flow_lock(b);
+    for (i = 0; i < SR_FLOW_WAYS; i++) {
+        rec = &b->rec[i];
+        if (rec->packets == 0) {
+            if (!victim || victim->packets)
+            { victim = rec; }
+            continue;
+        }
+        if (rec->src == ip->ip_src && rec->dst == ip->ip_dst &&
+            rec->sport == sport && rec->dport == dport &&
+            rec->proto == ip->ip_p) {
+            at = (uint32_t)(now > rec->first ? now - rec->first : 0);
+            rec->packets++;
+            rec->bytes += ntohs(ip->ip_len);
+            rec->tcp_flags |= flags;
+            if (at > rec->last)
+            { rec->last = at; }
+            rec->out_if = (uint8_t)out_if;
+            sr_flow_unlock(b);
+            return;
+        }
+        if (!victim || (victim->packets &&
+                        victim->first + victim->last > rec->first + rec->last))
+        { victim = rec; }
+    }
+
+    if (victim->packets) {
+        old = *victim;
+        evict = 1;
+    }
+    victim->src = ip->ip_src;
+    victim->dst = ip->ip_dst;
+    victim->sport = sport;
+    victim->dport = dport;
+    victim->proto = ip->ip_p;
+    victim->tcp_flags = flags;
+    victim->in_if = (uint8_t)in_if;
+    victim->out_if = (uint8_t)out_if;
+    victim->packets = 1;
+    victim->last = 0;
+    victim->bytes = ntohs(ip->ip_len);
+    victim->first = now;
+    sr_flow_unlock(b);
+
+    __atomic_fetch_add(&ft->created, 1, __ATOMIC_RELAXED);
+    if (evict)
+    { sr_flow_push(ft, &old, SR_FLOW_END_RESOURCES); }
+} /* -- sr_flow_packet -- */
+
+/*---------------------------------------------------------------------
+ * IPFIX encoding, all of it on the exporter thread
+ *---------------------------------------------------------------------*/
+
+static __inline__ void sr_ipfix_put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+} /* -- sr_ipfix_put16 -- */
+
+static __inline__ void sr_ipfix_put32(uint8_t* p, uint32_t v)
+{
+    sr_ipfix_put16(p, v >> 16);
+    sr_ipfix_put16(p + 2, v & 0xffff);
+} /* -- sr_ipfix_put32 -- */
+
+static __inline__ void sr_ipfix_put64(uint8_t* p, uint64_t v)
+{
+    sr_ipfix_put32(p, (uint32_t)(v >> 32));
+    sr_ipfix_put32(p + 4, (uint32_t)v);
+} /* -- sr_ipfix_put64 -- */
+
+/* close the open set, if any, writing its length */
+static void sr_ipfix_end_set(struct sr_flow_table* ft)
+{
+    if (ft->setstart) {
+        sr_ipfix_put16(ft->msg + ft->setstart + 2,
+                       (uint16_t)(ft->msglen - ft->setstart));
+        ft->setstart = 0;
+    }
+} /* -- sr_ipfix_end_set -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ipfix_flush(..)
+ * Scope:  Local
+ *
+ * Finish the message being built and write it out.  The sequence number
+ * in its header counts the data records sent before it (RFC 7011 3.1), so
+ * it is filled in here, along with the length and export time.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ipfix_flush(struct sr_flow_table* ft, uint32_t records)
+{
+    ssize_t n;
+
+    if (!ft->msglen)
+    { return; }
+    sr_ipfix_end_set(ft);
+    sr_ipfix_put16(ft->msg, SR_IPFIX_VERSION);
+    sr_ipfix_put16(ft->msg + 2, (uint16_t)ft->msglen);
+    sr_ipfix_put32(ft->msg + 4, (uint32_t)time(0));
+    sr_ipfix_put32(ft->msg + 8, ft->seq);
+    sr_ipfix_put32(ft->msg + 12, ft->domain);
+
+    n = ft->udp ? send(ft->fd, ft->msg, ft->msglen, 0) :
+                  write(ft->fd, ft->msg, ft->msglen);
+    if (n != (ssize_t)ft->msglen)
+    { ft->errors++; }
+    ft->messages++;
+    ft->seq += records;
+    ft->msglen = 0;
+} /* -- sr_ipfix_flush -- */
+
+static void sr_ipfix_template(struct sr_flow_table* ft, uint64_t now)
+{
+    uint8_t* p = ft->msg + ft->msglen;
+    unsigned int i;
+
+    sr_ipfix_put16(p, SR_IPFIX_TEMPLATE_SET);
+    sr_ipfix_put16(p + 2, (uint16_t)(8 + 4 * SR_IPFIX_NFIELDS));
+    sr_ipfix_put16(p + 4, SR_IPFIX_TEMPLATE_ID);
+    sr_ipfix_put16(p + 6, (uint16_t)SR_IPFIX_NFIELDS);
+    for (i = 0, p += 8; i < SR_IPFIX_NFIELDS; i++, p += 4) {
+        sr_ipfix_put16(p, sr_ipfix_fields[i][0]);
+        sr_ipfix_put16(p + 2, sr_ipfix_fields[i][1]);
+    }
+    ft->msglen += 8 + 4 * SR_IPFIX_NFIELDS;
+    ft->template_sent = now;
+} /* -- sr_ipfix_template -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ipfix_add(..)
+ * Scope:  Local
+ *
+ * Append a data record, starting a message (with the template when it is
+ * due: first thing in the file, every so often over UDP) and a set as
+ * needed.  *records counts the records in the message being built.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ipfix_add(struct sr_flow_table* ft, const struct sr_flow_rec* rec,
+                         int reason, uint64_t now, uint32_t* records)
+{
+    uint8_t* p;
+
+    if (ft->msglen && ft->msglen + SR_IPFIX_REC_LEN > ft->msgmax) {
+        sr_ipfix_flush(ft, *records);
+        *records = 0;
+    }
+    if (!ft->msglen) {
+        ft->msglen = SR_IPFIX_HDR_LEN;
+        if (!ft->template_sent ||
+            (ft->udp && now - ft->template_sent >= SR_IPFIX_TEMPLATE_MS))
+        { sr_ipfix_template(ft, now); }
+    }
+    if (!ft->setstart) {
+        ft->setstart = ft->msglen;
+        sr_ipfix_put16(ft->msg + ft->msglen, SR_IPFIX_TEMPLATE_ID);
+        ft->msglen += 4;
+    }
+
+    p = ft->msg + ft->msglen;
+    memcpy(p, &rec->src, 4);
+    memcpy(p + 4, &rec->dst, 4);
+    memcpy(p + 8, &rec->sport, 2);
+    memcpy(p + 10, &rec->dport, 2);
+    p[12] = rec->proto;
+    sr_ipfix_put16(p + 13, rec->tcp_flags);
+    /* -- ifIndex 0 means none, rows count from 1 -- */
+    sr_ipfix_put32(p + 15, rec->in_if + 1u);
+    sr_ipfix_put32(p + 19, rec->out_if + 1u);
+    sr_ipfix_put64(p + 23, rec->packets);
+    sr_ipfix_put64(p + 31, rec->bytes);
+    sr_ipfix_put64(p + 39, rec->first);
+    sr_ipfix_put64(p + 47, rec->first + rec->last);
+    p[55] = (uint8_t)reason;
+    ft->msglen += SR_IPFIX_REC_LEN;
+    (*records)++;
+} /* -- sr_ipfix_add -- */
+
+/* add what the packet path pushed out to the message being built */
+static void sr_flow_take_pending(struct sr_flow_table* ft, uint64_t now,
+                                 uint32_t* records)
+{
+    struct sr_flow_export pending[SR_FLOW_PENDING];
+    unsigned int npending, i;
+
+    pthread_mutex_lock(&ft->pending_lock);
+    npending = ft->npending;
+    memcpy(pending, ft->pending, npending * sizeof(pending[0]));
+    ft->npending = 0;
+    pthread_mutex_unlock(&ft->pending_lock);
+    for (i = 0; i < npending; i++)
+    { sr_ipfix_add(ft, &pending[i].rec, pending[i].reason, now, records); }
+} /* -- sr_flow_take_pending -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_scan(..)
+ * Scope:  Local
+ *
+ * Export what the packet path pushed out, then walk the table taking out
+ * expired records (every record if all), a bucket lock at a time.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_flow_scan(struct sr_flow_table* ft, uint64_t now, int all)
+{
+    struct sr_flow_export out[SR_FLOW_WAYS];
+    struct sr_flow_bucket* b;
+    struct sr_flow_rec* rec;
+    unsigned int nout, i, j;
+    uint32_t records = 0;
+    uint64_t end;
+
+    sr_flow_take_pending(ft, now, &records);
+
+    for (i = 0; i <= ft->mask; i++) {
+        b = &ft->bucket[i];
+        nout = 0;
+        sr_flow_lock(b);
+        for (j = 0; j < SR_FLOW_WAYS; j++) {
+            rec = &b->rec[j];
+            if (rec->packets == 0)
+            { continue; }
+            end = rec->first + rec->last;
+            if (all)
+            { out[nout].reason = SR_FLOW_END_FORCED; }
+            else if (now >= end + ft->idle_ms)
+            { out[nout].reason = SR_FLOW_END_IDLE; }
+            else if (now >= rec->first + ft->active_ms)
+            { out[nout].reason = SR_FLOW_END_ACTIVE; }
+            else
+            { continue; }
+            out[nout++].rec = *rec;
+            rec->packets = 0;
+        }
+        sr_flow_unlock(b);
+        for (j = 0; j < nout; j++) {
+            ft->expired[out[j].reason]++;
+            sr_ipfix_add(ft, &out[j].rec, out[j].reason, now, &records);
+        }
+    }
+    sr_ipfix_flush(ft, records);
+} /* -- sr_flow_scan -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_thread(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_flow_thread(void* arg)
+{
+    struct sr_flow_table* ft = (struct sr_flow_table*)arg;
+    struct timespec ts;
+    uint32_t records;
+    int tick = 1;
+
+    pthread_mutex_lock(&ft->lock);
+    while (ft->running) {
+        /* -- being woken for the pending list doesn't move the walk -- */
+        if (tick) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += SR_FLOW_TICK_MS * 1000000L;
+            while (ts.tv_nsec >= (long)SR_NSEC) {
+                ts.tv_sec++;
+                ts.tv_nsec -= SR_NSEC;
+            }
+        }
+        tick = 0;
+        if (!ft->drain) {
+            tick = pthread_cond_timedwait(&ft->cond, &ft->lock, &ts) ==
+                   ETIMEDOUT;
+        }
+        if (!ft->running)
+        { break; }
+        ft->drain = 0;
+        pthread_mutex_unlock(&ft->lock);
+        if (tick)
+        { sr_flow_scan(ft, sr_flow_now(), 0); }
+        else {
+            records = 0;
+            sr_flow_take_pending(ft, sr_flow_now(), &records);
+            sr_ipfix_flush(ft, records);
+        }
+        pthread_mutex_lock(&ft->lock);
+    }
+    pthread_mutex_unlock(&ft->lock);
+
+    /* -- forwarding has stopped; export what is left -- */
+    sr_flow_scan(ft, sr_flow_now(), 1);
+    return 0;
+} /* -- sr_flow_thread -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_close(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_flow_close(struct sr_flow_table* ft)
+{
+    if (!ft)
+    { return; }
+
+    pthread_mutex_lock(&ft->lock);
+    ft->running = 0;
+    pthread_cond_signal(&ft->cond);
+    pthread_mutex_unlock(&ft->lock);
+    pthread_join(ft->thread, NULL);
+
+    fprintf(stderr, "flows: %llu created, exported %llu idle, %llu active, "
+            "%llu at exit, %llu pushed out of full buckets, %llu lost; "
+            "%u records in %llu messages, %llu failed\n",
+            (unsigned long long)ft->created,
+            (unsigned long long)ft->expired[SR_FLOW_END_IDLE],
+            (unsigned long long)ft->expired[SR_FLOW_END_ACTIVE],
+            (unsigned long long)ft->expired[SR_FLOW_END_FORCED],
+            (unsigned long long)ft->expired[SR_FLOW_END_RESOURCES],
+            (unsigned long long)ft->lost, ft->seq,
+            (unsigned long long)ft->messages,
+            (unsigned long long)ft->errors);
+
+    close(ft->fd);
+    pthread_cond_destroy(&ft->cond);
+    pthread_mutex_destroy(&ft->lock);
+    pthread_mutex_destroy(&ft->pending_lock);
+    free(ft->msg);
+    free(ft->bucket);
+    free(ft);
+} /* -- sr_flow_close -- */
@@ -0,0 +1,143 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow.h
+ *
+ * Description:
+ *
+ * Flow accounting (-X), IPFIX style.  Every forwarded IPv4 packet is
+ * counted against its 5-tuple (addresses, protocol, ports or ICMP
+ * type/code) in a fixed-size table: packets, bytes, first and last seen,
+ * TCP flags and the interfaces it came in and left by.
+ *
+ * The table is open addressing with buckets of SR_FLOW_WAYS records, each
+ * bucket two cache lines holding its own lock, so a packet costs one hash,
+ * one bucket's lines and an uncontended lock; flows are sent to a worker
+ * by their hash (sr_dispatch.h), so two threads rarely want the same
+ * bucket.  A packet whose bucket is full pushes out the record seen least
+ * recently, which is exported early rather than lost; once half of
+ * SR_FLOW_PENDING such records wait, the exporter is woken to send them
+ * without waiting for its next walk.
+ *
+ * An exporter thread walks the table every second and takes out the
+ * records idle for longer than the idle timeout or active for longer than
+ * the active timeout, writing them as IPFIX (RFC 7011) messages either to
+ * a file (RFC 5655, one message after another) or to a collector over UDP,
+ * templates included.  What is left is exported when the router stops.
+ *
+ * Fragments after the first carry no ports and are counted as a flow of
+ * their own with ports 0.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLOW_H
+#define SR_FLOW_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#include "sr_protocol.h"
+
+#define SR_FLOW_WAYS            3       /* records per bucket */
+#define SR_FLOW_DEFAULT_ENTRIES 49152   /* 16384 buckets, 2MB */
+#define SR_FLOW_DEFAULT_IDLE    15      /* seconds */
+#define SR_FLOW_DEFAULT_ACTIVE  60      /* seconds */
+#define SR_FLOW_TICK_MS         1000    /* between scans of the table */
+#define SR_FLOW_PENDING         1024    /* pushed out records awaiting export */
+
+/* flowEndReason */
+#define SR_FLOW_END_IDLE        1
+#define SR_FLOW_END_ACTIVE      2
+#define SR_FLOW_END_FORCED      4       /* the router stopped */
+#define SR_FLOW_END_RESOURCES   5       /* pushed out of a full bucket */
+
+/* one flow, 40 bytes; free while packets is 0 */
+struct sr_flow_rec
+{
+    uint32_t src;                   /* network order */
+    uint32_t dst;
+    uint16_t sport;                 /* network order; ICMP: 0 */
+    uint16_t dport;                 /* ICMP: type << 8 | code */
+    uint8_t  proto;
+    uint8_t  tcp_flags;             /* every flag seen */
+    uint8_t  in_if;                 /* sr_stats interface rows */
+    uint8_t  out_if;
+    uint32_t packets;
+    uint32_t last;                  /* ms after first */
+    uint64_t bytes;                 /* IP bytes */
+    uint64_t first;                 /* CLOCK_REALTIME ms */
+};
+
+/* two cache lines */
+struct sr_flow_bucket
+{
+    uint32_t lock;
+    uint32_t pad;
+    struct sr_flow_rec rec[SR_FLOW_WAYS];
+} __attribute__ ((aligned (64)));
+
+/* a record on its way out */
+struct sr_flow_export
+{
+    struct sr_flow_rec rec;
+    uint8_t reason;                 /* SR_FLOW_END_* */
+};
+
+struct sr_flow_table
+{
+    struct sr_flow_bucket* bucket;
+    uint32_t mask;                  /* buckets - 1 */
+    uint32_t idle_ms;
+    uint32_t active_ms;
+
+    /* -- pushed out by the packet path, the exporter drains them -- */
+    pthread_mutex_t pending_lock;
+    struct sr_flow_export pending[SR_FLOW_PENDING];
+    unsigned int npending;
+
+    /* -- the exporter's alone -- */
+    int fd;
+    int udp;                        /* resend templates now and then */
+    uint32_t domain;                /* observation domain */
+    uint32_t seq;                   /* data records sent */
+    uint8_t* msg;
+    unsigned int msgmax;
+    unsigned int msglen;            /* 0 while no message is started */
+    unsigned int setstart;          /* offset of the open data set, 0 none */
+    uint64_t template_sent;         /* ms, 0 never */
+
+    pthread_mutex_t lock;           /* only for sleeping and waking */
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+    int drain;                      /* pending half full, export it now */
+
+    uint64_t created;               /* flows */
+    uint64_t expired[SR_FLOW_END_RESOURCES + 1];
+    uint64_t lost;                  /* pushed out with pending full */
+    uint64_t messages;
+    uint64_t errors;                /* messages the file or socket refused */
+};
+
+/* Open dest, a file or udp:host:port for a collector, for IPFIX
+   export from observation domain domain and start the exporter for a
+   table of at least entries flows (0 for the default), expiring them
+   after idle or active seconds (0 for the defaults).  0 on failure. */
+struct sr_flow_table* sr_flow_open(const char* dest, unsigned int entries,
+                                   unsigned int idle, unsigned int active,
+                                   uint32_t domain);
+
+/* Count a forwarded IP packet, of which len bytes are at hand, that came
+   in on interface row in_if and leaves by row out_if. */
+void sr_flow_packet(struct sr_flow_table* ft, const sr_ip_hdr_t* ip /* lent */,
+                    unsigned int len, unsigned int in_if, unsigned int out_if);
+
+/* Export every flow, print the counters and close dest. */
+void sr_flow_close(struct sr_flow_table* ft);
+
+#endif /* -- SR_FLOW_H -- */
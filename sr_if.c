@@ -24,6 +24,7 @@
 
 #include "sr_if.h"
 #include "sr_router.h"
+#include "sr_stats.h"
 
 
 /*--------------------------------------------------------------------- 
@@ -94,10 +95,12 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     /* -- empty list special case -- */
     if(sr->if_list == 0)
     {
-        sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
+        sr->if_list = (struct sr_if*)calloc(1,sizeof(struct sr_if));
         assert(sr->if_list);
         sr->if_list->next = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
+        sr->if_list->mtu = SR_DEFAULT_MTU;
+        sr->if_list->stats = sr_stats_if_index(name);
         return;
     }
 
@@ -106,10 +109,12 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     while(if_walker->next)
     {if_walker = if_walker->next; }
 
-    if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
+    if_walker->next = (struct sr_if*)calloc(1,sizeof(struct sr_if));
     assert(if_walker->next);
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
+    if_walker->mtu = SR_DEFAULT_MTU;
+    if_walker->stats = sr_stats_if_index(name);
     if_walker->next = 0;
 } /* -- sr_add_interface -- */ 
 
@@ -137,6 +142,29 @@ void sr_set_ether_addr(struct sr_instance* sr, const unsigned char* addr)
 
 } /* -- sr_set_ether_addr -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_set_ether_speed(..)
+ * Scope: Global
+ *
+ * set the speed (Mbit/s) of the LAST interface in the interface list
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_set_ether_speed(struct sr_instance* sr, uint32_t speed)
+{
+    struct sr_if* if_walker = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr->if_list);
+
+    if_walker = sr->if_list;
+    while(if_walker->next)
+    {if_walker = if_walker->next; }
+
+    if_walker->speed = speed;
+
+} /* -- sr_set_ether_speed -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_set_ether_ip(..)
  * Scope: Global
@@ -161,6 +189,143 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
 
 } /* -- sr_set_ether_ip -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_load_if(..)
+ * Scope: Global
+ *
+ * Read the interface list from a file instead of getting it from the
+ * server (HWINFO).  One interface per line, '#' starts a comment:
+ *
+ *     eth1 10.0.1.1 00:11:22:33:44:01 [speed [mtu]]
+ *
+ * speed is in Mbit/s, 0 (the default) leaves the interface unshaped.
+ *
+ * Returns 0 on success, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_load_if(struct sr_instance* sr, const char* filename)
+{
+    FILE* fp;
+    char  line[BUFSIZ];
+    char  name[32];
+    char  ip[32];
+    char  mac[32];
+    unsigned int m[ETHER_ADDR_LEN];
+    unsigned char addr[ETHER_ADDR_LEN];
+    unsigned long speed, mtu;
+    struct in_addr ip_addr;
+    int i, n, lineno = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(filename);
+
+    if( (fp = fopen(filename,"r")) == 0)
+    {
+        perror("fopen(..):sr_if.c::sr_load_if(..)");
+        return -1;
+    }
+
+    while( fgets(line,BUFSIZ,fp) != 0)
+    {
+        lineno++;
+        if(strchr(line,'#'))
+        { *strchr(line,'#') = '\0'; }
+
+        speed = 0;
+        mtu = SR_DEFAULT_MTU;
+        n = sscanf(line,"%31s %31s %31s %lu %lu",name,ip,mac,&speed,&mtu);
+        if(n <= 0)
+        { continue; }
+
+        if(n < 3 || inet_aton(ip,&ip_addr) == 0 ||
+           sscanf(mac,"%x:%x:%x:%x:%x:%x",&m[0],&m[1],&m[2],&m[3],&m[4],&m[5])
+           != ETHER_ADDR_LEN || mtu < SR_MIN_MTU || mtu > SR_MAX_MTU)
+        {
+            fprintf(stderr,"%s:%d: expected <name> <ip> <mac> [speed [mtu]]\n",
+                    filename,lineno);
+            fclose(fp);
+            return -1;
+        }
+        for(i = 0; i < ETHER_ADDR_LEN; i++)
+        { addr[i] = (unsigned char)m[i]; }
+
+        sr_add_interface(sr,name);
+        sr_set_ether_addr(sr,addr);
+        sr_set_ether_ip(sr,ip_addr.s_addr);
+        sr_get_interface(sr,name)->speed = (uint32_t)speed;
+        sr_get_interface(sr,name)->mtu = (uint32_t)mtu;
+    } /* -- while -- */
+
+    fclose(fp);
+    return 0;
+} /* -- sr_load_if -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_set_if_mtu(..)
+ * Scope: Global
+ *
+ * Apply a -m spec: either one MTU for every interface ("9000") or a
+ * comma separated list of name=mtu ("eth1=9000,eth2=1500").
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_set_if_mtu(struct sr_instance* sr, const char* spec)
+{
+    struct sr_if* if_walker = 0;
+    char* list;
+    char* tok;
+    char* val;
+    char* end;
+    unsigned long mtu;
+    int ret = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(spec);
+
+    list = strdup(spec);
+    assert(list);
+
+    for(tok = strtok(list,","); tok && ret == 0; tok = strtok(0,","))
+    {
+        if_walker = 0;
+        if((val = strchr(tok,'=')) != 0)
+        {
+            *val++ = '\0';
+            if((if_walker = sr_get_interface(sr,tok)) == 0)
+            {
+                fprintf(stderr,"-m: no interface %s\n",tok);
+                ret = -1;
+                break;
+            }
+        }
+        else
+        { val = tok; }
+
+        mtu = strtoul(val,&end,10);
+        if(*end || mtu < SR_MIN_MTU || mtu > SR_MAX_MTU)
+        {
+            fprintf(stderr,"-m: bad mtu %s, must be %d to %d\n",
+                    val,SR_MIN_MTU,SR_MAX_MTU);
+            ret = -1;
+            break;
+        }
+
+        if(if_walker)
+        { if_walker->mtu = (uint32_t)mtu; }
+        else
+        {
+            for(if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+            { if_walker->mtu = (uint32_t)mtu; }
+        }
+    }
+
+    free(list);
+    return ret;
+} /* -- sr_set_if_mtu -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_print_if_list(..)
  * Scope: Global
@@ -212,4 +377,7 @@ void sr_print_if(struct sr_if* iface)
     DebugMAC(iface->addr);
     Debug("\n");
     Debug("\tinet addr %s\n",inet_ntoa(ip_addr));
+    Debug("\tmtu %u\n",iface->mtu);
+    if(iface->speed)
+    { Debug("\tspeed %u Mbit/s\n",iface->speed); }
 } /* -- sr_print_if -- */
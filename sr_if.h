@@ -40,7 +40,9 @@ struct sr_if
   char name[sr_IFACE_NAMELEN];
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
-  uint32_t speed;
+  uint32_t speed; /* Mbit/s from HWSPEED, 0 if unknown */
+  uint32_t mtu;   /* IP bytes per frame, SR_DEFAULT_MTU unless configured */
+  unsigned int stats; /* row of its counters in sr_stats */
   struct sr_if* next;
 };
 
@@ -49,6 +51,9 @@ struct sr_if* sr_get_interface_by_ip(struct sr_instance* sr,uint32_t _ip);
 void sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
+void sr_set_ether_speed(struct sr_instance*, uint32_t speed);
+int sr_load_if(struct sr_instance*, const char* filename);
+int sr_set_if_mtu(struct sr_instance*, const char* spec);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
 
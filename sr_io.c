@@ -0,0 +1,270 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_io.c
+ *
+ * Description:
+ *
+ * Backend independent half of packet I/O: backend lookup, the common
+ * receive path and the sanity checks and logging done on every send.
+ * Most of this used to live in sr_vns_comm.c.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "sr_capture.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_dispatch.h"
+#include "sr_egress.h"
+#include "sr_io.h"
+#include "sr_stats.h"
+
+static const struct sr_io_ops* sr_io_backends[] =
+{
+    &sr_io_vns,
+    &sr_io_uring,
+    &sr_io_afpacket,
+    &sr_io_pcap,
+    &sr_io_shm,
+    0
+};
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_io_find(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+const struct sr_io_ops* sr_io_find(const char* name)
+{
+    int i;
+
+    assert(name);
+
+    for ( i = 0; sr_io_backends[i]; i++ )
+    {
+        if ( strcmp(sr_io_backends[i]->name, name) == 0 )
+        { return sr_io_backends[i]; }
+    }
+    return 0;
+} /* -- sr_io_find -- */
+
+static int sr_arp_req_not_for_us(struct sr_if* iface,
+                                 uint8_t * packet /* lent */,
+                                 unsigned int len);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_io_deliver(..)
+ * Scope: Global
+ *
+ * Every backend funnels received frames through here.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_io_deliver(struct sr_instance* sr, uint8_t* packet /* lent */,
+                   unsigned int len, char* iface /* lent */)
+{
+    struct sr_if* ifc = sr_get_interface(sr, iface);
+
+    SR_PROBE3(receive, iface, packet, len);
+
+    if ( ifc )
+    { SR_STATS_RX(ifc->stats, len); }
+
+    /* -- check if it is an ARP to another router if so drop   -- */
+    if ( ifc && sr_arp_req_not_for_us(ifc, packet, len) )
+    {
+        SR_SKETCH_SOURCE(((sr_arp_hdr_t*)(packet +
+                          sizeof(sr_ethernet_hdr_t)))->ar_sip);
+        SR_STATS_DROP(SR_DROP_ARP_NOT_US);
+        SR_SKETCH_SOURCE(0);
+        return;
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, packet, len, iface, SR_CAP_IN);
+
+    /* -- hand to the worker owning the flow, if any -- */
+    if ( sr->dispatch )
+    {
+        sr_dispatch_packet(sr, packet, len, iface);
+        return;
+    }
+
+    /* -- pass to router, student's code should take over here -- */
+    sr_handlepacket(sr, packet, len, iface);
+} /* -- sr_io_deliver -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_ether_addrs_match_interface(..)
+ * Scope: Local
+ *
+ * Make sure ethernet addresses are sane so we don't muck uo the system.
+ * Returns the interface, 0 if they aren't.
+ *
+ *----------------------------------------------------------------------------*/
+
+static struct sr_if*
+sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
+                                uint8_t* buf, /* borrowed */
+                                const char* name /* borrowed */ )
+{
+    struct sr_ethernet_hdr* ether_hdr = 0;
+    struct sr_if* iface = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(buf);
+    assert(name);
+
+    ether_hdr = (struct sr_ethernet_hdr*)buf;
+    iface = sr_get_interface(sr, name);
+
+    if ( iface == 0 ){
+        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
+        return 0;
+    }
+
+    if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
+        fprintf( stderr, "** Error, source address does not match interface\n");
+        return 0;
+    }
+
+    /* TODO */
+    /* Check destination, hardware address.  If it is private (i.e. destined
+     * to a virtual interface) ensure it is going to the correct topology
+     * Note: This check should really be done server side ...
+     */
+
+    return iface;
+
+} /* -- sr_ether_addrs_match_interface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet(..)
+ * Scope: Global
+ *
+ * Send a packet (ethernet header included!) of length 'len' out of
+ * interface 'iface' through whichever I/O backend is active.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet(struct sr_instance* sr /* borrowed */,
+                         uint8_t* buf /* borrowed */ ,
+                         unsigned int len,
+                         const char* iface /* borrowed */)
+{
+    struct sr_if* ifc = 0;
+    int tries;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->io);
+    assert(buf);
+    assert(iface);
+
+    SR_PROBE3(send, iface, buf, len);
+
+    /* don't waste my time ... */
+    if ( len < sizeof(struct sr_ethernet_hdr) ){
+        fprintf(stderr , "** Error: packet is wayy to short \n");
+        SR_STATS_DROP(SR_DROP_RUNT);
+        return -1;
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, buf, len, iface, SR_CAP_OUT);
+
+    if ( (ifc = sr_ether_addrs_match_interface( sr, buf, iface)) == 0 ){
+        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
+        SR_STATS_DROP(SR_DROP_BAD_SOURCE);
+        return -1;
+    }
+
+    SR_PKTRACE(SR_PT_SEND, len, 0, ifc->stats);
+
+    if ( sr->egress )
+    { return sr_egress_send(sr, buf, len, iface); }
+
+    /* -- no queues, a frame the transport can't take right now is lost -- */
+    switch ( sr->io->send(sr, buf, len, iface) )
+    {
+        case SR_IO_PARTIAL:
+            /* -- nobody else will push the rest out, wait a while for it;
+                  what is still left then goes ahead of the next send -- */
+            for ( tries = 0; sr->io->tx_flush && tries < SR_IO_FLUSH_TRIES;
+                  tries++ )
+            {
+                if ( sr->io->tx_flush(sr, SR_EGRESS_WAIT_MS) )
+                { break; }
+            }
+            if ( tries == SR_IO_FLUSH_TRIES )
+            {
+                SR_STATS_DROP(SR_DROP_TX_ERROR);
+                return -1;
+            }
+            /* fall through */
+        case 0:
+            SR_STATS_TX(ifc->stats, len);
+            return 0;
+        case SR_IO_DROPPED:
+            return -1;
+        default:
+            SR_STATS_DROP(SR_DROP_TX_ERROR);
+            return -1;
+    }
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_packet()
+ * Scope: Global
+ *
+ * Only stamps and copies the frame; sr_capture's writer thread does the
+ * file I/O.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len,
+                   const char* iface, int dir)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    if(!sr->capture)
+    {return; }
+
+    sr_capture_packet(sr->capture, buf, len, iface, dir);
+} /* -- sr_log_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_req_not_for_us()
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_arp_req_not_for_us(struct sr_if* iface,
+                                 uint8_t * packet /* lent */,
+                                 unsigned int len)
+{
+    struct sr_ethernet_hdr* e_hdr = 0;
+    struct sr_arp_hdr*       a_hdr = 0;
+
+    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
+    { return 0; }
+
+    assert(iface);
+
+    e_hdr = (struct sr_ethernet_hdr*)packet;
+    a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+
+    if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
+            (a_hdr->ar_op      == htons(arp_op_request))   &&
+            (a_hdr->ar_tip     != iface->ip ) )
+    { return 1; }
+
+    return 0;
+} /* -- sr_arp_req_not_for_us -- */
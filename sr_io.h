@@ -0,0 +1,88 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io.h
+ *
+ * Description:
+ *
+ * Pluggable packet I/O.  sr_send_packet() and the main receive loop no
+ * longer talk to the VNS socket directly; they go through the backend
+ * hanging off sr->io.  A backend moves whole Ethernet frames and names the
+ * interface each one belongs to; everything above it (logging, dispatch to
+ * workers, sr_handlepacket) is shared.
+ *
+ *   vns       the original VNS TCP protocol (sr_vns_comm.c)
+ *   uring     the VNS protocol over io_uring (sr_uring.c)
+ *   afpacket  Linux AF_PACKET with TPACKET_V3 mmap rings (sr_afpacket.c)
+ *   pcap      offline replay of pcap files (sr_pcap_replay.c)
+ *   shm       shared memory rings to a local packet source (sr_shm_io.c)
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_IO_H
+#define SR_IO_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+
+/* send() results besides 0 (sent) and -1 (dropped) */
+#define SR_IO_BUSY     1   /* not taken, transport full; retry after tx_flush */
+#define SR_IO_PARTIAL  2   /* taken, but only partly written; tx_flush ends it */
+#define SR_IO_DROPPED  3   /* dropped, and counted, by the backend itself */
+
+#define SR_IO_FLUSH_TRIES 10   /* tx_flush waits for a partial frame, no queues */
+
+struct sr_io_ops
+{
+    const char* name;
+
+    /* Bring the backend up.  arg is the backend specific -i argument.  On
+       return the interface list must be populated.  NULL for backends that
+       are set up by their own handshake (vns). */
+    int  (*open)(struct sr_instance* sr, const char* arg);
+
+    /* Put one frame on the wire without blocking.  0 on success, -1 if it
+       was dropped, SR_IO_DROPPED if it was dropped and the reason already
+       counted, SR_IO_BUSY or SR_IO_PARTIAL when the transport can't keep
+       up (see sr_egress.h). */
+    int  (*send)(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                 const char* iface);
+
+    /* One round of the receive loop: read whatever is ready and hand it to
+       sr_io_deliver().  1 to keep going, 0 on orderly close, -1 on error. */
+    int  (*poll)(struct sr_instance* sr);
+
+    void (*close)(struct sr_instance* sr);
+
+    /* Wait up to timeout_ms for the transport to have room, finishing any
+       partly written frame.  1 if there is room now, 0 if not.  NULL if
+       the backend can't wait for room; it is then just retried. */
+    int  (*tx_flush)(struct sr_instance* sr, int timeout_ms);
+};
+
+extern const struct sr_io_ops sr_io_vns;
+extern const struct sr_io_ops sr_io_uring;
+extern const struct sr_io_ops sr_io_afpacket;
+extern const struct sr_io_ops sr_io_pcap;
+extern const struct sr_io_ops sr_io_shm;
+
+/* Look a backend up by name, 0 if there is none. */
+const struct sr_io_ops* sr_io_find(const char* name);
+
+/* Common receive path for every backend: drop ARP requests for other
+   hosts, log, then hand to the worker owning the flow or to
+   sr_handlepacket() directly.  The frame is only lent. */
+void sr_io_deliver(struct sr_instance* sr, uint8_t* packet, unsigned int len,
+                   char* iface);
+
+/* Hand one frame seen on iface in direction dir (SR_CAP_IN, SR_CAP_OUT) to
+   the -l capture (no-op without one). */
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len,
+                   const char* iface, int dir);
+
+#endif /* -- SR_IO_H -- */
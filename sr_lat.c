@@ -0,0 +1,209 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_lat.c
+ *
+ * Description:
+ *
+ * Stage latency histograms, see sr_lat.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sr_lat.h"
+#include "sr_stats.h"
+#include "sr_pmu.h"
+
+#define SR_NSEC 1000000000ULL
+
+const char* sr_lat_stage_names[SR_LAT_NSTAGES] =
+{ "parse", "cksum", "route", "arp", "send" };
+
+const char* sr_lat_path_names[SR_LAT_NPATHS] =
+{ "", "forwarded", "to_me", "arp_queued" };
+
+unsigned int sr_lat_every = 0;
+__thread struct sr_lat_pkt sr_lat_self;
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_init(..)
+ * Scope:  Global
+ *
+ * The TSC ticks at a constant rate on anything recent (constant_tsc), it
+ * only has to be measured once against CLOCK_MONOTONIC.
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_lat_init(unsigned int every)
+{
+    uint64_t hz = SR_NSEC;
+#ifdef SR_LAT_HAVE_TSC
+    struct timespec a, b, nap;
+    uint64_t ta, tb, ns;
+
+    nap.tv_sec = 0;
+    nap.tv_nsec = 20000000;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    ta = sr_lat_now();
+    nanosleep(&nap, 0);
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    tb = sr_lat_now();
+    ns = (uint64_t)(b.tv_sec - a.tv_sec) * SR_NSEC + b.tv_nsec - a.tv_nsec;
+    hz = ns ? (tb - ta) * SR_NSEC / ns : SR_NSEC;
+#endif
+
+    sr_stats_set_lat(every, hz);
+    sr_lat_every = every;
+    return hz;
+} /* -- sr_lat_init -- */
+
+void sr_lat_begin(void)
+{
+    struct sr_lat_pkt* p = &sr_lat_self;
+
+    p->skip = sr_lat_every - 1;
+    if (!p->slot)
+    { p->slot = sr_stats_lat_slot(); }
+    p->on = 1;
+    p->path = SR_LAT_NONE;
+    p->next = SR_LAT_PARSE;
+    p->start = p->last = sr_lat_now();
+    if (sr_pmu_on)
+    { sr_pmu_begin(); }
+} /* -- sr_lat_begin -- */
+
+void sr_lat_mark(int stage)
+{
+    struct sr_lat_pkt* p = &sr_lat_self;
+    uint64_t now;
+
+    if (stage < p->next)
+    { return; }
+    if (stage >= SR_LAT_ARP && p->path != SR_LAT_FORWARDED)
+    { return; }
+
+    now = sr_lat_now();
+    p->slot->stage[stage].count[sr_lat_bucket(now - p->last)]++;
+    p->last = now;
+    p->next = stage + 1;
+    if (sr_pmu_on)
+    { sr_pmu_mark(stage); }
+} /* -- sr_lat_mark -- */
+
+void sr_lat_path(int path)
+{
+    struct sr_lat_pkt* p = &sr_lat_self;
+
+    /* -- a later fragment, or ICMP sent on the way, missing in the cache -- */
+    if (path == SR_LAT_ARP_QUEUED &&
+        (p->path != SR_LAT_FORWARDED || p->next > SR_LAT_SEND))
+    { return; }
+    p->path = path;
+} /* -- sr_lat_path -- */
+
+void sr_lat_end(void)
+{
+    struct sr_lat_pkt* p = &sr_lat_self;
+
+    if (p->path != SR_LAT_NONE) {
+        p->slot->path[p->path].count[sr_lat_bucket(sr_lat_now() - p->start)]++;
+        if (sr_pmu_on)
+        { sr_pmu_end(p->path); }
+    }
+    p->on = 0;
+} /* -- sr_lat_end -- */
+
+/* upper edge of bucket i, in ticks */
+static uint64_t sr_lat_value(unsigned int i)
+{
+    unsigned int shift;
+
+    if (i < SR_LAT_SUB)
+    { return i; }
+    shift = (i >> SR_LAT_SUB_BITS) - 1;
+    return (((uint64_t)(SR_LAT_SUB + (i & (SR_LAT_SUB - 1)) + 1)) << shift) - 1;
+} /* -- sr_lat_value -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_percentile(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_lat_percentile(const struct sr_lat_hist* h, double p)
+{
+    uint64_t total = 0, seen = 0, want;
+    unsigned int i;
+
+    for (i = 0; i < SR_LAT_NBUCKETS; i++)
+    { total += h->count[i]; }
+    if (!total)
+    { return 0; }
+
+    want = (uint64_t)(p * total + 0.5);
+    if (want < 1)
+    { want = 1; }
+    for (i = 0; i < SR_LAT_NBUCKETS; i++) {
+        seen += h->count[i];
+        if (seen >= want)
+        { break; }
+    }
+    return sr_lat_value(i < SR_LAT_NBUCKETS ? i : SR_LAT_NBUCKETS - 1);
+} /* -- sr_lat_percentile -- */
+
+static void sr_lat_print_hist(FILE* out, const char* name,
+                              const struct sr_lat_hist* h, uint64_t hz)
+{
+    static const double pct[] = { 0.50, 0.90, 0.99, 0.999, 1.0 };
+    uint64_t total = 0;
+    double ns = 1e9 / (double)hz;
+    unsigned int i;
+
+    for (i = 0; i < SR_LAT_NBUCKETS; i++)
+    { total += h->count[i]; }
+    fprintf(out, "%-11s %10llu", name, (unsigned long long)total);
+    for (i = 0; total && i < sizeof(pct) / sizeof(pct[0]); i++)
+    { fprintf(out, " %9.0f", sr_lat_percentile(h, pct[i]) * ns); }
+    fprintf(out, "\n");
+} /* -- sr_lat_print_hist -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_print(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_lat_print(FILE* out, const struct sr_lat_slot* slots,
+                  unsigned int nslots, uint64_t hz)
+{
+    struct sr_lat_hist* sum;
+    unsigned int s, i;
+    int k;
+
+    if ((sum = (struct sr_lat_hist*)malloc(sizeof(*sum))) == 0)
+    { return; }
+
+    fprintf(out, "\nLATENCY(ns)    SAMPLES       P50       P90       P99     "
+            "P99.9       MAX\n");
+    fprintf(out, "-------------------------------------------------------"
+            "-------------------\n");
+    for (k = 0; k < SR_LAT_NSTAGES; k++) {
+        memset(sum, 0, sizeof(*sum));
+        for (s = 0; s < nslots; s++) {
+            for (i = 0; i < SR_LAT_NBUCKETS; i++)
+            { sum->count[i] += slots[s].stage[k].count[i]; }
+        }
+        sr_lat_print_hist(out, sr_lat_stage_names[k], sum, hz);
+    }
+    for (k = SR_LAT_NONE + 1; k < SR_LAT_NPATHS; k++) {
+        memset(sum, 0, sizeof(*sum));
+        for (s = 0; s < nslots; s++) {
+            for (i = 0; i < SR_LAT_NBUCKETS; i++)
+            { sum->count[i] += slots[s].path[k].count[i]; }
+        }
+        sr_lat_print_hist(out, sr_lat_path_names[k], sum, hz);
+    }
+    free(sum);
+} /* -- sr_lat_print -- */
@@ -0,0 +1,180 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_lat.h
+ *
+ * Description:
+ *
+ * Where the time goes inside sr_handlepacket.  With -H n, one packet in n
+ * (per thread) is timestamped with the TSC at each stage boundary:
+ *
+ *     parse   ethernet and IP header checks
+ *     cksum   IP header checksum
+ *     route   local address check, TTL, sr_LPM
+ *     arp     ARP cache lookup of the next hop
+ *     send    sr_send_packet: capture, egress queues, backend
+ *
+ * and the cycles each stage took go into a histogram, as does the whole
+ * packet's time in one per path: forwarded, to the router (answered with
+ * ICMP) or parked waiting for ARP.  Histograms are HDR style, log-linear
+ * with SR_LAT_SUB buckets per power of two (about 6% resolution), counts
+ * only, so recording is an index computation and an increment.
+ *
+ * The histograms live in the sr_stats region, one set per thread next to
+ * its counters, so there is nothing to lock and srstat -l can print
+ * percentiles while the router runs; they are also printed on exit.
+ *
+ * A timestamp costs 15-25ns under virtualization, which is why not every
+ * packet is timed: at -H 8 the average added cost stays under 20ns.
+ * Packets that aren't sampled pay a countdown on a thread local.
+ *
+ * With -P the sampled packets also read hardware counters at the same
+ * boundaries, see sr_pmu.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LAT_H
+#define SR_LAT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+#include <time.h>
+
+/* stages, in the order a forwarded packet goes through them */
+#define SR_LAT_PARSE      0
+#define SR_LAT_CKSUM      1
+#define SR_LAT_ROUTE      2
+#define SR_LAT_ARP        3
+#define SR_LAT_SEND       4
+#define SR_LAT_NSTAGES    5
+
+/* how the packet left sr_handlepacket */
+#define SR_LAT_NONE       0         /* dropped or ARP, not recorded */
+#define SR_LAT_FORWARDED  1
+#define SR_LAT_TO_ME      2
+#define SR_LAT_ARP_QUEUED 3
+#define SR_LAT_NPATHS     4
+
+#define SR_LAT_SUB_BITS   4
+#define SR_LAT_SUB        (1 << SR_LAT_SUB_BITS)
+#define SR_LAT_MAX_BITS   36        /* 2^36 cycles, ~20s, is the last bucket */
+#define SR_LAT_NBUCKETS   ((SR_LAT_MAX_BITS - SR_LAT_SUB_BITS + 1) << SR_LAT_SUB_BITS)
+
+#define SR_LAT_DEFAULT_EVERY 8
+
+struct sr_lat_hist
+{
+    uint64_t count[SR_LAT_NBUCKETS];
+};
+
+/* one thread's histograms */
+struct sr_lat_slot
+{
+    struct sr_lat_hist stage[SR_LAT_NSTAGES];
+    struct sr_lat_hist path[SR_LAT_NPATHS];
+};
+
+/* the packet the thread is timing */
+struct sr_lat_pkt
+{
+    int on;                         /* this packet is sampled */
+    int path;                       /* SR_LAT_* path so far */
+    int next;                       /* first stage still to be marked */
+    unsigned int skip;              /* packets until the next sample */
+    uint64_t start;
+    uint64_t last;                  /* previous stage boundary */
+    struct sr_lat_slot* slot;
+};
+
+extern const char* sr_lat_stage_names[SR_LAT_NSTAGES];
+extern const char* sr_lat_path_names[SR_LAT_NPATHS];
+
+/* time 1 in this many packets, 0 = off */
+extern unsigned int sr_lat_every;
+extern __thread struct sr_lat_pkt sr_lat_self;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SR_LAT_HAVE_TSC 1
+static __inline__ uint64_t sr_lat_now(void)
+{
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+#else
+static __inline__ uint64_t sr_lat_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static __inline__ unsigned int sr_lat_bucket(uint64_t v)
+{
+    unsigned int msb, shift;
+
+    if (v < SR_LAT_SUB)
+    { return (unsigned int)v; }
+    msb = 63 - __builtin_clzll(v);
+    if (msb >= SR_LAT_MAX_BITS)
+    { return SR_LAT_NBUCKETS - 1; }
+    shift = msb - SR_LAT_SUB_BITS;
+    return ((shift + 1) << SR_LAT_SUB_BITS) +
+           (unsigned int)((v >> shift) & (SR_LAT_SUB - 1));
+}
+
+/* Start timing this packet if it is the thread's turn. */
+#define SR_LAT_BEGIN()                                                      \
+    do {                                                                    \
+        if (sr_lat_every && sr_lat_self.skip-- == 0)                        \
+        { sr_lat_begin(); }                                                 \
+    } while (0)
+
+/* A stage of the sampled packet ends here. */
+#define SR_LAT_MARK(stage)                                                  \
+    do {                                                                    \
+        if (sr_lat_self.on)                                                 \
+        { sr_lat_mark(stage); }                                             \
+    } while (0)
+
+/* The packet is known to take path.  The arp and send marks only count
+   on the forwarding path, so ICMP the router sends on the way doesn't
+   get mixed in, and only once, for the first fragment. */
+#define SR_LAT_PATH(p)                                                      \
+    do {                                                                    \
+        if (sr_lat_self.on)                                                 \
+        { sr_lat_path(p); }                                                 \
+    } while (0)
+
+/* Record the whole packet under its path and stop timing. */
+#define SR_LAT_END()                                                        \
+    do {                                                                    \
+        if (sr_lat_self.on)                                                 \
+        { sr_lat_end(); }                                                   \
+    } while (0)
+
+void sr_lat_begin(void);
+void sr_lat_mark(int stage);
+void sr_lat_path(int path);
+void sr_lat_end(void);
+
+/* Time 1 in every packets from now on; measures the TSC rate, which takes
+   about 20ms.  Returns the rate in ticks per second. */
+uint64_t sr_lat_init(unsigned int every);
+
+/* Upper edge of the bucket holding the p (0..1) quantile of h, 0 if h is
+   empty. */
+uint64_t sr_lat_percentile(const struct sr_lat_hist* h, double p);
+
+/* Percentiles of every stage and path summed over nslots slots, ticks
+   converted with hz. */
+void sr_lat_print(FILE* out, const struct sr_lat_slot* slots,
+                  unsigned int nslots, uint64_t hz);
+
+#endif /* -- SR_LAT_H -- */
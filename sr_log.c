@@ -0,0 +1,472 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.c
+ *
+ * Description:
+ *
+ * Deferred, rate limited logging, see sr_log.h.
+ *
+ * The ring is the same bounded multi-producer queue as sr_capture's: a
+ * producer claims a slot with a compare-and-swap on tail and publishes it
+ * by advancing the slot's sequence; the drain thread reads in order.  A
+ * record holds the call site and the arguments packed as the site's
+ * format says, so formatting (and stdio) only ever happens on the drain
+ * thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "sr_log.h"
+
+#define SR_LOG_RING_SZ   4096       /* records, power of two */
+#define SR_LOG_RING_MASK (SR_LOG_RING_SZ - 1)
+#define SR_LOG_PAYLOAD   96         /* bytes of packed arguments */
+#define SR_LOG_FLUSH_MS  50         /* longest a message waits */
+#define SR_LOG_LINE      512
+#define SR_LOG_OUTBUF    (64 * 1024)
+
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE CLOCK_MONOTONIC
+#endif
+
+/* argument types in sr_log_site.sig */
+#define SR_ARG_INT     'i'
+#define SR_ARG_LONG    'l'
+#define SR_ARG_LLONG   'q'
+#define SR_ARG_SIZE    'z'
+#define SR_ARG_PTR     'p'
+#define SR_ARG_DOUBLE  'd'
+#define SR_ARG_STR     's'
+
+struct sr_log_rec
+{
+    uint32_t seq;                   /* ring position this slot is ready for */
+    uint32_t suppressed;            /* the site's previous second lost these */
+    const struct sr_log_site* site;
+    int packed;                     /* arguments that fit in payload */
+    uint8_t payload[SR_LOG_PAYLOAD];
+};
+
+struct sr_log_ring
+{
+    struct sr_log_rec ring[SR_LOG_RING_SZ];
+    uint32_t tail;
+    uint32_t head;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int active;                     /* producers use the ring */
+    int running;                    /* the drain thread keeps going */
+    int sleeping;
+    uint64_t dropped;               /* ring full */
+};
+
+int sr_log_level = SR_LOG_DEFAULT_LEVEL;
+
+static unsigned int sr_log_rate = SR_LOG_DEFAULT_RATE;
+static struct sr_log_ring sr_log_q;
+
+/* -- skip a conversion's flags, width and precision; 0 on a * -- */
+static const char* sr_log_skip_spec(const char* p)
+{
+    while (*p && strchr("-+ #0", *p))
+    { p++; }
+    while (*p >= '0' && *p <= '9')
+    { p++; }
+    if (*p == '.') {
+        p++;
+        while (*p >= '0' && *p <= '9')
+        { p++; }
+    }
+    return *p == '*' ? 0 : p;
+} /* -- sr_log_skip_spec -- */
+
+/* work out the site's argument types from its format, once */
+static void sr_log_parse(struct sr_log_site* s)
+{
+    const char* p = s->fmt;
+    int n = 0, bad = 0;
+    char t;
+
+    while (!bad && (p = strchr(p, '%')) != 0) {
+        if (*++p == '%') {
+            p++;
+            continue;
+        }
+        if (!(p = sr_log_skip_spec(p))) {
+            bad = 1;
+            break;
+        }
+        t = SR_ARG_INT;
+        if (*p == 'h') {
+            while (*p == 'h')
+            { p++; }
+        }
+        else if (*p == 'l' && p[1] == 'l') {
+            t = SR_ARG_LLONG;
+            p += 2;
+        }
+        else if (*p == 'l' || *p == 'z' || *p == 'j') {
+            t = *p == 'l' ? SR_ARG_LONG : *p == 'z' ? SR_ARG_SIZE : SR_ARG_LLONG;
+            p++;
+        }
+
+        switch (*p) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            case 'c':
+                break;
+            case 's':
+                t = SR_ARG_STR;
+                break;
+            case 'p':
+                t = SR_ARG_PTR;
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+                t = SR_ARG_DOUBLE;
+                break;
+            default:
+                bad = 1;
+        }
+        if (n == SR_LOG_MAX_ARGS)
+        { bad = 1; }
+        if (!bad)
+        { s->sig[n++] = t; }
+        p++;
+    }
+
+    s->nargs = bad ? -1 : n;
+    __atomic_store_n(&s->ready, 1, __ATOMIC_RELEASE);
+} /* -- sr_log_parse -- */
+
+/* 1 if the site has used up this second; hands back what the last one
+   suppressed when a new second starts */
+static int sr_log_limit(struct sr_log_site* s, uint32_t* suppressed)
+{
+    struct timespec ts;
+    uint32_t now, w;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    now = (uint32_t)ts.tv_sec;
+    w = __atomic_load_n(&s->window, __ATOMIC_RELAXED);
+    if (w != now &&
+        __atomic_compare_exchange_n(&s->window, &w, now, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&s->count, 0, __ATOMIC_RELAXED);
+        *suppressed = __atomic_exchange_n(&s->suppressed, 0, __ATOMIC_RELAXED);
+    }
+    if (__atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED) >= sr_log_rate) {
+        __atomic_fetch_add(&s->suppressed, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+} /* -- sr_log_limit -- */
+
+/* copy the arguments into payload, returns how many fit */
+static int sr_log_pack(const struct sr_log_site* s, uint8_t* payload,
+                       va_list ap)
+{
+    unsigned int used = 0, n;
+    const char* str;
+    int i;
+    union { long long q; size_t z; void* p; double d; } v;
+
+    for (i = 0; i < s->nargs; i++) {
+        if (s->sig[i] == SR_ARG_STR) {
+            if ((str = va_arg(ap, const char*)) == 0)
+            { str = "(null)"; }
+            if (used + 2 > SR_LOG_PAYLOAD)
+            { break; }
+            n = strlen(str);
+            if (n > SR_LOG_PAYLOAD - used - 1)
+            { n = SR_LOG_PAYLOAD - used - 1; }
+            payload[used++] = (uint8_t)n;
+            memcpy(payload + used, str, n);
+            used += n;
+            continue;
+        }
+
+        if (used + sizeof(v) > SR_LOG_PAYLOAD)
+        { break; }
+        switch (s->sig[i]) {
+            case SR_ARG_INT:    v.q = va_arg(ap, int); break;
+            case SR_ARG_LONG:   v.q = va_arg(ap, long); break;
+            case SR_ARG_LLONG:  v.q = va_arg(ap, long long); break;
+            case SR_ARG_SIZE:   v.z = va_arg(ap, size_t); break;
+            case SR_ARG_PTR:    v.p = va_arg(ap, void*); break;
+            case SR_ARG_DOUBLE: v.d = va_arg(ap, double); break;
+        }
+        memcpy(payload + used, &v, sizeof(v));
+        used += sizeof(v);
+    }
+    return i;
+} /* -- sr_log_pack -- */
+
+/* format a record into out, always newline terminated, returns length */
+static int sr_log_format(char* out, int room, const struct sr_log_site* s,
+                         const uint8_t* payload, int packed)
+{
+    const char* p = s->fmt;
+    const char* end;
+    char spec[32], str[SR_LOG_PAYLOAD + 1];
+    unsigned int off = 0;
+    int len = 0, i = 0, n;
+    union { long long q; size_t z; void* p; double d; } v;
+
+    room -= 1;                      /* for the newline */
+    while (*p && len < room) {
+        if (*p != '%') {
+            out[len++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[len++] = '%';
+            p += 2;
+            continue;
+        }
+        end = sr_log_skip_spec(p + 1);
+        while (*end == 'h' || *end == 'l' || *end == 'z' || *end == 'j')
+        { end++; }
+        if (end - p + 2 > (int)sizeof(spec) || i >= packed) {
+            n = snprintf(out + len, room - len, "...");
+            len += n < room - len ? n : room - len;
+            break;
+        }
+        memcpy(spec, p, end - p + 1);
+        spec[end - p + 1] = '\0';
+        p = end + 1;
+
+        if (s->sig[i] == SR_ARG_STR) {
+            unsigned int sl = payload[off++];
+            memcpy(str, payload + off, sl);
+            str[sl] = '\0';
+            off += sl;
+            n = snprintf(out + len, room - len, spec, str);
+        }
+        else {
+            memcpy(&v, payload + off, sizeof(v));
+            off += sizeof(v);
+            switch (s->sig[i]) {
+                case SR_ARG_INT:    n = snprintf(out + len, room - len, spec, (int)v.q); break;
+                case SR_ARG_LONG:   n = snprintf(out + len, room - len, spec, (long)v.q); break;
+                case SR_ARG_LLONG:  n = snprintf(out + len, room - len, spec, v.q); break;
+                case SR_ARG_SIZE:   n = snprintf(out + len, room - len, spec, v.z); break;
+                case SR_ARG_PTR:    n = snprintf(out + len, room - len, spec, v.p); break;
+                default:            n = snprintf(out + len, room - len, spec, v.d); break;
+            }
+        }
+        i++;
+        if (n > 0)
+        { len += n < room - len ? n : room - len - 1; }
+    }
+
+    if (len == 0 || out[len - 1] != '\n')
+    { out[len++] = '\n'; }
+    return len;
+} /* -- sr_log_format -- */
+
+static void sr_log_suppressed(char* out, int* len, int room,
+                              const struct sr_log_site* s, uint32_t n)
+{
+    int k = snprintf(out + *len, room - *len, "%s:%d: %u messages suppressed\n",
+                     s->file, s->line, n);
+    if (k > 0)
+    { *len += k < room - *len ? k : room - *len - 1; }
+} /* -- sr_log_suppressed -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_write(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_log_write(struct sr_log_site* s, ...)
+{
+    struct sr_log_ring* q = &sr_log_q;
+    struct sr_log_rec* rec;
+    uint32_t suppressed = 0, pos, seq;
+    va_list ap;
+
+    if (sr_log_rate && sr_log_limit(s, &suppressed))
+    { return; }
+    if (!__atomic_load_n(&s->ready, __ATOMIC_ACQUIRE))
+    { sr_log_parse(s); }
+
+    va_start(ap, s);
+    if (!__atomic_load_n(&q->active, __ATOMIC_ACQUIRE) || s->nargs < 0) {
+        /* -- no drain thread, or a format we can't take apart -- */
+        vfprintf(stderr, s->fmt, ap);
+        if (suppressed)
+        { fprintf(stderr, "%s:%d: %u messages suppressed\n", s->file, s->line,
+                  suppressed); }
+        va_end(ap);
+        return;
+    }
+
+    pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        rec = &q->ring[pos & SR_LOG_RING_MASK];
+        seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 0,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            { break; }
+        }
+        else if ((int32_t)(seq - pos) < 0) {
+            __atomic_fetch_add(&q->dropped, 1, __ATOMIC_RELAXED);
+            va_end(ap);
+            return;
+        }
+        else
+        { pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED); }
+    }
+
+    rec->site = s;
+    rec->suppressed = suppressed;
+    rec->packed = sr_log_pack(s, rec->payload, ap);
+    va_end(ap);
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (pos + 1 - __atomic_load_n(&q->head, __ATOMIC_RELAXED) >= SR_LOG_RING_SZ / 2 &&
+        __atomic_load_n(&q->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&q->lock);
+        if (q->sleeping) {
+            q->sleeping = 0;
+            pthread_cond_signal(&q->cond);
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+} /* -- sr_log_write -- */
+
+static void sr_log_out(const char* out, int len)
+{
+    ssize_t n;
+
+    while (len > 0 && (n = write(STDERR_FILENO, out, len)) > 0) {
+        out += n;
+        len -= n;
+    }
+} /* -- sr_log_out -- */
+
+/* format and write out every published record */
+static void sr_log_drain(struct sr_log_ring* q, char* out)
+{
+    struct sr_log_rec* rec;
+    uint32_t head = q->head;
+    int len = 0;
+
+    for (;;) {
+        rec = &q->ring[head & SR_LOG_RING_MASK];
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != head + 1)
+        { break; }
+
+        if (len > SR_LOG_OUTBUF - 2 * SR_LOG_LINE) {
+            sr_log_out(out, len);
+            len = 0;
+        }
+        len += sr_log_format(out + len, SR_LOG_LINE, rec->site, rec->payload,
+                             rec->packed);
+        if (rec->suppressed)
+        { sr_log_suppressed(out, &len, len + SR_LOG_LINE, rec->site,
+                            rec->suppressed); }
+
+        __atomic_store_n(&rec->seq, head + SR_LOG_RING_SZ, __ATOMIC_RELEASE);
+        head++;
+        __atomic_store_n(&q->head, head, __ATOMIC_RELEASE);
+    }
+    sr_log_out(out, len);
+} /* -- sr_log_drain -- */
+
+static void* sr_log_thread(void* arg)
+{
+    struct sr_log_ring* q = (struct sr_log_ring*)arg;
+    struct timespec ts;
+    char* out = (char*)malloc(SR_LOG_OUTBUF);
+
+    for (;;) {
+        sr_log_drain(q, out);
+
+        pthread_mutex_lock(&q->lock);
+        if (!q->running) {
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+        __atomic_store_n(&q->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&q->tail, __ATOMIC_SEQ_CST) - q->head <
+            SR_LOG_RING_SZ / 2) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += SR_LOG_FLUSH_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&q->cond, &q->lock, &ts);
+        }
+        q->sleeping = 0;
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    sr_log_drain(q, out);
+    free(out);
+    return 0;
+} /* -- sr_log_thread -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_init(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_log_init(int level, unsigned int rate)
+{
+    struct sr_log_ring* q = &sr_log_q;
+    uint32_t i;
+
+    sr_log_level = level;
+    sr_log_rate = rate;
+
+    for (i = 0; i < SR_LOG_RING_SZ; i++)
+    { q->ring[i].seq = i; }
+    q->head = q->tail = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->running = 1;
+
+    if (pthread_create(&q->thread, NULL, sr_log_thread, q) != 0) {
+        perror("pthread_create(..):sr_log.c::sr_log_init(..)");
+        return -1;
+    }
+    __atomic_store_n(&q->active, 1, __ATOMIC_RELEASE);
+    return 0;
+} /* -- sr_log_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_shutdown(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_log_shutdown(void)
+{
+    struct sr_log_ring* q = &sr_log_q;
+
+    if (!q->active)
+    { return; }
+
+    __atomic_store_n(&q->active, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&q->lock);
+    q->running = 0;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+
+    if (q->dropped)
+    { fprintf(stderr, "log: %llu messages dropped, ring full\n",
+              (unsigned long long)q->dropped); }
+} /* -- sr_log_shutdown -- */
@@ -0,0 +1,116 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.h
+ *
+ * Description:
+ *
+ * Leveled logging for code on the packet path.
+ *
+ *     SR_TRACE("ttl %d\n", iphdr->ip_ttl);
+ *     SR_WARN("packet checksum WRONG\n");
+ *
+ * Messages above SR_LOG_MAX (make LOGLEVEL=n, default SR_LOG_DEBUG) are
+ * compiled out altogether, arguments included, so per-packet tracing costs
+ * nothing in a normal build.  Those compiled in are checked against the
+ * runtime level (-V) and then rate limited per call site (-V level,rate;
+ * messages per second, 0 = no limit).
+ *
+ * A message that passes is not formatted where it is logged.  Its
+ * arguments are copied, as the call site's format says, into a binary
+ * record on a bounded lock-free ring and a drain thread formats and writes
+ * a batch of them at a time to stderr.  The format string must be a
+ * literal; %s arguments are copied (truncated if long), * widths are not
+ * supported.  When the ring is full the message is dropped and counted.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LOG_H
+#define SR_LOG_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_LOG_ERR      0
+#define SR_LOG_WARN     1
+#define SR_LOG_INFO     2
+#define SR_LOG_DEBUG    3
+#define SR_LOG_TRACE    4           /* every packet */
+
+#ifndef SR_LOG_MAX
+#define SR_LOG_MAX      SR_LOG_DEBUG
+#endif
+
+#define SR_LOG_DEFAULT_LEVEL SR_LOG_INFO
+#define SR_LOG_DEFAULT_RATE  10     /* per call site per second */
+#define SR_LOG_MAX_ARGS      8
+
+/* one call site, a static in the expansion of SR_LOG_AT */
+struct sr_log_site
+{
+    const char* fmt;
+    const char* file;
+    int line;
+    int level;
+
+    int ready;                      /* sig has been parsed from fmt */
+    int nargs;                      /* -1: fmt can't be deferred */
+    char sig[SR_LOG_MAX_ARGS];      /* type of each argument */
+
+    uint32_t window;                /* second the count is for */
+    uint32_t count;                 /* messages in it */
+    uint32_t suppressed;            /* over the rate, not yet reported */
+};
+
+extern int sr_log_level;
+
+#define SR_LOG_AT(lvl, fmt, args...)                                        \
+    do {                                                                    \
+        static struct sr_log_site sr_log_site_ = { fmt, __FILE__, __LINE__, \
+                                                   lvl };                   \
+        if ((lvl) <= sr_log_level)                                          \
+        { sr_log_write(&sr_log_site_, ## args); }                           \
+    } while (0)
+
+#define SR_ERR(fmt, args...)  SR_LOG_AT(SR_LOG_ERR, fmt, ## args)
+
+#if SR_LOG_MAX >= SR_LOG_WARN
+#define SR_WARN(fmt, args...) SR_LOG_AT(SR_LOG_WARN, fmt, ## args)
+#else
+#define SR_WARN(fmt, args...) do {} while (0)
+#endif
+
+#if SR_LOG_MAX >= SR_LOG_INFO
+#define SR_INFO(fmt, args...) SR_LOG_AT(SR_LOG_INFO, fmt, ## args)
+#else
+#define SR_INFO(fmt, args...) do {} while (0)
+#endif
+
+#if SR_LOG_MAX >= SR_LOG_DEBUG
+#define SR_DEBUG(fmt, args...) SR_LOG_AT(SR_LOG_DEBUG, fmt, ## args)
+#else
+#define SR_DEBUG(fmt, args...) do {} while (0)
+#endif
+
+#if SR_LOG_MAX >= SR_LOG_TRACE
+#define SR_TRACE(fmt, args...) SR_LOG_AT(SR_LOG_TRACE, fmt, ## args)
+#else
+#define SR_TRACE(fmt, args...) do {} while (0)
+#endif
+
+/* Log at the levels up to level, rate messages per call site per second
+   (0 for no limit), and start the drain thread.  Until then messages are
+   written directly.  0 on success. */
+int  sr_log_init(int level, unsigned int rate);
+
+/* Write out what is queued and stop the drain thread; later messages are
+   written directly again. */
+void sr_log_shutdown(void);
+
+/* Used by SR_LOG_AT. */
+void sr_log_write(struct sr_log_site* site, ...);
+
+#endif /* -- SR_LOG_H -- */
@@ -29,9 +29,17 @@
 #include <getopt.h>
 #endif /* _LINUX_ */
 
-#include "sr_dumper.h"
+#include "sr_capture.h"
+#include "sr_flow.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_dispatch.h"
+#include "sr_egress.h"
+#include "sr_io.h"
+#include "sr_if.h"
+#include "sr_bufpool.h"
+#include "sr_log.h"
+#include "sr_stats.h"
 
 extern char* optarg;
 
@@ -44,6 +52,7 @@ extern char* optarg;
 #define DEFAULT_SERVER "localhost"
 #define DEFAULT_RTABLE "rtable"
 #define DEFAULT_TOPO 0
+#define DEFAULT_BACKEND "vns"
 
 static void usage(char* );
 static void sr_init_instance(struct sr_instance* );
@@ -65,11 +74,39 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    int workers = 0;
+    char *backend = DEFAULT_BACKEND;
+    char *ioarg = 0;
+    char *mtu = 0;
+    int depth = SR_EGRESS_DEFAULT_DEPTH;
+    long qdepth;
+    char *end;
+    double target = SR_CODEL_TARGET_US / 1000.0;
+    double interval = SR_CODEL_INTERVAL_US / 1000.0;
+    int shape = 1;
+    char *filter = 0;
+    unsigned int sample = 1;
+    unsigned int snaplen = PACKET_DUMP_SIZE;
+    struct sr_capfile_rotate rotate;
+    double mbytes;
+    int loglevel = SR_LOG_DEFAULT_LEVEL;
+    unsigned int lograte = SR_LOG_DEFAULT_RATE;
+    char *statsname = 0;
+    unsigned int latevery = 0;
+    int pmu = 0;
+    int tracecount = 0;
+    char *tracefilter = 0;
+    char *flowdest = 0;
+    unsigned int flowidle = 0, flowactive = 0, flowentries = 0;
+    char *comma;
+    int sketch = 1;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    memset(&rotate, 0, sizeof(rotate));
+
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:w:b:i:m:q:c:SF:n:L:C:G:V:k:H:PA:X:Z")) != EOF)
     {
         switch (c)
         {
@@ -101,12 +138,155 @@ int main(int argc, char **argv)
             case 'T':
                 template = optarg;
                 break;
+            case 'w':
+                workers = atoi((char *) optarg);
+                break;
+            case 'b':
+                backend = optarg;
+                break;
+            case 'i':
+                ioarg = optarg;
+                break;
+            case 'm':
+                mtu = optarg;
+                break;
+            case 'q':
+                qdepth = strtol(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || qdepth < 0 ||
+                   qdepth > SR_EGRESS_MAX_DEPTH || (qdepth & (qdepth - 1)))
+                {
+                    fprintf(stderr,"Bad queue depth %s, want 0 or a power of two up to %d\n",
+                            optarg, SR_EGRESS_MAX_DEPTH);
+                    exit(1);
+                }
+                depth = (int)qdepth;
+                break;
+            case 'c':
+                if(sscanf(optarg, "%lf,%lf", &target, &interval) < 1 ||
+                   target < 0 || interval <= 0)
+                {
+                    fprintf(stderr,"Bad CoDel spec %s, want target_ms[,interval_ms]\n",
+                            optarg);
+                    exit(1);
+                }
+                break;
+            case 'S':
+                shape = 0;
+                break;
+            case 'F':
+                filter = optarg;
+                break;
+            case 'n':
+                sample = atoi((char *) optarg);
+                break;
+            case 'L':
+                snaplen = atoi((char *) optarg);
+                if(snaplen == 0 || snaplen > PACKET_DUMP_SIZE)
+                { snaplen = PACKET_DUMP_SIZE; }
+                break;
+            case 'C':
+                if(sscanf(optarg, "%lf,%u", &mbytes, &rotate.files) < 1 ||
+                   mbytes <= 0)
+                {
+                    fprintf(stderr,"Bad rotation spec %s, want megabytes[,files]\n",
+                            optarg);
+                    exit(1);
+                }
+                rotate.bytes = (uint64_t)(mbytes * 1000000);
+                break;
+            case 'G':
+                rotate.secs = atoi((char *) optarg);
+                break;
+            case 'V':
+                if(sscanf(optarg, "%d,%u", &loglevel, &lograte) < 1 ||
+                   loglevel < SR_LOG_ERR)
+                {
+                    fprintf(stderr,"Bad log spec %s, want level[,per_second]\n",
+                            optarg);
+                    exit(1);
+                }
+                if(loglevel > SR_LOG_MAX)
+                {
+                    fprintf(stderr,"Log level %d not compiled in, using %d "
+                            "(make LOGLEVEL=%d)\n", loglevel, SR_LOG_MAX, loglevel);
+                    loglevel = SR_LOG_MAX;
+                }
+                break;
+            case 'k':
+                statsname = optarg;
+                break;
+            case 'H':
+                latevery = atoi((char *) optarg);
+                break;
+            case 'P':
+                pmu = 1;
+                break;
+            case 'A':
+                tracecount = atoi((char *) optarg);
+                if((tracefilter = strchr(optarg, ',')) != 0)
+                { tracefilter++; }
+                break;
+            case 'X':
+                flowdest = optarg;
+                if((comma = strchr(optarg, ',')) != 0)
+                {
+                    *comma = '\0';
+                    sscanf(comma + 1, "%u,%u,%u", &flowidle, &flowactive,
+                           &flowentries);
+                }
+                break;
+            case 'Z':
+                sketch = 0;
+                break;
         } /* switch */
     } /* -- while -- */
 
+    /* -- counters first, every thread started from here on counts -- */
+    if(sr_stats_init(statsname) != 0)
+    {
+        fprintf(stderr,"Counters are private, srstat can't read them\n");
+    }
+    if(sketch)
+    {
+        sr_sketch_init();
+    }
+    if(sr_pktrace_init(tracecount, tracefilter) != 0)
+    {
+        fprintf(stderr,"Error in trace filter %s\n", tracefilter);
+        exit(1);
+    }
+    if(pmu && sr_pmu_init() != 0)
+    {
+        fprintf(stderr,"No hardware counters, -P ignored\n");
+    }
+    else if(pmu && !latevery)
+    {
+        latevery = SR_LAT_DEFAULT_EVERY;
+    }
+    if(latevery)
+    {
+        sr_lat_init(latevery);
+    }
+
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
 
+    if(sr_log_init(loglevel, lograte) != 0)
+    {
+        fprintf(stderr,"Logging directly, no drain thread\n");
+    }
+
+    if((sr.io = sr_io_find(backend)) == 0)
+    {
+        fprintf(stderr,"Unknown I/O backend %s\n", backend);
+        exit(1);
+    }
+    if(template != NULL && sr.io->open)
+    {
+        fprintf(stderr,"Topology templates need a VNS connection\n");
+        exit(1);
+    }
+
     /* -- set up routing table from file -- */
     if(template == NULL) {
         sr.template[0] = '\0';
@@ -116,6 +296,12 @@ int main(int argc, char **argv)
         strncpy(sr.template, template, 30);
 
     sr.topo_id = topo;
+    sr.nworkers = workers;
+    sr.egress_depth = depth > 0 ? depth : 0;
+    sr.codel_target = (unsigned int)(target * 1000);
+    sr.codel_interval = (unsigned int)(interval * 1000);
+    sr.shape = shape;
+    sr.mtu_spec = mtu;
     strncpy(sr.host,host,32);
 
     if(! user )
@@ -126,41 +312,76 @@ int main(int argc, char **argv)
     /* -- set up file pointer for logging of raw packets -- */
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        sr.capture = sr_capture_open(logfile,snaplen,filter,sample,&rotate);
+        if(!sr.capture)
         {
-            fprintf(stderr,"Error opening up dump file %s\n",
+            fprintf(stderr,"Error setting up capture to %s\n",
                     logfile);
             exit(1);
         }
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
-    else
-        Debug("Requesting topology %d\n", topo);
-
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    if(flowdest != 0)
     {
-        return 1;
+        sr.flows = sr_flow_open(flowdest, flowentries, flowidle, flowactive,
+                                topo);
+        if(!sr.flows)
+        {
+            fprintf(stderr,"Error setting up flow export to %s\n", flowdest);
+            exit(1);
+        }
     }
 
-    if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
-        Debug("Connected to new instantiation of topology template %s\n", template);
-        sr_load_rt_wrap(&sr, "rtable.vrhost");
+    if(sr.io->open)
+    {
+        /* -- backend brings its own interfaces, rtable is already loaded -- */
+        if(sr.io->open(&sr, ioarg) != 0)
+        {
+            fprintf(stderr,"Error opening %s backend\n", sr.io->name);
+            return 1;
+        }
+        if(sr.mtu_spec && sr_set_if_mtu(&sr, sr.mtu_spec) != 0)
+        {
+            return 1;
+        }
+        printf("Router interfaces:\n");
+        sr_print_if_list(&sr);
+        if(sr_verify_routing_table(&sr) != 0)
+        {
+            fprintf(stderr,"Routing table not consistent with hardware\n");
+            return 1;
+        }
+        printf(" <-- Ready to process packets --> \n");
     }
-    else {
-      /* Read from specified routing table */
-      sr_load_rt_wrap(&sr, rtable);
+    else
+    {
+        Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+        if(template)
+            Debug("Requesting topology template %s\n", template);
+        else
+            Debug("Requesting topology %d\n", topo);
+
+        /* connect to server and negotiate session */
+        if(sr_connect_to_server(&sr,port,server) == -1)
+        {
+            return 1;
+        }
+
+        if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
+            Debug("Connected to new instantiation of topology template %s\n", template);
+            sr_load_rt_wrap(&sr, "rtable.vrhost");
+        }
+        else {
+          /* Read from specified routing table */
+          sr_load_rt_wrap(&sr, rtable);
+        }
     }
 
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    while( sr.io->poll(&sr) == 1);
 
     sr_destroy_instance(&sr);
 
@@ -178,7 +399,20 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file] [-w forwarding workers] \n");
+    printf("           [-b vns|uring|afpacket|pcap|shm] [-i backend arguments] \n");
+    printf("           [-m mtu | -m iface=mtu,..] [-q egress queue depth] \n");
+    printf("           [-c codel target_ms[,interval_ms] | -c 0] \n");
+    printf("           [-S don't shape to interface speed] \n");
+    printf("           [-F capture filter] [-n capture 1 in n] [-L snaplen] \n");
+    printf("           [-C rotate at megabytes[,files]] [-G rotate after seconds] \n");
+    printf("           [-V log level 0-4[,messages per second per site]] \n");
+    printf("           [-k shared memory name of the counters srstat reads] \n");
+    printf("           [-H time the stages of 1 in n packets] \n");
+    printf("           [-P read hardware counters on the timed packets] \n");
+    printf("           [-A trace the path of count[,filter] packets] \n");
+    printf("           [-X export flows to file|udp:host:port[,idle_s[,active_s[,entries]]]] \n");
+    printf("           [-Z don't keep top talkers] \n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -220,11 +454,32 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    /* -- the sweeper sends ARP requests through dispatch and egress -- */
+    sr_arpcache_stop(&(sr->cache));
+    sr_dispatch_destroy(sr);
+    sr_egress_destroy(sr);
+
+    if(sr->io && sr->io->close)
     {
-        sr_dump_close(sr->logfile);
+        sr->io->close(sr);
     }
 
+    sr_capture_close(sr->capture);
+    sr->capture = 0;
+    sr_flow_close(sr->flows);
+    sr->flows = 0;
+
+    sr_bufpool_print(stderr);
+    sr_stats_print_lat(stderr);
+    sr_stats_print_pmu(stderr);
+    sr_stats_print_trace(stderr);
+    sr_stats_print_sketch(stderr);
+    sr_stats_print_routes(stderr);
+    sr_stats_print_arp(stderr, sr_stats_arp_queue());
+
+    sr_log_shutdown();
+    sr_stats_shutdown();
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -248,60 +503,21 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->topo_id = 0;
     sr->if_list = 0;
     sr->routing_table = 0;
-    sr->logfile = 0;
+    sr->capture = 0;
+    sr->flows = 0;
+    sr->nworkers = 0;
+    sr->dispatch = 0;
+    sr->egress_depth = 0;
+    sr->codel_target = 0;
+    sr->codel_interval = 0;
+    sr->shape = 0;
+    sr->egress = 0;
+    sr->io = 0;
+    sr->io_priv = 0;
+    sr->mtu_spec = 0;
+    pthread_mutex_init(&(sr->send_lock), NULL);
 } /* -- sr_init_instance -- */
 
-/*-----------------------------------------------------------------------------
- * Method: sr_verify_routing_table()
- * Scope: Global
- *
- * make sure the routing table is consistent with the interface list by
- * verifying that all interfaces used in the routing table actually exist
- * in the hardware.
- *
- * RETURN VALUES:
- *
- *  0 on success
- *  something other than zero on error
- *
- *---------------------------------------------------------------------------*/
-
-int sr_verify_routing_table(struct sr_instance* sr)
-{
-    struct sr_rt* rt_walker = 0;
-    struct sr_if* if_walker = 0;
-    int ret = 0;
-
-    /* -- REQUIRES --*/
-    assert(sr);
-
-    if( (sr->if_list == 0) || (sr->routing_table == 0))
-    {
-        return 999; /* doh! */
-    }
-
-    rt_walker = sr->routing_table;
-
-    while(rt_walker)
-    {
-        /* -- check to see if interface exists -- */
-        if_walker = sr->if_list;
-        while(if_walker)
-        {
-            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
-                    == 0)
-            { break; }
-            if_walker = if_walker->next;
-        }
-        if(if_walker == 0)
-        { ret++; } /* -- interface not found! -- */
-
-        rt_walker = rt_walker->next;
-    } /* -- while -- */
-
-    return ret;
-} /* -- sr_verify_routing_table -- */
-
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     if(sr_load_rt(sr, rtable) != 0) {
         fprintf(stderr,"Error setting up routing table from file %s\n",
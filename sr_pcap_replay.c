@@ -0,0 +1,767 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_pcap_replay.c
+ *
+ * Description:
+ *
+ * Offline I/O backend: replays pcap files into the router and writes
+ * whatever it sends to one pcap file per interface.  No VNS server, Mininet
+ * or root is needed, and the same input always produces the same work, so
+ * this is what packets-per-second and latency numbers should come from.
+ *
+ *     -b pcap -i if=ifaces,eth1=in1.pcap,eth2=in2.pcap[,out=dir][,timed]
+ *                [,speed=2.0][,loop=10][,noarp]
+ *
+ *   if=FILE      interface list, see sr_load_if()
+ *   IFACE=FILE   frames in FILE are received on IFACE; with several inputs
+ *                frames are merged in timestamp order
+ *   out=DIR      where IFACE.out.pcap files go (default .)
+ *   timed        keep the original inter-frame gaps (divided by speed=)
+ *                instead of replaying as fast as possible
+ *   loop=N       replay the inputs N times
+ *   noarp        don't emulate neighbours (see below)
+ *
+ * Traces rarely carry ARP replies for the router, so by default the
+ * backend plays every neighbour: gateways in the routing table are put in
+ * the ARP cache up front and any ARP request the router sends is answered
+ * with the locally administered MAC 02:00:<ip>.
+ *
+ * Input files are mapped read-only; each frame is copied to a scratch
+ * buffer before delivery since the router rewrites headers in place.
+ *
+ * On close the backend reports the frames read and the frames sent, and
+ * pps and Mbit/s of what was sent, from the first frame read to the last
+ * one written, plus the ingress to egress latency of frames forwarded on
+ * the replay thread.  With -w the send happens on a worker and only
+ * throughput is reported; the replay waits for a full worker ring to drain
+ * rather than dropping, so the rate is what the workers can forward.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_dumper.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_protocol.h"
+#include "sr_io.h"
+#include "sr_dispatch.h"
+
+#define SR_PCAP_MAX_IFS     16
+#define SR_PCAP_SNAPLEN     65535
+#define SR_PCAP_BATCH       64         /* frames per poll round */
+#define SR_PCAP_SPIN_NS     50000      /* sleep for longer gaps, spin below */
+#define SR_PCAP_DRAIN_NS    6000000000ULL /* max wait for ARP after the input */
+#define SR_PCAP_MAX_SAMPLES (1 << 24)
+
+#define TCPDUMP_MAGIC_NSEC  0xa1b23c4d
+
+struct sr_pcap_in
+{
+    char name[sr_IFACE_NAMELEN];
+    char* path;
+    uint8_t* map;
+    size_t map_len;
+    size_t off;                 /* next record header */
+    int swapped;                /* file written with the other byte order */
+    int nsec;                   /* nanosecond timestamps */
+    int done;
+    uint64_t next_ts;           /* ns timestamp of the record at off */
+    uint64_t frames;
+    uint64_t bytes;
+};
+
+struct sr_pcap_out
+{
+    char name[sr_IFACE_NAMELEN];
+    FILE* fp;
+    uint64_t frames;            /* under flockfile(fp) */
+    uint64_t bytes;
+};
+
+/* a synthesized ARP reply waiting to be received */
+struct sr_pcap_arp
+{
+    char iface[sr_IFACE_NAMELEN];
+    uint8_t frame[sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr)];
+    struct sr_pcap_arp* next;
+};
+
+struct sr_pcap
+{
+    int nin;
+    struct sr_pcap_in in[SR_PCAP_MAX_IFS];
+    int nout;
+    struct sr_pcap_out out[SR_PCAP_MAX_IFS];
+
+    int timed;
+    double speed;
+    int loops;
+    int loop;
+    int emulate_arp;
+
+    int started;
+    int input_done;
+    uint64_t ts0;               /* first timestamp of the current pass */
+    uint64_t t_pass;            /* monotonic time the current pass began */
+    uint64_t t_start;
+    uint64_t t_end;
+    uint64_t t_last_out;        /* monotonic time of the last frame sent */
+
+    pthread_mutex_t arp_lock;
+    struct sr_pcap_arp* arp_head;
+    struct sr_pcap_arp* arp_tail;
+    uint64_t arp_answered;
+
+    uint8_t* scratch;
+
+    pthread_mutex_t lat_lock;
+    uint32_t* lat;              /* ingress to egress, ns */
+    size_t nlat;
+    size_t lat_cap;
+};
+
+/* monotonic time the frame being delivered on this thread was received */
+static __thread uint64_t sr_pcap_stamp = 0;
+
+static uint64_t sr_pcap_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- sr_pcap_now -- */
+
+static uint32_t sr_pcap_u32(const struct sr_pcap_in* in, uint32_t v)
+{
+    return in->swapped ? __builtin_bswap32(v) : v;
+} /* -- sr_pcap_u32 -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pcap_peek(..)
+ * Scope: Local
+ *
+ * Validate the record at in->off and load its timestamp, or mark the input
+ * done at the end of the file (or at a truncated record).
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pcap_peek(struct sr_pcap_in* in)
+{
+    struct pcap_sf_pkthdr h;
+    uint32_t caplen;
+
+    if (in->off + sizeof(h) > in->map_len)
+    {
+        in->done = 1;
+        return;
+    }
+    memcpy(&h, in->map + in->off, sizeof(h));
+    caplen = sr_pcap_u32(in, h.caplen);
+    if (caplen > SR_PCAP_SNAPLEN || in->off + sizeof(h) + caplen > in->map_len)
+    {
+        fprintf(stderr, "%s: truncated record at offset %lu\n", in->path,
+                (unsigned long)in->off);
+        in->done = 1;
+        return;
+    }
+    in->next_ts = (uint64_t)sr_pcap_u32(in, h.ts.tv_sec) * 1000000000ULL +
+        (uint64_t)sr_pcap_u32(in, h.ts.tv_usec) * (in->nsec ? 1 : 1000);
+} /* -- sr_pcap_peek -- */
+
+static void sr_pcap_rewind(struct sr_pcap_in* in)
+{
+    in->off = sizeof(struct pcap_file_header);
+    in->done = 0;
+    sr_pcap_peek(in);
+} /* -- sr_pcap_rewind -- */
+
+static int sr_pcap_in_open(struct sr_pcap_in* in, const char* name,
+                           const char* path)
+{
+    struct pcap_file_header fh;
+    struct stat st;
+    int fd;
+
+    strncpy(in->name, name, sr_IFACE_NAMELEN - 1);
+    in->path = strdup(path);
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        if (fd >= 0)
+        { close(fd); }
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(fh))
+    {
+        fprintf(stderr, "%s: not a pcap file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    in->map_len = st.st_size;
+    in->map = mmap(0, in->map_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (in->map == MAP_FAILED)
+    {
+        in->map = 0;
+        perror("mmap(..):sr_pcap_replay.c::sr_pcap_in_open(..)");
+        return -1;
+    }
+    madvise(in->map, in->map_len, MADV_SEQUENTIAL);
+
+    memcpy(&fh, in->map, sizeof(fh));
+    if (fh.magic == TCPDUMP_MAGIC || fh.magic == TCPDUMP_MAGIC_NSEC)
+    { in->swapped = 0; }
+    else if (__builtin_bswap32(fh.magic) == TCPDUMP_MAGIC ||
+             __builtin_bswap32(fh.magic) == TCPDUMP_MAGIC_NSEC)
+    { in->swapped = 1; }
+    else
+    {
+        fprintf(stderr, "%s: not a pcap file\n", path);
+        return -1;
+    }
+    in->nsec = sr_pcap_u32(in, fh.magic) == TCPDUMP_MAGIC_NSEC;
+
+    if (sr_pcap_u32(in, fh.linktype) != LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "%s: link type %u, only Ethernet is supported\n",
+                path, sr_pcap_u32(in, fh.linktype));
+        return -1;
+    }
+
+    sr_pcap_rewind(in);
+    return 0;
+} /* -- sr_pcap_in_open -- */
+
+static struct sr_pcap_out* sr_pcap_out_find(struct sr_pcap* rp, const char* name)
+{
+    int i;
+
+    for (i = 0; i < rp->nout; i++)
+    {
+        if (strncmp(rp->out[i].name, name, sr_IFACE_NAMELEN) == 0)
+        { return &rp->out[i]; }
+    }
+    return 0;
+} /* -- sr_pcap_out_find -- */
+
+static int sr_pcap_cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+} /* -- sr_pcap_cmp_u32 -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pcap_report(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pcap_report(struct sr_pcap* rp)
+{
+    uint64_t frames = 0, sent = 0, bytes = 0, t_last;
+    double secs;
+    int i;
+
+    if (!rp->started)
+    { return; }
+
+    for (i = 0; i < rp->nin; i++)
+    { frames += rp->in[i].frames; }
+    for (i = 0; i < rp->nout; i++)
+    {
+        sent += rp->out[i].frames;
+        bytes += rp->out[i].bytes;
+    }
+    /* -- workers may still have been sending after the input ran out -- */
+    t_last = __atomic_load_n(&rp->t_last_out, __ATOMIC_RELAXED);
+    if (rp->t_end > t_last)
+    { t_last = rp->t_end; }
+    secs = ((t_last ? t_last : sr_pcap_now()) - rp->t_start) / 1e9;
+
+    fprintf(stderr, "pcap replay: %llu frames in, %llu sent in %.3f s, "
+            "%.0f pps, %.1f Mbit/s sent%s\n", (unsigned long long)frames,
+            (unsigned long long)sent, secs,
+            secs > 0 ? sent / secs : 0.0,
+            secs > 0 ? bytes * 8 / secs / 1e6 : 0.0,
+            rp->timed ? " (timed)" : "");
+    for (i = 0; i < rp->nin; i++)
+    {
+        fprintf(stderr, "  in  %-8s %10llu frames %12llu bytes\n", rp->in[i].name,
+                (unsigned long long)rp->in[i].frames,
+                (unsigned long long)rp->in[i].bytes);
+    }
+    for (i = 0; i < rp->nout; i++)
+    {
+        fprintf(stderr, "  out %-8s %10llu frames %12llu bytes\n", rp->out[i].name,
+                (unsigned long long)rp->out[i].frames,
+                (unsigned long long)rp->out[i].bytes);
+    }
+    if (rp->emulate_arp)
+    {
+        fprintf(stderr, "  %llu ARP requests answered\n",
+                (unsigned long long)rp->arp_answered);
+    }
+
+    if (rp->nlat)
+    {
+        qsort(rp->lat, rp->nlat, sizeof(uint32_t), sr_pcap_cmp_u32);
+        fprintf(stderr, "  latency (us, %lu samples): min %.2f p50 %.2f "
+                "p90 %.2f p99 %.2f p99.9 %.2f max %.2f\n",
+                (unsigned long)rp->nlat, rp->lat[0] / 1e3,
+                rp->lat[rp->nlat / 2] / 1e3,
+                rp->lat[(size_t)(rp->nlat * 0.9)] / 1e3,
+                rp->lat[(size_t)(rp->nlat * 0.99)] / 1e3,
+                rp->lat[(size_t)(rp->nlat * 0.999)] / 1e3,
+                rp->lat[rp->nlat - 1] / 1e3);
+    }
+} /* -- sr_pcap_report -- */
+
+static void sr_pcap_close(struct sr_instance* sr)
+{
+    struct sr_pcap* rp = (struct sr_pcap*)sr->io_priv;
+    struct sr_pcap_arp* a;
+    int i;
+
+    if (!rp)
+    { return; }
+
+    sr_pcap_report(rp);
+
+    for (i = 0; i < rp->nin; i++)
+    {
+        if (rp->in[i].map)
+        { munmap(rp->in[i].map, rp->in[i].map_len); }
+        free(rp->in[i].path);
+    }
+    for (i = 0; i < rp->nout; i++)
+    {
+        if (rp->out[i].fp)
+        { sr_dump_close(rp->out[i].fp); }
+    }
+    while ((a = rp->arp_head) != 0)
+    {
+        rp->arp_head = a->next;
+        free(a);
+    }
+    pthread_mutex_destroy(&rp->arp_lock);
+    pthread_mutex_destroy(&rp->lat_lock);
+    free(rp->scratch);
+    free(rp->lat);
+    free(rp);
+    sr->io_priv = 0;
+} /* -- sr_pcap_close -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pcap_open(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_pcap_open(struct sr_instance* sr, const char* arg)
+{
+    struct sr_pcap* rp;
+    struct sr_if* ifw;
+    char *list, *tok, *save = 0, *val;
+    const char *iffile = 0, *outdir = ".";
+    char path[BUFSIZ];
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if (!arg || !*arg)
+    {
+        fprintf(stderr, "pcap backend needs -i if=FILE,iface=in.pcap[,...]\n");
+        return -1;
+    }
+
+    rp = (struct sr_pcap*)calloc(1, sizeof(struct sr_pcap));
+    assert(rp);
+    sr->io_priv = rp;
+    rp->speed = 1.0;
+    rp->loops = 1;
+    rp->emulate_arp = 1;
+    pthread_mutex_init(&rp->arp_lock, NULL);
+    pthread_mutex_init(&rp->lat_lock, NULL);
+    rp->scratch = (uint8_t*)malloc(SR_PCAP_SNAPLEN);
+    assert(rp->scratch);
+
+    list = strdup(arg);
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(0, ",", &save))
+    {
+        if ((val = strchr(tok, '=')) != 0)
+        { *val++ = '\0'; }
+
+        if (strcmp(tok, "timed") == 0)
+        { rp->timed = 1; }
+        else if (strcmp(tok, "noarp") == 0)
+        { rp->emulate_arp = 0; }
+        else if (!val)
+        {
+            fprintf(stderr, "pcap backend: don't know what %s is\n", tok);
+            goto fail;
+        }
+        else if (strcmp(tok, "if") == 0)
+        { iffile = val; }
+        else if (strcmp(tok, "out") == 0)
+        { outdir = val; }
+        else if (strcmp(tok, "speed") == 0)
+        {
+            if ((rp->speed = atof(val)) <= 0)
+            { rp->speed = 1.0; }
+        }
+        else if (strcmp(tok, "loop") == 0)
+        {
+            if ((rp->loops = atoi(val)) < 1)
+            { rp->loops = 1; }
+        }
+        else if (rp->nin == SR_PCAP_MAX_IFS)
+        {
+            fprintf(stderr, "Too many inputs, at most %d\n", SR_PCAP_MAX_IFS);
+            goto fail;
+        }
+        else if (sr_pcap_in_open(&rp->in[rp->nin++], tok, val) != 0)
+        { goto fail; }
+    }
+
+    if (!iffile || rp->nin == 0)
+    {
+        fprintf(stderr, "pcap backend needs if=FILE and at least one "
+                "iface=in.pcap\n");
+        goto fail;
+    }
+
+    if (sr_load_if(sr, iffile) != 0)
+    { goto fail; }
+
+    for (i = 0; i < rp->nin; i++)
+    {
+        if (!sr_get_interface(sr, rp->in[i].name))
+        {
+            fprintf(stderr, "Input for unknown interface %s\n", rp->in[i].name);
+            goto fail;
+        }
+    }
+
+    /* -- one output file per router interface -- */
+    for (ifw = sr->if_list; ifw && rp->nout < SR_PCAP_MAX_IFS; ifw = ifw->next)
+    {
+        struct sr_pcap_out* o = &rp->out[rp->nout++];
+
+        strncpy(o->name, ifw->name, sr_IFACE_NAMELEN - 1);
+        snprintf(path, sizeof(path), "%s/%s.out.pcap", outdir, ifw->name);
+        if ((o->fp = sr_dump_open(path, 0, SR_PCAP_SNAPLEN)) == 0)
+        { goto fail; }
+    }
+
+    free(list);
+    return 0;
+
+fail:
+    free(list);
+    sr_pcap_close(sr);
+    return -1;
+} /* -- sr_pcap_open -- */
+
+/* the neighbour MAC we make up for ip: 02:00 followed by the address */
+static void sr_pcap_neigh_mac(uint32_t ip, unsigned char* mac)
+{
+    mac[0] = 0x02;
+    mac[1] = 0x00;
+    memcpy(mac + 2, &ip, 4);
+} /* -- sr_pcap_neigh_mac -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pcap_arp_answer(..)
+ * Scope: Local
+ *
+ * If buf is an ARP request, queue the reply the neighbour would send.  It
+ * is received on the next poll round, whichever thread sent the request.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pcap_arp_answer(struct sr_pcap* rp, const uint8_t* buf,
+                               unsigned int len, const char* iface)
+{
+    const struct sr_ethernet_hdr* eh = (const struct sr_ethernet_hdr*)buf;
+    const struct sr_arp_hdr* ah =
+        (const struct sr_arp_hdr*)(buf + sizeof(struct sr_ethernet_hdr));
+    struct sr_ethernet_hdr* reh;
+    struct sr_arp_hdr* rah;
+    struct sr_pcap_arp* a;
+
+    if (len < sizeof(*eh) + sizeof(*ah) ||
+        eh->ether_type != htons(ethertype_arp) ||
+        ah->ar_op != htons(arp_op_request))
+    { return; }
+
+    if (!(a = (struct sr_pcap_arp*)calloc(1, sizeof(struct sr_pcap_arp))))
+    { return; }
+    strncpy(a->iface, iface, sr_IFACE_NAMELEN - 1);
+
+    reh = (struct sr_ethernet_hdr*)a->frame;
+    rah = (struct sr_arp_hdr*)(a->frame + sizeof(struct sr_ethernet_hdr));
+    memcpy(reh->ether_dhost, eh->ether_shost, ETHER_ADDR_LEN);
+    sr_pcap_neigh_mac(ah->ar_tip, reh->ether_shost);
+    reh->ether_type = htons(ethertype_arp);
+
+    rah->ar_hrd = htons(arp_hrd_ethernet);
+    rah->ar_pro = htons(ethertype_ip);
+    rah->ar_hln = ETHER_ADDR_LEN;
+    rah->ar_pln = 4;
+    rah->ar_op  = htons(arp_op_reply);
+    memcpy(rah->ar_sha, reh->ether_shost, ETHER_ADDR_LEN);
+    rah->ar_sip = ah->ar_tip;
+    memcpy(rah->ar_tha, ah->ar_sha, ETHER_ADDR_LEN);
+    rah->ar_tip = ah->ar_sip;
+
+    pthread_mutex_lock(&rp->arp_lock);
+    if (rp->arp_tail)
+    { rp->arp_tail->next = a; }
+    else
+    { rp->arp_head = a; }
+    rp->arp_tail = a;
+    rp->arp_answered++;
+    pthread_mutex_unlock(&rp->arp_lock);
+} /* -- sr_pcap_arp_answer -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pcap_send(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_pcap_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                        const char* iface)
+{
+    struct sr_pcap* rp = (struct sr_pcap*)sr->io_priv;
+    struct sr_pcap_out* o;
+    struct pcap_pkthdr h;
+
+    if (!(o = sr_pcap_out_find(rp, iface)))
+    {
+        fprintf(stderr, "** Error, interface %s, does not exist\n", iface);
+        return -1;
+    }
+
+    /* -- first frame out for the frame being received on this thread -- */
+    if (sr_pcap_stamp)
+    {
+        uint64_t d = sr_pcap_now() - sr_pcap_stamp;
+        sr_pcap_stamp = 0;
+
+        pthread_mutex_lock(&rp->lat_lock);
+        if (rp->nlat == rp->lat_cap && rp->lat_cap < SR_PCAP_MAX_SAMPLES)
+        {
+            size_t cap = rp->lat_cap ? rp->lat_cap * 2 : 65536;
+            uint32_t* lat = (uint32_t*)realloc(rp->lat, cap * sizeof(uint32_t));
+            if (lat)
+            {
+                rp->lat = lat;
+                rp->lat_cap = cap;
+            }
+        }
+        if (rp->nlat < rp->lat_cap)
+        { rp->lat[rp->nlat++] = d > 0xffffffffULL ? 0xffffffff : (uint32_t)d; }
+        pthread_mutex_unlock(&rp->lat_lock);
+    }
+
+    gettimeofday(&h.ts, 0);
+    h.caplen = len;
+    h.len = len;
+
+    flockfile(o->fp);
+    sr_dump(o->fp, &h, buf);
+    o->frames++;
+    o->bytes += len;
+    funlockfile(o->fp);
+    __atomic_store_n(&rp->t_last_out, sr_pcap_now(), __ATOMIC_RELAXED);
+
+    if (rp->emulate_arp)
+    { sr_pcap_arp_answer(rp, buf, len, iface); }
+
+    return 0;
+} /* -- sr_pcap_send -- */
+
+/* put every gateway of the routing table in the ARP cache */
+static void sr_pcap_prime_arp(struct sr_instance* sr)
+{
+    struct sr_rt* rt;
+    unsigned char mac[ETHER_ADDR_LEN];
+
+    for (rt = sr->routing_table; rt; rt = rt->next)
+    {
+        if (rt->gw.s_addr == 0)
+        { continue; }
+        sr_pcap_neigh_mac(rt->gw.s_addr, mac);
+        sr_arpcache_insert(&sr->cache, mac, rt->gw.s_addr);
+    }
+} /* -- sr_pcap_prime_arp -- */
+
+static void sr_pcap_deliver_arp(struct sr_instance* sr, struct sr_pcap* rp)
+{
+    struct sr_pcap_arp* a;
+
+    pthread_mutex_lock(&rp->arp_lock);
+    a = rp->arp_head;
+    rp->arp_head = rp->arp_tail = 0;
+    pthread_mutex_unlock(&rp->arp_lock);
+
+    while (a)
+    {
+        struct sr_pcap_arp* next = a->next;
+        sr_io_deliver(sr, a->frame, sizeof(a->frame), a->iface);
+        free(a);
+        a = next;
+    }
+} /* -- sr_pcap_deliver_arp -- */
+
+/* the input whose next frame is the oldest, 0 when all are done */
+static struct sr_pcap_in* sr_pcap_next_in(struct sr_pcap* rp)
+{
+    struct sr_pcap_in* best = 0;
+    int i;
+
+    for (i = 0; i < rp->nin; i++)
+    {
+        if (!rp->in[i].done && (!best || rp->in[i].next_ts < best->next_ts))
+        { best = &rp->in[i]; }
+    }
+    return best;
+} /* -- sr_pcap_next_in -- */
+
+static void sr_pcap_start_pass(struct sr_pcap* rp)
+{
+    struct sr_pcap_in* first;
+    int i;
+
+    if (rp->loop > 0)
+    {
+        for (i = 0; i < rp->nin; i++)
+        { sr_pcap_rewind(&rp->in[i]); }
+    }
+    first = sr_pcap_next_in(rp);
+    rp->ts0 = first ? first->next_ts : 0;
+    rp->t_pass = sr_pcap_now();
+} /* -- sr_pcap_start_pass -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pcap_poll(..)
+ * Scope: Local
+ *
+ * Deliver up to SR_PCAP_BATCH frames.  Once the input is used up keep
+ * going until the ARP queue is empty (or SR_PCAP_DRAIN_NS has passed), so
+ * frames waiting on a neighbour still make it to the output.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_pcap_poll(struct sr_instance* sr)
+{
+    struct sr_pcap* rp = (struct sr_pcap*)sr->io_priv;
+    int n;
+
+    if (!rp->started)
+    {
+        if (rp->emulate_arp)
+        { sr_pcap_prime_arp(sr); }
+        if (sr->dispatch)
+        { sr_dispatch_set_lossless(sr->dispatch); }
+        rp->started = 1;
+        sr_pcap_start_pass(rp);
+        rp->t_start = rp->t_pass;
+    }
+
+    sr_pcap_deliver_arp(sr, rp);
+
+    if (rp->input_done)
+    {
+        int waiting;
+
+        pthread_mutex_lock(&sr->cache.lock);
+        waiting = sr->cache.requests != 0;
+        pthread_mutex_unlock(&sr->cache.lock);
+
+        if (!waiting || sr_pcap_now() - rp->t_end > SR_PCAP_DRAIN_NS)
+        { return 0; }
+        usleep(1000);
+        return 1;
+    }
+
+    for (n = 0; n < SR_PCAP_BATCH; n++)
+    {
+        struct sr_pcap_in* in = sr_pcap_next_in(rp);
+        struct pcap_sf_pkthdr h;
+        uint32_t caplen;
+
+        if (!in)
+        {
+            if (++rp->loop < rp->loops)
+            {
+                sr_pcap_start_pass(rp);
+                continue;
+            }
+            rp->input_done = 1;
+            rp->t_end = sr_pcap_now();
+            break;
+        }
+
+        if (rp->timed)
+        {
+            /* -- out of order records or a later file that starts
+                  earlier are due right away -- */
+            int64_t gap = (int64_t)in->next_ts - (int64_t)rp->ts0;
+            uint64_t due = rp->t_pass +
+                (gap > 0 ? (uint64_t)(gap / rp->speed) : 0);
+            uint64_t now = sr_pcap_now();
+
+            if (due > now + SR_PCAP_SPIN_NS)
+            {
+                /* -- sleep in short steps so ARP replies keep flowing -- */
+                uint64_t d = due - now - SR_PCAP_SPIN_NS;
+                usleep(d > 1000000 ? 1000 : d / 1000);
+                return 1;
+            }
+            while (sr_pcap_now() < due)
+            ;
+        }
+
+        memcpy(&h, in->map + in->off, sizeof(h));
+        caplen = sr_pcap_u32(in, h.caplen);
+        memcpy(rp->scratch, in->map + in->off + sizeof(h), caplen);
+        in->off += sizeof(h) + caplen;
+        in->frames++;
+        in->bytes += caplen;
+
+        sr_pcap_stamp = sr_pcap_now();
+        sr_io_deliver(sr, rp->scratch, caplen, in->name);
+        sr_pcap_stamp = 0;
+
+        sr_pcap_peek(in);
+    }
+
+    return 1;
+} /* -- sr_pcap_poll -- */
+
+const struct sr_io_ops sr_io_pcap =
+{
+    "pcap",
+    sr_pcap_open,
+    sr_pcap_send,
+    sr_pcap_poll,
+    sr_pcap_close
+};
@@ -0,0 +1,266 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pktrace.c
+ *
+ * Description:
+ *
+ * Packet path tracing, see sr_pktrace.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_pktrace.h"
+#include "sr_capfilter.h"
+#include "sr_stats.h"
+
+static const char* sr_pktrace_steps[SR_PT_NSTEPS] =
+{
+    "",
+    "ip header ok",
+    "ip checksum ok",
+    "for the router",
+    "ttl expired",
+    "route",
+    "no route",
+    "fragment",
+    "too big, DF set",
+    "arp hit",
+    "arp queued",
+    "icmp",
+    "send",
+    "drop",
+    "arp"
+};
+
+static int32_t sr_pktrace_off = 0;
+volatile int32_t* sr_pktrace_left = &sr_pktrace_off;
+__thread struct sr_pktrace_rec* sr_pktrace_cur = 0;
+
+static struct sr_capfilter sr_pktrace_filter;
+static uint64_t sr_pktrace_seq = 0;
+static __thread struct sr_pktrace_ring* sr_pktrace_ring = 0;
+static __thread uint64_t sr_pktrace_start;
+
+static uint64_t sr_pktrace_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- sr_pktrace_ns -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktrace_init(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pktrace_init(int count, const char* filter)
+{
+    if (sr_capfilter_compile(&sr_pktrace_filter, filter ? filter : "") != 0)
+    { return -1; }
+    sr_pktrace_left = sr_stats_trace_arm(count, filter);
+    return 0;
+} /* -- sr_pktrace_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktrace_begin(..)
+ * Scope:  Global
+ *
+ * Taking one of the remaining packets is the only shared write, and only
+ * for packets that match.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pktrace_begin(const uint8_t* buf, unsigned int len, const char* iface)
+{
+    struct sr_pktrace_rec* rec;
+
+    if (!sr_capfilter_match(&sr_pktrace_filter, buf, len, iface, SR_CAP_IN))
+    { return; }
+    if (__atomic_sub_fetch(sr_pktrace_left, 1, __ATOMIC_RELAXED) < 0) {
+        /* -- someone else took the last one -- */
+        __atomic_store_n(sr_pktrace_left, 0, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (!sr_pktrace_ring)
+    { sr_pktrace_ring = sr_stats_trace_ring(); }
+    rec = &sr_pktrace_ring->rec[sr_pktrace_ring->head % SR_PKTRACE_RING];
+
+    rec->seq = __atomic_add_fetch(&sr_pktrace_seq, 1, __ATOMIC_RELAXED);
+    rec->when = sr_pktrace_ns(CLOCK_REALTIME);
+    memset(rec->iface, 0, sizeof(rec->iface));
+    strncpy(rec->iface, iface, sr_IFACE_NAMELEN - 1);
+    rec->len = len;
+    rec->nevents = 0;
+    rec->caplen = len < SR_PKTRACE_HEAD ? len : SR_PKTRACE_HEAD;
+    memcpy(rec->head, buf, rec->caplen);
+
+    sr_pktrace_start = sr_pktrace_ns(CLOCK_MONOTONIC);
+    sr_pktrace_cur = rec;
+} /* -- sr_pktrace_begin -- */
+
+void sr_pktrace_add(int what, uint32_t a, uint32_t b, unsigned int c)
+{
+    struct sr_pktrace_rec* rec = sr_pktrace_cur;
+    struct sr_pktrace_event* ev;
+
+    if (rec->nevents++ >= SR_PKTRACE_EVENTS)
+    { return; }
+    ev = &rec->ev[rec->nevents - 1];
+    ev->ns = (uint32_t)(sr_pktrace_ns(CLOCK_MONOTONIC) - sr_pktrace_start);
+    ev->what = (uint16_t)what;
+    ev->c = (uint16_t)c;
+    ev->a = a;
+    ev->b = b;
+} /* -- sr_pktrace_add -- */
+
+void sr_pktrace_end(void)
+{
+    /* -- publish the record; srstat reads up to head -- */
+    __atomic_store_n(&sr_pktrace_ring->head, sr_pktrace_ring->head + 1,
+                     __ATOMIC_RELEASE);
+    sr_pktrace_cur = 0;
+} /* -- sr_pktrace_end -- */
+
+static const char* sr_pktrace_ip(uint32_t ip, char* buf)
+{
+    struct in_addr in;
+
+    in.s_addr = ip;
+    return inet_ntop(AF_INET, &in, buf, INET_ADDRSTRLEN);
+} /* -- sr_pktrace_ip -- */
+
+/* what the frame was, from the bytes kept */
+static void sr_pktrace_print_head(FILE* out, const struct sr_pktrace_rec* rec)
+{
+    const sr_ip_hdr_t* ip;
+    const sr_arp_hdr_t* arp;
+    char s[INET_ADDRSTRLEN], d[INET_ADDRSTRLEN];
+    unsigned int ethtype;
+
+    if (rec->caplen < sizeof(sr_ethernet_hdr_t)) {
+        fprintf(out, "runt\n");
+        return;
+    }
+    ethtype = ntohs(((const sr_ethernet_hdr_t*)rec->head)->ether_type);
+    if (ethtype == ethertype_ip &&
+        rec->caplen >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)) {
+        ip = (const sr_ip_hdr_t*)(rec->head + sizeof(sr_ethernet_hdr_t));
+        fprintf(out, "ip %s -> %s proto %u ttl %u len %u\n",
+                sr_pktrace_ip(ip->ip_src, s), sr_pktrace_ip(ip->ip_dst, d),
+                ip->ip_p, ip->ip_ttl, ntohs(ip->ip_len));
+    }
+    else if (ethtype == ethertype_arp &&
+             rec->caplen >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)) {
+        arp = (const sr_arp_hdr_t*)(rec->head + sizeof(sr_ethernet_hdr_t));
+        fprintf(out, "arp %s %s -> %s\n",
+                ntohs(arp->ar_op) == arp_op_request ? "request" : "reply",
+                sr_pktrace_ip(arp->ar_sip, s), sr_pktrace_ip(arp->ar_tip, d));
+    }
+    else
+    { fprintf(out, "ethertype 0x%04x\n", ethtype); }
+} /* -- sr_pktrace_print_head -- */
+
+static void sr_pktrace_print_rec(FILE* out, const struct sr_stats_region* r,
+                                 const struct sr_pktrace_rec* rec, int thread)
+{
+    const struct sr_pktrace_event* ev;
+    char a[INET_ADDRSTRLEN], b[INET_ADDRSTRLEN];
+    time_t secs = (time_t)(rec->when / 1000000000ULL);
+    struct tm tm;
+    char when[32];
+    unsigned int i, n;
+
+    localtime_r(&secs, &tm);
+    strftime(when, sizeof(when), "%H:%M:%S", &tm);
+    fprintf(out, "\nPacket %llu, thread %d, %s.%06u, in %.*s, %u bytes: ",
+            (unsigned long long)rec->seq, thread, when,
+            (unsigned int)(rec->when % 1000000000ULL / 1000), sr_IFACE_NAMELEN,
+            rec->iface, rec->len);
+    sr_pktrace_print_head(out, rec);
+
+    n = rec->nevents < SR_PKTRACE_EVENTS ? rec->nevents : SR_PKTRACE_EVENTS;
+    for (i = 0; i < n; i++) {
+        ev = &rec->ev[i];
+        fprintf(out, "  %8.3fus  %s", ev->ns / 1e3,
+                ev->what < SR_PT_NSTEPS ? sr_pktrace_steps[ev->what] : "?");
+        switch (ev->what)
+        {
+            case SR_PT_LOCAL:
+                fprintf(out, ", proto %u", ev->c);
+                break;
+            case SR_PT_ROUTE:
+                fprintf(out, " %s/%u via %s", sr_pktrace_ip(ev->a, a), ev->c,
+                        sr_pktrace_ip(ev->b, b));
+                break;
+            case SR_PT_FRAGMENT:
+            case SR_PT_FRAG_NEEDED:
+                fprintf(out, ", mtu %u", ev->c);
+                break;
+            case SR_PT_ARP_HIT:
+            case SR_PT_ARP_QUEUED:
+                fprintf(out, " for %s", sr_pktrace_ip(ev->a, a));
+                break;
+            case SR_PT_ICMP:
+                fprintf(out, " type %u code %u to %s", ev->c >> 8, ev->c & 0xff,
+                        sr_pktrace_ip(ev->a, a));
+                break;
+            case SR_PT_SEND:
+                fprintf(out, " %u bytes on %.*s", ev->a, sr_IFACE_NAMELEN,
+                        ev->c < SR_STATS_MAX_IFS ? r->ifname[ev->c] : "?");
+                break;
+            case SR_PT_DROP:
+                fprintf(out, ", %.*s", SR_STATS_NAMELEN,
+                        ev->c < SR_DROP_NREASONS ? r->reason[ev->c] : "?");
+                break;
+            case SR_PT_ARP_IN:
+                fprintf(out, " %s from %s for %s",
+                        ev->c == arp_op_request ? "request" : "reply",
+                        sr_pktrace_ip(ev->a, a), sr_pktrace_ip(ev->b, b));
+                break;
+        }
+        fprintf(out, "\n");
+    }
+    if (rec->nevents > SR_PKTRACE_EVENTS)
+    { fprintf(out, "  ... %u more\n", rec->nevents - SR_PKTRACE_EVENTS); }
+} /* -- sr_pktrace_print_rec -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktrace_print(..)
+ * Scope:  Global
+ *
+ * Safe against a router still writing: a record is copied, then kept only
+ * if the ring hasn't come round to it meanwhile.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pktrace_print(FILE* out, const struct sr_stats_region* r)
+{
+    const struct sr_pktrace_ring* ring;
+    struct sr_pktrace_rec rec;
+    unsigned int nslots = r->nslots < SR_STATS_SLOTS ? r->nslots :
+                          SR_STATS_SLOTS;
+    uint64_t head, i;
+    unsigned int s;
+
+    fprintf(out, "%d packets left to trace%s%s\n", r->trace_left,
+            r->trace_filter[0] ? " matching " : "", r->trace_filter);
+    for (s = 0; s < nslots; s++) {
+        ring = &r->trace[s];
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        i = head > SR_PKTRACE_RING ? head - SR_PKTRACE_RING : 0;
+        for (; i < head; i++) {
+            memcpy(&rec, &ring->rec[i % SR_PKTRACE_RING], sizeof(rec));
+            if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >=
+                i + SR_PKTRACE_RING)
+            { continue; }
+            sr_pktrace_print_rec(out, r, &rec, s);
+        }
+    }
+} /* -- sr_pktrace_print -- */
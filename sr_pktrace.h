@@ -0,0 +1,132 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pktrace.h
+ *
+ * Description:
+ *
+ * Packet path tracing in the manner of VPP's packet trace: arm it for the
+ * next count packets matching a capture filter (-A count[,filter], the
+ * sr_capfilter.h syntax) and each of them records, in order, what
+ * sr_handlepacket decided about it:
+ *
+ *     ip header ok, checksum ok, for the router, TTL expired, route and
+ *     gateway matched or no route, fragmented or too big, ARP hit or
+ *     queued, ICMP emitted, sent on which interface, dropped and why
+ *
+ * with a timestamp for each step and the start of the frame.  Records go
+ * into a ring of the last SR_PKTRACE_RING traced packets per thread, in
+ * the sr_stats region, so srstat -t dumps them while the router runs and
+ * srstat -T count re-arms it for more packets.  The filter is fixed at
+ * startup; a router started without -A traces every packet once armed.
+ *
+ * Disarmed, a packet costs a load and a branch on entry and each step a
+ * branch on a thread local that is always 0; armed, packets that don't
+ * match the filter cost the filter.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PKTRACE_H
+#define SR_PKTRACE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#include "sr_protocol.h"
+
+#define SR_PKTRACE_RING     32      /* packets kept per thread */
+#define SR_PKTRACE_EVENTS   16      /* steps kept per packet */
+#define SR_PKTRACE_HEAD     64      /* bytes of the frame kept */
+#define SR_PKTRACE_FILTERLEN 128
+
+/* steps; a and b are addresses in network order, c a small number */
+#define SR_PT_IP_OK         1
+#define SR_PT_CKSUM_OK      2
+#define SR_PT_LOCAL         3       /* c: IP protocol */
+#define SR_PT_TTL_EXPIRED   4
+#define SR_PT_ROUTE         5       /* a: prefix, b: gateway, c: prefix length */
+#define SR_PT_NO_ROUTE      6
+#define SR_PT_FRAGMENT      7       /* c: mtu */
+#define SR_PT_FRAG_NEEDED   8       /* c: mtu */
+#define SR_PT_ARP_HIT       9       /* a: next hop */
+#define SR_PT_ARP_QUEUED    10      /* a: next hop */
+#define SR_PT_ICMP          11      /* a: to, c: type << 8 | code */
+#define SR_PT_SEND          12      /* a: length, c: sr_stats interface */
+#define SR_PT_DROP          13      /* c: SR_DROP_* */
+#define SR_PT_ARP_IN        14      /* a: sender, b: target, c: op */
+#define SR_PT_NSTEPS        15
+
+struct sr_pktrace_event
+{
+    uint32_t ns;                    /* since the packet came in */
+    uint16_t what;                  /* SR_PT_* */
+    uint16_t c;
+    uint32_t a;
+    uint32_t b;
+};
+
+/* one traced packet */
+struct sr_pktrace_rec
+{
+    uint64_t seq;                   /* 1 for the first packet traced */
+    uint64_t when;                  /* CLOCK_REALTIME ns */
+    char iface[sr_IFACE_NAMELEN];
+    uint32_t len;
+    uint16_t nevents;               /* recorded; past SR_PKTRACE_EVENTS lost */
+    uint16_t caplen;
+    uint8_t head[SR_PKTRACE_HEAD];
+    struct sr_pktrace_event ev[SR_PKTRACE_EVENTS];
+};
+
+/* one thread's last packets */
+struct sr_pktrace_ring
+{
+    uint64_t head;                  /* packets recorded, ever */
+    struct sr_pktrace_rec rec[SR_PKTRACE_RING];
+};
+
+struct sr_stats_region;
+
+/* packets still to trace, in the sr_stats region */
+extern volatile int32_t* sr_pktrace_left;
+
+/* the packet the calling thread is tracing, usually 0 */
+extern __thread struct sr_pktrace_rec* sr_pktrace_cur;
+
+/* Trace this packet if armed and it matches. */
+#define SR_PKTRACE_BEGIN(buf, len, iface)                                   \
+    do {                                                                    \
+        if (*sr_pktrace_left > 0)                                           \
+        { sr_pktrace_begin(buf, len, iface); }                              \
+    } while (0)
+
+/* The traced packet took a step; arguments are only evaluated then. */
+#define SR_PKTRACE(what, a, b, c)                                           \
+    do {                                                                    \
+        if (sr_pktrace_cur)                                                 \
+        { sr_pktrace_add(what, a, b, c); }                                  \
+    } while (0)
+
+#define SR_PKTRACE_END()                                                    \
+    do {                                                                    \
+        if (sr_pktrace_cur)                                                 \
+        { sr_pktrace_end(); }                                               \
+    } while (0)
+
+void sr_pktrace_begin(const uint8_t* buf, unsigned int len, const char* iface);
+void sr_pktrace_add(int what, uint32_t a, uint32_t b, unsigned int c);
+void sr_pktrace_end(void);
+
+/* Compile filter (0 for every packet) and arm for count packets.  Call
+   after sr_stats_init.  0 on success, -1 if the filter doesn't parse. */
+int  sr_pktrace_init(int count, const char* filter);
+
+/* Every thread's ring in region r, oldest first per thread. */
+void sr_pktrace_print(FILE* out, const struct sr_stats_region* r);
+
+#endif /* -- SR_PKTRACE_H -- */
@@ -0,0 +1,316 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pmu.c
+ *
+ * Description:
+ *
+ * Hardware counters per stage, see sr_pmu.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef _LINUX_
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif /* _LINUX_ */
+
+#include "sr_pmu.h"
+#include "sr_stats.h"
+
+static const char* sr_pmu_event_names[SR_PMU_NEVENTS] =
+{ "cycles", "instructions", "L1d misses", "LLC misses", "branch misses" };
+
+/* the calling thread's group */
+struct sr_pmu_thread
+{
+    int state;                      /* 0 not opened yet, 1 open, -1 can't */
+    int leader;                     /* fd of the group leader */
+    unsigned int n;                 /* events in the group */
+    int fd[SR_PMU_NEVENTS];         /* in read order, leader first */
+    int event[SR_PMU_NEVENTS];      /* SR_PMU_* of each value read */
+    uint64_t enabled;               /* group times at the last read */
+    uint64_t running;
+    int valid;                      /* start and last were read cleanly */
+    uint64_t start[SR_PMU_NEVENTS]; /* when the packet began */
+    uint64_t last[SR_PMU_NEVENTS];  /* at the previous stage boundary */
+    struct sr_pmu_slot* slot;
+};
+
+int sr_pmu_on = 0;
+static __thread struct sr_pmu_thread sr_pmu_self;
+
+#ifdef _LINUX_
+
+/* type and config of each SR_PMU_* */
+static void sr_pmu_attr(int event, struct perf_event_attr* pe)
+{
+    memset(pe, 0, sizeof(*pe));
+    pe->size = sizeof(*pe);
+    pe->exclude_kernel = 1;
+    pe->exclude_hv = 1;
+    pe->type = PERF_TYPE_HARDWARE;
+    switch (event)
+    {
+        case SR_PMU_CYCLES:
+            pe->config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case SR_PMU_INSTRUCTIONS:
+            pe->config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case SR_PMU_L1D_MISSES:
+            pe->type = PERF_TYPE_HW_CACHE;
+            pe->config = PERF_COUNT_HW_CACHE_L1D |
+                         (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case SR_PMU_LLC_MISSES:
+            pe->config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case SR_PMU_BRANCH_MISSES:
+            pe->config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+    }
+} /* -- sr_pmu_attr -- */
+
+static int sr_pmu_open_event(struct perf_event_attr* pe, int group)
+{
+    return (int)syscall(SYS_perf_event_open, pe, 0, -1, group, 0);
+} /* -- sr_pmu_open_event -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pmu_open(..)
+ * Scope:  Local
+ *
+ * Cycles lead the group; any other event this CPU doesn't have is left
+ * out rather than giving up on the rest.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pmu_open(struct sr_pmu_thread* t, uint32_t* events)
+{
+    struct perf_event_attr pe;
+    int e, fd;
+
+    t->n = 0;
+    *events = 0;
+    for (e = 0; e < SR_PMU_NEVENTS; e++) {
+        sr_pmu_attr(e, &pe);
+        if (e == SR_PMU_CYCLES) {
+            pe.read_format = PERF_FORMAT_GROUP |
+                             PERF_FORMAT_TOTAL_TIME_ENABLED |
+                             PERF_FORMAT_TOTAL_TIME_RUNNING;
+            if ((fd = t->leader = sr_pmu_open_event(&pe, -1)) < 0)
+            { return -1; }
+        }
+        else if ((fd = sr_pmu_open_event(&pe, t->leader)) < 0)
+        { continue; }
+        t->fd[t->n] = fd;
+        t->event[t->n++] = e;
+        *events |= 1u << e;
+    }
+    return 0;
+} /* -- sr_pmu_open -- */
+
+static void sr_pmu_close(struct sr_pmu_thread* t)
+{
+    unsigned int i;
+
+    for (i = 0; i < t->n; i++)
+    { close(t->fd[i]); }
+} /* -- sr_pmu_close -- */
+
+/* the whole group in v, by SR_PMU_*, events not opened 0.  0 if it ran
+   the whole time since the last read, 1 if it was multiplexed out for
+   some of it, -1 if it couldn't be read */
+static int sr_pmu_read(struct sr_pmu_thread* t, uint64_t* v)
+{
+    uint64_t buf[3 + SR_PMU_NEVENTS];
+    uint64_t de, dr;
+    unsigned int i;
+
+    if (read(t->leader, buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t)))
+    { return -1; }
+    memset(v, 0, SR_PMU_NEVENTS * sizeof(*v));
+    de = buf[1] - t->enabled;
+    dr = buf[2] - t->running;
+    t->enabled = buf[1];
+    t->running = buf[2];
+    for (i = 0; i < buf[0] && i < t->n; i++)
+    { v[t->event[i]] = buf[3 + i]; }
+    return de == dr ? 0 : 1;
+} /* -- sr_pmu_read -- */
+
+#else
+
+static int sr_pmu_open(struct sr_pmu_thread* t, uint32_t* events)
+{
+    errno = ENOSYS;
+    return -1;
+} /* -- sr_pmu_open -- */
+
+static void sr_pmu_close(struct sr_pmu_thread* t) { }
+
+static int sr_pmu_read(struct sr_pmu_thread* t, uint64_t* v)
+{
+    return -1;
+} /* -- sr_pmu_read -- */
+
+#endif /* _LINUX_ */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pmu_init(..)
+ * Scope:  Global
+ *
+ * Opens the group once on the calling thread to find out early whether
+ * there is a PMU at all; the forwarding threads open their own.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pmu_init(void)
+{
+    struct sr_pmu_thread t;
+    uint32_t events;
+
+    memset(&t, 0, sizeof(t));
+    if (sr_pmu_open(&t, &events) != 0) {
+        perror("perf_event_open(..):sr_pmu.c::sr_pmu_init(..)");
+        return -1;
+    }
+    sr_pmu_close(&t);
+    if (!(events & (1u << SR_PMU_INSTRUCTIONS)))
+    { fprintf(stderr, "Instructions can't be counted, no IPC\n"); }
+    sr_stats_set_pmu(1);
+    sr_pmu_on = 1;
+    return 0;
+} /* -- sr_pmu_init -- */
+
+void sr_pmu_begin(void)
+{
+    struct sr_pmu_thread* t = &sr_pmu_self;
+
+    if (t->state == 0) {
+        t->slot = sr_stats_pmu_slot();
+        t->state = sr_pmu_open(t, &t->slot->events) == 0 ? 1 : -1;
+    }
+    t->valid = 0;
+    if (t->state < 0)
+    { return; }
+    /* -- only the time since this read matters -- */
+    if (sr_pmu_read(t, t->start) >= 0) {
+        memcpy(t->last, t->start, sizeof(t->last));
+        t->valid = 1;
+    }
+} /* -- sr_pmu_begin -- */
+
+void sr_pmu_mark(int stage)
+{
+    struct sr_pmu_thread* t = &sr_pmu_self;
+    uint64_t v[SR_PMU_NEVENTS];
+    int e;
+
+    if (!t->valid)
+    { return; }
+    if (sr_pmu_read(t, v) != 0) {
+        t->slot->lost++;
+        t->valid = 0;
+        return;
+    }
+    for (e = 0; e < SR_PMU_NEVENTS; e++)
+    { t->slot->stage[stage][e] += v[e] - t->last[e]; }
+    t->slot->stage_samples[stage]++;
+    memcpy(t->last, v, sizeof(t->last));
+} /* -- sr_pmu_mark -- */
+
+void sr_pmu_end(int path)
+{
+    struct sr_pmu_thread* t = &sr_pmu_self;
+    uint64_t v[SR_PMU_NEVENTS];
+    int e;
+
+    if (!t->valid)
+    { return; }
+    t->valid = 0;
+    if (sr_pmu_read(t, v) != 0) {
+        t->slot->lost++;
+        return;
+    }
+    for (e = 0; e < SR_PMU_NEVENTS; e++)
+    { t->slot->path[path][e] += v[e] - t->start[e]; }
+    t->slot->path_samples[path]++;
+} /* -- sr_pmu_end -- */
+
+static void sr_pmu_print_row(FILE* out, const char* name, const uint64_t* sum,
+                             uint64_t n, uint32_t events)
+{
+    int e;
+
+    fprintf(out, "%-11s %10llu", name, (unsigned long long)n);
+    for (e = 0; n && e < SR_PMU_NEVENTS; e++) {
+        if (events & (1u << e))
+        { fprintf(out, " %9.1f", (double)sum[e] / n); }
+        else
+        { fprintf(out, " %9s", "-"); }
+        if (e == SR_PMU_INSTRUCTIONS) {
+            if ((events & 3u) == 3u && sum[SR_PMU_CYCLES])
+            { fprintf(out, " %5.2f", (double)sum[e] / sum[SR_PMU_CYCLES]); }
+            else
+            { fprintf(out, " %5s", "-"); }
+        }
+    }
+    fprintf(out, "\n");
+} /* -- sr_pmu_print_row -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pmu_print(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pmu_print(FILE* out, const struct sr_pmu_slot* slots,
+                  unsigned int nslots)
+{
+    uint64_t sum[SR_PMU_NEVENTS], n, lost = 0;
+    uint32_t events = 0;
+    unsigned int s;
+    int k, e;
+
+    for (s = 0; s < nslots; s++) {
+        events |= slots[s].events;
+        lost += slots[s].lost;
+    }
+    if (!events) {
+        fprintf(out, "\nno thread could open the hardware counters\n");
+        return;
+    }
+
+    fprintf(out, "\nPER PACKET     SAMPLES    CYCLES     INSNS   IPC  "
+            "L1D_MISS  LLC_MISS   BR_MISS\n");
+    fprintf(out, "-------------------------------------------------------"
+            "-------------------------\n");
+    for (k = 0; k < SR_LAT_NSTAGES + SR_LAT_NPATHS; k++) {
+        if (k == SR_LAT_NSTAGES + SR_LAT_NONE)
+        { continue; }
+        memset(sum, 0, sizeof(sum));
+        n = 0;
+        for (s = 0; s < nslots; s++) {
+            for (e = 0; e < SR_PMU_NEVENTS; e++) {
+                sum[e] += k < SR_LAT_NSTAGES ? slots[s].stage[k][e] :
+                          slots[s].path[k - SR_LAT_NSTAGES][e];
+            }
+            n += k < SR_LAT_NSTAGES ? slots[s].stage_samples[k] :
+                 slots[s].path_samples[k - SR_LAT_NSTAGES];
+        }
+        sr_pmu_print_row(out, k < SR_LAT_NSTAGES ? sr_lat_stage_names[k] :
+                         sr_lat_path_names[k - SR_LAT_NSTAGES], sum, n, events);
+    }
+    for (e = 0; e < SR_PMU_NEVENTS; e++) {
+        if (!(events & (1u << e)))
+        { fprintf(out, "%s not counted on this CPU\n", sr_pmu_event_names[e]); }
+    }
+    if (lost)
+    { fprintf(out, "%llu samples lost to multiplexing\n", (unsigned long long)lost); }
+} /* -- sr_pmu_print -- */
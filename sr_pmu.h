@@ -0,0 +1,78 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pmu.h
+ *
+ * Description:
+ *
+ * Hardware counters for the packets sr_lat samples (-P).  Each forwarding
+ * thread opens a perf_event_open group on itself, user space only:
+ *
+ *     cycles, instructions, L1d read misses, LLC misses, branch misses
+ *
+ * and reads the whole group in one read() at the same stage boundaries
+ * sr_lat timestamps (sr_lat.h).  The deltas are summed per stage and per
+ * path in the sr_stats region, next to the latency histograms, and printed
+ * as per packet averages with IPC on exit and by srstat -l.
+ *
+ * A group read is a syscall, about 1us under virtualization; the kernel
+ * side isn't counted (exclude_kernel) but it does disturb the caches, so
+ * keep sampling sparse (-H 64 or so) when the miss counts matter.  Samples
+ * for which the kernel had the group multiplexed out are thrown away and
+ * counted as lost rather than scaled.
+ *
+ * Without a PMU (most VMs) the counters can't be opened; -P says so and
+ * the router runs as if it wasn't given.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PMU_H
+#define SR_PMU_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#include "sr_lat.h"
+
+#define SR_PMU_CYCLES        0
+#define SR_PMU_INSTRUCTIONS  1
+#define SR_PMU_L1D_MISSES    2
+#define SR_PMU_LLC_MISSES    3
+#define SR_PMU_BRANCH_MISSES 4
+#define SR_PMU_NEVENTS       5
+
+/* one thread's counter sums */
+struct sr_pmu_slot
+{
+    uint64_t stage[SR_LAT_NSTAGES][SR_PMU_NEVENTS];
+    uint64_t stage_samples[SR_LAT_NSTAGES];
+    uint64_t path[SR_LAT_NPATHS][SR_PMU_NEVENTS];
+    uint64_t path_samples[SR_LAT_NPATHS];
+    uint64_t lost;                  /* samples taken while multiplexed out */
+    uint32_t events;                /* bit per SR_PMU_* the thread opened */
+    uint32_t pad;
+};
+
+/* read the counters along with sr_lat's timestamps */
+extern int sr_pmu_on;
+
+/* Check the counters can be opened and turn them on.  sr_lat has to be
+   sampling for them to be read.  0 if they are on. */
+int  sr_pmu_init(void);
+
+/* Called by sr_lat for sampled packets only. */
+void sr_pmu_begin(void);
+void sr_pmu_mark(int stage);
+void sr_pmu_end(int path);
+
+/* Per packet averages for every stage and path summed over nslots
+   slots. */
+void sr_pmu_print(FILE* out, const struct sr_pmu_slot* slots,
+                  unsigned int nslots);
+
+#endif /* -- SR_PMU_H -- */
@@ -0,0 +1,133 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_probe.h
+ *
+ * Description:
+ *
+ * USDT (SystemTap style) static probes on the packet path, provider "sr":
+ *
+ *     receive(iface, frame, len)            every backend, sr_io_deliver
+ *     decision(iface, src, dst, len, verdict)
+ *                                           IP in sr_handlepacket, verdict
+ *                                           is an SR_VERDICT_*
+ *     drop(reason)                          every SR_STATS_DROP, reason is
+ *                                           an SR_DROP_* of sr_stats.h
+ *     lpm(dst, prefix, mask, gw, iface)     sr_LPM's answer, all 0 on a miss
+ *     arp_queue(nexthop, iface, len)        parked waiting for ARP
+ *     arp_dequeue(nexthop, len, wait_ns, resolved)
+ *                                           left the ARP queue, sent if
+ *                                           resolved, host unreachable if not
+ *     icmp(type, code, dst, len)            the router built an ICMP message
+ *     send(iface, frame, len)               sr_send_packet
+ *
+ * Interfaces are C strings, IPv4 addresses network byte order; every
+ * argument is passed as 64 bits.  With bpftrace, for instance:
+ *
+ *     bpftrace -e 'usdt:./sr:sr:drop { @[arg0] = count(); }'
+ *     bpftrace -e 'usdt:./sr:sr:arp_dequeue { @wait = hist(arg2); }'
+ *
+ * A probe site is a single nop plus an ELF note naming it and saying where
+ * its arguments are (a register or stack slot the compiler already had
+ * them in); a tracer patches the nop into a breakpoint when it attaches,
+ * nothing happens otherwise.  The arguments are values at hand or a load
+ * away, nothing is computed for the probe's sake.
+ *
+ * The notes come from <sys/sdt.h> when it's installed (make SDT=1), are
+ * written inline on x86-64 ELF otherwise, and elsewhere the probes compile
+ * to nothing.  make PROBES=0 leaves them out everywhere.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PROBE_H
+#define SR_PROBE_H
+
+#define SR_VERDICT_FORWARD      0
+#define SR_VERDICT_LOCAL        1   /* for the router itself */
+#define SR_VERDICT_TTL          2   /* time exceeded sent */
+#define SR_VERDICT_NO_ROUTE     3   /* net unreachable sent */
+#define SR_VERDICT_FRAG_NEEDED  4   /* too big with DF set */
+
+#define SR_PROBE_ARG(x) ((unsigned long)(x))
+
+#if defined(SR_NO_PROBES)
+
+#define SR_PROBE_SITE(name, args, ops...) do { } while (0)
+
+#elif defined(SR_HAVE_SDT)
+
+#include <sys/sdt.h>
+
+#elif defined(__x86_64__) && defined(__ELF__)
+
+/* what <sys/sdt.h> emits, version 3 notes with no semaphore */
+#define SR_PROBE_NOTE(name, args)                                           \
+    "990: nop\n"                                                            \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                           \
+    ".balign 4\n"                                                           \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                      \
+    "991: .asciz \"stapsdt\"\n"                                             \
+    "992: .balign 4\n"                                                      \
+    "993: .8byte 990b\n"                                                    \
+    ".8byte _.stapsdt.base\n"                                               \
+    ".8byte 0\n"                                                            \
+    ".asciz \"sr\"\n"                                                       \
+    ".asciz \"" #name "\"\n"                                                \
+    ".asciz \"" args "\"\n"                                                 \
+    "994: .balign 4\n"                                                      \
+    ".popsection\n"                                                         \
+    ".ifndef _.stapsdt.base\n"                                              \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n"                                                \
+    ".hidden _.stapsdt.base\n"                                              \
+    "_.stapsdt.base: .space 1\n"                                            \
+    ".size _.stapsdt.base, 1\n"                                             \
+    ".popsection\n"                                                         \
+    ".endif\n"
+
+#define SR_PROBE_SITE(name, args, ops...)                                   \
+    do {                                                                    \
+        __asm__ __volatile__ (SR_PROBE_NOTE(name, args) : : ops);          \
+    } while (0)
+
+#else
+
+#define SR_PROBE_SITE(name, args, ops...) do { } while (0)
+
+#endif
+
+#if defined(SR_HAVE_SDT) && !defined(SR_NO_PROBES)
+
+#define SR_PROBE1(name, x1) \
+    DTRACE_PROBE1(sr, name, SR_PROBE_ARG(x1))
+#define SR_PROBE3(name, x1, x2, x3) \
+    DTRACE_PROBE3(sr, name, SR_PROBE_ARG(x1), SR_PROBE_ARG(x2), \
+                  SR_PROBE_ARG(x3))
+#define SR_PROBE4(name, x1, x2, x3, x4) \
+    DTRACE_PROBE4(sr, name, SR_PROBE_ARG(x1), SR_PROBE_ARG(x2), \
+                  SR_PROBE_ARG(x3), SR_PROBE_ARG(x4))
+#define SR_PROBE5(name, x1, x2, x3, x4, x5) \
+    DTRACE_PROBE5(sr, name, SR_PROBE_ARG(x1), SR_PROBE_ARG(x2), \
+                  SR_PROBE_ARG(x3), SR_PROBE_ARG(x4), SR_PROBE_ARG(x5))
+
+#else
+
+#define SR_PROBE_OP(op, x) [op] "nor" (SR_PROBE_ARG(x))
+
+#define SR_PROBE1(name, x1)                                                 \
+    SR_PROBE_SITE(name, "8@%[a1]", SR_PROBE_OP(a1, x1))
+#define SR_PROBE3(name, x1, x2, x3)                                         \
+    SR_PROBE_SITE(name, "8@%[a1] 8@%[a2] 8@%[a3]",                          \
+                  SR_PROBE_OP(a1, x1), SR_PROBE_OP(a2, x2),                 \
+                  SR_PROBE_OP(a3, x3))
+#define SR_PROBE4(name, x1, x2, x3, x4)                                     \
+    SR_PROBE_SITE(name, "8@%[a1] 8@%[a2] 8@%[a3] 8@%[a4]",                  \
+                  SR_PROBE_OP(a1, x1), SR_PROBE_OP(a2, x2),                 \
+                  SR_PROBE_OP(a3, x3), SR_PROBE_OP(a4, x4))
+#define SR_PROBE5(name, x1, x2, x3, x4, x5)                                 \
+    SR_PROBE_SITE(name, "8@%[a1] 8@%[a2] 8@%[a3] 8@%[a4] 8@%[a5]",          \
+                  SR_PROBE_OP(a1, x1), SR_PROBE_OP(a2, x2),                 \
+                  SR_PROBE_OP(a3, x3), SR_PROBE_OP(a4, x4),                 \
+                  SR_PROBE_OP(a5, x5))
+
+#endif
+
+#endif /* -- SR_PROBE_H -- */
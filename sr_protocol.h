@@ -159,10 +159,19 @@ struct sr_ethernet_hdr
 } __attribute__ ((packed)) ;
 typedef struct sr_ethernet_hdr sr_ethernet_hdr_t;
 
+/* IP MTU of an interface unless configured otherwise, and the most any
+   interface can be given (jumbo frames) */
+#define SR_DEFAULT_MTU 1500
+#define SR_MIN_MTU     68
+#define SR_MAX_MTU     9216
+#define SR_MAX_FRAME   (SR_MAX_MTU + sizeof(sr_ethernet_hdr_t))
+
 
 
 enum sr_ip_protocol {
   ip_protocol_icmp = 0x0001,
+  ip_protocol_tcp = 0x0006,
+  ip_protocol_udp = 0x0011,
 };
 
 enum sr_ethertype {
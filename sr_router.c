@@ -22,8 +22,33 @@
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
 #include "sr_utils.h"
+#include "sr_dispatch.h"
+#include "sr_egress.h"
+#include "sr_bufpool.h"
+#include "sr_log.h"
+#include "sr_stats.h"
+#include "sr_lat.h"
+#include "sr_probe.h"
+#include "sr_flow.h"
 #include <string.h>
 
+/*USDT sr:decision for the IP packet being handled, see sr_probe.h*/
+#define SR_PROBE_DECISION(verdict) \
+  SR_PROBE5(decision,interface,iphdr->ip_src,iphdr->ip_dst,len,verdict)
+
+/*count the IP packet being forwarded against its flow (-X)*/
+#define SR_FLOW_COUNT(out_if)                                               \
+  do {                                                                      \
+    if(sr->flows){                                                          \
+      struct sr_if* in_if = sr_get_interface(sr,interface);                 \
+      sr_flow_packet(sr->flows,iphdr,len-sizeof(sr_ethernet_hdr_t),         \
+                     in_if ? in_if->stats : 0,(out_if)->stats);             \
+    }                                                                       \
+  } while (0)
+
+static void sr_icmp_t3(struct sr_instance*,sr_ip_hdr_t*,uint8_t,uint16_t);
+static void sr_handleframe(struct sr_instance*,uint8_t*,unsigned int,char*);
+
 /*---------------------------------------------------------------------
  * Method: sr_init(void)
  * Scope:  Global
@@ -44,14 +69,82 @@ void sr_init(struct sr_instance* sr)
     pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
     pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
     pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
-    pthread_t thread;
 
-    pthread_create(&thread, &(sr->attr), sr_arpcache_timeout, sr);
+    sr->cache.sweeping = pthread_create(&(sr->cache.sweeper), &(sr->attr),
+                                        sr_arpcache_timeout, sr) == 0;
     
-    /* Add initialization code here! */
+    /* Queue frames the transport can't take instead of blocking on it */
+    if(sr->egress_depth > 0 && sr_egress_init(sr, sr->egress_depth,
+                       sr->codel_target, sr->codel_interval,
+                       sr->shape) != 0){
+        fprintf(stderr,"Falling back to transmitting without queues\n");
+    }
+
+    /* Spread forwarding over worker threads if asked to */
+    if(sr->nworkers > 0 && sr_dispatch_init(sr, sr->nworkers) != 0){
+        fprintf(stderr,"Falling back to forwarding on the receive thread\n");
+    }
 
 } /* -- sr_init -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_defer(..)
+ * Scope:  Local
+ *
+ * ICMP generation does not need to stay in flow order, so on a worker it
+ * goes to the work-stealing scheduler instead of holding up the rx ring.
+ * The offending IP packet is copied since the frame is only lent to us.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_icmp_job
+{
+    uint8_t type;
+    uint8_t code;
+    uint16_t mtu;
+    uint8_t iphdr[0];
+};
+
+static void sr_icmp_job_run(struct sr_instance* sr, void* arg)
+{
+    struct sr_icmp_job* job = (struct sr_icmp_job*)arg;
+    sr_ip_hdr_t* iphdr = (sr_ip_hdr_t*)job->iphdr;
+
+    if(job->type==0)sr_icmp_echo_reply(sr,iphdr);
+    else if(job->type==11)sr_icmp_TLE(sr,iphdr);
+    else if(job->code==4)sr_icmp_frag_needed(sr,iphdr,job->mtu);
+    else sr_icmp_dest_unr(sr,iphdr,job->code);
+    sr_buf_free(job);
+}
+
+static void sr_icmp_defer(struct sr_instance* sr,sr_ip_hdr_t* iphdr,
+                          unsigned int avail,uint8_t type,uint8_t code,
+                          uint16_t mtu){
+	SR_PKTRACE(SR_PT_ICMP,iphdr->ip_src,0,type<<8|code);
+	if(!sr->dispatch){
+		if(type==0)sr_icmp_echo_reply(sr,iphdr);
+		else if(type==11)sr_icmp_TLE(sr,iphdr);
+		else if(code==4)sr_icmp_frag_needed(sr,iphdr,mtu);
+		else sr_icmp_dest_unr(sr,iphdr,code);
+		return;
+	}
+	/*builders read ip_len bytes for echo and ICMP_DATA_SIZE otherwise*/
+	unsigned int size = ntohs(iphdr->ip_len);
+	if(size<ICMP_DATA_SIZE)size = ICMP_DATA_SIZE;
+	struct sr_icmp_job* job = (struct sr_icmp_job*)sr_buf_alloc(sizeof(struct sr_icmp_job)+size);
+	if(!job){
+		SR_ERR("out of memory deferring icmp, dropped\n");
+		SR_STATS_DROP(SR_DROP_NO_BUF);
+		return;
+	}
+	memset(job,0,sizeof(struct sr_icmp_job)+size);
+	job->type = type;
+	job->code = code;
+	job->mtu = mtu;
+	memcpy(job->iphdr,iphdr,avail<size?avail:size);
+	sr_defer(sr,sr_icmp_job_run,job);
+}
+
 /*---------------------------------------------------------------------
  * Method: sr_handlepacket(uint8_t* p,char* interface)
  * Scope:  Global
@@ -77,11 +170,26 @@ void sr_handlepacket(struct sr_instance* sr,
   assert(sr);
   assert(packet);
   assert(interface);
-  
-  printf("*** -> Received packet of length %d \n",len);
+
+  SR_LAT_BEGIN();
+  SR_PKTRACE_BEGIN(packet,len,interface);
+  sr_handleframe(sr,packet,len,interface);
+  SR_SKETCH_SOURCE(0);
+  SR_PKTRACE_END();
+  SR_LAT_END();
+}
+
+/*the forwarding path itself, sr_handlepacket only times it (-H)*/
+static void sr_handleframe(struct sr_instance* sr,
+        uint8_t * packet/* lent */,
+        unsigned int len,
+        char* interface/* lent */)
+{
+  SR_TRACE("*** -> Received packet of length %d \n",len);
   int  minlength = sizeof(sr_ethernet_hdr_t);
   if (len < minlength) {
-    fprintf(stderr, "Failed to load ETHERNET header, insufficient length\n");
+    SR_WARN("Failed to load ETHERNET header, insufficient length\n");
+    SR_STATS_DROP(SR_DROP_RUNT);
     return;
   }
   
@@ -89,96 +197,142 @@ void sr_handlepacket(struct sr_instance* sr,
   /*sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t*)(packet);*/
   
   if(ethertype_ip == ethtype){
-  	printf("get a ip packet\n");
+  	SR_TRACE("get a ip packet\n");
   	/*i'll use a different style of early return here,don't like too much indent*/
   	minlength += sizeof(sr_ip_hdr_t);
   	if(len < minlength){
-  		fprintf(stderr,"Failed to load ip header, insufficient length\n");
+  		SR_WARN("Failed to load ip header, insufficient length\n");
+  		SR_STATS_DROP(SR_DROP_IP_SHORT);
   		return;
   	}
-  	printf("checking validity\n");
+  	SR_TRACE("checking validity\n");
   	sr_ip_hdr_t *iphdr = (sr_ip_hdr_t*)(packet+sizeof(sr_ethernet_hdr_t));
   	if(iphdr->ip_v!=4||iphdr->ip_hl<5){
-  		fprintf(stderr,"packet version/hl wrong\n");
+  		SR_WARN("packet version/hl wrong\n");
+  		SR_STATS_DROP(SR_DROP_IP_HEADER);
   		return;
   	}
+  	SR_SKETCH_IP(iphdr->ip_src,iphdr->ip_dst);
+  	SR_LAT_MARK(SR_LAT_PARSE);
+  	SR_PKTRACE(SR_PT_IP_OK,0,0,0);
   	uint32_t ip_sum = iphdr->ip_sum;
   	iphdr->ip_sum = 0;
   	uint32_t ip_cksum = cksum(iphdr,iphdr->ip_hl*4);
   	if(ip_cksum!=ip_sum){
-  		fprintf(stderr,"packet checksum WRONG\n");
+  		SR_WARN("packet checksum WRONG\n");
+  		SR_STATS_DROP(SR_DROP_IP_CKSUM);
   		return;
   	}
   	iphdr->ip_sum = ip_cksum;
-  	printf("	ip checksum OK\n");
+  	SR_LAT_MARK(SR_LAT_CKSUM);
+  	SR_PKTRACE(SR_PT_CKSUM_OK,0,0,0);
+  	SR_TRACE("	ip checksum OK\n");
   	struct sr_if *to_interface = sr_get_interface_by_ip(sr,iphdr->ip_dst);
   	if(to_interface){
-  		printf("	it's an IP for me\n");
+  		SR_TRACE("	it's an IP for me\n");
+  		SR_LAT_PATH(SR_LAT_TO_ME);
+  		SR_PROBE_DECISION(SR_VERDICT_LOCAL);
+  		SR_PKTRACE(SR_PT_LOCAL,0,0,iphdr->ip_p);
   		if(iphdr->ip_p==1){
-  			printf("	it's an ICMP\n");
+  			SR_TRACE("	it's an ICMP\n");
   			sr_icmp_hdr_t *icmp_hdr =(sr_icmp_hdr_t*)(packet+sizeof(sr_ethernet_hdr_t)
   															+sizeof(sr_ip_hdr_t));
   			if(icmp_hdr->icmp_type!=8||icmp_hdr->icmp_code!=0){
-  				printf("	not an echo request\n");
+  				SR_TRACE("	not an echo request\n");
+  				SR_STATS_DROP(SR_DROP_ICMP_TYPE);
   				return;
   			}
   			uint32_t icmp_cksum = icmp_hdr->icmp_sum;
   			icmp_hdr->icmp_sum = 0;
   			if(icmp_cksum!=cksum((uint8_t*)icmp_hdr,ntohs(iphdr->ip_len)-sizeof(sr_ip_hdr_t))){
-  				fprintf(stderr,"	icmp cksum wrong \n");
+  				SR_WARN("	icmp cksum wrong \n");
+  				SR_STATS_DROP(SR_DROP_ICMP_CKSUM);
   				return;
   			}
-  			sr_icmp_echo_reply(sr,iphdr);
+  			sr_icmp_defer(sr,iphdr,len-sizeof(sr_ethernet_hdr_t),0,0,0);
   		}else{
-  			sr_icmp_dest_unr(sr,iphdr,3);
+  			SR_STATS_DROP(SR_DROP_NO_LISTENER);
+  			sr_icmp_defer(sr,iphdr,len-sizeof(sr_ethernet_hdr_t),3,3,0);
   		}
   	}else{
-  		printf("	it's not to me,foward it!\n");
-  		printf("	TTL = %d\n",iphdr->ip_ttl);
+  		SR_TRACE("	it's not to me,foward it!\n");
+  		SR_TRACE("	TTL = %d\n",iphdr->ip_ttl);
   		if(iphdr->ip_ttl==1){
-  			printf("TTL = 0\n");
-  			sr_icmp_TLE(sr,iphdr);
+  			SR_TRACE("TTL = 0\n");
+  			SR_STATS_DROP(SR_DROP_TTL);
+  			SR_PROBE_DECISION(SR_VERDICT_TTL);
+  			SR_PKTRACE(SR_PT_TTL_EXPIRED,0,0,0);
+  			sr_icmp_defer(sr,iphdr,len-sizeof(sr_ethernet_hdr_t),11,0,0);
   			return;
   		}
   		iphdr->ip_ttl = iphdr->ip_ttl-1;
 	  	iphdr->ip_sum = 0;
 	  	iphdr->ip_sum = cksum(iphdr,iphdr->ip_hl*4);
 		struct sr_rt *tb = sr_LPM(sr,iphdr->ip_dst);
+		SR_LAT_MARK(SR_LAT_ROUTE);
 		if(!tb){
-			printf("	no match in LPM,net unreachable\n");
-			sr_icmp_dest_unr(sr,iphdr,0);
+			SR_DEBUG("	no match in LPM,net unreachable\n");
+			SR_STATS_DROP(SR_DROP_NO_ROUTE);
+			SR_PROBE_DECISION(SR_VERDICT_NO_ROUTE);
+			SR_PKTRACE(SR_PT_NO_ROUTE,0,0,0);
+			sr_icmp_defer(sr,iphdr,len-sizeof(sr_ethernet_hdr_t),3,0,0);
 		}else{
-			struct sr_if* interface = sr_get_interface(sr,tb->interface);
-			sr_nexthop_ip_iface(sr,packet,len,tb->gw.s_addr,interface);
+			struct sr_if* out_if = sr_get_interface(sr,tb->interface);
+			SR_STATS_ROUTE(tb,SR_ROUTE_FORWARD,ntohs(iphdr->ip_len));
+			SR_PKTRACE(SR_PT_ROUTE,tb->dest.s_addr,tb->gw.s_addr,
+			           __builtin_popcount(tb->mask.s_addr));
+			if(ntohs(iphdr->ip_len)<=out_if->mtu){
+				SR_LAT_PATH(SR_LAT_FORWARDED);
+				SR_PROBE_DECISION(SR_VERDICT_FORWARD);
+				SR_FLOW_COUNT(out_if);
+				sr_nexthop_ip_iface(sr,packet,len,tb->gw.s_addr,out_if);
+			}else if(ntohs(iphdr->ip_off)&IP_DF){
+				SR_DEBUG("	bigger than mtu %u and DF set\n",out_if->mtu);
+				SR_STATS_DROP(SR_DROP_FRAG_NEEDED);
+				SR_PROBE_DECISION(SR_VERDICT_FRAG_NEEDED);
+				SR_PKTRACE(SR_PT_FRAG_NEEDED,0,0,out_if->mtu);
+				sr_icmp_defer(sr,iphdr,len-sizeof(sr_ethernet_hdr_t),3,4,
+				              (uint16_t)out_if->mtu);
+			}else{
+				SR_LAT_PATH(SR_LAT_FORWARDED);
+				SR_PROBE_DECISION(SR_VERDICT_FORWARD);
+				SR_PKTRACE(SR_PT_FRAGMENT,0,0,out_if->mtu);
+				SR_FLOW_COUNT(out_if);
+				sr_ip_fragment(sr,packet,len,tb->gw.s_addr,out_if);
+			}
   		}
   	}
   }else if(ethertype_arp == ethtype){
-  	printf("get a arp packet\n");
+  	SR_TRACE("get a arp packet\n");
   	minlength += sizeof(sr_arp_hdr_t);
-   	if (len < minlength)
-		fprintf(stderr, "Failed to load ARP header, insufficient length\n");
-    else{
-    	printf("checking validaty\n");
+   	if (len < minlength){
+		SR_WARN("Failed to load ARP header, insufficient length\n");
+		SR_STATS_DROP(SR_DROP_ARP_SHORT);
+    }else{
+    	SR_TRACE("checking validaty\n");
     	sr_arp_hdr_t *arphdr = (sr_arp_hdr_t*)(packet+sizeof(sr_ethernet_hdr_t));
+    	SR_SKETCH_SOURCE(arphdr->ar_sip);
     	/*printf("ar_hrd = %x\n",ntohs(arphdr->ar_hrd)*/
 	/*print_hdr_arp(packet+sizeof(sr_ethernet_hdr_t));*/
     	if(ntohs(arphdr->ar_hrd)==arp_hrd_ethernet&&
     	   ntohs(arphdr->ar_pro)==ethertype_ip&&
     	   arphdr->ar_hln==0x06&&arphdr->ar_pln==0x04){
+    		   	SR_PKTRACE(SR_PT_ARP_IN,arphdr->ar_sip,arphdr->ar_tip,
+    		   	           ntohs(arphdr->ar_op));
     		   	if(ntohs(arphdr->ar_op)==arp_op_request){
     		   		uint32_t _ip = arphdr->ar_tip;
     		   		/*assume sr_if store ip in network order*/
     		   		struct sr_if *interface = sr_get_interface_by_ip(sr,_ip);
-    		   		printf("getting a arp request\n");
+    		   		SR_TRACE("getting a arp request\n");
     		   		if(interface){
-    		   			printf("found the interface refered\n");
+    		   			SR_TRACE("found the interface refered\n");
     		   			/* send a ARP reply to the place(proper interface)*/
     		   			sr_arp_reply(sr,interface,arphdr->ar_sha,arphdr->ar_sip);
     		   			
     		   			struct sr_arpreq *req = sr_arpcache_insert(&sr->cache,arphdr->ar_sha,arphdr->ar_sip);
     		   			
     		   			if(req){
-    		   				printf("Got a few packets waiting on incoming request arp\n");
+    		   				SR_TRACE("Got a few packets waiting on incoming request arp\n");
     		   				/* send all packets in req and arp_destroy it*/
     		   				struct sr_packet *pkts = req->packets;
     		   				struct sr_if* interface= 0;
@@ -188,9 +342,11 @@ void sr_handlepacket(struct sr_instance* sr,
     		   					pkts = pkts->next;
     		   				}
     		   				sr_arpreq_destroy(&sr->cache,req);
-    		   				printf("req quest queue destoried\n");
+    		   				SR_TRACE("req quest queue destoried\n");
     		   				
     		   			}				   
+    		   		}else{
+    		   			SR_STATS_DROP(SR_DROP_ARP_NOT_US);
     		   		}
     		   	}else if(ntohs(arphdr->ar_op)==arp_op_reply){
     		   		/* verify it's a reply to me */
@@ -199,7 +355,7 @@ void sr_handlepacket(struct sr_instance* sr,
     		   		!strncmp((const char*)interface->addr,(const char*)arphdr->ar_tha,ETHER_ADDR_LEN)){
     		   			struct sr_arpreq *req = sr_arpcache_insert(&sr->cache,arphdr->ar_sha,arphdr->ar_sip);
     	   			if(req){
-    		   				printf("Got a few packets waiting on incoming reply arp\n");
+    		   				SR_TRACE("Got a few packets waiting on incoming reply arp\n");
     		   				/* send all packets in req and arp_destroy it*/
     		   				struct sr_packet *pkts = req->packets;
     		   				struct sr_if* interface= 0;
@@ -209,16 +365,23 @@ void sr_handlepacket(struct sr_instance* sr,
     		   					pkts = pkts->next;
     		   				}
     		   				sr_arpreq_destroy(&sr->cache,req);
-    		   				printf("req quest queue destoried\n");
+    		   				SR_TRACE("req quest queue destoried\n");
     		   				
     		   			}
-    		   		}   		   	
+    		   		}else{
+    		   			SR_STATS_DROP(SR_DROP_ARP_NOT_US);
+    		   		}
+    		   	}else{
+    		   		SR_STATS_DROP(SR_DROP_ARP_FORMAT);
     		   	}
     	   	
+    	}else{
+    		SR_STATS_DROP(SR_DROP_ARP_FORMAT);
     	}
   	}
   }else{
-  	printf("*** -> Neither arp nor ip of typeid %x \n",ethtype);
+  	SR_DEBUG("*** -> Neither arp nor ip of typeid %x \n",ethtype);
+  	SR_STATS_DROP(SR_DROP_ETHERTYPE);
   }
 
   /* fill in code here */
@@ -227,10 +390,15 @@ void sr_handlepacket(struct sr_instance* sr,
 
 /*send TLE to the dest defined in iphdr*/
 void sr_icmp_TLE(struct sr_instance* sr,sr_ip_hdr_t* siphdr){
-	printf("sending icmp TLE\n");
+	SR_DEBUG("sending icmp TLE\n");
 	unsigned int len = sizeof(sr_ethernet_hdr_t)+sizeof(sr_ip_hdr_t)+
 					   sizeof(sr_icmp_t11_hdr_t);
-	uint8_t* buf = (uint8_t*)malloc(len);
+	uint8_t* buf = (uint8_t*)sr_buf_alloc(len);
+	if(!buf){
+		SR_ERR("out of memory building icmp, dropped\n");
+		SR_STATS_DROP(SR_DROP_NO_BUF);
+		return;
+	}
 	
 	sr_ethernet_hdr_t* eth_hdr =(sr_ethernet_hdr_t*)(buf);
 	eth_hdr->ether_type = htons(ethertype_ip);
@@ -249,15 +417,18 @@ void sr_icmp_TLE(struct sr_instance* sr,sr_ip_hdr_t* siphdr){
 	ip_hdr->ip_sum = 0;
 	ip_hdr->ip_dst = siphdr->ip_src;
 	/*ip_hdr->ip_src on the interface send out*/
+	SR_PROBE4(icmp,11,0,ip_hdr->ip_dst,len);
 	
 	struct sr_rt *tb = sr_LPM(sr,ip_hdr->ip_dst);
 	/*if I found none it's safe to quit and print error 
 	for otherwise I'll be sending myself icmp net unreachable*/
 	if(!tb){
-		fprintf(stderr,"Destination net unreachable from the router\n");
-		free(buf);
+		SR_WARN("Destination net unreachable from the router\n");
+		SR_STATS_DROP(SR_DROP_ICMP_UNROUTABLE);
+		sr_buf_free(buf);
 		return;
 	}
+	SR_STATS_ROUTE(tb,SR_ROUTE_ICMP,len-sizeof(sr_ethernet_hdr_t));
 	struct sr_if* interface = sr_get_interface(sr,tb->interface);
 	
 	ip_hdr->ip_src = interface->ip;
@@ -276,14 +447,19 @@ void sr_icmp_TLE(struct sr_instance* sr,sr_ip_hdr_t* siphdr){
 
 	/*careful here,towards the packet to gw not dest*/	
 	sr_nexthop_ip_iface(sr,buf,len,tb->gw.s_addr,interface);
-	free(buf);
+	sr_buf_free(buf);
 }
 
 void sr_icmp_echo_reply(struct sr_instance* sr,sr_ip_hdr_t* siphdr){
-	printf("sending echo_reply\n");
+	SR_DEBUG("sending echo_reply\n");
 	uint16_t iplen = ntohs(siphdr->ip_len);
 	unsigned int len = sizeof(sr_ethernet_hdr_t)+iplen;
-	uint8_t* buf = (uint8_t*)malloc(len);
+	uint8_t* buf = (uint8_t*)sr_buf_alloc(len);
+	if(!buf){
+		SR_ERR("out of memory building icmp, dropped\n");
+		SR_STATS_DROP(SR_DROP_NO_BUF);
+		return;
+	}
 	
 	sr_ethernet_hdr_t* eth_hdr =(sr_ethernet_hdr_t*)(buf);
 	eth_hdr->ether_type = htons(ethertype_ip);
@@ -296,15 +472,18 @@ void sr_icmp_echo_reply(struct sr_instance* sr,sr_ip_hdr_t* siphdr){
 	ip_hdr->ip_dst = siphdr->ip_src;
 	ip_hdr->ip_src = siphdr->ip_dst;
 	ip_hdr->ip_sum = cksum(buf+sizeof(sr_ethernet_hdr_t),sizeof(sr_ip_hdr_t));
+	SR_PROBE4(icmp,0,0,ip_hdr->ip_dst,len);
 	
 	struct sr_rt *tb = sr_LPM(sr,ip_hdr->ip_dst);
 	/*if I found none it's safe to quit and print error 
 	for otherwise I'll be sending myself icmp net unreachable*/
 	if(!tb){
-		fprintf(stderr,"Destination net unreachable from the router\n");
-		free(buf);
+		SR_WARN("Destination net unreachable from the router\n");
+		SR_STATS_DROP(SR_DROP_ICMP_UNROUTABLE);
+		sr_buf_free(buf);
 		return;
 	}
+	SR_STATS_ROUTE(tb,SR_ROUTE_ICMP,len-sizeof(sr_ethernet_hdr_t));
 	struct sr_if* interface = sr_get_interface(sr,tb->interface);
 	
 	
@@ -317,21 +496,37 @@ void sr_icmp_echo_reply(struct sr_instance* sr,sr_ip_hdr_t* siphdr){
 	icmp_hdr->icmp_sum  = cksum((uint8_t*)icmp_hdr,iplen-sizeof(sr_ip_hdr_t));
 													  
 	/*careful here,towards the packet to gw not dest*/	
-	sr_nexthop_ip_iface(sr,buf,len,tb->gw.s_addr,interface);
-	free(buf);
+	if(iplen>interface->mtu)sr_ip_fragment(sr,buf,len,tb->gw.s_addr,interface);
+	else sr_nexthop_ip_iface(sr,buf,len,tb->gw.s_addr,interface);
+	sr_buf_free(buf);
 
 
 }
 /*send dest unreachable to the dest define in iphdr
   code = 0/net,1/host,3/port*/
 void sr_icmp_dest_unr(struct sr_instance* sr,sr_ip_hdr_t* siphdr,uint8_t code){
-	if(code==0)printf("sending net unreachable\n");
-	else if(code==1)printf("sending host unreachable\n");
-	else printf("sending port unreachable\n");
+	sr_icmp_t3(sr,siphdr,code,0);
+}
+
+/*send fragmentation needed (type 3 code 4) carrying the next hop mtu*/
+void sr_icmp_frag_needed(struct sr_instance* sr,sr_ip_hdr_t* siphdr,uint16_t mtu){
+	sr_icmp_t3(sr,siphdr,4,mtu);
+}
+
+static void sr_icmp_t3(struct sr_instance* sr,sr_ip_hdr_t* siphdr,uint8_t code,uint16_t mtu){
+	if(code==0)SR_DEBUG("sending net unreachable\n");
+	else if(code==1)SR_DEBUG("sending host unreachable\n");
+	else if(code==4)SR_DEBUG("sending fragmentation needed, mtu %u\n",mtu);
+	else SR_DEBUG("sending port unreachable\n");
 	
 	unsigned int len = sizeof(sr_ethernet_hdr_t)+sizeof(sr_ip_hdr_t)+
 					   sizeof(sr_icmp_t3_hdr_t);
-	uint8_t* buf = (uint8_t*)malloc(len);
+	uint8_t* buf = (uint8_t*)sr_buf_alloc(len);
+	if(!buf){
+		SR_ERR("out of memory building icmp, dropped\n");
+		SR_STATS_DROP(SR_DROP_NO_BUF);
+		return;
+	}
 	
 	sr_ethernet_hdr_t* eth_hdr =(sr_ethernet_hdr_t*)(buf);
 	eth_hdr->ether_type = htons(ethertype_ip);
@@ -349,15 +544,18 @@ void sr_icmp_dest_unr(struct sr_instance* sr,sr_ip_hdr_t* siphdr,uint8_t code){
 	ip_hdr->ip_p = 1;
 	ip_hdr->ip_sum = 0;
 	ip_hdr->ip_dst = siphdr->ip_src;
+	SR_PROBE4(icmp,3,code,ip_hdr->ip_dst,len);
 	
 	struct sr_rt *tb = sr_LPM(sr,ip_hdr->ip_dst);
 	/*if I found none it's safe to quit and print error 
 	for otherwise I'll be sending myself icmp net unreachable*/
 	if(!tb){
-		fprintf(stderr,"Destination net unreachable from the router\n");
-		free(buf);
+		SR_WARN("Destination net unreachable from the router\n");
+		SR_STATS_DROP(SR_DROP_ICMP_UNROUTABLE);
+		sr_buf_free(buf);
 		return;
 	}
+	SR_STATS_ROUTE(tb,SR_ROUTE_ICMP,len-sizeof(sr_ethernet_hdr_t));
 	struct sr_if* interface = sr_get_interface(sr,tb->interface);
 	
 	if(code==3)ip_hdr->ip_src = siphdr->ip_dst;
@@ -371,6 +569,8 @@ void sr_icmp_dest_unr(struct sr_instance* sr,sr_ip_hdr_t* siphdr,uint8_t code){
 	icmp_hdr->icmp_type = 3;
 	icmp_hdr->icmp_code = code;
 	icmp_hdr->icmp_sum  = 0;
+	icmp_hdr->unused = 0;
+	icmp_hdr->next_mtu = htons(mtu);
 	memcpy(icmp_hdr->data,(uint8_t*)siphdr,ICMP_DATA_SIZE);
 	icmp_hdr->icmp_sum  = cksum((uint8_t*)icmp_hdr,len-sizeof(sr_ethernet_hdr_t)
 													  -sizeof(sr_ip_hdr_t));
@@ -378,7 +578,7 @@ void sr_icmp_dest_unr(struct sr_instance* sr,sr_ip_hdr_t* siphdr,uint8_t code){
 
 	/*careful here,towards the packet to gw not dest*/	
 	sr_nexthop_ip_iface(sr,buf,len,tb->gw.s_addr,interface);
-	free(buf);
+	sr_buf_free(buf);
 }
 
 
@@ -390,15 +590,77 @@ void sr_nexthop_ip_iface(struct sr_instance* sr,uint8_t* packet,unsigned int len
 	assert(interface);
 	
 	struct sr_arpentry* arp = sr_arpcache_lookup(&sr->cache,tip);
+	SR_LAT_MARK(SR_LAT_ARP);
 	if(!arp){
 		/*arp entry not found ,TRY ARP REQUEST*/
-		printf("arp entry not found,try request");
+		SR_TRACE("arp entry not found,try request\n");
+		SR_LAT_PATH(SR_LAT_ARP_QUEUED);
+		SR_PKTRACE(SR_PT_ARP_QUEUED,tip,0,0);
 		sr_arpcache_queuereq(&sr->cache,tip,packet,len,interface->name);
 	}else{
 		sr_ethernet_hdr_t* eth_hdr =(sr_ethernet_hdr_t*)(packet);
+		SR_PKTRACE(SR_PT_ARP_HIT,tip,0,0);
 		memcpy(eth_hdr->ether_dhost,arp->mac,6);
 		memcpy(eth_hdr->ether_shost,interface->addr,6);
 		sr_send_packet(sr,packet,len,interface->name);
+		SR_LAT_MARK(SR_LAT_SEND);
 		free(arp);
 	}
 }
+
+/*---------------------------------------------------------------------
+ * Method: sr_ip_fragment(..)
+ * Scope:  Global
+ *
+ * Send an IP packet (ethernet header included) that is bigger than the
+ * MTU of interface as fragments that fit (RFC 791).  The header, options
+ * and all, is repeated in every fragment; DF is not looked at, callers
+ * that care check it first.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_ip_fragment(struct sr_instance* sr,uint8_t* packet,unsigned int len,uint32_t tip,struct sr_if* interface){
+	sr_ip_hdr_t* iphdr = (sr_ip_hdr_t*)(packet+sizeof(sr_ethernet_hdr_t));
+	unsigned int hl = iphdr->ip_hl*4;
+	unsigned int total = ntohs(iphdr->ip_len);
+	uint16_t off = ntohs(iphdr->ip_off);
+	unsigned int chunk, payload, pos, n;
+	uint8_t* frag;
+
+	assert(sr);
+	assert(packet);
+	assert(interface);
+
+	if(total>len-sizeof(sr_ethernet_hdr_t))total = len-sizeof(sr_ethernet_hdr_t);
+	if(total<=hl||interface->mtu<hl+8){
+		SR_WARN("can't fragment for mtu %u, dropped\n",interface->mtu);
+		SR_STATS_DROP(SR_DROP_FRAG_FAILED);
+		return;
+	}
+	payload = total-hl;
+	chunk = (interface->mtu-hl)&~7u;
+
+	frag = (uint8_t*)sr_buf_alloc(sizeof(sr_ethernet_hdr_t)+hl+chunk);
+	if(!frag){
+		SR_ERR("out of memory fragmenting, dropped\n");
+		SR_STATS_DROP(SR_DROP_NO_BUF);
+		return;
+	}
+	SR_DEBUG("fragmenting %u bytes for mtu %u\n",total,interface->mtu);
+
+	for(pos = 0; pos<payload; pos += n){
+		sr_ip_hdr_t* fip = (sr_ip_hdr_t*)(frag+sizeof(sr_ethernet_hdr_t));
+		n = payload-pos<chunk ? payload-pos : chunk;
+		memcpy(frag,packet,sizeof(sr_ethernet_hdr_t)+hl);
+		memcpy(frag+sizeof(sr_ethernet_hdr_t)+hl,
+		       packet+sizeof(sr_ethernet_hdr_t)+hl+pos,n);
+		fip->ip_len = htons(hl+n);
+		/*a fragment of a fragment keeps its offset and MF*/
+		fip->ip_off = htons((uint16_t)(((off&IP_OFFMASK)+pos/8)|
+		              ((pos+n<payload||(off&IP_MF))?IP_MF:0)));
+		fip->ip_sum = 0;
+		fip->ip_sum = cksum(fip,hl);
+		sr_nexthop_ip_iface(sr,frag,sizeof(sr_ethernet_hdr_t)+hl+n,tip,interface);
+	}
+	sr_buf_free(frag);
+}
@@ -28,11 +28,16 @@
 #endif
 
 #define INIT_TTL 255
-#define PACKET_DUMP_SIZE 1024
+#define PACKET_DUMP_SIZE SR_MAX_FRAME
 
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_dispatch;
+struct sr_egress;
+struct sr_capture;
+struct sr_flow_table;
+struct sr_io_ops;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -53,13 +58,28 @@ struct sr_instance
     struct sr_rt* routing_table; /* routing table */
     struct sr_arpcache cache;   /* ARP cache */
     pthread_attr_t attr;
-    FILE* logfile;
+    struct sr_capture* capture; /* -l packet log if any */
+    struct sr_flow_table* flows; /* -X flow accounting if any */
+    int nworkers; /* forwarding workers, 0 = handle on the receive thread */
+    struct sr_dispatch* dispatch; /* flow-affine worker pool if any */
+    unsigned int egress_depth; /* per-interface transmit queue, 0 = none */
+    unsigned int codel_target; /* us, 0 = drop tail only */
+    unsigned int codel_interval; /* us */
+    int shape; /* pace egress at each interface's speed */
+    struct sr_egress* egress; /* transmit queues if any */
+    pthread_mutex_t send_lock; /* serializes writes to the server socket */
+    const struct sr_io_ops* io; /* packet I/O backend */
+    void* io_priv; /* backend private state */
+    const char* mtu_spec; /* -m, applied once the interfaces are known */
 };
 
-/* -- sr_vns_comm.c -- */
+/* -- sr_io.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+
+/* -- sr_vns_comm.c -- */
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
+int sr_handle_vns_command(struct sr_instance* , uint8_t* , int );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
@@ -73,6 +93,10 @@ void sr_icmp_echo_reply(struct sr_instance*,sr_ip_hdr_t*);
 /*send dest unreachable to the dest define in iphdr
   code = 0/net,1/host,3/port*/
 void sr_icmp_dest_unr(struct sr_instance*,sr_ip_hdr_t*,uint8_t);
+/*send fragmentation needed with the mtu of the next hop*/
+void sr_icmp_frag_needed(struct sr_instance*,sr_ip_hdr_t*,uint16_t);
+/*send a packet bigger than the interface mtu as fragments*/
+void sr_ip_fragment(struct sr_instance*,uint8_t*,unsigned int,uint32_t,struct sr_if*);
 
 void sr_nexthop_ip_iface(struct sr_instance* sr,uint8_t* packet,unsigned int len,uint32_t tip,struct sr_if*);
 
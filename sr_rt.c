@@ -21,6 +21,8 @@
 
 #include "sr_rt.h"
 #include "sr_router.h"
+#include "sr_probe.h"
+#include "sr_stats.h"
 
 /*---------------------------------------------------------------------
  * Method:
@@ -40,6 +42,10 @@ struct sr_rt* sr_LPM(struct sr_instance* sr,uint32_t tip){
 		}
 		rt_walker = rt_walker->next;
 	}
+	if(ret)
+		SR_PROBE5(lpm,tip,ret->dest.s_addr,best,ret->gw.s_addr,ret->interface);
+	else
+		SR_PROBE5(lpm,tip,0,0,0,0);
 	return ret;
 }
 
@@ -127,6 +133,8 @@ struct in_addr gw, struct in_addr mask,char* if_name)
         sr->routing_table->gw   = gw;
         sr->routing_table->mask = mask;
         strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+        sr->routing_table->stats = sr_stats_route_index(dest.s_addr,
+                mask.s_addr, gw.s_addr, if_name);
 
         return;
     }
@@ -146,9 +154,62 @@ struct in_addr gw, struct in_addr mask,char* if_name)
     rt_walker->gw   = gw;
     rt_walker->mask = mask;
     strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    rt_walker->stats = sr_stats_route_index(dest.s_addr, mask.s_addr,
+            gw.s_addr, if_name);
 
 } /* -- sr_add_entry -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_verify_routing_table()
+ * Scope: Global
+ *
+ * make sure the routing table is consistent with the interface list by
+ * verifying that all interfaces used in the routing table actually exist
+ * in the hardware.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  something other than zero on error
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_verify_routing_table(struct sr_instance* sr)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_if* if_walker = 0;
+    int ret = 0;
+
+    /* -- REQUIRES --*/
+    assert(sr);
+
+    if( (sr->if_list == 0) || (sr->routing_table == 0))
+    {
+        return 999; /* doh! */
+    }
+
+    rt_walker = sr->routing_table;
+
+    while(rt_walker)
+    {
+        /* -- check to see if interface exists -- */
+        if_walker = sr->if_list;
+        while(if_walker)
+        {
+            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
+                    == 0)
+            { break; }
+            if_walker = if_walker->next;
+        }
+        if(if_walker == 0)
+        { ret++; } /* -- interface not found! -- */
+
+        rt_walker = rt_walker->next;
+    } /* -- while -- */
+
+    return ret;
+} /* -- sr_verify_routing_table -- */
+
 /*---------------------------------------------------------------------
  * Method:
  *
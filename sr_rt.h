@@ -33,6 +33,7 @@ struct sr_rt
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    unsigned int stats;             /* sr_stats route row */
     struct sr_rt* next;
 };
 
@@ -43,5 +44,6 @@ void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
 struct sr_rt* sr_LPM(struct sr_instance*,uint32_t);
+int sr_verify_routing_table(struct sr_instance* sr);
 
 #endif  /* --  sr_RT_H -- */
@@ -0,0 +1,310 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.c
+ *
+ * Description:
+ *
+ * Shared memory region and SPSC rings, see sr_shm.h.  Nothing in here
+ * knows about the router so the packet source can link it as is.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifdef _LINUX_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "sr_shm.h"
+
+#define SR_SHM_MASK (SR_SHM_RING_SZ - 1)
+
+static void sr_shm_bind(struct sr_shm_end* e, int rx_idx)
+{
+    e->rx_idx = rx_idx;
+    e->tx_idx = !rx_idx;
+    e->rx = &e->region->ring[e->rx_idx];
+    e->tx = &e->region->ring[e->tx_idx];
+} /* -- sr_shm_bind -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_create(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_shm_create(struct sr_shm_end* e)
+{
+    /* REQUIRES */
+    assert(e);
+
+    memset(e, 0, sizeof(*e));
+    e->efd[0] = e->efd[1] = e->ctl = -1;
+
+    if ((e->memfd = memfd_create("sr_shm", MFD_CLOEXEC)) < 0)
+    {
+        perror("memfd_create(..):sr_shm.c::sr_shm_create(..)");
+        return -1;
+    }
+    if (ftruncate(e->memfd, sizeof(struct sr_shm_region)) < 0)
+    {
+        perror("ftruncate(..):sr_shm.c::sr_shm_create(..)");
+        sr_shm_destroy(e);
+        return -1;
+    }
+    e->region = mmap(0, sizeof(struct sr_shm_region), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, e->memfd, 0);
+    if (e->region == MAP_FAILED)
+    {
+        e->region = 0;
+        perror("mmap(..):sr_shm.c::sr_shm_create(..)");
+        sr_shm_destroy(e);
+        return -1;
+    }
+    if ((e->efd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        (e->efd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        perror("eventfd(..):sr_shm.c::sr_shm_create(..)");
+        sr_shm_destroy(e);
+        return -1;
+    }
+
+    /* -- a fresh memfd is zero filled, rings start out empty -- */
+    e->region->magic = SR_SHM_MAGIC;
+    e->region->version = SR_SHM_VERSION;
+    e->region->ring_sz = SR_SHM_RING_SZ;
+    e->region->buf_sz = SR_SHM_BUF_SZ;
+
+    sr_shm_bind(e, SR_SHM_FROM_ROUTER);
+    return 0;
+} /* -- sr_shm_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_send_fds(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_shm_send_fds(struct sr_shm_end* e, int ctl)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    uint32_t magic = SR_SHM_MAGIC;
+    int fds[3];
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } u;
+
+    fds[0] = e->memfd;
+    fds[1] = e->efd[0];
+    fds[2] = e->efd[1];
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&u, 0, sizeof(u));
+    iov.iov_base = &magic;
+    iov.iov_len = sizeof(magic);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = sizeof(u.buf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(ctl, &msg, 0) != sizeof(magic))
+    {
+        perror("sendmsg(..):sr_shm.c::sr_shm_send_fds(..)");
+        return -1;
+    }
+    e->ctl = ctl;
+    return 0;
+} /* -- sr_shm_send_fds -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_recv_fds(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_shm_recv_fds(struct sr_shm_end* e, int ctl)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    uint32_t magic = 0;
+    int fds[3];
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } u;
+
+    /* REQUIRES */
+    assert(e);
+
+    memset(e, 0, sizeof(*e));
+    e->memfd = e->efd[0] = e->efd[1] = -1;
+    e->ctl = ctl;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &magic;
+    iov.iov_len = sizeof(magic);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = sizeof(u.buf);
+
+    if (recvmsg(ctl, &msg, MSG_CMSG_CLOEXEC) != sizeof(magic) ||
+        magic != SR_SHM_MAGIC || !(cmsg = CMSG_FIRSTHDR(&msg)) ||
+        cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        fprintf(stderr, "sr_shm: peer did not send a region\n");
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    e->memfd = fds[0];
+    e->efd[0] = fds[1];
+    e->efd[1] = fds[2];
+
+    e->region = mmap(0, sizeof(struct sr_shm_region), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, e->memfd, 0);
+    if (e->region == MAP_FAILED)
+    {
+        e->region = 0;
+        perror("mmap(..):sr_shm.c::sr_shm_recv_fds(..)");
+        return -1;
+    }
+    if (e->region->magic != SR_SHM_MAGIC ||
+        e->region->version != SR_SHM_VERSION ||
+        e->region->ring_sz != SR_SHM_RING_SZ ||
+        e->region->buf_sz != SR_SHM_BUF_SZ)
+    {
+        fprintf(stderr, "sr_shm: region layout does not match this build\n");
+        return -1;
+    }
+
+    sr_shm_bind(e, SR_SHM_TO_ROUTER);
+    return 0;
+} /* -- sr_shm_recv_fds -- */
+
+void sr_shm_destroy(struct sr_shm_end* e)
+{
+    if (e->region)
+    { munmap(e->region, sizeof(struct sr_shm_region)); }
+    if (e->memfd >= 0)
+    { close(e->memfd); }
+    if (e->efd[0] >= 0)
+    { close(e->efd[0]); }
+    if (e->efd[1] >= 0)
+    { close(e->efd[1]); }
+    if (e->ctl >= 0)
+    { close(e->ctl); }
+    memset(e, 0, sizeof(*e));
+    e->memfd = e->efd[0] = e->efd[1] = e->ctl = -1;
+} /* -- sr_shm_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Ring operations.  The producer owns tail, the consumer owns head; the
+ * acquire/release pairs order the descriptor and buffer contents against
+ * the index that publishes or frees them.
+ *---------------------------------------------------------------------------*/
+
+uint8_t* sr_shm_tx_buf(struct sr_shm_end* e)
+{
+    struct sr_shm_ring* r = e->tx;
+    uint32_t tail = r->tail;
+
+    if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >= SR_SHM_RING_SZ)
+    { return 0; }
+    return r->buf[tail & SR_SHM_MASK];
+} /* -- sr_shm_tx_buf -- */
+
+void sr_shm_tx_commit(struct sr_shm_end* e, unsigned int len, const char* iface)
+{
+    struct sr_shm_ring* r = e->tx;
+    uint32_t tail = r->tail;
+    struct sr_shm_desc* d = &r->desc[tail & SR_SHM_MASK];
+    uint64_t one = 1;
+
+    d->len = len;
+    memset(d->iface, 0, SR_SHM_IFNAMSIZ);
+    strncpy(d->iface, iface, SR_SHM_IFNAMSIZ);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+
+    /* -- pairs with the fence in sr_shm_rx_wait -- */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->waiting, __ATOMIC_RELAXED))
+    {
+        if (write(e->efd[e->tx_idx], &one, sizeof(one)) < 0 && errno != EAGAIN)
+        { perror("write(..):sr_shm.c::sr_shm_tx_commit(..)"); }
+    }
+} /* -- sr_shm_tx_commit -- */
+
+struct sr_shm_desc* sr_shm_rx_peek(struct sr_shm_end* e, uint8_t** buf)
+{
+    struct sr_shm_ring* r = e->rx;
+    uint32_t head = r->head;
+
+    if (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+    { return 0; }
+    *buf = r->buf[head & SR_SHM_MASK];
+    return &r->desc[head & SR_SHM_MASK];
+} /* -- sr_shm_rx_peek -- */
+
+void sr_shm_rx_release(struct sr_shm_end* e)
+{
+    __atomic_store_n(&e->rx->head, e->rx->head + 1, __ATOMIC_RELEASE);
+} /* -- sr_shm_rx_release -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_rx_wait(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_shm_rx_wait(struct sr_shm_end* e, int timeout_ms)
+{
+    struct sr_shm_ring* r = e->rx;
+    struct pollfd pfd[2];
+    uint64_t v;
+
+    __atomic_store_n(&r->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    /* -- a producer that missed the flag published before our fence -- */
+    if (r->head != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+    {
+        __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    pfd[0].fd = e->efd[e->rx_idx];
+    pfd[0].events = POLLIN;
+    pfd[1].fd = e->ctl;
+    pfd[1].events = POLLIN;
+    if (poll(pfd, 2, timeout_ms) < 0 && errno != EINTR)
+    { perror("poll(..):sr_shm.c::sr_shm_rx_wait(..)"); }
+
+    __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+    if (pfd[0].revents & POLLIN)
+    {
+        if (read(pfd[0].fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+        { perror("read(..):sr_shm.c::sr_shm_rx_wait(..)"); }
+    }
+    return (pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+} /* -- sr_shm_rx_wait -- */
+
+#endif /* _LINUX_ */
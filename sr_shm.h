@@ -0,0 +1,121 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.h
+ *
+ * Description:
+ *
+ * Shared memory transport between the router and a packet source on the
+ * same host (vns_standin -x, test harnesses).  It replaces the VNS TCP
+ * socket: no per-frame syscall, no copy through the kernel, no framing.
+ *
+ * The packet source creates a memfd holding two single-producer/single-
+ * consumer descriptor rings, one per direction, and an eventfd per ring.
+ * It listens on a unix socket; the router connects, gets the three fds
+ * with SCM_RIGHTS and then a VNSHWINFO message on the same socket.  After
+ * that the socket only carries VNSCLOSE and tells either side when the
+ * other one goes away.
+ *
+ * A descriptor is a VNSPACKET without the framing: length, interface name
+ * (same 16 bytes as c_packet_header) and a frame in the packet buffer pool.
+ * Each ring owns SR_SHM_RING_SZ buffers and descriptor slot i always uses
+ * buffer i, so a buffer is free again exactly when the consumer moves head
+ * past its slot and no free list has to be shared across processes.
+ *
+ * Wakeups are suppressed while the consumer is busy: it only sets
+ * 'waiting' (and the producer only writes the eventfd) when the ring has
+ * run dry.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHM_H
+#define SR_SHM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_SHM_MAGIC     0x5352534d /* "SRSM" */
+#define SR_SHM_VERSION   2
+#define SR_SHM_RING_SZ   1024       /* descriptors per direction, power of 2 */
+#define SR_SHM_BUF_SZ    9728       /* bytes per packet buffer, a 9216 MTU frame */
+#define SR_SHM_IFNAMSIZ  16         /* as c_packet_header.mInterfaceName */
+
+#define SR_SHM_TO_ROUTER   0
+#define SR_SHM_FROM_ROUTER 1
+
+#define SR_SHM_CACHELINE 64
+
+struct sr_shm_desc
+{
+    uint32_t len;
+    char iface[SR_SHM_IFNAMSIZ];
+};
+
+struct sr_shm_ring
+{
+    /* -- consumer -- */
+    volatile uint32_t head __attribute__ ((aligned (SR_SHM_CACHELINE)));
+    volatile uint32_t waiting;      /* consumer is about to block */
+
+    /* -- producer -- */
+    volatile uint32_t tail __attribute__ ((aligned (SR_SHM_CACHELINE)));
+
+    struct sr_shm_desc desc[SR_SHM_RING_SZ]
+        __attribute__ ((aligned (SR_SHM_CACHELINE)));
+    uint8_t buf[SR_SHM_RING_SZ][SR_SHM_BUF_SZ]
+        __attribute__ ((aligned (SR_SHM_CACHELINE)));
+};
+
+struct sr_shm_region
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_sz;
+    uint32_t buf_sz;
+    struct sr_shm_ring ring[2];
+};
+
+/* one side's view of a region */
+struct sr_shm_end
+{
+    struct sr_shm_region* region;
+    int memfd;
+    int efd[2];                     /* signals ring[i] is no longer empty */
+    int ctl;                        /* unix socket to the other side */
+    struct sr_shm_ring* rx;
+    struct sr_shm_ring* tx;
+    int rx_idx;
+    int tx_idx;
+};
+
+/* Packet source side: create the region and eventfds.  0 on success. */
+int  sr_shm_create(struct sr_shm_end* e);
+
+/* Packet source side: hand region and eventfds to the router over ctl. */
+int  sr_shm_send_fds(struct sr_shm_end* e, int ctl);
+
+/* Router side: receive and map what sr_shm_send_fds sent.  0 on success. */
+int  sr_shm_recv_fds(struct sr_shm_end* e, int ctl);
+
+void sr_shm_destroy(struct sr_shm_end* e);
+
+/* Next free tx buffer (SR_SHM_BUF_SZ bytes) or 0 if the ring is full. */
+uint8_t* sr_shm_tx_buf(struct sr_shm_end* e);
+
+/* Publish the buffer from sr_shm_tx_buf, waking the consumer if needed. */
+void sr_shm_tx_commit(struct sr_shm_end* e, unsigned int len, const char* iface);
+
+/* Oldest unconsumed descriptor (its frame in *buf) or 0 if none. */
+struct sr_shm_desc* sr_shm_rx_peek(struct sr_shm_end* e, uint8_t** buf);
+
+/* Done with the descriptor from sr_shm_rx_peek, its buffer goes back. */
+void sr_shm_rx_release(struct sr_shm_end* e);
+
+/* Block until the rx ring has something, ctl is readable or timeout_ms
+   passes.  Returns 1 if ctl needs attention, 0 otherwise. */
+int  sr_shm_rx_wait(struct sr_shm_end* e, int timeout_ms);
+
+#endif /* -- SR_SHM_H -- */
@@ -0,0 +1,276 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_shm_io.c
+ *
+ * Description:
+ *
+ * Shared memory I/O backend, the router end of sr_shm.h.
+ *
+ *     -b shm -i /tmp/sr.sock
+ *
+ * connects to a packet source listening on that unix socket (for example
+ * vns_standin -x /tmp/sr.sock), maps the region it hands over and takes
+ * the interface list from the VNSHWINFO that follows.  The peer can still
+ * write a ring slot while the router looks at it, so each received frame is
+ * copied into a pool buffer and its slot released before it is delivered;
+ * nothing the router validates can change under it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifdef _LINUX_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_io.h"
+#include "sr_shm.h"
+#include "sr_bufpool.h"
+#include "sr_stats.h"
+#include "vnscommand.h"
+
+#define SR_SHM_RX_BATCH  64         /* frames per poll round */
+#define SR_SHM_POLL_MS   100
+#define SR_SHM_CTL_MAX   VNS_MSG_MAX
+
+int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo);
+
+struct sr_shm_io
+{
+    struct sr_shm_end end;
+    pthread_mutex_t tx_lock;        /* the tx ring has a single producer */
+    unsigned long tx_full;          /* sends refused, ring full */
+};
+
+/* read one length prefixed VNS message from the control socket */
+static int sr_shm_read_ctl(int fd, uint8_t* buf)
+{
+    uint32_t len;
+    ssize_t n;
+
+    if ((n = recv(fd, buf, sizeof(c_base), MSG_WAITALL)) != sizeof(c_base))
+    { return n == 0 ? 0 : -1; }
+    len = ntohl(((c_base*)buf)->mLen);
+    if (len < sizeof(c_base) || len > SR_SHM_CTL_MAX)
+    {
+        fprintf(stderr, "sr_shm: bad control message length %u\n", len);
+        return -1;
+    }
+    if (len > sizeof(c_base) &&
+        recv(fd, buf + sizeof(c_base), len - sizeof(c_base), MSG_WAITALL) !=
+        (ssize_t)(len - sizeof(c_base)))
+    { return -1; }
+    return ntohl(((c_base*)buf)->mType);
+} /* -- sr_shm_read_ctl -- */
+
+static void sr_shm_close(struct sr_instance* sr)
+{
+    struct sr_shm_io* sio = (struct sr_shm_io*)sr->io_priv;
+
+    if (!sio)
+    { return; }
+
+    if (sio->tx_full)
+    { fprintf(stderr, "shm: tx ring full %lu times\n", sio->tx_full); }
+    sr_shm_destroy(&sio->end);
+    pthread_mutex_destroy(&sio->tx_lock);
+    free(sio);
+    sr->io_priv = 0;
+} /* -- sr_shm_close -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_open(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_shm_open(struct sr_instance* sr, const char* arg)
+{
+    struct sr_shm_io* sio;
+    struct sockaddr_un sun;
+    uint8_t* buf;
+    int fd;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if (!arg || !*arg || strlen(arg) >= sizeof(sun.sun_path))
+    {
+        fprintf(stderr, "shm backend needs -i /path/to/socket\n");
+        return -1;
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("socket(..):sr_shm_io.c::sr_shm_open(..)");
+        return -1;
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, arg);
+    if (connect(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0)
+    {
+        perror("connect(..):sr_shm_io.c::sr_shm_open(..)");
+        close(fd);
+        return -1;
+    }
+
+    sio = (struct sr_shm_io*)calloc(1, sizeof(struct sr_shm_io));
+    assert(sio);
+    pthread_mutex_init(&sio->tx_lock, NULL);
+    sr->io_priv = sio;
+
+    if (sr_shm_recv_fds(&sio->end, fd) != 0)
+    {
+        sr_shm_close(sr);
+        return -1;
+    }
+
+    /* -- interfaces, exactly as the VNS server would send them -- */
+    buf = (uint8_t*)malloc(SR_SHM_CTL_MAX);
+    assert(buf);
+    if (sr_shm_read_ctl(fd, buf) != VNSHWINFO)
+    {
+        fprintf(stderr, "sr_shm: expected VNSHWINFO from peer\n");
+        free(buf);
+        sr_shm_close(sr);
+        return -1;
+    }
+    sr_handle_hwinfo(sr, (c_hwinfo*)buf);
+    free(buf);
+
+    return 0;
+} /* -- sr_shm_open -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_send(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_shm_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                       const char* iface)
+{
+    struct sr_shm_io* sio = (struct sr_shm_io*)sr->io_priv;
+    uint8_t* slot;
+
+    if (len > SR_SHM_BUF_SZ)
+    {
+        fprintf(stderr, "** Error: frame of %u bytes too big for shm\n", len);
+        return -1;
+    }
+
+    pthread_mutex_lock(&sio->tx_lock);
+    if ((slot = sr_shm_tx_buf(&sio->end)) == 0)
+    {
+        sio->tx_full++;
+        pthread_mutex_unlock(&sio->tx_lock);
+        return SR_IO_BUSY;
+    }
+    memcpy(slot, buf, len);
+    sr_shm_tx_commit(&sio->end, len, iface);
+    pthread_mutex_unlock(&sio->tx_lock);
+
+    return 0;
+} /* -- sr_shm_send -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_poll(..)
+ * Scope: Local
+ *
+ * Deliver up to SR_SHM_RX_BATCH frames; sleep on the eventfd when there
+ * are none.  The control socket only ever says goodbye.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_shm_poll(struct sr_instance* sr)
+{
+    struct sr_shm_io* sio = (struct sr_shm_io*)sr->io_priv;
+    struct sr_shm_desc* d;
+    char iface[SR_SHM_IFNAMSIZ + 1];
+    uint8_t* buf;
+    uint8_t* frame;
+    uint32_t len;
+    int n;
+
+    for (n = 0; n < SR_SHM_RX_BATCH && (d = sr_shm_rx_peek(&sio->end, &buf)); n++)
+    {
+        memcpy(iface, d->iface, SR_SHM_IFNAMSIZ);
+        iface[SR_SHM_IFNAMSIZ] = '\0';
+        /* -- the peer can rewrite the slot; check and use one copy -- */
+        len = *(volatile uint32_t*)&d->len;
+        frame = len <= SR_SHM_BUF_SZ ? (uint8_t*)sr_buf_alloc(len) : 0;
+        if (frame)
+        { memcpy(frame, buf, len); }
+        else if (len <= SR_SHM_BUF_SZ)
+        { SR_STATS_DROP(SR_DROP_NO_BUF); }
+        sr_shm_rx_release(&sio->end);
+
+        if (frame) {
+            sr_io_deliver(sr, frame, len, iface);
+            sr_buf_free(frame);
+        }
+    }
+
+    if (n == 0 && sr_shm_rx_wait(&sio->end, SR_SHM_POLL_MS))
+    {
+        uint8_t msg[SR_SHM_CTL_MAX];
+        int type;
+
+        /* -- the only thing the peer says after setup -- */
+        if ((type = sr_shm_read_ctl(sio->end.ctl, msg)) == VNSCLOSE)
+        {
+            fprintf(stderr, "shm peer closed session.\n");
+            fprintf(stderr, "Reason: %s\n", ((c_close*)msg)->mErrorMessage);
+            return 0;
+        }
+        if (type <= 0)
+        {
+            fprintf(stderr, "shm peer went away\n");
+            return type;
+        }
+    }
+
+    return 1;
+} /* -- sr_shm_poll -- */
+
+const struct sr_io_ops sr_io_shm =
+{
+    "shm",
+    sr_shm_open,
+    sr_shm_send,
+    sr_shm_poll,
+    sr_shm_close
+};
+
+#else /* _LINUX_ */
+
+#include <stdio.h>
+#include "sr_io.h"
+
+static int sr_shm_open(struct sr_instance* sr, const char* arg)
+{
+    fprintf(stderr, "shm backend is only available on Linux\n");
+    return -1;
+}
+
+const struct sr_io_ops sr_io_shm =
+{
+    "shm",
+    sr_shm_open,
+    0,
+    0,
+    0
+};
+
+#endif /* _LINUX_ */
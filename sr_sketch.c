@@ -0,0 +1,275 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_sketch.c
+ *
+ * Description:
+ *
+ * Count-Min and Space-Saving sketches of the top talkers, see sr_sketch.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "sr_sketch.h"
+#include "sr_stats.h"
+
+__thread uint32_t sr_sketch_src = 0;
+int sr_sketch_on = 0;
+
+static __thread struct sr_sketch_slot* sr_sketch_self = 0;
+
+static const char* sr_sketch_titles[SR_SKETCH_N] =
+{ "TOP SOURCES", "TOP DESTINATIONS", "TOP DROPPED" };
+
+/* murmur3's 64 bit finalizer; each row takes 16 bits of it */
+static __inline__ uint64_t sr_sketch_hash(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+} /* -- sr_sketch_hash -- */
+
+#define SR_SKETCH_COL(h, d) \
+    ((uint32_t)((h) >> (16 * (d))) & (SR_SKETCH_WIDTH - 1))
+
+void sr_sketch_init(void)
+{
+    sr_stats_set_sketch(1);
+    sr_sketch_on = 1;
+} /* -- sr_sketch_init -- */
+
+/* the smallest count in the summary */
+static __inline__ void sr_sketch_min(struct sr_sketch* s)
+{
+    uint32_t min = s->count[0];
+    int i;
+
+    for (i = 1; i < SR_SKETCH_TOPK; i++) {
+        if (s->count[i] < min)
+        { min = s->count[i]; }
+    }
+    s->min = min;
+} /* -- sr_sketch_min -- */
+
+/* the decay: every counter halved, entries counted down to 0 freed */
+static void sr_sketch_halve(struct sr_sketch* s)
+{
+    int d, i;
+
+    for (d = 0; d < SR_SKETCH_DEPTH; d++) {
+        for (i = 0; i < SR_SKETCH_WIDTH; i++)
+        { s->cm[d][i] >>= 1; }
+    }
+    for (i = 0; i < SR_SKETCH_TOPK; i++) {
+        s->count[i] >>= 1;
+        s->err[i] >>= 1;
+    }
+    sr_sketch_min(s);
+    s->total >>= 1;
+    s->halved++;
+} /* -- sr_sketch_halve -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_sketch_add(..)
+ * Scope:  Local
+ *
+ * Count-Min with conservative update: only the counters at the minimum
+ * are raised, which keeps collisions from inflating the estimate.  Then
+ * Space-Saving: a key in the summary is counted, any other takes over the
+ * smallest entry and inherits its count as its possible error.
+ *
+ * The summary is only looked at for a key Count-Min puts above its
+ * smallest entry.  A key that doesn't get that far could not have stayed
+ * in it anyway, and it spares the scan for the many keys seen once or
+ * twice.  A key in the summary is then never counted more often than it
+ * was seen, so count - error stays a lower bound, and any key with more
+ * than 1/SR_SKETCH_TOPK of the packets still gets in.
+ *
+ *---------------------------------------------------------------------*/
+
+static __inline__ void sr_sketch_add(struct sr_sketch* s, uint64_t key)
+{
+    uint64_t h = sr_sketch_hash(key);
+    uint32_t* c[SR_SKETCH_DEPTH];
+    uint32_t est = 0xffffffffu;
+    int d, i, min = 0;
+
+    for (d = 0; d < SR_SKETCH_DEPTH; d++) {
+        c[d] = &s->cm[d][SR_SKETCH_COL(h, d)];
+        if (*c[d] < est)
+        { est = *c[d]; }
+    }
+    est++;
+    for (d = 0; d < SR_SKETCH_DEPTH; d++) {
+        if (*c[d] < est)
+        { *c[d] = est; }
+    }
+
+    if (est > s->min) {
+        for (i = 0; i < SR_SKETCH_TOPK; i++) {
+            if (s->key[i] == key && s->count[i]) {
+                /* -- the smallest only moves if this was it -- */
+                if (s->count[i]++ == s->min)
+                { sr_sketch_min(s); }
+                break;
+            }
+            if (s->count[i] < s->count[min])
+            { min = i; }
+        }
+        if (i == SR_SKETCH_TOPK) {
+            s->key[min] = key;
+            s->err[min] = s->count[min];
+            s->count[min]++;
+            sr_sketch_min(s);
+        }
+    }
+
+    if (++s->total >= SR_SKETCH_HALVE)
+    { sr_sketch_halve(s); }
+} /* -- sr_sketch_add -- */
+
+static __inline__ struct sr_sketch_slot* sr_sketch_slot(void)
+{
+    if (!sr_sketch_self)
+    { sr_sketch_self = sr_stats_sketch_slot(); }
+    return sr_sketch_self;
+} /* -- sr_sketch_slot -- */
+
+void sr_sketch_ip(uint32_t src, uint32_t dst)
+{
+    struct sr_sketch_slot* slot = sr_sketch_slot();
+
+    sr_sketch_add(&slot->s[SR_SKETCH_SOURCES], src);
+    sr_sketch_add(&slot->s[SR_SKETCH_DESTS], dst);
+} /* -- sr_sketch_ip -- */
+
+void sr_sketch_drop(int reason)
+{
+    sr_sketch_add(&sr_sketch_slot()->s[SR_SKETCH_DROPS],
+                  SR_SKETCH_DROP_KEY(sr_sketch_src, reason));
+} /* -- sr_sketch_drop -- */
+
+/* a key's Count-Min estimate in one thread's sketch */
+static uint32_t sr_sketch_query(const struct sr_sketch* s, uint64_t key)
+{
+    uint64_t h = sr_sketch_hash(key);
+    uint32_t est = 0xffffffffu;
+    int d;
+
+    for (d = 0; d < SR_SKETCH_DEPTH; d++) {
+        if (s->cm[d][SR_SKETCH_COL(h, d)] < est)
+        { est = s->cm[d][SR_SKETCH_COL(h, d)]; }
+    }
+    return est;
+} /* -- sr_sketch_query -- */
+
+/* a candidate for the merged summary */
+struct sr_sketch_top
+{
+    uint64_t key;
+    uint64_t est;                   /* summed Count-Min estimates */
+    uint64_t least;                 /* summed Space-Saving count - error */
+};
+
+static int sr_sketch_cmp(const void* a, const void* b)
+{
+    const struct sr_sketch_top* x = (const struct sr_sketch_top*)a;
+    const struct sr_sketch_top* y = (const struct sr_sketch_top*)b;
+
+    if (x->est != y->est)
+    { return x->est < y->est ? 1 : -1; }
+    return x->key < y->key ? -1 : x->key > y->key;
+} /* -- sr_sketch_cmp -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_sketch_print(..)
+ * Scope:  Global
+ *
+ * Count-Min sketches add up cell by cell, but a thread's minimum is
+ * tighter than the minimum of the sums, so each candidate's estimate is
+ * the sum of the threads' own estimates.  A thread that doesn't have the
+ * key in its summary adds nothing to the guaranteed count.  Keys that
+ * could be all collisions, estimated at no more than the sketch's error
+ * bound, are left out.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_sketch_print(FILE* out, const struct sr_stats_region* r, int which)
+{
+    static struct sr_sketch_top top[SR_STATS_SLOTS * SR_SKETCH_TOPK];
+    const struct sr_sketch* s;
+    unsigned int nslots = r->nslots < SR_STATS_SLOTS ? r->nslots :
+                          SR_STATS_SLOTS;
+    unsigned int ntop = 0, t, i, j;
+    uint64_t total = 0, noise, key;
+    char ip[INET_ADDRSTRLEN];
+    char label[INET_ADDRSTRLEN + SR_STATS_NAMELEN + 2];
+    struct in_addr in;
+    unsigned int reason;
+
+    for (t = 0; t < nslots; t++) {
+        s = &r->sketch[t].s[which];
+        total += s->total;
+        for (i = 0; i < SR_SKETCH_TOPK; i++) {
+            if (!s->count[i])
+            { continue; }
+            for (j = 0; j < ntop && top[j].key != s->key[i]; j++)
+            { }
+            if (j == ntop) {
+                top[ntop].key = s->key[i];
+                top[ntop].est = top[ntop].least = 0;
+                ntop++;
+            }
+        }
+    }
+
+    fprintf(out, "\n%-32s %12s %6s %12s   of %llu recent\n",
+            sr_sketch_titles[which], "PACKETS", "SHARE", "AT_LEAST",
+            (unsigned long long)total);
+    if (!ntop)
+    { return; }
+
+    for (j = 0; j < ntop; j++) {
+        for (t = 0; t < nslots; t++) {
+            s = &r->sketch[t].s[which];
+            top[j].est += sr_sketch_query(s, top[j].key);
+            for (i = 0; i < SR_SKETCH_TOPK; i++) {
+                if (s->count[i] && s->key[i] == top[j].key) {
+                    top[j].least += s->count[i] - s->err[i];
+                    break;
+                }
+            }
+        }
+    }
+    qsort(top, ntop, sizeof(top[0]), sr_sketch_cmp);
+
+    /* -- e/width of everything counted -- */
+    noise = total * 2718 / 1000 / SR_SKETCH_WIDTH;
+    for (j = 0; j < ntop && j < SR_SKETCH_TOPK; j++) {
+        if (top[j].est <= noise) {
+            fprintf(out, "(none else above the error, %llu)\n",
+                    (unsigned long long)noise);
+            break;
+        }
+        key = top[j].key;
+        in.s_addr = (uint32_t)key;
+        inet_ntop(AF_INET, &in, ip, sizeof(ip));
+        if (which == SR_SKETCH_DROPS) {
+            reason = (unsigned int)(key >> 32);
+            snprintf(label, sizeof(label), "%s %.*s", in.s_addr ? ip : "-",
+                     SR_STATS_NAMELEN, reason < SR_DROP_NREASONS ?
+                     r->reason[reason] : "?");
+        }
+        else
+        { snprintf(label, sizeof(label), "%s", ip); }
+        fprintf(out, "%-32s %12llu %5.1f%% %12llu\n", label,
+                (unsigned long long)top[j].est,
+                total ? 100.0 * top[j].est / total : 0.0,
+                (unsigned long long)top[j].least);
+    }
+} /* -- sr_sketch_print -- */
@@ -0,0 +1,112 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_sketch.h
+ *
+ * Description:
+ *
+ * Top talkers: who is sending the most, to whom, and who is getting
+ * dropped most and why, in constant memory however many addresses show up.
+ * Three streams are sketched:
+ *
+ *     src     every IP packet received, by source address
+ *     dst     every IP packet received, by destination address
+ *     drop    every SR_STATS_DROP, by (source address, reason); the source
+ *             is that of the IP or ARP packet being handled, 0 if none
+ *
+ * each into a Count-Min sketch (SR_SKETCH_DEPTH rows of SR_SKETCH_WIDTH
+ * counters, conservative update), which estimates the count of any key
+ * to within about e/SR_SKETCH_WIDTH of all the packets, and a Space-Saving
+ * summary of the SR_SKETCH_TOPK heaviest keys, which can't miss a key
+ * making up more than 1/SR_SKETCH_TOPK of them.
+ *
+ * Like every other counter they live per thread in the sr_stats region and
+ * are only written by their thread; srstat -s merges them: the candidates
+ * are every thread's top keys, ranked by the sum of the threads' Count-Min
+ * estimates, with the Space-Saving guaranteed count next to it.  A thread
+ * halves all of a sketch each time it has seen SR_SKETCH_HALVE packets, so
+ * the ranking follows the last one or two times that many packets rather
+ * than everything since startup.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SKETCH_H
+#define SR_SKETCH_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#define SR_SKETCH_DEPTH     4
+#define SR_SKETCH_WIDTH     1024    /* power of two */
+#define SR_SKETCH_TOPK      16
+#define SR_SKETCH_HALVE     (1u << 19)
+
+#define SR_SKETCH_SOURCES   0
+#define SR_SKETCH_DESTS     1
+#define SR_SKETCH_DROPS     2
+#define SR_SKETCH_N         3
+
+/* key of the drop sketch */
+#define SR_SKETCH_DROP_KEY(src, reason) \
+    ((uint64_t)(reason) << 32 | (uint32_t)(src))
+
+struct sr_sketch
+{
+    uint32_t total;                 /* packets, halved along with the rest */
+    uint32_t halved;                /* times */
+    uint32_t min;                   /* smallest count in the summary */
+    uint32_t pad;
+    uint64_t key[SR_SKETCH_TOPK];   /* Space-Saving, IPs in network order */
+    uint32_t count[SR_SKETCH_TOPK]; /* 0 for an empty entry */
+    uint32_t err[SR_SKETCH_TOPK];   /* count overestimates by at most this */
+    uint32_t cm[SR_SKETCH_DEPTH][SR_SKETCH_WIDTH];
+};
+
+/* one thread's sketches */
+struct sr_sketch_slot
+{
+    struct sr_sketch s[SR_SKETCH_N];
+};
+
+/* source of the packet the calling thread is handling, for drops */
+extern __thread uint32_t sr_sketch_src;
+
+/* sketching is on */
+extern int sr_sketch_on;
+
+/* Count an IP packet from src to dst (network order) and remember src for
+   any drop while it is handled. */
+#define SR_SKETCH_IP(src, dst)                                              \
+    do {                                                                    \
+        sr_sketch_src = (src);                                              \
+        if (sr_sketch_on)                                                   \
+        { sr_sketch_ip(sr_sketch_src, dst); }                               \
+    } while (0)
+
+/* The packet being handled came from src, an ARP sender say. */
+#define SR_SKETCH_SOURCE(src) do { sr_sketch_src = (src); } while (0)
+
+#define SR_SKETCH_DROP(reason)                                              \
+    do {                                                                    \
+        if (sr_sketch_on)                                                   \
+        { sr_sketch_drop(reason); }                                         \
+    } while (0)
+
+void sr_sketch_ip(uint32_t src, uint32_t dst);
+void sr_sketch_drop(int reason);
+
+/* Turn sketching on. */
+void sr_sketch_init(void);
+
+struct sr_stats_region;
+
+/* The merged top keys of sketch which (SR_SKETCH_*) over every thread in
+   region r. */
+void sr_sketch_print(FILE* out, const struct sr_stats_region* r, int which);
+
+#endif /* -- SR_SKETCH_H -- */
@@ -0,0 +1,612 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Shared memory counters, see sr_stats.h.  Nothing in here knows about the
+ * router so srstat can link it as is.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "sr_stats.h"
+
+static const char* sr_drop_names[SR_DROP_NREASONS] =
+{
+    "runt",
+    "ethertype",
+    "ip_short",
+    "ip_header",
+    "ip_cksum",
+    "icmp_cksum",
+    "icmp_type",
+    "no_listener",
+    "ttl",
+    "no_route",
+    "frag_needed",
+    "frag_failed",
+    "icmp_unroutable",
+    "arp_short",
+    "arp_format",
+    "arp_not_us",
+    "arp_unresolved",
+    "worker_full",
+    "queue_full",
+    "codel",
+    "no_buf",
+    "bad_source",
+    "tx_error"
+};
+
+/* used until (and unless) the shared region is mapped */
+static struct sr_stats_region sr_stats_private;
+
+static struct sr_stats_region* sr_stats_r = &sr_stats_private;
+static char sr_stats_name[256];
+static pthread_mutex_t sr_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+__thread struct sr_stats_slot* sr_stats_self = 0;
+
+static void sr_stats_fill(struct sr_stats_region* r)
+{
+    int i;
+
+    r->magic = SR_STATS_MAGIC;
+    r->version = SR_STATS_VERSION;
+    r->pid = (uint32_t)getpid();
+    r->nreasons = SR_DROP_NREASONS;
+    r->started = (uint64_t)time(0);
+    for (i = 0; i < SR_DROP_NREASONS; i++)
+    { strncpy(r->reason[i], sr_drop_names[i], SR_STATS_NAMELEN - 1); }
+} /* -- sr_stats_fill -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_owner(..)
+ * Scope:  Local
+ *
+ * Pid of the live router that made the existing region name, 0 if it is
+ * gone or the region isn't one of ours.
+ *
+ *---------------------------------------------------------------------*/
+
+static pid_t sr_stats_owner(const char* name)
+{
+    struct sr_stats_region* r;
+    struct stat st;
+    pid_t pid = 0;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+    { return 0; }
+    /* -- any version will do, only the header is looked at -- */
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size <
+        offsetof(struct sr_stats_region, pid) + sizeof(r->pid)) {
+        close(fd);
+        return 0;
+    }
+    r = (struct sr_stats_region*)mmap(0, st.st_size, PROT_READ, MAP_SHARED,
+                                      fd, 0);
+    close(fd);
+    if (r == MAP_FAILED)
+    { return 0; }
+    if (r->magic == SR_STATS_MAGIC)
+    { pid = (pid_t)r->pid; }
+    munmap((void*)r, st.st_size);
+
+    if (pid > 0 && pid != getpid() && (kill(pid, 0) == 0 || errno == EPERM))
+    { return pid; }
+    return 0;
+} /* -- sr_stats_owner -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_init(..)
+ * Scope:  Global
+ *
+ * Never truncates a region that may be mapped: a left over one is only
+ * replaced once its router is known to be gone.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_stats_init(const char* name)
+{
+    struct sr_stats_region* r;
+    pid_t owner;
+    int fd;
+
+    if (!name)
+    { name = SR_STATS_NAME; }
+    sr_stats_fill(&sr_stats_private);
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        if ((owner = sr_stats_owner(name)) != 0) {
+            fprintf(stderr, "%s is in use by router %d\n", name, (int)owner);
+            return -1;
+        }
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd < 0) {
+        perror("shm_open(..):sr_stats.c::sr_stats_init(..)");
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(struct sr_stats_region)) < 0) {
+        perror("ftruncate(..):sr_stats.c::sr_stats_init(..)");
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    r = (struct sr_stats_region*)mmap(0, sizeof(struct sr_stats_region),
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED) {
+        perror("mmap(..):sr_stats.c::sr_stats_init(..)");
+        shm_unlink(name);
+        return -1;
+    }
+
+    /* -- the object is new and zero filled, every counter starts at 0 -- */
+    sr_stats_fill(r);
+    sr_stats_r = r;
+    strncpy(sr_stats_name, name, sizeof(sr_stats_name) - 1);
+    return 0;
+} /* -- sr_stats_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_claim(..)
+ * Scope:  Global
+ *
+ * Slow path of SR_STATS_SLOT, once per thread.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_stats_slot* sr_stats_claim(void)
+{
+    struct sr_stats_region* r = sr_stats_r;
+    uint32_t n = __atomic_fetch_add(&r->nslots, 1, __ATOMIC_RELAXED);
+
+    if (n >= SR_STATS_SLOTS) {
+        /* -- out of slots, the last one is shared and may lose counts -- */
+        r->nslots = SR_STATS_SLOTS;
+        n = SR_STATS_SLOTS - 1;
+    }
+    sr_stats_self = &r->slot[n];
+    return sr_stats_self;
+} /* -- sr_stats_claim -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_if_index(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_stats_if_index(const char* name)
+{
+    struct sr_stats_region* r = sr_stats_r;
+    unsigned int i;
+
+    assert(name);
+
+    pthread_mutex_lock(&sr_stats_lock);
+    for (i = 0; i < r->nifs; i++) {
+        if (strncmp(r->ifname[i], name, sr_IFACE_NAMELEN) == 0)
+        { break; }
+    }
+    if (i == r->nifs) {
+        if (i == SR_STATS_MAX_IFS)
+        { i = SR_STATS_MAX_IFS - 1; }
+        else {
+            strncpy(r->ifname[i], name, sr_IFACE_NAMELEN - 1);
+            __atomic_store_n(&r->nifs, i + 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&sr_stats_lock);
+    return i;
+} /* -- sr_stats_if_index -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_route_index(..)
+ * Scope:  Global
+ *
+ * A route loaded again, as a reloaded table does, gets its old row back
+ * and keeps counting where it left off.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_stats_route_index(uint32_t dest, uint32_t mask, uint32_t gw,
+                                  const char* iface)
+{
+    struct sr_stats_region* r = sr_stats_r;
+    struct sr_stats_route* rt;
+    unsigned int i;
+
+    assert(iface);
+
+    pthread_mutex_lock(&sr_stats_lock);
+    for (i = 0; i < r->nroutes; i++) {
+        rt = &r->route[i];
+        if (rt->dest == dest && rt->mask == mask && rt->gw == gw &&
+            strncmp(rt->iface, iface, sr_IFACE_NAMELEN) == 0)
+        { break; }
+    }
+    if (i == r->nroutes) {
+        if (i == SR_STATS_MAX_ROUTES)
+        { i = SR_STATS_MAX_ROUTES - 1; }
+        else {
+            rt = &r->route[i];
+            rt->dest = dest;
+            rt->mask = mask;
+            rt->gw = gw;
+            strncpy(rt->iface, iface, sr_IFACE_NAMELEN - 1);
+            __atomic_store_n(&r->nroutes, i + 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&sr_stats_lock);
+    return i;
+} /* -- sr_stats_route_index -- */
+
+struct sr_lat_slot* sr_stats_lat_slot(void)
+{
+    return &sr_stats_r->lat[SR_STATS_SLOT() - sr_stats_r->slot];
+} /* -- sr_stats_lat_slot -- */
+
+void sr_stats_set_lat(unsigned int every, uint64_t hz)
+{
+    sr_stats_r->lat_hz = hz;
+    sr_stats_r->lat_every = every;
+} /* -- sr_stats_set_lat -- */
+
+void sr_stats_print_lat(FILE* out)
+{
+    struct sr_stats_region* r = sr_stats_r;
+
+    if (!r->lat_every)
+    { return; }
+    fprintf(out, "\nstage latency, 1 in %u packets timed", r->lat_every);
+    sr_lat_print(out, r->lat, r->nslots < SR_STATS_SLOTS ? r->nslots :
+                 SR_STATS_SLOTS, r->lat_hz);
+} /* -- sr_stats_print_lat -- */
+
+struct sr_pmu_slot* sr_stats_pmu_slot(void)
+{
+    return &sr_stats_r->pmu_slot[SR_STATS_SLOT() - sr_stats_r->slot];
+} /* -- sr_stats_pmu_slot -- */
+
+void sr_stats_set_pmu(int on)
+{
+    sr_stats_r->pmu = on;
+} /* -- sr_stats_set_pmu -- */
+
+void sr_stats_print_pmu(FILE* out)
+{
+    struct sr_stats_region* r = sr_stats_r;
+
+    if (!r->pmu)
+    { return; }
+    fprintf(out, "\nhardware counters, user space, same packets");
+    sr_pmu_print(out, r->pmu_slot, r->nslots < SR_STATS_SLOTS ? r->nslots :
+                 SR_STATS_SLOTS);
+} /* -- sr_stats_print_pmu -- */
+
+struct sr_pktrace_ring* sr_stats_trace_ring(void)
+{
+    return &sr_stats_r->trace[SR_STATS_SLOT() - sr_stats_r->slot];
+} /* -- sr_stats_trace_ring -- */
+
+volatile int32_t* sr_stats_trace_arm(int count, const char* filter)
+{
+    struct sr_stats_region* r = sr_stats_r;
+
+    if (filter)
+    { strncpy(r->trace_filter, filter, SR_PKTRACE_FILTERLEN - 1); }
+    r->trace_count = count;
+    r->trace_left = count;
+    return &r->trace_left;
+} /* -- sr_stats_trace_arm -- */
+
+void sr_stats_print_trace(FILE* out)
+{
+    if (!sr_stats_r->trace_count)
+    { return; }
+    fprintf(out, "\npacket trace, ");
+    sr_pktrace_print(out, sr_stats_r);
+} /* -- sr_stats_print_trace -- */
+
+struct sr_sketch_slot* sr_stats_sketch_slot(void)
+{
+    return &sr_stats_r->sketch[SR_STATS_SLOT() - sr_stats_r->slot];
+} /* -- sr_stats_sketch_slot -- */
+
+void sr_stats_set_sketch(int on)
+{
+    sr_stats_r->sketching = on;
+} /* -- sr_stats_set_sketch -- */
+
+void sr_stats_print_sketch(FILE* out)
+{
+    int k;
+
+    if (!sr_stats_r->sketching)
+    { return; }
+    for (k = 0; k < SR_SKETCH_N; k++)
+    { sr_sketch_print(out, sr_stats_r, k); }
+} /* -- sr_stats_print_sketch -- */
+
+struct sr_stats_arpq* sr_stats_arp_queue(void)
+{
+    return &sr_stats_r->arp;
+} /* -- sr_stats_arp_queue -- */
+
+void sr_stats_print_arp(FILE* out, const struct sr_stats_arpq* q)
+{
+    if (!q->released && !q->unreachable && !q->pending)
+    { return; }
+    fprintf(out, "arp queue: %llu pending, %llu packets (%llu bytes) parked; "
+            "%llu released, %llu host unreachable\n",
+            (unsigned long long)q->pending,
+            (unsigned long long)q->queued_packets,
+            (unsigned long long)q->queued_bytes,
+            (unsigned long long)q->released,
+            (unsigned long long)q->unreachable);
+    if (q->released || q->unreachable) {
+        fprintf(out, "arp queue delay (ms): p50 %.1f p90 %.1f p99 %.1f "
+                "max %.1f\n",
+                sr_lat_percentile(&q->delay, 0.50) / 1e6,
+                sr_lat_percentile(&q->delay, 0.90) / 1e6,
+                sr_lat_percentile(&q->delay, 0.99) / 1e6,
+                sr_lat_percentile(&q->delay, 1.0) / 1e6);
+    }
+} /* -- sr_stats_print_arp -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_shutdown(..)
+ * Scope:  Global
+ *
+ * The mapping stays, threads still holding a slot keep counting into
+ * memory nobody else will see.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_shutdown(void)
+{
+    if (sr_stats_r == &sr_stats_private)
+    { return; }
+    shm_unlink(sr_stats_name);
+} /* -- sr_stats_shutdown -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_map(..)
+ * Scope:  Local
+ *
+ * Map a running router's region, read only unless writable.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_stats_region* sr_stats_map(const char* name, int writable)
+{
+    struct sr_stats_region* r;
+    struct stat st;
+    int fd;
+
+    if (!name)
+    { name = SR_STATS_NAME; }
+
+    if ((fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0)) < 0) {
+        perror("shm_open(..):sr_stats.c::sr_stats_map(..)");
+        return 0;
+    }
+    if (fstat(fd, &st) < 0 ||
+        (size_t)st.st_size < sizeof(struct sr_stats_region)) {
+        fprintf(stderr, "%s: not a stats region of this version\n", name);
+        close(fd);
+        return 0;
+    }
+    r = (struct sr_stats_region*)mmap(0, sizeof(struct sr_stats_region),
+                                      writable ? PROT_READ | PROT_WRITE :
+                                      PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED) {
+        perror("mmap(..):sr_stats.c::sr_stats_map(..)");
+        return 0;
+    }
+    if (r->magic != SR_STATS_MAGIC || r->version != SR_STATS_VERSION ||
+        r->nreasons != SR_DROP_NREASONS) {
+        fprintf(stderr, "%s: not a stats region of this version\n", name);
+        munmap((void*)r, sizeof(struct sr_stats_region));
+        return 0;
+    }
+    return r;
+} /* -- sr_stats_map -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_attach(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+const struct sr_stats_region* sr_stats_attach(const char* name)
+{
+    return sr_stats_map(name, 0);
+} /* -- sr_stats_attach -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_trace_rearm(..)
+ * Scope:  Global
+ *
+ * The count is the one thing another process may write; the router only
+ * ever decrements it atomically.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_stats_trace_rearm(const char* name, int count)
+{
+    struct sr_stats_region* r;
+
+    if ((r = sr_stats_map(name, 1)) == 0)
+    { return -1; }
+    __atomic_store_n(&r->trace_left, count, __ATOMIC_RELAXED);
+    munmap(r, sizeof(struct sr_stats_region));
+    return 0;
+} /* -- sr_stats_trace_rearm -- */
+
+/* route i's counters summed over the slots of r */
+static void sr_stats_route_sum(const struct sr_stats_region* r, unsigned int i,
+                               struct sr_stats_route_use* sum)
+{
+    const volatile struct sr_stats_route_use* u;
+    unsigned int nslots = r->nslots < SR_STATS_SLOTS ? r->nslots :
+                          SR_STATS_SLOTS;
+    unsigned int s;
+    int k;
+
+    memset(sum, 0, SR_ROUTE_NUSES * sizeof(*sum));
+    for (s = 0; s < nslots; s++) {
+        u = r->slot[s].routes[i];
+        for (k = 0; k < SR_ROUTE_NUSES; k++) {
+            sum[k].packets += u[k].packets;
+            sum[k].bytes += u[k].bytes;
+        }
+    }
+} /* -- sr_stats_route_sum -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_routes_reset(..)
+ * Scope:  Global
+ *
+ * The router's threads never read the baseline, so writing it needs no
+ * more care than a reader summing the slots takes.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_stats_routes_reset(const char* name)
+{
+    struct sr_stats_region* r;
+    unsigned int i;
+
+    if ((r = sr_stats_map(name, 1)) == 0)
+    { return -1; }
+    for (i = 0; i < SR_STATS_MAX_ROUTES; i++)
+    { sr_stats_route_sum(r, i, r->route_base[i]); }
+    r->routes_reset = (uint64_t)time(0);
+    munmap(r, sizeof(struct sr_stats_region));
+    return 0;
+} /* -- sr_stats_routes_reset -- */
+
+/* a route's hits since the reset */
+struct sr_stats_fib_row
+{
+    unsigned int route;
+    uint64_t hits;                  /* packets of every use */
+    struct sr_stats_route_use use[SR_ROUTE_NUSES];
+};
+
+static int sr_stats_fib_cmp(const void* a, const void* b)
+{
+    const struct sr_stats_fib_row* x = (const struct sr_stats_fib_row*)a;
+    const struct sr_stats_fib_row* y = (const struct sr_stats_fib_row*)b;
+
+    if (x->hits != y->hits)
+    { return x->hits < y->hits ? 1 : -1; }
+    if (x->use[SR_ROUTE_FORWARD].bytes != y->use[SR_ROUTE_FORWARD].bytes)
+    { return x->use[SR_ROUTE_FORWARD].bytes <
+             y->use[SR_ROUTE_FORWARD].bytes ? 1 : -1; }
+    return x->route < y->route ? -1 : x->route > y->route;
+} /* -- sr_stats_fib_cmp -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_print_fib(..)
+ * Scope:  Global
+ *
+ * Ranked by lookups of any kind, the share column and its running total
+ * say how much of the lookups the first so many routes would answer from
+ * a cache.  Routes nothing looked up since the reset are listed last, as
+ * candidates for aggregating away.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_print_fib(FILE* out, const struct sr_stats_region* r)
+{
+    static struct sr_stats_fib_row row[SR_STATS_MAX_ROUTES];
+    const struct sr_stats_route* rt;
+    unsigned int nroutes = r->nroutes < SR_STATS_MAX_ROUTES ? r->nroutes :
+                           SR_STATS_MAX_ROUTES;
+    unsigned int i, unused = 0;
+    uint64_t total = 0, cum = 0;
+    char dest[INET_ADDRSTRLEN], gw[INET_ADDRSTRLEN];
+    char prefix[INET_ADDRSTRLEN + 4];
+    struct in_addr in;
+    int k;
+
+    for (i = 0; i < nroutes; i++) {
+        row[i].route = i;
+        row[i].hits = 0;
+        sr_stats_route_sum(r, i, row[i].use);
+        for (k = 0; k < SR_ROUTE_NUSES; k++) {
+            /* -- counters only grow, the base is never ahead -- */
+            row[i].use[k].packets -= r->route_base[i][k].packets;
+            row[i].use[k].bytes -= r->route_base[i][k].bytes;
+            row[i].hits += row[i].use[k].packets;
+        }
+        total += row[i].hits;
+        if (!row[i].hits)
+        { unused++; }
+    }
+    qsort(row, nroutes, sizeof(row[0]), sr_stats_fib_cmp);
+
+    fprintf(out, "\nroute lookups since %s %llus ago: %llu, %u of %u routes "
+            "unused\n", r->routes_reset ? "reset" : "start",
+            (unsigned long long)(time(0) - (r->routes_reset ? r->routes_reset :
+                                             r->started)),
+            (unsigned long long)total, unused, nroutes);
+    if (!nroutes)
+    { return; }
+    fprintf(out, "%-18s %-15s %-8s %12s %14s %10s %10s %6s %6s\n", "PREFIX",
+            "GATEWAY", "IFACE", "FWD_PACKETS", "FWD_BYTES", "ICMP", "ARP",
+            "SHARE", "CUM");
+    for (i = 0; i < nroutes; i++) {
+        rt = &r->route[row[i].route];
+        in.s_addr = rt->dest;
+        inet_ntop(AF_INET, &in, dest, sizeof(dest));
+        in.s_addr = rt->gw;
+        inet_ntop(AF_INET, &in, gw, sizeof(gw));
+        snprintf(prefix, sizeof(prefix), "%s/%d", dest,
+                 __builtin_popcount(rt->mask));
+        cum += row[i].hits;
+        fprintf(out, "%-18s %-15s %-8.*s %12llu %14llu %10llu %10llu ",
+                prefix, gw, sr_IFACE_NAMELEN, rt->iface,
+                (unsigned long long)row[i].use[SR_ROUTE_FORWARD].packets,
+                (unsigned long long)row[i].use[SR_ROUTE_FORWARD].bytes,
+                (unsigned long long)row[i].use[SR_ROUTE_ICMP].packets,
+                (unsigned long long)row[i].use[SR_ROUTE_ARP].packets);
+        if (row[i].hits)
+        { fprintf(out, "%5.1f%% %5.1f%%\n", 100.0 * row[i].hits / total,
+                  100.0 * cum / total); }
+        else
+        { fprintf(out, "%6s %6s\n", "unused", "-"); }
+    }
+    if (r->nroutes >= SR_STATS_MAX_ROUTES)
+    { fprintf(out, "(the last row counts every route past it too)\n"); }
+} /* -- sr_stats_print_fib -- */
+
+void sr_stats_print_routes(FILE* out)
+{
+    if (!sr_stats_r->nroutes)
+    { return; }
+    sr_stats_print_fib(out, sr_stats_r);
+} /* -- sr_stats_print_routes -- */
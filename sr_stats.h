@@ -0,0 +1,291 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ *
+ * Description:
+ *
+ * Packet and drop counters published in shared memory, read by srstat the
+ * way ethtool -S reads a NIC's.
+ *
+ * The region (POSIX shm, /dev/shm/sr_stats by default, -k to rename) holds
+ * a header naming the interfaces and drop reasons, then one slot of
+ * counters per thread.  A thread claims a slot the first time it counts
+ * something and from then on only ever writes its own slot, with plain
+ * increments: no atomics, no locks, no syscalls, and slots are cache line
+ * aligned so threads don't share lines.  srstat sums the slots; a reader
+ * may see one counter a packet ahead of another, never a torn value.
+ *
+ * Every early return in sr_handlepacket, every frame the ARP code, the
+ * dispatch rings, the egress queues or the transport give up on is counted
+ * against one SR_DROP_* reason, and fires the sr:drop probe (sr_probe.h).
+ *
+ * The stage latency histograms of sr_lat.h are kept here too, a set per
+ * slot, after all the counters, and the sr_pmu hardware counter sums, the
+ * sr_pktrace rings and the sr_sketch top talkers likewise.  So are gauges
+ * and a delay histogram of the packets parked on ARP requests; those only
+ * change under the ARP cache lock and have a single copy.
+ *
+ * Every routing table entry has a row of hit counters in each slot, one
+ * pair of packets and bytes for each kind of sr_LPM caller: forwarding
+ * (IP bytes), ICMP the router sends (IP bytes) and ARP requests (frame
+ * bytes).  The header names the routes.  srstat -z resets them by storing
+ * the current sums as a baseline the report subtracts, so the router never
+ * has to stop counting; srstat -r sorts the routes by traffic.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_STATS_H
+#define SR_STATS_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#include "sr_protocol.h"
+#include "sr_lat.h"
+#include "sr_pmu.h"
+#include "sr_probe.h"
+#include "sr_pktrace.h"
+#include "sr_sketch.h"
+
+#define SR_STATS_MAGIC      0x53525354 /* "SRST" */
+#define SR_STATS_VERSION    7
+#define SR_STATS_NAME       "/sr_stats"
+#define SR_STATS_SLOTS      64      /* threads; any past the last share it */
+#define SR_STATS_MAX_IFS    16      /* interfaces past the last share it */
+#define SR_STATS_MAX_ROUTES 128     /* routes past the last share it */
+#define SR_STATS_NAMELEN    24
+#define SR_STATS_CACHELINE  64
+
+/* why a frame was dropped */
+enum sr_drop_reason
+{
+    SR_DROP_RUNT = 0,               /* shorter than an ethernet header */
+    SR_DROP_ETHERTYPE,              /* neither IP nor ARP */
+    SR_DROP_IP_SHORT,               /* shorter than an IP header */
+    SR_DROP_IP_HEADER,              /* not version 4 or header length < 5 */
+    SR_DROP_IP_CKSUM,
+    SR_DROP_ICMP_CKSUM,
+    SR_DROP_ICMP_TYPE,              /* ICMP for us that isn't an echo request */
+    SR_DROP_NO_LISTENER,            /* other IP for us, port unreachable sent */
+    SR_DROP_TTL,                    /* time exceeded sent */
+    SR_DROP_NO_ROUTE,               /* net unreachable sent */
+    SR_DROP_FRAG_NEEDED,            /* over the MTU with DF set */
+    SR_DROP_FRAG_FAILED,            /* over the MTU and can't be fragmented */
+    SR_DROP_ICMP_UNROUTABLE,        /* an ICMP we built has no route back */
+    SR_DROP_ARP_SHORT,
+    SR_DROP_ARP_FORMAT,             /* not ethernet/IPv4 */
+    SR_DROP_ARP_NOT_US,             /* request or reply for someone else */
+    SR_DROP_ARP_UNRESOLVED,         /* next hop never answered, host unreachable sent */
+    SR_DROP_WORKER_FULL,            /* a forwarding worker's ring was full */
+    SR_DROP_QUEUE_FULL,             /* egress drop tail */
+    SR_DROP_CODEL,                  /* egress CoDel */
+    SR_DROP_NO_BUF,                 /* buffer pool exhausted */
+    SR_DROP_BAD_SOURCE,             /* ethernet source isn't the interface's */
+    SR_DROP_TX_ERROR,               /* the transport refused it */
+    SR_DROP_NREASONS
+};
+
+struct sr_stats_if
+{
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+};
+
+/* what a route was looked up for */
+#define SR_ROUTE_FORWARD    0
+#define SR_ROUTE_ICMP       1
+#define SR_ROUTE_ARP        2
+#define SR_ROUTE_NUSES      3
+
+struct sr_stats_route_use
+{
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+/* a routing table entry, addresses in network order */
+struct sr_stats_route
+{
+    uint32_t dest;
+    uint32_t mask;
+    uint32_t gw;
+    char iface[sr_IFACE_NAMELEN];
+};
+
+/* one thread's counters */
+struct sr_stats_slot
+{
+    struct sr_stats_if ifs[SR_STATS_MAX_IFS];
+    uint64_t drops[SR_DROP_NREASONS];
+    struct sr_stats_route_use routes[SR_STATS_MAX_ROUTES][SR_ROUTE_NUSES];
+} __attribute__ ((aligned (SR_STATS_CACHELINE)));
+
+/* the ARP request queue, written under the ARP cache lock */
+struct sr_stats_arpq
+{
+    uint64_t pending;               /* requests outstanding, gauge */
+    uint64_t queued_packets;        /* packets parked on them, gauge */
+    uint64_t queued_bytes;          /* gauge */
+    uint64_t released;              /* sent once the next hop answered */
+    uint64_t unreachable;           /* answered with host unreachable */
+    struct sr_lat_hist delay;       /* time parked, ns */
+};
+
+struct sr_stats_region
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;                   /* of the router */
+    uint32_t nslots;                /* slots claimed so far */
+    uint32_t nifs;                  /* interfaces named so far */
+    uint32_t nreasons;
+    uint64_t started;               /* CLOCK_REALTIME seconds */
+    uint64_t lat_hz;                /* sr_lat ticks per second */
+    uint32_t lat_every;             /* sr_lat samples 1 in this, 0 = off */
+    uint32_t pmu;                   /* sr_pmu counters are being read */
+    char ifname[SR_STATS_MAX_IFS][sr_IFACE_NAMELEN];
+    char reason[SR_DROP_NREASONS][SR_STATS_NAMELEN];
+    struct sr_stats_arpq arp;
+    int32_t trace_left;             /* sr_pktrace packets still to trace */
+    uint32_t trace_count;           /* armed for, at startup */
+    char trace_filter[SR_PKTRACE_FILTERLEN];
+    uint32_t sketching;             /* sr_sketch is counting */
+    uint32_t nroutes;               /* routes named so far */
+    uint64_t routes_reset;          /* CLOCK_REALTIME seconds, 0 never */
+    struct sr_stats_route route[SR_STATS_MAX_ROUTES];
+    /* -- the sums at the last reset, written by srstat -z -- */
+    struct sr_stats_route_use route_base[SR_STATS_MAX_ROUTES][SR_ROUTE_NUSES];
+
+    struct sr_stats_slot slot[SR_STATS_SLOTS];
+    struct sr_lat_slot lat[SR_STATS_SLOTS]; /* same index as slot */
+    struct sr_pmu_slot pmu_slot[SR_STATS_SLOTS];
+    struct sr_pktrace_ring trace[SR_STATS_SLOTS];
+    struct sr_sketch_slot sketch[SR_STATS_SLOTS];
+};
+
+/* the calling thread's slot, 0 until it has one */
+extern __thread struct sr_stats_slot* sr_stats_self;
+
+struct sr_stats_slot* sr_stats_claim(void);
+
+#define SR_STATS_SLOT() (sr_stats_self ? sr_stats_self : sr_stats_claim())
+
+#define SR_STATS_DROP(reason)                                               \
+    do {                                                                    \
+        SR_PROBE1(drop, reason);                                            \
+        SR_PKTRACE(SR_PT_DROP, 0, 0, reason);                               \
+        SR_SKETCH_DROP(reason);                                             \
+        SR_STATS_SLOT()->drops[reason]++;                                   \
+    } while (0)
+
+#define SR_STATS_RX(ifidx, len)                                             \
+    do {                                                                    \
+        struct sr_stats_if* sr_stats_if_ = &SR_STATS_SLOT()->ifs[ifidx];    \
+        sr_stats_if_->rx_packets++;                                         \
+        sr_stats_if_->rx_bytes += (len);                                    \
+    } while (0)
+
+#define SR_STATS_TX(ifidx, len)                                             \
+    do {                                                                    \
+        struct sr_stats_if* sr_stats_if_ = &SR_STATS_SLOT()->ifs[ifidx];    \
+        sr_stats_if_->tx_packets++;                                         \
+        sr_stats_if_->tx_bytes += (len);                                    \
+    } while (0)
+
+/* Count a hit on route rt (a struct sr_rt*) for use, len bytes. */
+#define SR_STATS_ROUTE(rt, use, len)                                        \
+    do {                                                                    \
+        struct sr_stats_route_use* sr_stats_ru_ =                           \
+            &SR_STATS_SLOT()->routes[(rt)->stats][use];                     \
+        sr_stats_ru_->packets++;                                            \
+        sr_stats_ru_->bytes += (len);                                       \
+    } while (0)
+
+/* Create and map the region under name (SR_STATS_NAME if 0).  A region
+   left by a router that is gone is replaced; one whose router is still
+   running is left alone.  If shared memory can't be had the counters still
+   work, in private memory nobody else can see.  Call before any thread
+   counts anything.  0 if the region is shared. */
+int  sr_stats_init(const char* name);
+
+/* Index of interface name's counters, adding it if it's new. */
+unsigned int sr_stats_if_index(const char* name);
+
+/* Index of the counters of the route to dest/mask via gw on iface
+   (network order), adding it if it's new. */
+unsigned int sr_stats_route_index(uint32_t dest, uint32_t mask, uint32_t gw,
+                                  const char* iface);
+
+/* Print the routes of region r by traffic since the last reset, the
+   unused ones last. */
+void sr_stats_print_fib(FILE* out, const struct sr_stats_region* r);
+
+/* Print the router's own routes by traffic if it has any. */
+void sr_stats_print_routes(FILE* out);
+
+/* Reset the route counters of the router publishing name (SR_STATS_NAME
+   if 0), for srstat.  0 on success. */
+int  sr_stats_routes_reset(const char* name);
+
+/* The calling thread's sr_lat histograms. */
+struct sr_lat_slot* sr_stats_lat_slot(void);
+
+/* Note that sr_lat samples 1 in every packets, ticks at hz. */
+void sr_stats_set_lat(unsigned int every, uint64_t hz);
+
+/* Print the sr_lat histograms if sampling is on. */
+void sr_stats_print_lat(FILE* out);
+
+/* The calling thread's sr_pmu sums. */
+struct sr_pmu_slot* sr_stats_pmu_slot(void);
+
+/* Note that sr_pmu counters are being read. */
+void sr_stats_set_pmu(int on);
+
+/* Print the sr_pmu per packet counts if they are being read. */
+void sr_stats_print_pmu(FILE* out);
+
+/* The ARP queue counters; only touch them holding the ARP cache lock. */
+struct sr_stats_arpq* sr_stats_arp_queue(void);
+
+/* Print the ARP queue counters and delay if anything was ever queued. */
+void sr_stats_print_arp(FILE* out, const struct sr_stats_arpq* q);
+
+/* The calling thread's sr_pktrace ring. */
+struct sr_pktrace_ring* sr_stats_trace_ring(void);
+
+/* Note the sr_pktrace filter and arm it for count packets; the count
+   sr_pktrace takes packets from. */
+volatile int32_t* sr_stats_trace_arm(int count, const char* filter);
+
+/* Print the sr_pktrace rings if -A armed it at startup. */
+void sr_stats_print_trace(FILE* out);
+
+/* Arm the sr_pktrace of the router publishing name (SR_STATS_NAME if 0)
+   for count more packets, for srstat.  0 on success. */
+int  sr_stats_trace_rearm(const char* name, int count);
+
+/* The calling thread's sr_sketch sketches. */
+struct sr_sketch_slot* sr_stats_sketch_slot(void);
+
+/* Note that sr_sketch is counting. */
+void sr_stats_set_sketch(int on);
+
+/* Print the sr_sketch top talkers if it is counting. */
+void sr_stats_print_sketch(FILE* out);
+
+/* Unlink the region; counting into it stays safe. */
+void sr_stats_shutdown(void);
+
+/* Map name (SR_STATS_NAME if 0) read only, for srstat.  0 on failure. */
+const struct sr_stats_region* sr_stats_attach(const char* name);
+
+#endif /* -- SR_STATS_H -- */
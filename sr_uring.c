@@ -0,0 +1,663 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_uring.c
+ *
+ * Description:
+ *
+ * io_uring engine for the VNS connection, an alternative to the blocking
+ * recv/read/write loop in sr_vns_comm.c:
+ *
+ *     -b uring
+ *
+ * The handshake (auth, OPEN, RTABLE) still runs blocking through
+ * sr_connect_to_server(); the ring takes over the socket on the first poll.
+ *
+ *   receive   one multishot recv fills buffers from a provided buffer ring.
+ *             Complete messages are handled in place, messages split across
+ *             buffers are put back together in a side buffer first.
+ *   transmit  frames are framed into fixed tx slots and submitted as a
+ *             chain of linked sends, one chain in flight at a time, so the
+ *             byte stream stays in order.  A slow server fills the slots and
+ *             costs dropped frames instead of stalling forwarding.
+ *   reaping   every completion that is ready is handled per io_uring_enter;
+ *             the receive thread only blocks when the CQ is empty.
+ *
+ * No liburing: the ring is set up with the raw syscalls.  io_uring_enter
+ * calls and packets are counted and reported on exit.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifdef _LINUX_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+
+#include "sr_router.h"
+#include "sr_io.h"
+#include "vnscommand.h"
+
+#define SR_URING_SQ_ENTRIES 256
+#define SR_URING_CQ_ENTRIES 1024
+#define SR_URING_MSG_MAX    VNS_MSG_MAX
+#define SR_URING_RX_BUFS    64         /* provided buffers, power of 2 */
+#define SR_URING_RX_BUF_SZ  16384
+#define SR_URING_BGID       0
+#define SR_URING_TX_SLOTS   256        /* power of 2 */
+#define SR_URING_TX_CHAIN   128        /* longest linked send chain */
+
+#define SR_URING_UD_RECV    (~(uint64_t)0)
+
+struct sr_uring
+{
+    int fd;
+    int sockfd;
+
+    /* -- submission queue, only touched with lock held -- */
+    uint8_t* sq_map;
+    size_t sq_map_len;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+
+    /* -- completion queue, receive thread only -- */
+    uint8_t* cq_map;
+    size_t cq_map_len;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    /* -- provided receive buffers -- */
+    struct io_uring_buf_ring* br;
+    size_t br_len;
+    uint8_t* rx_bufs;
+    uint16_t br_tail;
+    int recv_armed;
+
+    /* -- a message split across receive buffers -- */
+    uint8_t* msg;
+    unsigned int msg_have;
+    unsigned int msg_len;
+
+    /* -- tx slots, sent strictly in order: done <= sub <= prod -- */
+    pthread_mutex_t lock;
+    uint8_t* tx_bufs;
+    unsigned int tx_len[SR_URING_TX_SLOTS];
+    uint32_t tx_prod;                  /* filled */
+    uint32_t tx_sub;                   /* handed to the kernel */
+    uint32_t tx_done;                  /* completed */
+
+    /* -- counters -- */
+    unsigned long enters;
+    unsigned long rx_msgs;
+    unsigned long rx_joined;           /* went through the side buffer */
+    unsigned long tx_frames;
+    unsigned long tx_full;             /* sends refused, slots full */
+    unsigned long tx_errors;
+};
+
+/* set while the receive loop handles completions, so sends it causes
+   are submitted in one go at the end of the round */
+static __thread int sr_uring_in_rx = 0;
+
+static int sr_uring_enter(struct sr_uring* u, unsigned int submit,
+                          unsigned int wait, unsigned int flags)
+{
+    int ret;
+
+    __atomic_fetch_add(&u->enters, 1, __ATOMIC_RELAXED);
+    ret = syscall(__NR_io_uring_enter, u->fd, submit, wait, flags, 0, 0);
+    if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    {
+        perror("io_uring_enter(..):sr_uring.c::sr_uring_enter(..)");
+        return -1;
+    }
+    return ret < 0 ? 0 : ret;
+} /* -- sr_uring_enter -- */
+
+/* next free SQE, zeroed; lock held.  Becomes visible with sr_uring_sqe_push */
+static struct io_uring_sqe* sr_uring_sqe_get(struct sr_uring* u)
+{
+    unsigned tail = *u->sq_tail;
+    struct io_uring_sqe* sqe;
+
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+    { return 0; }
+    sqe = &u->sqes[tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[tail & u->sq_mask] = tail & u->sq_mask;
+    return sqe;
+} /* -- sr_uring_sqe_get -- */
+
+static void sr_uring_sqe_push(struct sr_uring* u)
+{
+    __atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+} /* -- sr_uring_sqe_push -- */
+
+/* give a receive buffer back to the kernel */
+static void sr_uring_buf_add(struct sr_uring* u, unsigned int bid)
+{
+    struct io_uring_buf* b = &u->br->bufs[u->br_tail & (SR_URING_RX_BUFS - 1)];
+
+    b->addr = (uint64_t)(unsigned long)(u->rx_bufs + (size_t)bid * SR_URING_RX_BUF_SZ);
+    b->len = SR_URING_RX_BUF_SZ;
+    b->bid = bid;
+    u->br_tail++;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+} /* -- sr_uring_buf_add -- */
+
+/* queue the multishot recv; lock held.  Returns SQEs queued */
+static int sr_uring_arm_recv(struct sr_uring* u)
+{
+    struct io_uring_sqe* sqe;
+
+    if (u->recv_armed || !(sqe = sr_uring_sqe_get(u)))
+    { return 0; }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = u->sockfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = SR_URING_BGID;
+    sqe->user_data = SR_URING_UD_RECV;
+    sr_uring_sqe_push(u);
+    u->recv_armed = 1;
+    return 1;
+} /* -- sr_uring_arm_recv -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_tx_chain(..)
+ * Scope: Local
+ *
+ * Queue the filled tx slots as one chain of linked sends.  Only one chain
+ * is ever in flight: two would race for the socket and could interleave.
+ * lock held.  Returns SQEs queued.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_uring_tx_chain(struct sr_uring* u)
+{
+    struct io_uring_sqe* sqe;
+    uint32_t n, i;
+
+    if (u->tx_sub != u->tx_done || u->tx_sub == u->tx_prod)
+    { return 0; }
+
+    n = u->tx_prod - u->tx_sub;
+    if (n > SR_URING_TX_CHAIN)
+    { n = SR_URING_TX_CHAIN; }
+
+    for (i = 0; i < n; i++)
+    {
+        uint32_t slot = (u->tx_sub + i) & (SR_URING_TX_SLOTS - 1);
+
+        /* -- can't happen, the chain is shorter than the SQ -- */
+        if (!(sqe = sr_uring_sqe_get(u)))
+        { break; }
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = u->sockfd;
+        sqe->addr = (uint64_t)(unsigned long)(u->tx_bufs + (size_t)slot * SR_URING_MSG_MAX);
+        sqe->len = u->tx_len[slot];
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        sqe->user_data = u->tx_sub + i;
+        if (i + 1 < n)
+        { sqe->flags = IOSQE_IO_LINK; }
+        sr_uring_sqe_push(u);
+    }
+    u->tx_sub += i;
+    return i;
+} /* -- sr_uring_tx_chain -- */
+
+static void sr_uring_free(struct sr_uring* u)
+{
+    if (u->fd >= 0)
+    { close(u->fd); }
+    if (u->sq_map)
+    { munmap(u->sq_map, u->sq_map_len); }
+    if (u->cq_map && u->cq_map != u->sq_map)
+    { munmap(u->cq_map, u->cq_map_len); }
+    if (u->sqes)
+    { munmap(u->sqes, u->sqes_len); }
+    if (u->br)
+    { munmap(u->br, u->br_len); }
+    free(u->rx_bufs);
+    free(u->tx_bufs);
+    free(u->msg);
+    pthread_mutex_destroy(&u->lock);
+    free(u);
+} /* -- sr_uring_free -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_start(..)
+ * Scope: Local
+ *
+ * Set up the ring and the provided buffers for the connected socket.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_uring_start(struct sr_instance* sr)
+{
+    struct sr_uring* u;
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    unsigned int i;
+
+    /* REQUIRES */
+    assert(sr);
+
+    u = (struct sr_uring*)calloc(1, sizeof(struct sr_uring));
+    assert(u);
+    u->sockfd = sr->sockfd;
+    pthread_mutex_init(&u->lock, NULL);
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = SR_URING_CQ_ENTRIES;
+    if ((u->fd = syscall(__NR_io_uring_setup, SR_URING_SQ_ENTRIES, &p)) < 0)
+    {
+        perror("io_uring_setup(..):sr_uring.c::sr_uring_start(..)");
+        free(u);
+        return -1;
+    }
+
+    /* -- map the rings -- */
+    u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cq_map_len > u->sq_map_len)
+        { u->sq_map_len = u->cq_map_len; }
+        u->cq_map_len = u->sq_map_len;
+    }
+    u->sq_map = mmap(0, u->sq_map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_map == MAP_FAILED)
+    {
+        u->sq_map = 0;
+        perror("mmap(..):sr_uring.c::sr_uring_start(..)");
+        sr_uring_free(u);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    { u->cq_map = u->sq_map; }
+    else
+    {
+        u->cq_map = mmap(0, u->cq_map_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_map == MAP_FAILED)
+        {
+            u->cq_map = 0;
+            perror("mmap(..):sr_uring.c::sr_uring_start(..)");
+            sr_uring_free(u);
+            return -1;
+        }
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(0, u->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    {
+        u->sqes = 0;
+        perror("mmap(..):sr_uring.c::sr_uring_start(..)");
+        sr_uring_free(u);
+        return -1;
+    }
+
+    u->sq_head = (unsigned*)(u->sq_map + p.sq_off.head);
+    u->sq_tail = (unsigned*)(u->sq_map + p.sq_off.tail);
+    u->sq_mask = *(unsigned*)(u->sq_map + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->sq_array = (unsigned*)(u->sq_map + p.sq_off.array);
+    u->cq_head = (unsigned*)(u->cq_map + p.cq_off.head);
+    u->cq_tail = (unsigned*)(u->cq_map + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)(u->cq_map + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(u->cq_map + p.cq_off.cqes);
+
+    /* -- provided buffer ring, needs to be page aligned -- */
+    u->br_len = SR_URING_RX_BUFS * sizeof(struct io_uring_buf);
+    u->br = mmap(0, u->br_len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->br == MAP_FAILED)
+    {
+        u->br = 0;
+        perror("mmap(..):sr_uring.c::sr_uring_start(..)");
+        sr_uring_free(u);
+        return -1;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(unsigned long)u->br;
+    reg.ring_entries = SR_URING_RX_BUFS;
+    reg.bgid = SR_URING_BGID;
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0)
+    {
+        perror("io_uring_register(PBUF_RING):sr_uring.c::sr_uring_start(..)");
+        fprintf(stderr, "the uring engine needs Linux 6.0 or newer\n");
+        sr_uring_free(u);
+        return -1;
+    }
+
+    u->rx_bufs = (uint8_t*)malloc((size_t)SR_URING_RX_BUFS * SR_URING_RX_BUF_SZ);
+    u->tx_bufs = (uint8_t*)malloc((size_t)SR_URING_TX_SLOTS * SR_URING_MSG_MAX);
+    u->msg = (uint8_t*)malloc(SR_URING_MSG_MAX);
+    assert(u->rx_bufs && u->tx_bufs && u->msg);
+    for (i = 0; i < SR_URING_RX_BUFS; i++)
+    { sr_uring_buf_add(u, i); }
+
+    pthread_mutex_lock(&u->lock);
+    i = sr_uring_arm_recv(u);
+    if (sr_uring_enter(u, i, 0, 0) < 0)
+    {
+        pthread_mutex_unlock(&u->lock);
+        sr_uring_free(u);
+        return -1;
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    sr->io_priv = u;
+    return 0;
+} /* -- sr_uring_start -- */
+
+static int sr_uring_msg_len(const uint8_t* p)
+{
+    uint32_t len;
+
+    memcpy(&len, p, sizeof(len));
+    len = ntohl(len);
+    if (len < sizeof(c_base) || len > SR_URING_MSG_MAX)
+    {
+        fprintf(stderr, "Error: command length to large %u\n", len);
+        return -1;
+    }
+    return len;
+} /* -- sr_uring_msg_len -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_feed(..)
+ * Scope: Local
+ *
+ * Split a chunk of the byte stream into VNS messages.  Whole, aligned
+ * messages are handled where they are; the rest is collected in u->msg.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_uring_feed(struct sr_instance* sr, struct sr_uring* u,
+                         uint8_t* p, unsigned int n)
+{
+    unsigned int take;
+    int len, ret;
+
+    while (n > 0)
+    {
+        if (u->msg_have == 0 && n >= sizeof(uint32_t) &&
+            ((unsigned long)p & (sizeof(uint32_t) - 1)) == 0)
+        {
+            if ((len = sr_uring_msg_len(p)) < 0)
+            { return -1; }
+            if ((unsigned int)len <= n)
+            {
+                u->rx_msgs++;
+                if ((ret = sr_handle_vns_command(sr, p, 0)) != 1)
+                { return ret; }
+                p += len;
+                n -= len;
+                continue;
+            }
+        }
+
+        /* -- length first, then the rest of the message -- */
+        if (u->msg_have < sizeof(uint32_t))
+        { take = sizeof(uint32_t) - u->msg_have; }
+        else
+        { take = u->msg_len - u->msg_have; }
+        if (take > n)
+        { take = n; }
+        memcpy(u->msg + u->msg_have, p, take);
+        u->msg_have += take;
+        p += take;
+        n -= take;
+
+        if (u->msg_have == sizeof(uint32_t))
+        {
+            if ((len = sr_uring_msg_len(u->msg)) < 0)
+            { return -1; }
+            u->msg_len = len;
+        }
+        else if (u->msg_have > sizeof(uint32_t) && u->msg_have == u->msg_len)
+        {
+            u->msg_have = 0;
+            u->rx_msgs++;
+            u->rx_joined++;
+            if ((ret = sr_handle_vns_command(sr, u->msg, 0)) != 1)
+            { return ret; }
+        }
+    }
+    return 1;
+} /* -- sr_uring_feed -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_send(..)
+ * Scope: Local
+ *
+ * Frame the packet into the next tx slot.  Sends from the receive loop are
+ * submitted at the end of its round; anything else (ARP sweeper, workers)
+ * starts a chain right away unless one is already in flight, in which case
+ * the receive loop picks the slot up when that chain completes.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_uring_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                         const char* iface)
+{
+    struct sr_uring* u = (struct sr_uring*)sr->io_priv;
+    c_packet_header* hdr;
+    unsigned int total_len = len + sizeof(c_packet_header);
+    uint32_t slot;
+    int n;
+
+    /* -- not taken over the socket yet -- */
+    if (!u)
+    { return sr_io_vns.send(sr, buf, len, iface); }
+
+    if (total_len > SR_URING_MSG_MAX)
+    {
+        fprintf(stderr, "** Error: frame of %u bytes too big for VNS\n", len);
+        return -1;
+    }
+
+    pthread_mutex_lock(&u->lock);
+    if (u->tx_prod - u->tx_done >= SR_URING_TX_SLOTS)
+    {
+        u->tx_full++;
+        pthread_mutex_unlock(&u->lock);
+        return SR_IO_BUSY;
+    }
+
+    slot = u->tx_prod & (SR_URING_TX_SLOTS - 1);
+    hdr = (c_packet_header*)(u->tx_bufs + (size_t)slot * SR_URING_MSG_MAX);
+    hdr->mLen = htonl(total_len);
+    hdr->mType = htonl(VNSPACKET);
+    strncpy(hdr->mInterfaceName, iface, 16);
+    memcpy((uint8_t*)hdr + sizeof(c_packet_header), buf, len);
+    u->tx_len[slot] = total_len;
+    u->tx_prod++;
+
+    if (!sr_uring_in_rx && (n = sr_uring_tx_chain(u)) > 0)
+    { sr_uring_enter(u, n, 0, 0); }
+    pthread_mutex_unlock(&u->lock);
+
+    return 0;
+} /* -- sr_uring_send -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_poll(..)
+ * Scope: Local
+ *
+ * Handle every completion that is ready, waiting for one only if there are
+ * none, then submit whatever the round produced.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_uring_poll(struct sr_instance* sr)
+{
+    struct sr_uring* u = (struct sr_uring*)sr->io_priv;
+    unsigned head, tail;
+    uint32_t done = 0;
+    int ret = 1, n;
+
+    if (!u)
+    {
+        if (sr_uring_start(sr) != 0)
+        { return -1; }
+        u = (struct sr_uring*)sr->io_priv;
+    }
+
+    head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) &&
+        sr_uring_enter(u, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+    { return -1; }
+
+    sr_uring_in_rx = 1;
+
+    tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail && ret == 1; head++)
+    {
+        struct io_uring_cqe* cqe = &u->cqes[head & u->cq_mask];
+
+        if (cqe->user_data != SR_URING_UD_RECV)
+        {
+            /* -- send completion, they arrive in chain order -- */
+            uint32_t slot = (uint32_t)cqe->user_data & (SR_URING_TX_SLOTS - 1);
+
+            done++;
+            if (cqe->res == (int)u->tx_len[slot])
+            { u->tx_frames++; }
+            else
+            {
+                u->tx_errors++;
+                if (cqe->res != -ECANCELED)
+                {
+                    fprintf(stderr, "uring: send failed: %s\n",
+                            cqe->res < 0 ? strerror(-cqe->res) : "short write");
+                    ret = -1;
+                }
+            }
+            continue;
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+        { u->recv_armed = 0; }
+
+        if (cqe->res == -ENOBUFS)
+        { continue; } /* -- re-armed below once buffers are back -- */
+        if (cqe->res < 0)
+        {
+            fprintf(stderr, "uring: recv failed: %s\n", strerror(-cqe->res));
+            ret = -1;
+            continue;
+        }
+        if (cqe->res == 0)
+        {
+            fprintf(stderr, "VNS server closed the connection.\n");
+            ret = -1;
+            continue;
+        }
+
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+        {
+            unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+            ret = sr_uring_feed(sr, u, u->rx_bufs + (size_t)bid * SR_URING_RX_BUF_SZ,
+                                cqe->res);
+            sr_uring_buf_add(u, bid);
+        }
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    sr_uring_in_rx = 0;
+
+    /* -- one submission for the round: re-arm, next chain of sends -- */
+    pthread_mutex_lock(&u->lock);
+    u->tx_done += done;
+    n = 0;
+    if (ret == 1)
+    {
+        n += sr_uring_arm_recv(u);
+        n += sr_uring_tx_chain(u);
+    }
+    if (n > 0 && sr_uring_enter(u, n, 0, 0) < 0)
+    { ret = -1; }
+    pthread_mutex_unlock(&u->lock);
+
+    return ret;
+} /* -- sr_uring_poll -- */
+
+static void sr_uring_close(struct sr_instance* sr)
+{
+    struct sr_uring* u = (struct sr_uring*)sr->io_priv;
+
+    if (u)
+    {
+        unsigned long pkts = u->rx_msgs + u->tx_frames;
+
+        fprintf(stderr, "uring: %lu messages in (%lu reassembled), %lu frames out, "
+                "tx slots full %lu times, %lu tx errors\n", u->rx_msgs, u->rx_joined,
+                u->tx_frames, u->tx_full, u->tx_errors);
+        fprintf(stderr, "uring: %lu io_uring_enter calls, %.3f syscalls per packet\n",
+                u->enters, pkts ? (double)u->enters / pkts : 0.0);
+        sr_uring_free(u);
+        sr->io_priv = 0;
+    }
+    sr_io_vns.close(sr);
+} /* -- sr_uring_close -- */
+
+const struct sr_io_ops sr_io_uring =
+{
+    "uring",
+    0,                   /* set up by sr_connect_to_server() */
+    sr_uring_send,
+    sr_uring_poll,
+    sr_uring_close
+};
+
+#else /* _LINUX_ */
+
+#include <stdio.h>
+#include "sr_io.h"
+
+static int sr_uring_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                         const char* iface)
+{
+    return -1;
+}
+
+static int sr_uring_poll(struct sr_instance* sr)
+{
+    fprintf(stderr, "uring engine is only available on Linux\n");
+    return -1;
+}
+
+const struct sr_io_ops sr_io_uring =
+{
+    "uring",
+    0,
+    sr_uring_send,
+    sr_uring_poll,
+    0
+};
+
+#endif /* _LINUX_ */
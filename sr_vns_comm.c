@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <errno.h>
+#include <poll.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -39,18 +40,33 @@
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_if.h"
+#include "sr_rt.h"
 #include "sr_protocol.h"
+#include "sr_io.h"
+#include "sr_bufpool.h"
+#include "sr_log.h"
+#include "sr_stats.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
-static void sr_log_packet(struct sr_instance* , uint8_t* , int );
-static int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                                  uint8_t * packet /* lent */,
-                                  unsigned int len,
-                                  char* interface  /* lent */);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Keep the kernel's send buffer short so a backlog towards a slow server
+   builds up in the egress queues, where CoDel can see and trim it, rather
+   than in the socket. */
+#define SR_VNS_SNDBUF (64 * 1024)
+
+/* A message the socket only took part of.  The rest has to go out before
+   anything else or the stream loses its framing.  Guarded by send_lock. */
+static uint8_t* sr_vns_residue = 0;
+static unsigned int sr_vns_residue_len = 0;
+static unsigned int sr_vns_residue_off = 0;
+
 /*-----------------------------------------------------------------------------
  * Method: sr_session_closed_help(..)
  *
@@ -81,6 +97,7 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
     c_open_template ot;
     char* buf;
     uint32_t buf_len;
+    int sndbuf;
 
     /* REQUIRES */
     assert(sr);
@@ -111,6 +128,9 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
         perror("socket(..):sr_client.c::sr_connect_to_server(..)");
         return -1;
     }
+    sndbuf = SR_VNS_SNDBUF;
+    if (setsockopt(sr->sockfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0)
+    { perror("setsockopt(..):sr_client.c::sr_connect_to_server(..)"); }
 
     /* attempt to connect to the server */
     if (connect(sr->sockfd, (struct sockaddr *)&(sr->sr_addr),
@@ -201,6 +221,8 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
             case HWSPEED:
                 /* Debug("Speed: %d\n",
                         ntohl(*((unsigned int*)hwinfo->mHWInfo[i].value))); */
+                sr_set_ether_speed(sr,
+                        ntohl(*((uint32_t*)hwinfo->mHWInfo[i].value)));
                 break;
             case HWSUBNET:
                 /* Debug("Subnet: %s\n",inet_ntoa(
@@ -226,9 +248,6 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
         } /* -- switch -- */
     } /* -- for -- */
 
-    printf("Router interfaces:\n");
-    sr_print_if_list(sr);
-
     return num_entries;
 } /* -- sr_handle_hwinfo -- */
 
@@ -319,92 +338,31 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
 }
 
 /*-----------------------------------------------------------------------------
- * Method: sr_read_from_server(..)
+ * Method: sr_handle_vns_command(..)
  * Scope: global
  *
- * Houses main while loop for communicating with the virtual router server.
+ * Act on one complete VNS message.  buf starts with the c_base header as it
+ * came off the wire (network byte order); the type is converted in place.
+ * Shared by the blocking reader below and the io_uring engine, which hands
+ * messages straight out of its receive buffers.
+ *
+ * RETURN VALUES:
+ *
+ *  1 to keep going, 0 if the server closed the session, -1 on error
  *
  *---------------------------------------------------------------------------*/
 
-int sr_read_from_server(struct sr_instance* sr /* borrowed */)
-{
-    return sr_read_from_server_expect(sr, 0);
-}
-
-int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+int sr_handle_vns_command(struct sr_instance* sr /* borrowed */,
+                          uint8_t* buf /* borrowed */, int expected_cmd)
 {
     int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    int ret;
 
     /* REQUIRES */
     assert(sr);
+    assert(buf);
 
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
-
-    bytes_read = 0;
-
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
-    {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
-
-    }
-
-    len = ntohl(len);
-
-    if ( len > 10000 || len < 0 )
-    {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
-    }
-
-    if((buf = malloc(len)) == 0)
-    {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
-        return -1;
-    }
-
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
-
-    bytes_read = 0;
-
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
-    {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
-    }
+    len = ntohl(*((int *)buf));
 
     /* My entry for most unreadable line of code - guido */
     /* ... you win - mc                                  */
@@ -424,27 +382,12 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         /* -------------        VNSPACKET     -------------------- */
 
         case VNSPACKET:
-            sr_pkt = (c_packet_ethernet_header *)buf;
-
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
-            { break; }
-
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
-
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
+            /* -- log, filter and pass to router via the common rx path -- */
+            sr_io_deliver(sr,
                     (buf+sizeof(c_packet_header)),
                     len - sizeof(c_packet_ethernet_header) +
                     sizeof(struct sr_ethernet_hdr),
                     (char*)(buf + sizeof(c_base)));
-
             break;
 
             /* -------------        VNSCLOSE      -------------------- */
@@ -453,10 +396,7 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"VNS server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
-
-            if(buf)
-            { free(buf); }
-            return 0;
+            ret = 0;
             break;
 
             /* -------------        VNSBANNER      -------------------- */
@@ -469,6 +409,10 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
         case VNSHWINFO:
             sr_handle_hwinfo(sr,(c_hwinfo*)buf);
+            if(sr->mtu_spec && sr_set_if_mtu(sr, sr->mtu_spec) != 0)
+            { return -1; }
+            printf("Router interfaces:\n");
+            sr_print_if_list(sr);
             if(sr_verify_routing_table(sr) != 0)
             {
                 fprintf(stderr,"Routing table not consistent with hardware\n");
@@ -501,167 +445,279 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
-}/* -- sr_read_from_server -- */
+}/* -- sr_handle_vns_command -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_ether_addrs_match_interface(..)
- * Scope: Local
+ * Method: sr_read_from_server(..)
+ * Scope: global
  *
- * Make sure ethernet addresses are sane so we don't muck uo the system.
+ * Houses main while loop for communicating with the virtual router server.
  *
- *----------------------------------------------------------------------------*/
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server(struct sr_instance* sr /* borrowed */)
+{
+    return sr_read_from_server_expect(sr, 0);
+}
 
-static int
-sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
-                                uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
 {
-    struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
+    int len;
+    unsigned char *buf = 0;
+    int ret = 0, bytes_read = 0;
 
-    /* -- REQUIRES -- */
+    /* REQUIRES */
     assert(sr);
-    assert(buf);
-    assert(name);
 
-    ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
+    /*---------------------------------------------------------------------------
+      Read a command from the server
+      -------------------------------------------------------------------------*/
+
+    bytes_read = 0;
+
+    /* attempt to read the size of the incoming packet */
+    while( bytes_read < 4)
+    {
+        do
+        { /* -- just in case SIGALRM breaks recv -- */
+            errno = 0; /* -- hacky glibc workaround -- */
+            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
+                            4 - bytes_read, 0)) == -1)
+            {
+                if ( errno == EINTR )
+                { continue; }
+
+                perror("recv(..):sr_client.c::sr_read_from_server");
+                return -1;
+            }
+            bytes_read += ret;
+        } while ( errno == EINTR); /* be mindful of signals */
 
-    if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
-        return 0;
     }
 
-    if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
-        fprintf( stderr, "** Error, source address does not match interface\n");
-        return 0;
+    len = ntohl(len);
+
+    if ( len > VNS_MSG_MAX || len < 0 )
+    {
+        fprintf(stderr,"Error: command length to large %d\n",len);
+        close(sr->sockfd);
+        return -1;
     }
 
-    /* TODO */
-    /* Check destination, hardware address.  If it is private (i.e. destined
-     * to a virtual interface) ensure it is going to the correct topology
-     * Note: This check should really be done server side ...
-     */
+    if((buf = sr_buf_alloc(len)) == 0)
+    {
+        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+        return -1;
+    }
 
-    return 1;
+    /* set first field of command since we've already read it */
+    *((int *)buf) = htonl(len);
 
-} /* -- sr_ether_addrs_match_interface -- */
+    bytes_read = 0;
+
+    /* read the rest of the command */
+    while ( bytes_read < len - 4)
+    {
+        do
+        {/* -- just in case SIGALRM breaks recv -- */
+            errno = 0; /* -- hacky glibc workaround -- */
+            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
+                    -1)
+            {
+                if ( errno == EINTR )
+                { continue; }
+                fprintf(stderr,"Error: failed reading command body %d\n",ret);
+                close(sr->sockfd);
+                return -1;
+            }
+            bytes_read += ret;
+        } while (errno == EINTR); /* be mindful of signals */
+    }
+
+    ret = sr_handle_vns_command(sr, buf, expected_cmd);
+
+    sr_buf_free(buf);
+    return ret;
+}/* -- sr_read_from_server -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_send_packet(..)
- * Scope: Global
+ * Method: sr_vns_write(..)
+ * Scope: Local
+ *
+ * Non-blocking write of the rest of the residue, then of msg if there is
+ * one.  Whatever part of msg the socket doesn't take becomes the new
+ * residue (msg is then owned by it).  send_lock held.
+ *
+ * RETURN VALUES:
  *
- * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ *  0             msg written in full
+ *  SR_IO_PARTIAL msg partly written, the rest is the residue
+ *  SR_IO_BUSY    msg not written at all, socket full
+ *  -1            socket error
  *
  *---------------------------------------------------------------------------*/
 
-int sr_send_packet(struct sr_instance* sr /* borrowed */,
-                         uint8_t* buf /* borrowed */ ,
-                         unsigned int len,
-                         const char* iface /* borrowed */)
+static int sr_vns_write(struct sr_instance* sr, uint8_t* msg, unsigned int len)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
-
-    /* REQUIRES */
-    assert(sr);
-    assert(buf);
-    assert(iface);
+    ssize_t n;
 
-    /* don't waste my time ... */
-    if ( len < sizeof(struct sr_ethernet_hdr) ){
-        fprintf(stderr , "** Error: packet is wayy to short \n");
-        return -1;
+    while ( sr_vns_residue )
+    {
+        n = send(sr->sockfd, sr_vns_residue + sr_vns_residue_off,
+                 sr_vns_residue_len - sr_vns_residue_off,
+                 MSG_DONTWAIT | MSG_NOSIGNAL);
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            { return SR_IO_BUSY; }
+            perror("send(..):sr_vns_comm.c::sr_vns_write(..)");
+            return -1;
+        }
+        if ( (sr_vns_residue_off += n) == sr_vns_residue_len )
+        {
+            sr_buf_free(sr_vns_residue);
+            sr_vns_residue = 0;
+        }
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    if ( !msg )
+    { return 0; }
 
-    /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+    do
+    { n = send(sr->sockfd, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL); }
+    while ( n < 0 && errno == EINTR );
 
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
-        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
+    if ( n < 0 )
+    {
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+        { return SR_IO_BUSY; }
+        perror("send(..):sr_vns_comm.c::sr_vns_write(..)");
         return -1;
     }
-
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        return -1;
+    if ( (unsigned int)n < len )
+    {
+        sr_vns_residue = msg;
+        sr_vns_residue_len = len;
+        sr_vns_residue_off = n;
+        return SR_IO_PARTIAL;
     }
-
-    free(sr_pkt);
-
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_vns_write -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_log_packet()
+ * Method: sr_vns_send(..)
  * Scope: Local
  *
+ * Wrap a frame (ethernet header included!) in a VNSPACKET message and send
+ * it to the server to be injected onto the wire.  Never blocks: a slow
+ * server gets SR_IO_BUSY back, see sr_vns_write(..).
+ *
  *---------------------------------------------------------------------------*/
 
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
+static int sr_vns_send(struct sr_instance* sr /* borrowed */,
+                       uint8_t* buf /* borrowed */ ,
+                       unsigned int len,
+                       const char* iface /* borrowed */)
 {
-    struct pcap_pkthdr h;
-    int size;
+    c_packet_header *sr_pkt;
+    unsigned int total_len =  len + (sizeof(c_packet_header));
+    int ret;
 
-    /* REQUIRES */
-    assert(sr);
+    if ( total_len > VNS_MSG_MAX )
+    {
+        fprintf(stderr, "** Error: frame of %u bytes too big for VNS\n", len);
+        return -1;
+    }
+
+    /* -- workers may send concurrently, keep messages whole -- */
+    pthread_mutex_lock(&(sr->send_lock));
+
+    /* -- no point building a message the socket won't take -- */
+    if ( sr_vns_residue && (ret = sr_vns_write(sr, 0, 0)) != 0 )
+    {
+        pthread_mutex_unlock(&(sr->send_lock));
+        return ret;
+    }
 
-    if(!sr->logfile)
-    {return; }
+    /* Create packet */
+    sr_pkt = (c_packet_header *)sr_buf_alloc(total_len);
+    if ( !sr_pkt )
+    {
+        pthread_mutex_unlock(&(sr->send_lock));
+        SR_ERR("out of memory building VNS message, dropped\n");
+        SR_STATS_DROP(SR_DROP_NO_BUF);
+        return SR_IO_DROPPED;
+    }
+    sr_pkt->mLen  = htonl(total_len);
+    sr_pkt->mType = htonl(VNSPACKET);
+    strncpy(sr_pkt->mInterfaceName,iface,16);
+    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
+            buf,len);
 
-    size = min(PACKET_DUMP_SIZE, len);
+    ret = sr_vns_write(sr, (uint8_t*)sr_pkt, total_len);
+    pthread_mutex_unlock(&(sr->send_lock));
 
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
+    if ( ret != SR_IO_PARTIAL )
+    { sr_buf_free(sr_pkt); }
+    if ( ret < 0 )
+    { fprintf(stderr, "Error writing packet\n"); }
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
-} /* -- sr_log_packet -- */
+    return ret;
+} /* -- sr_vns_send -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_arp_req_not_for_us()
+ * Method: sr_vns_tx_flush(..)
  * Scope: Local
  *
+ * Wait for the socket to drain and push out the rest of a partly written
+ * message.
+ *
  *---------------------------------------------------------------------------*/
 
-int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                           uint8_t * packet /* lent */,
-                           unsigned int len,
-                           char* interface  /* lent */)
+static int sr_vns_tx_flush(struct sr_instance* sr, int timeout_ms)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
-    struct sr_ethernet_hdr* e_hdr = 0;
-    struct sr_arp_hdr*       a_hdr = 0;
+    struct pollfd pfd;
+    int ret;
 
-    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
+    pfd.fd = sr->sockfd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    if ( poll(&pfd, 1, timeout_ms) <= 0 )
     { return 0; }
 
-    assert(iface);
+    pthread_mutex_lock(&(sr->send_lock));
+    ret = sr_vns_write(sr, 0, 0);
+    if ( ret < 0 && sr_vns_residue )
+    {
+        /* -- the connection is gone, nothing left to keep framed -- */
+        sr_buf_free(sr_vns_residue);
+        sr_vns_residue = 0;
+    }
+    pthread_mutex_unlock(&(sr->send_lock));
 
-    e_hdr = (struct sr_ethernet_hdr*)packet;
-    a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+    return ret == 0;
+} /* -- sr_vns_tx_flush -- */
 
-    if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
-            (a_hdr->ar_op      == htons(arp_op_request))   &&
-            (a_hdr->ar_tip     != iface->ip ) )
-    { return 1; }
+static void sr_vns_close(struct sr_instance* sr)
+{
+    if ( sr->sockfd >= 0 )
+    {
+        close(sr->sockfd);
+        sr->sockfd = -1;
+    }
+    sr_buf_free(sr_vns_residue);
+    sr_vns_residue = 0;
+} /* -- sr_vns_close -- */
 
-    return 0;
-} /* -- sr_arp_req_not_for_us -- */
+const struct sr_io_ops sr_io_vns =
+{
+    "vns",
+    0,                   /* set up by sr_connect_to_server() */
+    sr_vns_send,
+    sr_read_from_server,
+    sr_vns_close,
+    sr_vns_tx_flush
+};
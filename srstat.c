@@ -0,0 +1,314 @@
+/*-----------------------------------------------------------------------------
+ * File: srstat.c
+ *
+ * Description:
+ *
+ * Reads the counters a running sr publishes in shared memory (sr_stats.h)
+ * and prints them, summed over the router's threads: packets and bytes
+ * per interface and drops per reason.  The router does nothing to be
+ * read, this only maps the region and adds up slots.
+ *
+ * With -i the counters are printed every interval seconds as per second
+ * rates over the last interval (packets, and drops of all reasons), like
+ * vmstat.
+ *
+ * The packets parked waiting for ARP are shown too: how many and how
+ * long they waited, and whether they went out or were answered with host
+ * unreachable.  The rates line carries the number parked as a gauge.
+ *
+ * -t dumps the packet trace rings (sr -A) and -T count arms the trace for
+ * count more packets.
+ *
+ * -s lists the top talkers (sr_sketch.h): the sources and destinations
+ * sending the most and the sources dropped most, with why; with -i it
+ * does so every interval.
+ *
+ * -r reports how much each route was used: the lookups that hit it for
+ * forwarding, for ICMP and for ARP, most used first, with the share of
+ * all lookups the routes so far account for and the unused ones marked.
+ * -z resets those counters first, for the router as a whole.
+ *
+ * -l prints the stage latency histograms instead, when the router was
+ * started with -H, and its hardware counters per packet if it was also
+ * given -P.
+ *
+ *     srstat [-k shm name] [-i interval [-c count]] [-a] [-l] [-t] [-T count]
+ *            [-s] [-r] [-z]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "sr_stats.h"
+
+/* the region summed over slots */
+struct srstat_snap
+{
+    struct sr_stats_if ifs[SR_STATS_MAX_IFS];
+    uint64_t drops[SR_DROP_NREASONS];
+    double t;
+};
+
+static void srstat_take(const struct sr_stats_region* r, struct srstat_snap* s)
+{
+    const volatile struct sr_stats_slot* slot;
+    struct timespec ts;
+    uint32_t nslots = r->nslots, i;
+    int k;
+
+    memset(s, 0, sizeof(*s));
+    if (nslots > SR_STATS_SLOTS)
+    { nslots = SR_STATS_SLOTS; }
+
+    for (i = 0; i < nslots; i++) {
+        slot = &r->slot[i];
+        for (k = 0; k < SR_STATS_MAX_IFS; k++) {
+            s->ifs[k].rx_packets += slot->ifs[k].rx_packets;
+            s->ifs[k].rx_bytes += slot->ifs[k].rx_bytes;
+            s->ifs[k].tx_packets += slot->ifs[k].tx_packets;
+            s->ifs[k].tx_bytes += slot->ifs[k].tx_bytes;
+        }
+        for (k = 0; k < SR_DROP_NREASONS; k++)
+        { s->drops[k] += slot->drops[k]; }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    s->t = ts.tv_sec + ts.tv_nsec / 1e9;
+} /* -- srstat_take -- */
+
+/* totals since the router started */
+static void srstat_print(const struct sr_stats_region* r,
+                         const struct srstat_snap* s, int all)
+{
+    uint64_t total = 0;
+    uint32_t i;
+    int k;
+
+    printf("sr pid %u, up %llus, %u threads counting\n\n", r->pid,
+           (unsigned long long)(time(0) - r->started), r->nslots);
+
+    printf("%-8s %14s %16s %14s %16s\n", "IFACE", "RX_PACKETS", "RX_BYTES",
+           "TX_PACKETS", "TX_BYTES");
+    for (i = 0; i < r->nifs && i < SR_STATS_MAX_IFS; i++) {
+        printf("%-8.*s %14llu %16llu %14llu %16llu\n", sr_IFACE_NAMELEN,
+               r->ifname[i],
+               (unsigned long long)s->ifs[i].rx_packets,
+               (unsigned long long)s->ifs[i].rx_bytes,
+               (unsigned long long)s->ifs[i].tx_packets,
+               (unsigned long long)s->ifs[i].tx_bytes);
+    }
+
+    for (k = 0; k < SR_DROP_NREASONS; k++)
+    { total += s->drops[k]; }
+    printf("\ndrops: %llu\n", (unsigned long long)total);
+    for (k = 0; k < SR_DROP_NREASONS; k++) {
+        if (s->drops[k] || all) {
+            printf("     %-*.*s %14llu\n", SR_STATS_NAMELEN, SR_STATS_NAMELEN,
+                   r->reason[k], (unsigned long long)s->drops[k]);
+        }
+    }
+
+    printf("\n");
+    sr_stats_print_arp(stdout, &r->arp);
+} /* -- srstat_print -- */
+
+/* one line of rates between a and b */
+static void srstat_print_rates(const struct sr_stats_region* r,
+                               const struct srstat_snap* a,
+                               const struct srstat_snap* b, int header)
+{
+    double dt = b->t - a->t;
+    uint64_t drops = 0;
+    char label[sr_IFACE_NAMELEN + 8];
+    uint32_t i;
+    int k;
+
+    if (dt <= 0)
+    { return; }
+
+    if (header) {
+        for (i = 0; i < r->nifs && i < SR_STATS_MAX_IFS; i++) {
+            snprintf(label, sizeof(label), "%.*s_rx", sr_IFACE_NAMELEN,
+                     r->ifname[i]);
+            printf("%10s ", label);
+            snprintf(label, sizeof(label), "%.*s_tx", sr_IFACE_NAMELEN,
+                     r->ifname[i]);
+            printf("%10s %8s ", label, "Mbit/s");
+        }
+        printf("%10s %8s\n", "drops", "arpq");
+    }
+
+    for (i = 0; i < r->nifs && i < SR_STATS_MAX_IFS; i++) {
+        printf("%10.0f %10.0f %8.1f ",
+               (b->ifs[i].rx_packets - a->ifs[i].rx_packets) / dt,
+               (b->ifs[i].tx_packets - a->ifs[i].tx_packets) / dt,
+               (b->ifs[i].tx_bytes - a->ifs[i].tx_bytes) * 8 / dt / 1e6);
+    }
+    for (k = 0; k < SR_DROP_NREASONS; k++)
+    { drops += b->drops[k] - a->drops[k]; }
+    printf("%10.0f %8llu\n", drops / dt,
+           (unsigned long long)r->arp.queued_packets);
+    fflush(stdout);
+} /* -- srstat_print_rates -- */
+
+static void usage(const char* argv0)
+{
+    printf("Format: %s [-k shm name] [-i interval [-c count]] [-a] [-l] [-t] "
+           "[-T count] [-s] [-r] [-z]\n", argv0);
+    printf("   -k  name of the router's stats region, default %s\n",
+           SR_STATS_NAME);
+    printf("   -i  print rates every interval seconds\n");
+    printf("   -c  stop after count intervals\n");
+    printf("   -a  list every drop reason, not only those seen\n");
+    printf("   -l  stage latency percentiles (sr -H), counters (sr -P)\n");
+    printf("   -t  the last packets traced (sr -A)\n");
+    printf("   -T  trace the next count packets the filter of sr -A matches\n");
+    printf("   -s  top sources, destinations and dropped sources\n");
+    printf("   -r  routes by traffic since the last reset\n");
+    printf("   -z  reset the route counters\n");
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    const struct sr_stats_region* r;
+    struct srstat_snap prev, cur;
+    const char* name = 0;
+    double interval = 0;
+    int count = -1, all = 0, lat = 0, trace = 0, arm = -1, top = 0, n = 0, c;
+    int routes = 0, reset = 0;
+
+    while ((c = getopt(argc, argv, "hk:i:c:altT:srz")) != EOF)
+    {
+        switch (c)
+        {
+            case 'k':
+                name = optarg;
+                break;
+            case 'i':
+                interval = atof(optarg);
+                break;
+            case 'c':
+                count = atoi(optarg);
+                break;
+            case 'a':
+                all = 1;
+                break;
+            case 'l':
+                lat = 1;
+                break;
+            case 't':
+                trace = 1;
+                break;
+            case 'T':
+                arm = atoi(optarg);
+                break;
+            case 's':
+                top = 1;
+                break;
+            case 'r':
+                routes = 1;
+                break;
+            case 'z':
+                reset = 1;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                exit(c == 'h' ? 0 : 1);
+        }
+    }
+
+    if (arm >= 0) {
+        if (sr_stats_trace_rearm(name, arm) != 0) {
+            fprintf(stderr, "Is sr running?\n");
+            return 1;
+        }
+        if (!trace)
+        { return 0; }
+    }
+
+    if (reset) {
+        if (sr_stats_routes_reset(name) != 0) {
+            fprintf(stderr, "Is sr running?\n");
+            return 1;
+        }
+        if (!routes)
+        { return 0; }
+    }
+
+    if ((r = sr_stats_attach(name)) == 0)
+    {
+        fprintf(stderr, "Is sr running?\n");
+        return 1;
+    }
+
+    if (trace) {
+        sr_pktrace_print(stdout, r);
+        return 0;
+    }
+
+    if (routes) {
+        while (count < 0 || n < count) {
+            sr_stats_print_fib(stdout, r);
+            if (interval <= 0)
+            { break; }
+            fflush(stdout);
+            usleep((useconds_t)(interval * 1e6));
+            n++;
+        }
+        return 0;
+    }
+
+    if (top) {
+        if (!r->sketching) {
+            fprintf(stderr, "sr isn't sketching its top talkers\n");
+            return 1;
+        }
+        while (count < 0 || n < count) {
+            for (c = 0; c < SR_SKETCH_N; c++)
+            { sr_sketch_print(stdout, r, c); }
+            if (interval <= 0)
+            { break; }
+            fflush(stdout);
+            usleep((useconds_t)(interval * 1e6));
+            printf("\n");
+            n++;
+        }
+        return 0;
+    }
+
+    if (lat) {
+        if (!r->lat_every) {
+            fprintf(stderr, "Stage latency isn't being sampled, start sr with -H\n");
+            return 1;
+        }
+        printf("1 in %u packets timed", r->lat_every);
+        sr_lat_print(stdout, r->lat, r->nslots < SR_STATS_SLOTS ? r->nslots :
+                     SR_STATS_SLOTS, r->lat_hz);
+        if (r->pmu) {
+            printf("\nhardware counters, user space, same packets");
+            sr_pmu_print(stdout, r->pmu_slot, r->nslots < SR_STATS_SLOTS ?
+                         r->nslots : SR_STATS_SLOTS);
+        }
+        return 0;
+    }
+
+    srstat_take(r, &cur);
+    if (interval <= 0) {
+        srstat_print(r, &cur, all);
+        return 0;
+    }
+
+    while (count < 0 || n < count) {
+        prev = cur;
+        usleep((useconds_t)(interval * 1e6));
+        srstat_take(r, &cur);
+        srstat_print_rates(r, &prev, &cur, n % 20 == 0);
+        n++;
+    }
+    return 0;
+} /* -- main -- */
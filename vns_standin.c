@@ -0,0 +1,1173 @@
+/*-----------------------------------------------------------------------------
+ * File: vns_standin.c
+ *
+ * Description:
+ *
+ * Local stand-in for the VNS server, so the real TCP path of the router
+ * (sr_connect_to_server, sr_read_from_server_expect, VNSPACKET framing) can
+ * be load tested on one machine.
+ *
+ * It speaks enough of the protocol for sr to come up: VNS_AUTH_REQUEST,
+ * reads the VNS_AUTH_REPLY (checked against -k if given), VNS_AUTH_STATUS,
+ * then on VNSOPEN or VNS_OPEN_TEMPLATE (answered with VNS_RTABLE) it sends
+ * VNSHWINFO for the emulated topology and starts moving VNSPACKETs.
+ *
+ * The topology is a list of router interfaces and the hosts behind them:
+ *
+ *     iface eth1 192.168.2.1 00:00:00:00:01:01 [speed]
+ *     host  eth1 192.168.2.2 [mac]
+ *
+ * Hosts answer ARP and ICMP echo.  Without -t the topology matches the
+ * rtable shipped with the stub.
+ *
+ * With -c or -d the server also generates traffic between hosts on
+ * different interfaces: -f flows (each its own 5-tuple), IMIX or fixed
+ * sizes, paced at -R packets per second or, with -R 0, as fast as a window
+ * of -W frames in flight allows.  Every frame carries a sequence number and
+ * a send timestamp, so each one that comes back out of the router gives a
+ * latency sample.  udp frames cross the router once; icmp echoes cross it
+ * twice (request and reply) and give a true round trip.  The first -w
+ * seconds warm up the router's ARP cache and are not counted.
+ *
+ * With -x the same hosts and generator talk to the router through the
+ * shared memory rings of sr_shm.h instead (sr -b shm -i <path>); there is
+ * no authentication step, the unix socket's permissions are the gate.
+ *
+ *     vns_standin [-p port | -x unix socket] [-t topology] [-r rtable]
+ *                 [-k auth_key] [-c packets] [-d seconds] [-R pps]
+ *                 [-W window] [-f flows] [-s imix|bytes] [-m udp|icmp]
+ *                 [-w warmup]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_shm.h"
+#include "vnscommand.h"
+#include "sha1.h"
+
+#define DEFAULT_PORT     8888
+#define MAX_IFACES       16
+#define MAX_HOSTS        256
+#define MAX_FLOWS        65536
+#define MAX_MSG          VNS_MSG_MAX
+#define OUTBUF_HIGH      (256 * 1024) /* stop generating above this backlog */
+#define SALT_LEN         20
+#define AUTH_KEY_LEN     64
+#define MAX_SAMPLES      (1 << 24)
+#define GEN_MAGIC        0x53525447 /* "SRTG" */
+#define GEN_UDP_PORT     9          /* discard */
+
+struct st_iface
+{
+    char name[16];
+    uint32_t ip;
+    uint8_t mac[ETHER_ADDR_LEN];
+    uint32_t speed;
+};
+
+struct st_host
+{
+    struct st_iface* iface;         /* the router port it hangs off */
+    uint32_t ip;
+    uint8_t mac[ETHER_ADDR_LEN];
+};
+
+struct st_flow
+{
+    struct st_host* src;
+    struct st_host* dst;
+    uint16_t sport;
+    uint32_t seq;
+};
+
+/* what the generator puts after the UDP header or ICMP echo header */
+struct st_payload
+{
+    uint32_t magic;
+    uint32_t flow;
+    uint32_t seq;
+    uint32_t ts_hi;                 /* send time, CLOCK_MONOTONIC ns */
+    uint32_t ts_lo;
+} __attribute__ ((packed));
+
+enum st_state { ST_AUTH, ST_OPEN, ST_RUNNING };
+
+static struct st_iface ifaces[MAX_IFACES];
+static int nifaces;
+static struct st_host hosts[MAX_HOSTS];
+static int nhosts;
+static struct st_flow* flows;
+
+/* -- options -- */
+static const char* rtable_file;
+static const char* key_file;
+static long   opt_count = 0;
+static double opt_duration = 0;
+static double opt_rate = 10000;
+static int    opt_window = 256;
+static int    opt_flows = 16;
+static int    opt_size = 0;         /* IP length, 0 = IMIX */
+static int    opt_icmp = 0;
+static double opt_warmup = 2.0;
+
+/* -- connection -- */
+static int cfd = -1;
+static enum st_state state;
+static uint8_t salt[SALT_LEN];
+static uint8_t* inbuf;
+static size_t inlen;
+static uint8_t* outbuf;
+static size_t outlen, outcap;
+static const char* shm_path;        /* -x: frames go through sr_shm rings */
+static struct sr_shm_end shm;
+static long shm_tx_full;
+
+/* -- generator and counters -- */
+static int generating;
+static int measuring;
+static uint64_t t_gen, t_meas, t_meas_end;
+static long sent, sent_warm, rcvd, inflight_base;
+static uint64_t sent_bytes, rcvd_bytes;
+static uint64_t last_rcvd_at;
+static long arp_answered, echo_answered, icmp_errors, dropped_unknown;
+static uint32_t* lat;
+static size_t nlat, lat_cap;
+static uint16_t ip_id;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- now_ns -- */
+
+static int parse_mac(const char* s, uint8_t* mac)
+{
+    unsigned int m[ETHER_ADDR_LEN];
+    int i;
+
+    if (sscanf(s, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4],
+               &m[5]) != ETHER_ADDR_LEN)
+    { return -1; }
+    for (i = 0; i < ETHER_ADDR_LEN; i++)
+    { mac[i] = (uint8_t)m[i]; }
+    return 0;
+} /* -- parse_mac -- */
+
+static struct st_iface* find_iface(const char* name)
+{
+    int i;
+
+    for (i = 0; i < nifaces; i++)
+    {
+        if (strncmp(ifaces[i].name, name, sizeof(ifaces[i].name)) == 0)
+        { return &ifaces[i]; }
+    }
+    return 0;
+} /* -- find_iface -- */
+
+static struct st_host* find_host(struct st_iface* ifc, uint32_t ip)
+{
+    int i;
+
+    for (i = 0; i < nhosts; i++)
+    {
+        if (hosts[i].ip == ip && (!ifc || hosts[i].iface == ifc))
+        { return &hosts[i]; }
+    }
+    return 0;
+} /* -- find_host -- */
+
+static int add_iface(const char* name, const char* ip, const char* mac,
+                     unsigned long speed)
+{
+    struct st_iface* ifc = &ifaces[nifaces];
+    struct in_addr a;
+
+    if (nifaces == MAX_IFACES || strlen(name) >= sizeof(ifc->name) ||
+        inet_aton(ip, &a) == 0 || parse_mac(mac, ifc->mac) != 0)
+    { return -1; }
+    strcpy(ifc->name, name);
+    ifc->ip = a.s_addr;
+    ifc->speed = speed;
+    nifaces++;
+    return 0;
+} /* -- add_iface -- */
+
+static int add_host(const char* iface, const char* ip, const char* mac)
+{
+    struct st_host* h = &hosts[nhosts];
+    struct in_addr a;
+
+    if (nhosts == MAX_HOSTS || !(h->iface = find_iface(iface)) ||
+        inet_aton(ip, &a) == 0)
+    { return -1; }
+    h->ip = a.s_addr;
+    if (mac)
+    {
+        if (parse_mac(mac, h->mac) != 0)
+        { return -1; }
+    }
+    else
+    {
+        /* locally administered, derived from the address */
+        h->mac[0] = 0x02;
+        h->mac[1] = 0x01;
+        memcpy(h->mac + 2, &h->ip, 4);
+    }
+    nhosts++;
+    return 0;
+} /* -- add_host -- */
+
+static int load_topology(const char* file)
+{
+    FILE* fp;
+    char line[BUFSIZ], kw[32], a[32], b[32], c[32];
+    unsigned long speed;
+    int n, lineno = 0;
+
+    if (!file)
+    {
+        /* -- matches the stub's rtable -- */
+        add_iface("eth1", "192.168.2.1", "00:00:00:00:01:01", 100);
+        add_iface("eth2", "172.64.3.1",  "00:00:00:00:02:01", 100);
+        add_iface("eth3", "10.0.1.1",    "00:00:00:00:03:01", 100);
+        add_host("eth1", "192.168.2.2", 0);
+        add_host("eth1", "192.168.2.3", 0);
+        add_host("eth2", "172.64.3.10", 0);
+        add_host("eth3", "10.0.1.100", 0);
+        return 0;
+    }
+
+    if ((fp = fopen(file, "r")) == 0)
+    {
+        perror(file);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        if (strchr(line, '#'))
+        { *strchr(line, '#') = '\0'; }
+        speed = 0;
+        if ((n = sscanf(line, "%31s %31s %31s %31s %lu", kw, a, b, c, &speed)) <= 0)
+        { continue; }
+
+        if (strcmp(kw, "iface") == 0 && n >= 4 && add_iface(a, b, c, speed) == 0)
+        { continue; }
+        if (strcmp(kw, "host") == 0 && n >= 3 && add_host(a, b, n >= 4 ? c : 0) == 0)
+        { continue; }
+
+        fprintf(stderr, "%s:%d: expected 'iface <name> <ip> <mac> [speed]' or "
+                "'host <iface> <ip> [mac]'\n", file, lineno);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    return 0;
+} /* -- load_topology -- */
+
+/*-----------------------------------------------------------------------------
+ * Output to the router.  The socket is non-blocking; whatever doesn't fit
+ * waits in outbuf until poll says we can write, so we keep reading while
+ * the router is busy writing back to us.
+ *---------------------------------------------------------------------------*/
+
+static void flush_out(void)
+{
+    ssize_t n;
+
+    while (outlen)
+    {
+        if ((n = send(cfd, outbuf, outlen, MSG_NOSIGNAL)) < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("send(..):vns_standin.c::flush_out(..)");
+                outlen = 0;
+            }
+            return;
+        }
+        memmove(outbuf, outbuf + n, outlen - n);
+        outlen -= n;
+    }
+} /* -- flush_out -- */
+
+static void queue_out(const void* msg, size_t len)
+{
+    if (outlen + len > outcap)
+    {
+        outcap = (outlen + len) * 2;
+        outbuf = (uint8_t*)realloc(outbuf, outcap);
+        assert(outbuf);
+    }
+    memcpy(outbuf + outlen, msg, len);
+    outlen += len;
+    flush_out();
+} /* -- queue_out -- */
+
+static void send_packet(struct st_iface* ifc, const uint8_t* frame, unsigned int len)
+{
+    uint8_t msg[MAX_MSG];
+    c_packet_header* h = (c_packet_header*)msg;
+    uint8_t* slot;
+
+    if (shm_path)
+    {
+        if (len > SR_SHM_BUF_SZ || !(slot = sr_shm_tx_buf(&shm)))
+        {
+            shm_tx_full++;
+            return;
+        }
+        memcpy(slot, frame, len);
+        sr_shm_tx_commit(&shm, len, ifc->name);
+        return;
+    }
+
+    if (len + sizeof(*h) > sizeof(msg))
+    { return; }
+    h->mLen = htonl(sizeof(*h) + len);
+    h->mType = htonl(VNSPACKET);
+    memset(h->mInterfaceName, 0, sizeof(h->mInterfaceName));
+    strncpy(h->mInterfaceName, ifc->name, sizeof(h->mInterfaceName));
+    memcpy(msg + sizeof(*h), frame, len);
+    queue_out(msg, sizeof(*h) + len);
+} /* -- send_packet -- */
+
+/* can the generator send without piling up a backlog */
+static int tx_room(void)
+{
+    if (shm_path)
+    { return sr_shm_tx_buf(&shm) != 0; }
+    return outlen < OUTBUF_HIGH;
+} /* -- tx_room -- */
+
+static void send_close(const char* why)
+{
+    c_close c;
+
+    memset(&c, 0, sizeof(c));
+    c.mLen = htonl(sizeof(c));
+    c.mType = htonl(VNSCLOSE);
+    strncpy(c.mErrorMessage, why, sizeof(c.mErrorMessage) - 1);
+    queue_out(&c, sizeof(c));
+} /* -- send_close -- */
+
+/*-----------------------------------------------------------------------------
+ * Session setup
+ *---------------------------------------------------------------------------*/
+
+static void send_auth_request(void)
+{
+    uint8_t msg[sizeof(c_auth_request) + SALT_LEN];
+    c_auth_request* r = (c_auth_request*)msg;
+    int i;
+
+    for (i = 0; i < SALT_LEN; i++)
+    { salt[i] = (uint8_t)rand(); }
+    r->mLen = htonl(sizeof(msg));
+    r->mType = htonl(VNS_AUTH_REQUEST);
+    memcpy(r->salt, salt, SALT_LEN);
+    queue_out(msg, sizeof(msg));
+} /* -- send_auth_request -- */
+
+static int check_auth_reply(c_auth_reply* ar, uint32_t len)
+{
+    char key[AUTH_KEY_LEN + 1];
+    SHA1Context sha1;
+    uint32_t ulen = ntohl(ar->usernameLen);
+    FILE* fp;
+    int i;
+
+    if (sizeof(*ar) + ulen + 20 > len)
+    { return 0; }
+    printf("auth reply from %.*s\n", (int)ulen, ar->username);
+    if (!key_file)
+    { return 1; }
+
+    if (!(fp = fopen(key_file, "r")) || fgets(key, sizeof(key), fp) != key)
+    {
+        perror(key_file);
+        if (fp)
+        { fclose(fp); }
+        return 0;
+    }
+    fclose(fp);
+
+    SHA1Reset(&sha1);
+    SHA1Input(&sha1, salt, SALT_LEN);
+    SHA1Input(&sha1, (unsigned char*)key, AUTH_KEY_LEN);
+    if (!SHA1Result(&sha1))
+    { return 0; }
+    for (i = 0; i < 5; i++)
+    { sha1.Message_Digest[i] = htonl(sha1.Message_Digest[i]); }
+    return memcmp(ar->username + ulen, sha1.Message_Digest, 20) == 0;
+} /* -- check_auth_reply -- */
+
+static void send_auth_status(int ok, const char* why)
+{
+    uint8_t msg[sizeof(c_auth_status) + 128];
+    c_auth_status* s = (c_auth_status*)msg;
+    size_t len = sizeof(*s) + strlen(why) + 1;
+
+    s->mLen = htonl(len);
+    s->mType = htonl(VNS_AUTH_STATUS);
+    s->auth_ok = ok;
+    strcpy(s->msg, why);
+    queue_out(msg, len);
+} /* -- send_auth_status -- */
+
+static void send_rtable(const char* vhost)
+{
+    char text[MAX_MSG - sizeof(c_rtable)];
+    uint8_t msg[MAX_MSG];
+    c_rtable* rt = (c_rtable*)msg;
+    size_t n = 0;
+    FILE* fp;
+    int i;
+
+    if (rtable_file && (fp = fopen(rtable_file, "r")))
+    {
+        n = fread(text, 1, sizeof(text), fp);
+        fclose(fp);
+    }
+    else
+    {
+        if (rtable_file)
+        { perror(rtable_file); }
+        /* -- one host route per emulated host -- */
+        for (i = 0; i < nhosts && n + 80 < sizeof(text); i++)
+        {
+            struct in_addr a;
+            char ip[16];
+            a.s_addr = hosts[i].ip;
+            strcpy(ip, inet_ntoa(a));
+            n += sprintf(text + n, "%s %s 255.255.255.255 %s\n", ip, ip,
+                         hosts[i].iface->name);
+        }
+    }
+
+    memset(rt, 0, sizeof(*rt));
+    rt->mLen = htonl(sizeof(*rt) + n);
+    rt->mType = htonl(VNS_RTABLE);
+    strncpy(rt->mVirtualHostID, vhost, IDSIZE - 1);
+    memcpy(rt->rtable, text, n);
+    queue_out(msg, sizeof(*rt) + n);
+} /* -- send_rtable -- */
+
+static void send_hwinfo(void)
+{
+    c_hwinfo hw;
+    int i, n = 0;
+
+    memset(&hw, 0, sizeof(hw));
+    for (i = 0; i < nifaces; i++)
+    {
+        uint32_t speed = htonl(ifaces[i].speed);
+
+        hw.mHWInfo[n].mKey = htonl(HWINTERFACE);
+        strncpy(hw.mHWInfo[n++].value, ifaces[i].name, 31);
+        hw.mHWInfo[n].mKey = htonl(HWSPEED);
+        memcpy(hw.mHWInfo[n++].value, &speed, 4);
+        hw.mHWInfo[n].mKey = htonl(HWETHER);
+        memcpy(hw.mHWInfo[n++].value, ifaces[i].mac, ETHER_ADDR_LEN);
+        hw.mHWInfo[n].mKey = htonl(HWETHIP);
+        memcpy(hw.mHWInfo[n++].value, &ifaces[i].ip, 4);
+    }
+    hw.mLen = htonl(2 * sizeof(uint32_t) + n * sizeof(c_hw_entry));
+    hw.mType = htonl(VNSHWINFO);
+    queue_out(&hw, 2 * sizeof(uint32_t) + n * sizeof(c_hw_entry));
+} /* -- send_hwinfo -- */
+
+/*-----------------------------------------------------------------------------
+ * Emulated hosts
+ *---------------------------------------------------------------------------*/
+
+/* Ethernet + IP header from h to dst, addressed to the router port */
+static unsigned int build_ip(uint8_t* frame, struct st_host* h, uint32_t dst,
+                             uint8_t proto, unsigned int ip_len)
+{
+    sr_ethernet_hdr_t* eh = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(frame + sizeof(*eh));
+
+    memcpy(eh->ether_dhost, h->iface->mac, ETHER_ADDR_LEN);
+    memcpy(eh->ether_shost, h->mac, ETHER_ADDR_LEN);
+    eh->ether_type = htons(ethertype_ip);
+
+    memset(ip, 0, sizeof(*ip));
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(ip_len);
+    ip->ip_id = htons(ip_id++);
+    ip->ip_ttl = 64;
+    ip->ip_p = proto;
+    ip->ip_src = h->ip;
+    ip->ip_dst = dst;
+    ip->ip_sum = cksum(ip, sizeof(*ip));
+    return sizeof(*eh) + ip_len;
+} /* -- build_ip -- */
+
+static void host_arp(struct st_iface* ifc, uint8_t* frame, unsigned int len)
+{
+    sr_arp_hdr_t* ah = (sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    uint8_t reply[sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
+    sr_ethernet_hdr_t* reh = (sr_ethernet_hdr_t*)reply;
+    sr_arp_hdr_t* rah = (sr_arp_hdr_t*)(reply + sizeof(*reh));
+    struct st_host* h;
+
+    if (len < sizeof(reply) || ah->ar_op != htons(arp_op_request) ||
+        !(h = find_host(ifc, ah->ar_tip)))
+    { return; }
+
+    memcpy(reh->ether_dhost, ah->ar_sha, ETHER_ADDR_LEN);
+    memcpy(reh->ether_shost, h->mac, ETHER_ADDR_LEN);
+    reh->ether_type = htons(ethertype_arp);
+    rah->ar_hrd = htons(arp_hrd_ethernet);
+    rah->ar_pro = htons(ethertype_ip);
+    rah->ar_hln = ETHER_ADDR_LEN;
+    rah->ar_pln = 4;
+    rah->ar_op = htons(arp_op_reply);
+    memcpy(rah->ar_sha, h->mac, ETHER_ADDR_LEN);
+    rah->ar_sip = h->ip;
+    memcpy(rah->ar_tha, ah->ar_sha, ETHER_ADDR_LEN);
+    rah->ar_tip = ah->ar_sip;
+
+    send_packet(ifc, reply, sizeof(reply));
+    arp_answered++;
+} /* -- host_arp -- */
+
+static void gen_received(const struct st_payload* p, unsigned int len)
+{
+    uint64_t sent_at, d;
+
+    if (len < sizeof(*p) || ntohl(p->magic) != GEN_MAGIC ||
+        ntohl(p->flow) >= (uint32_t)opt_flows)
+    { return; }
+
+    sent_at = ((uint64_t)ntohl(p->ts_hi) << 32) | ntohl(p->ts_lo);
+    last_rcvd_at = now_ns();
+    if (!measuring || sent_at < t_meas)
+    { return; }
+
+    rcvd++;
+    rcvd_bytes += len;
+    d = last_rcvd_at - sent_at;
+    if (nlat == lat_cap && lat_cap < MAX_SAMPLES)
+    {
+        lat_cap = lat_cap ? lat_cap * 2 : 65536;
+        lat = (uint32_t*)realloc(lat, lat_cap * sizeof(uint32_t));
+        assert(lat);
+    }
+    if (nlat < lat_cap)
+    { lat[nlat++] = d > 0xffffffffULL ? 0xffffffff : (uint32_t)d; }
+} /* -- gen_received -- */
+
+static void host_ip(struct st_iface* ifc, uint8_t* frame, unsigned int len)
+{
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    unsigned int hl, ip_len;
+    uint8_t* l4;
+    struct st_host* h;
+
+    if (len < sizeof(sr_ethernet_hdr_t) + sizeof(*ip))
+    { return; }
+    hl = ip->ip_hl * 4;
+    ip_len = ntohs(ip->ip_len);
+    if (ip_len > len - sizeof(sr_ethernet_hdr_t) || hl < sizeof(*ip) || ip_len < hl)
+    { return; }
+    if (!(h = find_host(ifc, ip->ip_dst)))
+    {
+        dropped_unknown++;
+        return;
+    }
+    l4 = (uint8_t*)ip + hl;
+
+    if (ip->ip_p == ip_protocol_icmp && ip_len >= hl + 8)
+    {
+        sr_icmp_hdr_t* ic = (sr_icmp_hdr_t*)l4;
+
+        if (ic->icmp_type == 8)
+        {
+            /* -- echo request: answer it back through the router -- */
+            uint8_t reply[MAX_MSG];
+            unsigned int icmp_len = ip_len - hl;
+            unsigned int n = build_ip(reply, h, ip->ip_src, ip_protocol_icmp,
+                                      sizeof(sr_ip_hdr_t) + icmp_len);
+            sr_icmp_hdr_t* ric = (sr_icmp_hdr_t*)(reply +
+                sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+
+            memcpy(ric, ic, icmp_len);
+            ric->icmp_type = 0;
+            ric->icmp_sum = 0;
+            ric->icmp_sum = cksum(ric, icmp_len);
+            send_packet(ifc, reply, n);
+            echo_answered++;
+        }
+        else if (ic->icmp_type == 0)
+        { gen_received((struct st_payload*)(l4 + 8), ip_len - hl - 8); }
+        else
+        { icmp_errors++; }
+        return;
+    }
+
+    if (ip->ip_p == IPPROTO_UDP && ip_len >= hl + 8)
+    { gen_received((struct st_payload*)(l4 + 8), ip_len - hl - 8); }
+} /* -- host_ip -- */
+
+/* a frame the router sent out of the port named by the 16 byte ifname */
+static void handle_frame(const char* ifname, uint8_t* frame, unsigned int flen)
+{
+    char name[SR_SHM_IFNAMSIZ + 1];
+    struct st_iface* ifc;
+
+    memcpy(name, ifname, SR_SHM_IFNAMSIZ);
+    name[SR_SHM_IFNAMSIZ] = '\0';
+    if (flen < sizeof(sr_ethernet_hdr_t) || !(ifc = find_iface(name)))
+    { return; }
+
+    switch (ethertype(frame))
+    {
+        case ethertype_arp:
+            host_arp(ifc, frame, flen);
+            break;
+        case ethertype_ip:
+            host_ip(ifc, frame, flen);
+            break;
+    }
+} /* -- handle_frame -- */
+
+/*-----------------------------------------------------------------------------
+ * Traffic generator
+ *---------------------------------------------------------------------------*/
+
+/* IP lengths of the classic 7:4:1 simple IMIX */
+static unsigned int imix_len(long n)
+{
+    static const unsigned int mix[12] =
+        { 40, 576, 40, 40, 576, 40, 1500, 40, 576, 40, 576, 40 };
+    return mix[n % 12];
+} /* -- imix_len -- */
+
+/* 0, or -1 if some host has no other host behind a different port */
+static int setup_flows(void)
+{
+    int i, j = 0;
+
+    flows = (struct st_flow*)calloc(opt_flows, sizeof(struct st_flow));
+    assert(flows);
+    for (i = 0; i < opt_flows; i++)
+    {
+        struct st_flow* f = &flows[i];
+        int k;
+
+        /* -- spread sources round robin, pick a host behind another port -- */
+        f->src = &hosts[i % nhosts];
+        for (k = 0; k < nhosts; k++)
+        {
+            struct st_host* d = &hosts[(i + 1 + j + k) % nhosts];
+            if (d->iface != f->src->iface)
+            {
+                f->dst = d;
+                break;
+            }
+        }
+        if (!f->dst)
+        {
+            fprintf(stderr, "traffic needs hosts behind two different ports\n");
+            return -1;
+        }
+        j += i % nhosts == nhosts - 1;
+        f->sport = 10000 + i;
+    }
+    return 0;
+} /* -- setup_flows -- */
+
+static void gen_one(void)
+{
+    uint8_t frame[MAX_MSG];
+    struct st_flow* f = &flows[sent % opt_flows];
+    unsigned int ip_len = opt_size ? (unsigned int)opt_size : imix_len(sent);
+    unsigned int hdr = sizeof(sr_ip_hdr_t) + 8, n;
+    struct st_payload* p;
+    uint8_t* l4;
+    uint64_t t;
+
+    if (ip_len < hdr + sizeof(*p))
+    { ip_len = hdr + sizeof(*p); }
+    n = build_ip(frame, f->src, f->dst->ip,
+                 opt_icmp ? ip_protocol_icmp : IPPROTO_UDP, ip_len);
+    l4 = frame + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t);
+    p = (struct st_payload*)(l4 + 8);
+    memset(l4, 0, ip_len - sizeof(sr_ip_hdr_t));
+
+    t = now_ns();
+    p->magic = htonl(GEN_MAGIC);
+    p->flow = htonl(f - flows);
+    p->seq = htonl(f->seq++);
+    p->ts_hi = htonl((uint32_t)(t >> 32));
+    p->ts_lo = htonl((uint32_t)t);
+
+    if (opt_icmp)
+    {
+        sr_icmp_hdr_t* ic = (sr_icmp_hdr_t*)l4;
+        ic->icmp_type = 8;
+        *(uint16_t*)(l4 + 4) = htons(f->sport);
+        *(uint16_t*)(l4 + 6) = htons((uint16_t)f->seq);
+        ic->icmp_sum = cksum(l4, ip_len - sizeof(sr_ip_hdr_t));
+    }
+    else
+    {
+        *(uint16_t*)(l4 + 0) = htons(f->sport);
+        *(uint16_t*)(l4 + 2) = htons(GEN_UDP_PORT);
+        *(uint16_t*)(l4 + 4) = htons(ip_len - sizeof(sr_ip_hdr_t));
+    }
+
+    send_packet(f->src->iface, frame, n);
+    sent++;
+    if (measuring)
+    { sent_bytes += ip_len; }
+} /* -- gen_one -- */
+
+/* send whatever is due; returns ms until more is due (-1 idle) */
+static int gen_run(void)
+{
+    uint64_t now = now_ns();
+    long due, budget = 64;
+
+    if (!generating)
+    { return -1; }
+
+    if (!measuring && now - t_gen >= (uint64_t)(opt_warmup * 1e9))
+    {
+        measuring = 1;
+        t_meas = now;
+        sent_warm = sent;
+    }
+
+    if (measuring && ((opt_count && sent - sent_warm >= opt_count) ||
+                      (opt_duration && now - t_meas >= (uint64_t)(opt_duration * 1e9))))
+    {
+        generating = 0;
+        t_meas_end = now;
+        return -1;
+    }
+
+    while (budget-- > 0 && tx_room())
+    {
+        if (!measuring && sent >= opt_flows * 4L)
+        { break; }                      /* a few per flow resolve ARP */
+        if (opt_rate > 0)
+        {
+            due = (long)((now - (measuring ? t_meas : t_gen)) / 1e9 * opt_rate);
+            if (sent - (measuring ? sent_warm : 0) >= due)
+            { return 1; }
+        }
+        else if (measuring && sent - sent_warm - rcvd - inflight_base >= opt_window)
+        {
+            /* -- window full; give up on stragglers after 200ms -- */
+            if (now - last_rcvd_at > 200000000ULL)
+            {
+                inflight_base = sent - sent_warm - rcvd;
+                last_rcvd_at = now;
+            }
+            return 1;
+        }
+        gen_one();
+        if (opt_count && measuring && sent - sent_warm >= opt_count)
+        { break; }
+    }
+    return 0;
+} /* -- gen_run -- */
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+} /* -- cmp_u32 -- */
+
+static void report(void)
+{
+    double secs = ((t_meas_end ? t_meas_end : now_ns()) - t_meas) / 1e9;
+    long tx = sent - sent_warm;
+
+    printf("\n%ld sent, %ld received (%.2f%% lost) in %.3f s, %s %s\n", tx, rcvd,
+           tx ? 100.0 * (tx - rcvd) / tx : 0.0, secs, opt_icmp ? "icmp" : "udp",
+           opt_size ? "fixed size" : "IMIX");
+    if (secs > 0)
+    {
+        printf("offered %.0f pps, forwarded %.0f pps, %.1f Mbit/s\n",
+               tx / secs, rcvd / secs, rcvd_bytes * 8 / secs / 1e6);
+    }
+    if (nlat)
+    {
+        qsort(lat, nlat, sizeof(uint32_t), cmp_u32);
+        printf("%s (us): min %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+               opt_icmp ? "round trip" : "one way through router",
+               lat[0] / 1e3, lat[nlat / 2] / 1e3, lat[(size_t)(nlat * 0.9)] / 1e3,
+               lat[(size_t)(nlat * 0.99)] / 1e3, lat[(size_t)(nlat * 0.999)] / 1e3,
+               lat[nlat - 1] / 1e3);
+    }
+    printf("arp answered %ld, echo answered %ld, icmp errors %ld, "
+           "to unknown hosts %ld\n", arp_answered, echo_answered, icmp_errors,
+           dropped_unknown);
+} /* -- report -- */
+
+/*-----------------------------------------------------------------------------
+ * Message loop
+ *---------------------------------------------------------------------------*/
+
+static void start_session(void)
+{
+    send_hwinfo();
+    state = ST_RUNNING;
+    printf("router up, %d interfaces, %d hosts\n", nifaces, nhosts);
+    if (opt_count || opt_duration)
+    {
+        generating = 1;
+        t_gen = last_rcvd_at = now_ns();
+    }
+} /* -- start_session -- */
+
+/* after the last frame give stragglers a second, then end the session;
+   returns 1 when it is time to go */
+static int test_finished(int* timeout)
+{
+    if (generating || !t_meas_end)
+    { return 0; }
+    if (now_ns() - t_meas_end > 1000000000ULL)
+    {
+        send_close("test finished");
+        flush_out();
+        return 1;
+    }
+    *timeout = 10;
+    return 0;
+} /* -- test_finished -- */
+
+static int handle_msg(uint8_t* msg, uint32_t len)
+{
+    uint32_t type = ntohl(((c_base*)msg)->mType);
+
+    switch (type)
+    {
+        case VNS_AUTH_REPLY:
+            if (state != ST_AUTH)
+            { break; }
+            if (!check_auth_reply((c_auth_reply*)msg, len))
+            {
+                send_auth_status(0, "bad credentials");
+                return -1;
+            }
+            send_auth_status(1, "");
+            state = ST_OPEN;
+            break;
+
+        case VNSOPEN:
+        case VNS_OPEN_TEMPLATE:
+            if (state != ST_OPEN)
+            { break; }
+            if (type == VNS_OPEN_TEMPLATE && len >= sizeof(c_open_template))
+            {
+                char vhost[IDSIZE + 1];
+                memcpy(vhost, ((c_open_template*)msg)->mVirtualHostID, IDSIZE);
+                vhost[IDSIZE] = '\0';
+                send_rtable(vhost);
+            }
+            start_session();
+            break;
+
+        case VNSPACKET:
+            if (state == ST_RUNNING && len >= sizeof(c_packet_header))
+            {
+                c_packet_header* h = (c_packet_header*)msg;
+                handle_frame(h->mInterfaceName, msg + sizeof(*h),
+                             len - sizeof(*h));
+            }
+            break;
+
+        case VNSCLOSE:
+            printf("router closed the session\n");
+            return -1;
+
+        default:
+            fprintf(stderr, "ignoring message type %u\n", type);
+            break;
+    }
+    return 0;
+} /* -- handle_msg -- */
+
+static void serve(int fd)
+{
+    struct pollfd pfd;
+    int timeout, one = 1;
+    size_t off;
+    ssize_t n;
+
+    cfd = fd;
+    fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    state = ST_AUTH;
+    inlen = outlen = 0;
+    send_auth_request();
+
+    for (;;)
+    {
+        timeout = gen_run();
+        if (test_finished(&timeout))
+        { break; }
+
+        pfd.fd = cfd;
+        pfd.events = POLLIN | (outlen ? POLLOUT : 0);
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+        {
+            perror("poll(..):vns_standin.c::serve(..)");
+            break;
+        }
+        if (pfd.revents & POLLOUT)
+        { flush_out(); }
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+        { continue; }
+
+        if ((n = recv(cfd, inbuf + inlen, MAX_MSG * 4 - inlen, 0)) <= 0)
+        {
+            if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            { continue; }
+            printf("router disconnected\n");
+            break;
+        }
+        inlen += n;
+
+        for (off = 0; inlen - off >= 8; )
+        {
+            uint32_t len = ntohl(*(uint32_t*)(inbuf + off));
+            if (len < 8 || len > MAX_MSG)
+            {
+                fprintf(stderr, "bad message length %u\n", len);
+                goto out;
+            }
+            if (inlen - off < len)
+            { break; }
+            if (handle_msg(inbuf + off, len) != 0)
+            { goto out; }
+            off += len;
+        }
+        memmove(inbuf, inbuf + off, inlen - off);
+        inlen -= off;
+    }
+out:
+    close(cfd);
+    cfd = -1;
+} /* -- serve -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: serve_shm(..)
+ *
+ * Same session over sr_shm rings; fd is the accepted unix socket, which
+ * carries the region, VNSHWINFO and finally VNSCLOSE.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void serve_shm(int fd)
+{
+    struct sr_shm_desc* d;
+    uint8_t* buf;
+    char c;
+    int timeout, n;
+
+    if (sr_shm_create(&shm) != 0 || sr_shm_send_fds(&shm, fd) != 0)
+    {
+        sr_shm_destroy(&shm);
+        close(fd);
+        return;
+    }
+    cfd = fd;
+    outlen = 0;
+    start_session();
+    fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+
+    for (;;)
+    {
+        timeout = gen_run();
+        if (test_finished(&timeout))
+        { break; }
+
+        for (n = 0; (d = sr_shm_rx_peek(&shm, &buf)) != 0; n++)
+        {
+            handle_frame(d->iface, buf, d->len);
+            sr_shm_rx_release(&shm);
+        }
+        if (n || timeout == 0)
+        { continue; }
+
+        if (sr_shm_rx_wait(&shm, timeout < 0 ? 100 : timeout) &&
+            recv(cfd, &c, 1, 0) <= 0 && errno != EAGAIN)
+        {
+            printf("router disconnected\n");
+            break;
+        }
+    }
+
+    if (shm_tx_full)
+    { printf("%ld frames dropped, ring to router full\n", shm_tx_full); }
+    sr_shm_destroy(&shm);           /* closes cfd too */
+    cfd = -1;
+} /* -- serve_shm -- */
+
+static int listen_unix(const char* path)
+{
+    struct sockaddr_un sun;
+    int fd;
+
+    if (strlen(path) >= sizeof(sun.sun_path) ||
+        (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        fprintf(stderr, "can't create unix socket %s\n", path);
+        return -1;
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0 || listen(fd, 1) < 0)
+    {
+        perror("bind(..):vns_standin.c::listen_unix(..)");
+        close(fd);
+        return -1;
+    }
+    printf("listening on %s\n", path);
+    return fd;
+} /* -- listen_unix -- */
+
+static void usage(const char* argv0)
+{
+    printf("VNS stand-in server\n");
+    printf("Format: %s [-p port | -x unix socket] [-t topology] [-r rtable]\n", argv0);
+    printf("           [-k auth_key]\n");
+    printf("           [-c packets] [-d seconds] [-R pps, 0 = windowed]\n");
+    printf("           [-W window] [-f flows] [-s imix|ip bytes] [-m udp|icmp]\n");
+    printf("           [-w warmup seconds]\n");
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    struct sockaddr_in sa;
+    unsigned short port = DEFAULT_PORT;
+    const char* topo = 0;
+    int c, lfd, one = 1;
+
+    while ((c = getopt(argc, argv, "hp:x:t:r:k:c:d:R:W:f:s:m:w:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'p': port = atoi(optarg); break;
+            case 'x': shm_path = optarg; break;
+            case 't': topo = optarg; break;
+            case 'r': rtable_file = optarg; break;
+            case 'k': key_file = optarg; break;
+            case 'c': opt_count = atol(optarg); break;
+            case 'd': opt_duration = atof(optarg); break;
+            case 'R': opt_rate = atof(optarg); break;
+            case 'W': opt_window = atoi(optarg); break;
+            case 'f': opt_flows = atoi(optarg); break;
+            case 's': opt_size = strcmp(optarg, "imix") ? atoi(optarg) : 0; break;
+            case 'm': opt_icmp = strcmp(optarg, "icmp") == 0; break;
+            case 'w': opt_warmup = atof(optarg); break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (opt_flows < 1 || opt_flows > MAX_FLOWS || opt_window < 1 ||
+        opt_size < 0 || opt_size > SR_MAX_MTU)
+    {
+        fprintf(stderr, "need 1..%d flows, a window of at least 1 and sizes "
+                "up to %d\n", MAX_FLOWS, SR_MAX_MTU);
+        return 1;
+    }
+
+    if (load_topology(topo) != 0)
+    { return 1; }
+    if ((opt_count || opt_duration) && nhosts < 2)
+    {
+        fprintf(stderr, "traffic needs at least two hosts\n");
+        return 1;
+    }
+    if ((opt_count || opt_duration) && setup_flows() != 0)
+    { return 1; }
+
+    inbuf = (uint8_t*)malloc(MAX_MSG * 4);
+    assert(inbuf);
+    srand(time(0));
+
+    if (shm_path)
+    {
+        if ((lfd = listen_unix(shm_path)) < 0)
+        { return 1; }
+    }
+    else
+    {
+        if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        {
+            perror("socket(..):vns_standin.c::main(..)");
+            return 1;
+        }
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(lfd, (struct sockaddr*)&sa, sizeof(sa)) < 0 || listen(lfd, 1) < 0)
+        {
+            perror("bind(..):vns_standin.c::main(..)");
+            return 1;
+        }
+        printf("listening on port %u\n", port);
+    }
+    fflush(stdout);
+
+    for (;;)
+    {
+        int fd = accept(lfd, 0, 0);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            perror("accept(..):vns_standin.c::main(..)");
+            return 1;
+        }
+        printf("router connected\n");
+        if (shm_path)
+        { serve_shm(fd); }
+        else
+        { serve(fd); }
+        if (opt_count || opt_duration)
+        {
+            report();
+            break;
+        }
+    }
+
+    close(lfd);
+    if (shm_path)
+    { unlink(shm_path); }
+    return 0;
+} /* -- main -- */
@@ -20,6 +20,10 @@
 
 #define IDSIZE 32
 
+/* largest message we accept or send; a VNSPACKET carrying a frame for a
+   9216 byte MTU fits */
+#define VNS_MSG_MAX 16384
+
 /*-----------------------------------------------------------------------------
                                  BASE
   ---------------------------------------------------------------------------*/